@@ -0,0 +1,299 @@
+#!/usr/bin/env python
+#coding: utf-8
+#file   : nc-replay.py
+#
+# Replay a request capture recorded by nutcracker -C against a running
+# nutcracker, at the recorded rate or faster.
+#
+# Keys and values are not captured, so each request is rebuilt from its
+# shape: the key is derived from the recorded key hash, which keeps the
+# key popularity of the original traffic, and the value is sized so the
+# request has the recorded length. Commands the replay does not know how
+# to rebuild are sent as a get of the same key.
+#
+#   nc-replay.py -p 0=127.0.0.1:22121 capture.bin
+#   nc-replay.py -p 0=127.0.0.1:22121 -p 1=127.0.0.1:22122 -s 4 capture.bin
+#   nc-replay.py --dump capture.bin
+
+from __future__ import print_function
+
+import mmap
+import optparse
+import socket
+import struct
+import sys
+import threading
+import time
+
+CAPTURE_MAGIC = 0x5043434e
+CAPTURE_VERSION = 1
+
+HEADER = struct.Struct('=IIIIIIIIQ')
+RECORD = struct.Struct('=qIIIIHHHH')
+
+# redis commands rebuilt with their keys only
+REDIS_KEY_CMDS = set([
+    'get', 'del', 'unlink', 'exists', 'touch', 'ttl', 'pttl', 'type',
+    'strlen', 'incr', 'decr', 'persist', 'mget', 'llen', 'lpop', 'rpop',
+    'scard', 'smembers', 'hgetall', 'hkeys', 'hvals', 'hlen', 'zcard',
+])
+
+# redis commands rebuilt with a key and a value
+REDIS_VALUE_CMDS = set(['set', 'setnx', 'getset', 'append', 'lpush',
+                        'rpush', 'sadd'])
+
+MC_STORE_CMDS = set(['set', 'add', 'replace', 'append', 'prepend', 'cas'])
+
+
+class Capture(object):
+
+    def __init__(self, filename):
+        f = open(filename, 'rb')
+        self.data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        f.close()
+
+        (magic, version, rsize, nrec, ntype, type_off, rec_off, _,
+         count) = HEADER.unpack_from(self.data, 0)
+        if magic != CAPTURE_MAGIC or version != CAPTURE_VERSION:
+            raise ValueError('%s is not a capture file' % filename)
+        if rsize != RECORD.size:
+            raise ValueError('%s has records of %d bytes' % (filename, rsize))
+
+        self.types = []
+        for i in range(ntype):
+            off = type_off + i * 32
+            name = self.data[off:off + 32].split(b'\0', 1)[0]
+            self.types.append(name.decode('ascii'))
+
+        self.nrec = nrec
+        self.rec_off = rec_off
+        self.count = count
+
+    def records(self):
+        """Return captured records in order of receive time"""
+        recs = []
+        for i in range(max(0, self.count - self.nrec), self.count):
+            off = self.rec_off + (i % self.nrec) * RECORD.size
+            recs.append(RECORD.unpack_from(self.data, off))
+        recs.sort()
+        return recs
+
+
+def key_of(h, i):
+    if i == 0:
+        return 'nc:%08x' % h
+    return 'nc:%08x:%d' % (h, i)
+
+
+def redis_encode(args):
+    out = ['*%d\r\n' % len(args)]
+    for a in args:
+        out.append('$%d\r\n%s\r\n' % (len(a), a))
+    return ''.join(out)
+
+
+def redis_request(cmd, keys, req_len):
+    if cmd in REDIS_KEY_CMDS:
+        return redis_encode([cmd] + keys), True
+    if cmd == 'mset':
+        args = [cmd]
+        for k in keys:
+            args += [k, '']
+        vlen = max(1, (req_len - len(redis_encode(args))) // len(keys))
+        args = [cmd]
+        for k in keys:
+            args += [k, 'x' * vlen]
+        return redis_encode(args), True
+    if cmd in REDIS_VALUE_CMDS or cmd in ('setex', 'psetex'):
+        args = [cmd, keys[0]]
+        if cmd in ('setex', 'psetex'):
+            args.append('3600000')
+        vlen = max(1, req_len - len(redis_encode(args + [''])) - 1)
+        return redis_encode(args + ['x' * vlen]), True
+    return redis_encode(['get', keys[0]]), False
+
+
+def mc_request(cmd, keys, req_len):
+    if cmd in ('get', 'gets'):
+        return '%s %s\r\n' % (cmd, ' '.join(keys)), True
+    if cmd in MC_STORE_CMDS:
+        head = 'set %s 0 0 ' % keys[0]
+        vlen = max(1, req_len - len(head) - 6)
+        return '%s%d\r\n%s\r\n' % (head, vlen, 'x' * vlen), cmd != 'cas'
+    if cmd == 'delete':
+        return 'delete %s\r\n' % keys[0], True
+    if cmd in ('incr', 'decr'):
+        return '%s %s 1\r\n' % (cmd, keys[0]), True
+    if cmd == 'touch':
+        return 'touch %s 0\r\n' % keys[0], True
+    return 'get %s\r\n' % keys[0], False
+
+
+def redis_read(f):
+    line = f.readline()
+    if not line:
+        raise EOFError
+    t = line[0:1]
+    if t in (b'$', b'=', b'!'):
+        n = int(line[1:])
+        if n >= 0:
+            f.read(n + 2)
+    elif t in (b'*', b'~', b'>', b'%', b'|'):
+        n = int(line[1:])
+        if t in (b'%', b'|'):
+            n *= 2
+        for _ in range(max(n, 0)):
+            redis_read(f)
+        if t == b'|':
+            redis_read(f)
+    return t != b'-'
+
+
+def mc_read(f, multi):
+    while True:
+        line = f.readline()
+        if not line:
+            raise EOFError
+        if line.startswith(b'VALUE '):
+            f.read(int(line.split()[3]) + 2)
+            continue
+        if not multi or line == b'END\r\n' or b'ERROR' in line:
+            return b'ERROR' not in line
+
+
+class Worker(threading.Thread):
+
+    def __init__(self, opts, jobs, start):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.opts = opts
+        self.jobs = jobs
+        self.start_time = start
+        self.conns = {}
+        self.latency = []
+        self.nerror = 0
+        self.lag = 0.0
+
+    def conn(self, addr):
+        c = self.conns.get(addr)
+        if c is None:
+            s = socket.create_connection(addr)
+            s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            c = (s, s.makefile('rb'))
+            self.conns[addr] = c
+        return c
+
+    def run(self):
+        speed = self.opts.speed
+        for at, addr, redis, multi, payload in self.jobs:
+            if speed > 0:
+                due = self.start_time + at / speed
+                wait = due - time.time()
+                if wait > 0:
+                    time.sleep(wait)
+                else:
+                    self.lag = max(self.lag, -wait)
+            s, f = self.conn(addr)
+            t = time.time()
+            s.sendall(payload)
+            ok = redis_read(f) if redis else mc_read(f, multi)
+            self.latency.append(time.time() - t)
+            if not ok:
+                self.nerror += 1
+
+
+def dump(cap):
+    print('# %d records captured, %d in file' % (cap.count,
+          min(cap.count, cap.nrec)))
+    print('# usec pool type rsp_type hash nkey req_len rsp_len latency')
+    for usec, lat, h, req_len, rsp_len, pool, typ, rsp_typ, nkey in \
+            cap.records():
+        print('%d %d %s %s %08x %d %d %d %d' % (usec, pool, cap.types[typ],
+              cap.types[rsp_typ], h, nkey, req_len, rsp_len, lat))
+
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] capture-file')
+    parser.add_option('-p', '--pool', action='append', default=[],
+                      metavar='IDX=HOST:PORT',
+                      help='replay pool IDX against HOST:PORT')
+    parser.add_option('-s', '--speed', type='float', default=1.0,
+                      help='replay at SPEED times the recorded rate, '
+                           '0 for as fast as possible (default: 1)')
+    parser.add_option('-c', '--conns', type='int', default=8,
+                      help='# connections per pool (default: 8)')
+    parser.add_option('-n', '--count', type='int', default=0,
+                      help='replay only the first COUNT records')
+    parser.add_option('--dump', action='store_true',
+                      help='print the records and exit')
+    opts, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error('a capture file is required')
+
+    cap = Capture(args[0])
+    if opts.dump:
+        dump(cap)
+        return 0
+
+    pools = {}
+    for p in opts.pool:
+        idx, addr = p.split('=', 1)
+        host, port = addr.rsplit(':', 1)
+        pools[int(idx)] = (host, int(port))
+    if not pools:
+        parser.error('at least one --pool is required')
+
+    recs = cap.records()
+    if opts.count > 0:
+        recs = recs[:opts.count]
+
+    jobs = [[] for _ in range(opts.conns)]
+    nskip = nsubst = 0
+    first = recs[0][0] if recs else 0
+    for i, (usec, lat, h, req_len, rsp_len, pool, typ, rsp_typ, nkey) in \
+            enumerate(recs):
+        addr = pools.get(pool)
+        name = cap.types[typ]
+        if addr is None or not name.startswith('REQ_'):
+            nskip += 1
+            continue
+        redis = name.startswith('REQ_REDIS_')
+        cmd = name.split('_', 2)[2].lower()
+        keys = [key_of(h, j) for j in range(max(nkey, 1))]
+        if redis:
+            payload, exact = redis_request(cmd, keys, req_len)
+        else:
+            payload, exact = mc_request(cmd, keys, req_len)
+        if not exact:
+            nsubst += 1
+        multi = not redis and payload.startswith(('get ', 'gets '))
+        jobs[h % opts.conns].append(((usec - first) / 1e6, addr, redis,
+                                     multi, payload.encode('ascii')))
+
+    # give the workers time to connect before the first request is due
+    start = time.time() + (0.1 if opts.speed > 0 else 0)
+    workers = [Worker(opts, j, start) for j in jobs if j]
+    for w in workers:
+        w.start()
+    for w in workers:
+        w.join()
+    elapsed = time.time() - start
+
+    latency = sorted(l for w in workers for l in w.latency)
+    n = len(latency)
+    print('replayed %d requests in %.3f sec, %.0f req/sec' % (n, elapsed,
+          n / elapsed if elapsed > 0 else 0))
+    print('skipped %d, substituted %d, errors %d' % (nskip, nsubst,
+          sum(w.nerror for w in workers)))
+    if n:
+        print('latency msec: avg %.3f p50 %.3f p99 %.3f max %.3f' % (
+              sum(latency) / n * 1e3, latency[n // 2] * 1e3,
+              latency[min(n - 1, n * 99 // 100)] * 1e3, latency[-1] * 1e3))
+    if opts.speed > 0:
+        print('max lag behind schedule: %.3f sec' % max(w.lag for w in
+              workers))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -103,6 +103,9 @@ event_add_in(struct event_base *evb, struct conn *c)
     }
 
     event.events = (uint32_t)(EPOLLIN | EPOLLET);
+    if (c->send_active) {
+        event.events |= (uint32_t)EPOLLOUT;
+    }
     event.data.ptr = c;
 
     status = epoll_ctl(ep, EPOLL_CTL_MOD, c->sd, &event);
@@ -119,7 +122,33 @@ event_add_in(struct event_base *evb, struct conn *c)
 int
 event_del_in(struct event_base *evb, struct conn *c)
 {
-    return 0;
+    int status;
+    struct epoll_event event;
+    int ep = evb->ep;
+
+    ASSERT(ep > 0);
+    ASSERT(c != NULL);
+    ASSERT(c->sd > 0);
+
+    if (!c->recv_active) {
+        return 0;
+    }
+
+    event.events = 0;
+    if (c->send_active) {
+        event.events = (uint32_t)(EPOLLOUT | EPOLLET);
+    }
+    event.data.ptr = c;
+
+    status = epoll_ctl(ep, EPOLL_CTL_MOD, c->sd, &event);
+    if (status < 0) {
+        log_error("epoll ctl on e %d sd %d failed: %s", ep, c->sd,
+                  strerror(errno));
+    } else {
+        c->recv_active = 0;
+    }
+
+    return status;
 }
 
 int
@@ -132,13 +161,15 @@ event_add_out(struct event_base *evb, struct conn *c)
     ASSERT(ep > 0);
     ASSERT(c != NULL);
     ASSERT(c->sd > 0);
-    ASSERT(c->recv_active);
 
     if (c->send_active) {
         return 0;
     }
 
-    event.events = (uint32_t)(EPOLLIN | EPOLLOUT | EPOLLET);
+    event.events = (uint32_t)(EPOLLOUT | EPOLLET);
+    if (c->recv_active) {
+        event.events |= (uint32_t)EPOLLIN;
+    }
     event.data.ptr = c;
 
     status = epoll_ctl(ep, EPOLL_CTL_MOD, c->sd, &event);
@@ -162,13 +193,15 @@ event_del_out(struct event_base *evb, struct conn *c)
     ASSERT(ep > 0);
     ASSERT(c != NULL);
     ASSERT(c->sd > 0);
-    ASSERT(c->recv_active);
 
     if (!c->send_active) {
         return 0;
     }
 
-    event.events = (uint32_t)(EPOLLIN | EPOLLET);
+    event.events = 0;
+    if (c->recv_active) {
+        event.events = (uint32_t)(EPOLLIN | EPOLLET);
+    }
     event.data.ptr = c;
 
     status = epoll_ctl(ep, EPOLL_CTL_MOD, c->sd, &event);
@@ -283,8 +316,9 @@ event_wait(struct event_base *evb, int timeout)
             return 0;
         }
 
+        /* return on signal, so that the caller gets to act on it */
         if (errno == EINTR) {
-            continue;
+            return 0;
         }
 
         log_error("epoll wait on e %d with %d events failed: %s", ep, nevent,
@@ -333,6 +367,11 @@ event_loop_stats(event_stats_cb_t cb, void *arg)
 
         //stats_loop_callback
         cb(st, &n);
+
+        /* listener was handed off on upgrade */
+        if (st->sd < 0) {
+            break;
+        }
     }
 
 error:
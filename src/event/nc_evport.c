@@ -91,31 +91,83 @@ event_base_destroy(struct event_base *evb)
 int
 event_add_in(struct event_base *evb, struct conn *c)
 {
-    return 0;
+    int status, events;
+    int evp = evb->evp;
+
+    ASSERT(evp > 0);
+    ASSERT(c != NULL);
+    ASSERT(c->sd > 0);
+
+    if (c->recv_active) {
+        return 0;
+    }
+
+    events = c->send_active ? POLLIN | POLLOUT : POLLIN;
+
+    status = port_associate(evp, PORT_SOURCE_FD, c->sd, events, c);
+    if (status < 0) {
+        log_error("port associate on evp %d sd %d failed: %s", evp, c->sd,
+                  strerror(errno));
+    } else {
+        c->recv_active = 1;
+    }
+
+    return status;
 }
 
 int
 event_del_in(struct event_base *evb, struct conn *c)
 {
+    int status;
+    int evp = evb->evp;
+
+    ASSERT(evp > 0);
+    ASSERT(c != NULL);
+    ASSERT(c->sd > 0);
+
+    if (!c->recv_active) {
+        return 0;
+    }
+
+    if (c->send_active) {
+        status = port_associate(evp, PORT_SOURCE_FD, c->sd, POLLOUT, c);
+        if (status < 0) {
+            log_error("port associate on evp %d sd %d failed: %s", evp, c->sd,
+                      strerror(errno));
+            return status;
+        }
+    } else {
+        /* not associated if we are called from the event loop, see event_del_conn */
+        status = port_dissociate(evp, PORT_SOURCE_FD, c->sd);
+        if (status < 0 && errno != ENOENT) {
+            log_error("port dissociate evp %d sd %d failed: %s", evp, c->sd,
+                      strerror(errno));
+            return status;
+        }
+    }
+
+    c->recv_active = 0;
+
     return 0;
 }
 
 int
 event_add_out(struct event_base *evb, struct conn *c)
 {
-    int status;
+    int status, events;
     int evp = evb->evp;
 
     ASSERT(evp > 0);
     ASSERT(c != NULL);
     ASSERT(c->sd > 0);
-    ASSERT(c->recv_active);
 
     if (c->send_active) {
         return 0;
     }
 
-    status = port_associate(evp, PORT_SOURCE_FD, c->sd, POLLIN | POLLOUT, c);
+    events = c->recv_active ? POLLIN | POLLOUT : POLLOUT;
+
+    status = port_associate(evp, PORT_SOURCE_FD, c->sd, events, c);
     if (status < 0) {
         log_error("port associate on evp %d sd %d failed: %s", evp, c->sd,
                   strerror(errno));
@@ -135,21 +187,30 @@ event_del_out(struct event_base *evb, struct conn *c)
     ASSERT(evp > 0);
     ASSERT(c != NULL);
     ASSERT(c->sd > 0);
-    ASSERT(c->recv_active);
 
     if (!c->send_active) {
         return 0;
     }
 
-    status = port_associate(evp, PORT_SOURCE_FD, c->sd, POLLIN, c);
-    if (status < 0) {
-        log_error("port associate on evp %d sd %d failed: %s", evp, c->sd,
-                  strerror(errno));
+    if (c->recv_active) {
+        status = port_associate(evp, PORT_SOURCE_FD, c->sd, POLLIN, c);
+        if (status < 0) {
+            log_error("port associate on evp %d sd %d failed: %s", evp, c->sd,
+                      strerror(errno));
+            return status;
+        }
     } else {
-        c->send_active = 0;
+        status = port_dissociate(evp, PORT_SOURCE_FD, c->sd);
+        if (status < 0 && errno != ENOENT) {
+            log_error("port dissociate evp %d sd %d failed: %s", evp, c->sd,
+                      strerror(errno));
+            return status;
+        }
     }
 
-    return status;
+    c->send_active = 0;
+
+    return 0;
 }
 
 int
@@ -221,12 +282,15 @@ event_reassociate(struct event_base *evb, struct conn *c)
     ASSERT(evp > 0);
     ASSERT(c != NULL);
     ASSERT(c->sd > 0);
-    ASSERT(c->recv_active);
 
-    if (c->send_active) {
+    if (c->recv_active && c->send_active) {
         events = POLLIN | POLLOUT;
-    } else {
+    } else if (c->recv_active) {
         events = POLLIN;
+    } else if (c->send_active) {
+        events = POLLOUT;
+    } else {
+        return 0;
     }
 
     status = port_associate(evp, PORT_SOURCE_FD, c->sd, events , c);
@@ -273,7 +337,12 @@ event_wait(struct event_base *evb, int timeout)
          */
         status = port_getn(evp, event, nevent, &nreturned, tsp);
         if (status < 0) {
-            if (errno == EINTR || errno == EAGAIN) {
+            /* return on signal, so that the caller gets to act on it */
+            if (errno == EINTR) {
+                return 0;
+            }
+
+            if (errno == EAGAIN) {
                 continue;
             }
 
@@ -407,6 +476,11 @@ event_loop_stats(event_stats_cb_t cb, void *arg)
         }
 
         cb(st, &nreturned);
+
+        /* listener was handed off on upgrade */
+        if (st->sd < 0) {
+            goto error;
+        }
     }
 
 error:
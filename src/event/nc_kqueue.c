@@ -155,7 +155,6 @@ event_add_out(struct event_base *evb, struct conn *c)
     ASSERT(evb->kq > 0);
     ASSERT(c != NULL);
     ASSERT(c->sd > 0);
-    ASSERT(c->recv_active);
     ASSERT(evb->nchange < evb->nevent);
 
     if (c->send_active) {
@@ -178,7 +177,6 @@ event_del_out(struct event_base *evb, struct conn *c)
     ASSERT(evb->kq > 0);
     ASSERT(c != NULL);
     ASSERT(c->sd > 0);
-    ASSERT(c->recv_active);
     ASSERT(evb->nchange < evb->nevent);
 
     if (!c->send_active) {
@@ -333,8 +331,9 @@ event_wait(struct event_base *evb, int timeout)
             return 0;
         }
 
+        /* return on signal, so that the caller gets to act on it */
         if (errno == EINTR) {
-            continue;
+            return 0;
         }
 
         log_error("kevent on kq %d with %d events failed: %s", kq, evb->nevent,
@@ -399,6 +398,11 @@ event_loop_stats(event_stats_cb_t cb, void *arg)
         }
 
         cb(st, &nreturned);
+
+        /* listener was handed off on upgrade */
+        if (st->sd < 0) {
+            goto error;
+        }
     }
 
 error:
@@ -122,6 +122,10 @@ ketama_update(struct server_pool *pool) //server_pool_server
     for (server_index = 0; server_index < nserver; server_index++) {
         struct server *server = array_get(&pool->server, server_index);
 
+        if (server->ejected) {
+            continue;
+        }
+
         if (pool->auto_eject_hosts) {
             if (server->next_retry <= now) {
                 server->next_retry = 0LL;
@@ -188,7 +192,8 @@ ketama_update(struct server_pool *pool) //server_pool_server
 
         server = array_get(&pool->server, server_index);
 
-        if (pool->auto_eject_hosts && server->next_retry > now) {
+        if (server->ejected ||
+            (pool->auto_eject_hosts && server->next_retry > now)) {
             continue;
         }
 
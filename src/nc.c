@@ -27,6 +27,11 @@
 #include <nc_core.h>
 #include <nc_conf.h>
 #include <nc_signal.h>
+#include <nc_upgrade.h>
+#include <nc_reload.h>
+#include <nc_admin.h>
+#include <nc_resolver.h>
+#include <nc_capture.h>
 
 #define NC_CONF_PATH        "conf/nutcracker.yml"
 
@@ -45,6 +50,14 @@
 #define NC_MBUF_MIN_SIZE    MBUF_MIN_SIZE
 #define NC_MBUF_MAX_SIZE    MBUF_MAX_SIZE
 
+#define NC_MEM_LIMIT        0
+#define NC_MBUF_ARENA       0
+
+#define NC_ADMIN_PORT       0
+
+#define NC_CAPTURE_FILE     NULL
+#define NC_CAPTURE_SAMPLE   CAPTURE_SAMPLE
+
 static int show_help; //-h
 static int show_version; //-V
 static int test_conf; //-t
@@ -65,10 +78,15 @@ static struct option long_options[] = {
     { "stats-addr",     required_argument,  NULL,   'a' },
     { "pid-file",       required_argument,  NULL,   'p' },
     { "mbuf-size",      required_argument,  NULL,   'm' },
+    { "memory-limit",   required_argument,  NULL,   'M' },
+    { "hugepage-arena", required_argument,  NULL,   'H' },
+    { "admin-port",     required_argument,  NULL,   'A' },
+    { "capture-file",   required_argument,  NULL,   'C' },
+    { "capture-sample", required_argument,  NULL,   'S' },
     { NULL,             0,                  NULL,    0  }
 };
 
-static char short_options[] = "hVtdDv:o:c:s:i:a:p:m:";
+static char short_options[] = "hVtdDv:o:c:s:i:a:p:m:M:H:A:C:S:";
 
 static rstatus_t
 nc_daemonize(int dump_core)
@@ -205,6 +223,8 @@ nc_show_usage(void)
         "Usage: nutcracker [-?hVdDt] [-v verbosity level] [-o output file]" CRLF
         "                  [-c conf file] [-s stats port] [-a stats addr]" CRLF
         "                  [-i stats interval] [-p pid file] [-m mbuf size]" CRLF
+        "                  [-M memory limit] [-H hugepage arena] [-A admin port]" CRLF
+        "                  [-C capture file] [-S capture sample]" CRLF
         "");
     log_stderr(
         "Options:" CRLF
@@ -222,13 +242,19 @@ nc_show_usage(void)
         "  -i, --stats-interval=N : set stats aggregation interval in msec (default: %d msec)" CRLF
         "  -p, --pid-file=S       : set pid file (default: %s)" CRLF
         "  -m, --mbuf-size=N      : set size of mbuf chunk in bytes (default: %d bytes)" CRLF
+        "  -M, --memory-limit=N   : set limit on buffered data in MB (default: %d, unlimited)" CRLF
+        "  -H, --hugepage-arena=N : carve mbufs from N MB huge page slabs (default: %d, off)" CRLF
+        "  -A, --admin-port=N     : set admin command port on %s (default: %d, off)" CRLF
+        "  -C, --capture-file=S   : set request capture file (default: %s)" CRLF
+        "  -S, --capture-sample=N : set capture of 1 in N requests (default: %d)" CRLF
         "",
         NC_LOG_DEFAULT, NC_LOG_MIN, NC_LOG_MAX,
         NC_LOG_PATH != NULL ? NC_LOG_PATH : "stderr",
         NC_CONF_PATH,
         NC_STATS_PORT, NC_STATS_ADDR, NC_STATS_INTERVAL,
         NC_PID_FILE != NULL ? NC_PID_FILE : "off",
-        NC_MBUF_SIZE);
+        NC_MBUF_SIZE, NC_MEM_LIMIT, NC_MBUF_ARENA, ADMIN_ADDR, NC_ADMIN_PORT,
+        NC_CAPTURE_FILE != NULL ? NC_CAPTURE_FILE : "off", NC_CAPTURE_SAMPLE);
 }
 
 static rstatus_t
@@ -296,6 +322,12 @@ nc_set_default_options(struct instance *nci)
     nci->hostname[NC_MAXHOSTNAMELEN - 1] = '\0';
 
     nci->mbuf_chunk_size = NC_MBUF_SIZE;
+    nci->mem_limit = NC_MEM_LIMIT;
+    nci->mbuf_arena_size = NC_MBUF_ARENA;
+    nci->admin_port = NC_ADMIN_PORT;
+    nci->capture_filename = NC_CAPTURE_FILE;
+    nci->capture_sample = NC_CAPTURE_SAMPLE;
+    nci->argv = NULL;
 
     nci->pid = (pid_t)-1;
     nci->pid_filename = NULL;
@@ -405,16 +437,70 @@ nc_get_options(int argc, char **argv, struct instance *nci)
             nci->mbuf_chunk_size = (size_t)value;
             break;
 
+        case 'M':
+            value = nc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("nutcracker: option -M requires a number");
+                return NC_ERROR;
+            }
+
+            nci->mem_limit = (size_t)value * 1024 * 1024;
+            break;
+
+        case 'H':
+            value = nc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("nutcracker: option -H requires a number");
+                return NC_ERROR;
+            }
+
+            nci->mbuf_arena_size = (size_t)value * 1024 * 1024;
+            break;
+
+        case 'A':
+            value = nc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("nutcracker: option -A requires a number");
+                return NC_ERROR;
+            }
+            if (value != 0 && !nc_valid_port(value)) {
+                log_stderr("nutcracker: option -A value %d is not a valid "
+                           "port", value);
+                return NC_ERROR;
+            }
+
+            nci->admin_port = (uint16_t)value;
+            break;
+
+        case 'C':
+            nci->capture_filename = optarg;
+            break;
+
+        case 'S':
+            value = nc_atoi(optarg, strlen(optarg));
+            if (value <= 0) {
+                log_stderr("nutcracker: option -S requires a positive number");
+                return NC_ERROR;
+            }
+
+            nci->capture_sample = value;
+            break;
+
         case '?':
             switch (optopt) {
             case 'o':
             case 'c':
             case 'p':
+            case 'C':
                 log_stderr("nutcracker: option -%c requires a file name",
                            optopt);
                 break;
 
             case 'm':
+            case 'M':
+            case 'H':
+            case 'A':
+            case 'S':
             case 'v':
             case 's':
             case 'i':
@@ -481,6 +567,16 @@ nc_pre_run(struct instance *nci)
         return status;
     }
 
+    status = upgrade_init(nci);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = reload_init(nci);
+    if (status != NC_OK) {
+        return status;
+    }
+
     if (daemonize) {
         status = nc_daemonize(1);
         if (status != NC_OK) {
@@ -488,6 +584,16 @@ nc_pre_run(struct instance *nci)
         }
     }
 
+    status = log_start();
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = capture_init(nci->capture_filename, nci->capture_sample);
+    if (status != NC_OK) {
+        return status;
+    }
+
     nci->pid = getpid();
 
     status = signal_init();
@@ -495,7 +601,11 @@ nc_pre_run(struct instance *nci)
         return status;
     }
 
-    if (nci->pid_filename) {
+    /*
+     * On upgrade, the pid file still belongs to the old process until the
+     * handoff is done, see nc_run
+     */
+    if (nci->pid_filename && !upgrade_pending()) {
         status = nc_create_pidfile(nci);
         if (status != NC_OK) {
             return status;
@@ -516,6 +626,14 @@ nc_post_run(struct instance *nci)
 
     signal_deinit();
 
+    upgrade_deinit();
+
+    reload_deinit();
+
+    resolver_deinit();
+
+    capture_deinit();
+
     nc_print_done();
 
     log_deinit();
@@ -532,6 +650,14 @@ nc_run(struct instance *nci)
         return;
     }
 
+    if (nci->pid_filename && !nci->pidfile) {
+        status = nc_create_pidfile(nci);
+        if (status != NC_OK) {
+            core_stop(ctx);
+            return;
+        }
+    }
+
     /* run rabbit run */
     for (;;) {
         status = core_loop(ctx);
@@ -540,6 +666,11 @@ nc_run(struct instance *nci)
         }
     }
 
+    /* clients may still be connected on an exit signal; leave them be */
+    if (signal_exiting() != 0) {
+        return;
+    }
+
     core_stop(ctx);
 }
 
@@ -570,6 +701,7 @@ main(int argc, char **argv)
 
     //Ĭϲʼ
     nc_set_default_options(&nci);
+    nci.argv = argv;
 
     status = nc_get_options(argc, argv, &nci);
     if (status != NC_OK) {
@@ -607,5 +739,7 @@ main(int argc, char **argv)
 
     nc_post_run(&nci);
 
+    signal_exit();
+
     exit(1);
 }
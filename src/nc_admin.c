@@ -0,0 +1,1201 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+
+#include <nc_core.h>
+#include <nc_conf.h>
+#include <nc_server.h>
+#include <nc_upgrade.h>
+#include <nc_admin.h>
+
+/*
+ * Admin command port.
+ *
+ * When enabled with -A, nutcracker listens on ADMIN_ADDR for a line based
+ * protocol that inspects and changes the servers of the pools at runtime:
+ *
+ *   pools                              list pools
+ *   servers <pool>                     list servers of a pool
+ *   add <pool> <host:port:weight> [name]
+ *   remove <pool> <server>
+ *   weight <pool> <server> <weight>
+ *   eject <pool> <server>              stop routing keys to the server
+ *   drain <pool> <server>              eject and close connections once idle
+ *   uneject <pool> <server>            route keys to the server again
+ *   hotkeys <pool>                     list hot keys of a pool
+ *   slowlog <pool> [<count>|len|reset] list, count or clear slow requests
+ *   quit
+ *
+ * Listings end with "END", changes reply "OK" and errors "ERR <reason>".
+ * Adding, removing and reweighing a server edits the servers of the pool in
+ * the running configuration and applies it through the same path as a
+ * reload on SIGHUP, so connections to unchanged servers are kept.
+ */
+
+typedef rstatus_t (*admin_handler_t)(struct context *, struct admin_session *,
+                                     int, char **);
+
+struct admin_command {
+    char            *name;    /* command name */
+    int             argc_min; /* min # arguments, including the name */
+    int             argc_max; /* max # arguments, including the name */
+    admin_handler_t handler;  /* command handler */
+};
+
+struct context *
+admin_ctx(struct conn *conn)
+{
+    struct admin *adm;
+
+    ASSERT(conn->admin);
+
+    if (conn->proxy) {
+        adm = conn->owner;
+    } else {
+        adm = ((struct admin_session *)conn->owner)->admin;
+    }
+
+    return adm->ctx;
+}
+
+void
+admin_ref(struct conn *conn, void *owner)
+{
+    struct admin *adm;
+
+    ASSERT(conn->admin);
+    ASSERT(conn->owner == NULL);
+
+    if (conn->proxy) {
+        adm = owner;
+        adm->p_conn = conn;
+    } else {
+        adm = ((struct admin_session *)owner)->admin;
+        TAILQ_INSERT_TAIL(&adm->c_conn_q, conn, conn_tqe);
+        adm->nc_conn_q++;
+    }
+
+    conn->family = adm->info.family;
+    conn->addrlen = adm->info.addrlen;
+    conn->addr = (struct sockaddr *)&adm->info.addr;
+
+    conn->owner = owner;
+
+    log_debug(LOG_VVERB, "ref conn %p owner %p into admin", conn, owner);
+}
+
+void
+admin_unref(struct conn *conn)
+{
+    struct admin *adm;
+
+    ASSERT(conn->admin);
+    ASSERT(conn->owner != NULL);
+
+    if (conn->proxy) {
+        adm = conn->owner;
+        adm->p_conn = NULL;
+    } else {
+        adm = ((struct admin_session *)conn->owner)->admin;
+        ASSERT(adm->nc_conn_q != 0);
+        adm->nc_conn_q--;
+        TAILQ_REMOVE(&adm->c_conn_q, conn, conn_tqe);
+    }
+
+    log_debug(LOG_VVERB, "unref conn %p owner %p from admin", conn,
+              conn->owner);
+
+    conn->owner = NULL;
+}
+
+void
+admin_close(struct context *ctx, struct conn *conn)
+{
+    rstatus_t status;
+    struct admin_session *sess;
+
+    ASSERT(conn->admin);
+
+    sess = conn->proxy ? NULL : conn->owner;
+
+    conn->unref(conn);
+
+    if (sess != NULL) {
+        if (sess->sbuf != NULL) {
+            nc_free(sess->sbuf);
+        }
+        nc_free(sess);
+    }
+
+    if (conn->sd >= 0) {
+        status = close(conn->sd);
+        if (status < 0) {
+            log_error("close admin %d failed, ignored: %s", conn->sd,
+                      strerror(errno));
+        }
+        conn->sd = -1;
+    }
+
+    conn_put(conn);
+}
+
+bool
+admin_active(struct conn *conn)
+{
+    struct admin_session *sess = conn->owner;
+
+    ASSERT(conn->admin && !conn->proxy);
+
+    return sess->spos < sess->slen;
+}
+
+/*
+ * Append a CRLF terminated reply line to the reply buffer of the session
+ */
+static rstatus_t
+admin_reply(struct admin_session *sess, const char *fmt, ...)
+{
+    va_list args;
+    size_t size;
+    char *buf;
+    int n;
+
+    for (;;) {
+        if (sess->sbuf != NULL) {
+            va_start(args, fmt);
+            n = nc_vsnprintf(sess->sbuf + sess->slen, sess->ssize - sess->slen,
+                             fmt, args);
+            va_end(args);
+            if (n < 0) {
+                return NC_ERROR;
+            }
+
+            if ((size_t)n + CRLF_LEN < sess->ssize - sess->slen) {
+                sess->slen += (size_t)n;
+                nc_memcpy(sess->sbuf + sess->slen, CRLF, CRLF_LEN);
+                sess->slen += CRLF_LEN;
+                return NC_OK;
+            }
+        } else {
+            n = 0;
+        }
+
+        size = MAX(sess->ssize * 2, ADMIN_SBUF_SIZE);
+        size = MAX(size, sess->slen + (size_t)n + CRLF_LEN + 1);
+        buf = nc_realloc(sess->sbuf, size);
+        if (buf == NULL) {
+            return NC_ENOMEM;
+        }
+        sess->sbuf = buf;
+        sess->ssize = size;
+    }
+}
+
+static struct server_pool *
+admin_pool(struct context *ctx, const char *name)
+{
+    uint32_t i, npool, len;
+
+    len = (uint32_t)strlen(name);
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+
+        if (pool->name.len == len && nc_strncmp(pool->name.data, name, len) == 0) {
+            return pool;
+        }
+    }
+
+    return NULL;
+}
+
+static struct conf_pool *
+admin_conf_pool(struct context *ctx, struct server_pool *pool)
+{
+    uint32_t i, npool;
+
+    for (i = 0, npool = array_n(&ctx->cf->pool); i < npool; i++) {
+        struct conf_pool *cp = array_get(&ctx->cf->pool, i);
+
+        if (string_compare(&cp->name, &pool->name) == 0) {
+            return cp;
+        }
+    }
+
+    return NULL;
+}
+
+static struct server *
+admin_server(struct server_pool *pool, const char *name)
+{
+    uint32_t i, nserver, len;
+
+    len = (uint32_t)strlen(name);
+
+    for (i = 0, nserver = array_n(&pool->server); i < nserver; i++) {
+        struct server *server = array_get(&pool->server, i);
+
+        if (server->name.len == len &&
+            nc_strncmp(server->name.data, name, len) == 0) {
+            return server;
+        }
+    }
+
+    return NULL;
+}
+
+static int
+admin_conf_server(struct array *server, const char *name)
+{
+    uint32_t i, nserver, len;
+
+    len = (uint32_t)strlen(name);
+
+    for (i = 0, nserver = array_n(server); i < nserver; i++) {
+        struct conf_server *cs = array_get(server, i);
+
+        if (cs->name.len == len && nc_strncmp(cs->name.data, name, len) == 0) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+static const char *
+admin_server_state(struct server *server)
+{
+    struct server_pool *pool = server->owner;
+
+    if (server->draining) {
+        return "draining";
+    }
+
+    if (server->ejected) {
+        return "ejected";
+    }
+
+    if (pool->auto_eject_hosts && server->next_retry > nc_usec_now()) {
+        return "auto_ejected";
+    }
+
+    return "live";
+}
+
+/*
+ * Replace the servers of conf pool 'cp' with 'server' and apply the change
+ * to its running pool 'pool', leaving the other pools alone. On return,
+ * 'server' holds whichever of the old and the new servers is no longer in
+ * use and is destroyed
+ */
+static rstatus_t
+admin_update(struct context *ctx, struct server_pool *pool,
+             struct conf_pool *cp, struct array *server)
+{
+    rstatus_t status;
+    struct array old;
+
+    old = cp->server;
+    cp->server = *server;
+
+    status = server_pool_reload_one(ctx, pool, cp);
+    if (status != NC_OK) {
+        *server = cp->server;
+        cp->server = old;
+    } else {
+        *server = old;
+    }
+
+    conf_server_destroy(server);
+
+    return status;
+}
+
+static rstatus_t
+admin_cmd_pools(struct context *ctx, struct admin_session *sess, int argc,
+                char **argv)
+{
+    rstatus_t status;
+    uint32_t i, npool;
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+
+        status = admin_reply(sess, "%.*s %.*s servers %"PRIu32"",
+                             pool->name.len, pool->name.data,
+                             pool->addrstr.len, pool->addrstr.data,
+                             array_n(&pool->server));
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return admin_reply(sess, "END");
+}
+
+static rstatus_t
+admin_cmd_servers(struct context *ctx, struct admin_session *sess, int argc,
+                  char **argv)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    uint32_t i, nserver;
+
+    pool = admin_pool(ctx, argv[1]);
+    if (pool == NULL) {
+        return admin_reply(sess, "ERR no such pool");
+    }
+
+    for (i = 0, nserver = array_n(&pool->server); i < nserver; i++) {
+        struct server *server = array_get(&pool->server, i);
+
+        status = admin_reply(sess, "%.*s %.*s %s connections %"PRIu32"",
+                             server->name.len, server->name.data,
+                             server->pname.len, server->pname.data,
+                             admin_server_state(server), server->ns_conn_q);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return admin_reply(sess, "END");
+}
+
+static rstatus_t
+admin_cmd_add(struct context *ctx, struct admin_session *sess, int argc,
+              char **argv)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    struct conf_pool *cp;
+    struct conf_server *cs;
+    struct array server;
+    struct string value;
+    char buf[ADMIN_RBUF_SIZE];
+    char *err;
+    int n;
+
+    pool = admin_pool(ctx, argv[1]);
+    cp = pool != NULL ? admin_conf_pool(ctx, pool) : NULL;
+    if (cp == NULL) {
+        return admin_reply(sess, "ERR no such pool");
+    }
+
+    if (argc == 4) {
+        n = nc_scnprintf(buf, sizeof(buf), "%s %s", argv[2], argv[3]);
+    } else {
+        n = nc_scnprintf(buf, sizeof(buf), "%s", argv[2]);
+    }
+    value.data = (uint8_t *)buf;
+    value.len = (uint32_t)n;
+
+    status = conf_server_copy(&server, &cp->server);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    cs = array_push(&server);
+    conf_server_init(cs);
+
+    err = conf_server_parse(cs, &value);
+    if (err != CONF_OK) {
+        conf_server_destroy(&server);
+        return admin_reply(sess, "ERR server %s", err);
+    }
+
+    if (admin_conf_server(&server, (char *)cs->name.data) !=
+        (int)array_n(&server) - 1) {
+        conf_server_destroy(&server);
+        return admin_reply(sess, "ERR duplicate server name");
+    }
+
+    conf_server_sort(&server);
+
+    status = admin_update(ctx, pool, cp, &server);
+    if (status != NC_OK) {
+        return admin_reply(sess, "ERR update of pool failed");
+    }
+
+    loga("admin added server '%s' to pool '%s'", buf, argv[1]);
+
+    return admin_reply(sess, "OK");
+}
+
+static rstatus_t
+admin_cmd_remove(struct context *ctx, struct admin_session *sess, int argc,
+                 char **argv)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    struct conf_pool *cp;
+    struct array server;
+    uint32_t j;
+    int i;
+
+    pool = admin_pool(ctx, argv[1]);
+    cp = pool != NULL ? admin_conf_pool(ctx, pool) : NULL;
+    if (cp == NULL) {
+        return admin_reply(sess, "ERR no such pool");
+    }
+
+    i = admin_conf_server(&cp->server, argv[2]);
+    if (i < 0) {
+        return admin_reply(sess, "ERR no such server");
+    }
+
+    if (array_n(&cp->server) == 1) {
+        return admin_reply(sess, "ERR cannot remove the last server");
+    }
+
+    status = conf_server_copy(&server, &cp->server);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    conf_server_deinit(array_get(&server, (uint32_t)i));
+    for (j = (uint32_t)i; j + 1 < array_n(&server); j++) {
+        nc_memcpy(array_get(&server, j), array_get(&server, j + 1),
+                  sizeof(struct conf_server));
+    }
+    array_pop(&server);
+
+    status = admin_update(ctx, pool, cp, &server);
+    if (status != NC_OK) {
+        return admin_reply(sess, "ERR update of pool failed");
+    }
+
+    loga("admin removed server '%s' from pool '%s'", argv[2], argv[1]);
+
+    return admin_reply(sess, "OK");
+}
+
+static rstatus_t
+admin_cmd_weight(struct context *ctx, struct admin_session *sess, int argc,
+                 char **argv)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    struct conf_pool *cp;
+    struct array server;
+    int i, weight;
+
+    pool = admin_pool(ctx, argv[1]);
+    cp = pool != NULL ? admin_conf_pool(ctx, pool) : NULL;
+    if (cp == NULL) {
+        return admin_reply(sess, "ERR no such pool");
+    }
+
+    i = admin_conf_server(&cp->server, argv[2]);
+    if (i < 0) {
+        return admin_reply(sess, "ERR no such server");
+    }
+
+    weight = nc_atoi(argv[3], strlen(argv[3]));
+    if (weight <= 0) {
+        return admin_reply(sess, "ERR weight must be a positive number");
+    }
+
+    status = conf_server_copy(&server, &cp->server);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = conf_server_set_weight(array_get(&server, (uint32_t)i), weight);
+    if (status != NC_OK) {
+        conf_server_destroy(&server);
+        return status;
+    }
+
+    status = admin_update(ctx, pool, cp, &server);
+    if (status != NC_OK) {
+        return admin_reply(sess, "ERR update of pool failed");
+    }
+
+    loga("admin set weight of server '%s' in pool '%s' to %d", argv[2],
+         argv[1], weight);
+
+    return admin_reply(sess, "OK");
+}
+
+/*
+ * Set the admin eject and drain state of a server and update the pool's
+ * distribution; an ejected server gets no keys, while a draining server in
+ * addition has its connections closed as they go idle by admin_loop()
+ */
+static rstatus_t
+admin_eject(struct context *ctx, struct admin_session *sess, char **argv,
+            bool ejected, bool draining)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    struct server *server;
+    bool oejected, odraining;
+    uint32_t i, nserver, nlive;
+
+    pool = admin_pool(ctx, argv[1]);
+    if (pool == NULL) {
+        return admin_reply(sess, "ERR no such pool");
+    }
+
+    server = admin_server(pool, argv[2]);
+    if (server == NULL) {
+        return admin_reply(sess, "ERR no such server");
+    }
+
+    if (ejected) {
+        for (nlive = 0, i = 0, nserver = array_n(&pool->server); i < nserver; i++) {
+            struct server *s = array_get(&pool->server, i);
+
+            if (s != server && !s->ejected) {
+                nlive++;
+            }
+        }
+
+        if (nlive == 0) {
+            return admin_reply(sess, "ERR cannot eject the last server");
+        }
+    }
+
+    oejected = server->ejected ? true : false;
+    odraining = server->draining ? true : false;
+
+    server->ejected = ejected ? 1 : 0;
+    server->draining = draining ? 1 : 0;
+
+    if (ejected && !oejected) {
+        stats_server_set_ts(ctx, server, server_ejected_at, nc_usec_now());
+    } else if (!ejected) {
+        server->failure_count = 0;
+        server->next_retry = 0LL;
+    }
+
+    status = server_pool_run(pool);
+    if (status != NC_OK) {
+        server->ejected = oejected ? 1 : 0;
+        server->draining = odraining ? 1 : 0;
+        return admin_reply(sess, "ERR update of pool failed");
+    }
+
+    if (draining) {
+        ctx->admin->ndraining++;
+    }
+
+    loga("admin %s server '%s' in pool '%s'", argv[0], argv[2], argv[1]);
+
+    return admin_reply(sess, "OK");
+}
+
+static rstatus_t
+admin_cmd_eject(struct context *ctx, struct admin_session *sess, int argc,
+                char **argv)
+{
+    return admin_eject(ctx, sess, argv, true, false);
+}
+
+static rstatus_t
+admin_cmd_drain(struct context *ctx, struct admin_session *sess, int argc,
+                char **argv)
+{
+    return admin_eject(ctx, sess, argv, true, true);
+}
+
+static rstatus_t
+admin_cmd_uneject(struct context *ctx, struct admin_session *sess, int argc,
+                  char **argv)
+{
+    return admin_eject(ctx, sess, argv, false, false);
+}
+
+static rstatus_t
+admin_cmd_hotkeys(struct context *ctx, struct admin_session *sess, int argc,
+                  char **argv)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    struct hotkey_entry top[HOTKEY_MAX_TOPK];
+    char key[HOTKEY_KEY_LEN * 4 + 4];
+    uint32_t i, n;
+
+    pool = admin_pool(ctx, argv[1]);
+    if (pool == NULL) {
+        return admin_reply(sess, "ERR no such pool");
+    }
+
+    if (pool->hotkey == NULL) {
+        return admin_reply(sess, "ERR hot keys are disabled");
+    }
+
+    n = hotkey_top(pool->hotkey, top, HOTKEY_MAX_TOPK);
+    for (i = 0; i < n; i++) {
+        struct hotkey_entry *he = &top[i];
+        struct string unknown = string("-");
+        struct string *name = &unknown;
+
+        if (he->server < array_n(&pool->server)) {
+            struct server *server = array_get(&pool->server, he->server);
+            name = &server->name;
+        }
+
+        hotkey_key_string(he, key, sizeof(key), false);
+
+        status = admin_reply(sess, "%s %.*s requests %"PRIu64" error %"PRIu64"",
+                             key, name->len, name->data, he->count, he->error);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return admin_reply(sess, "END");
+}
+
+static rstatus_t
+admin_cmd_slowlog(struct context *ctx, struct admin_session *sess, int argc,
+                  char **argv)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    struct slowlog *sl;
+    struct slowlog_entry *se;
+    char key[SLOWLOG_KEY_LEN * 4 + 4];
+    uint32_t i, n;
+    int count;
+
+    pool = admin_pool(ctx, argv[1]);
+    if (pool == NULL) {
+        return admin_reply(sess, "ERR no such pool");
+    }
+
+    sl = pool->slowlog;
+    if (sl == NULL) {
+        return admin_reply(sess, "ERR slow log is disabled");
+    }
+
+    n = SLOWLOG_GET;
+    if (argc > 2) {
+        if (strcmp(argv[2], "len") == 0) {
+            return admin_reply(sess, "%"PRIu32"", slowlog_len(sl));
+        }
+
+        if (strcmp(argv[2], "reset") == 0) {
+            slowlog_reset(sl);
+            return admin_reply(sess, "OK");
+        }
+
+        count = nc_atoi(argv[2], strlen(argv[2]));
+        if (count <= 0) {
+            return admin_reply(sess, "ERR count must be a positive number");
+        }
+        n = (uint32_t)count;
+    }
+
+    for (i = 0; i < n && (se = slowlog_get(sl, i)) != NULL; i++) {
+        struct string unknown = string("-");
+        struct string *name = &unknown;
+        struct string *type = msg_type_string(se->type);
+
+        if (se->server < array_n(&pool->server)) {
+            struct server *server = array_get(&pool->server, se->server);
+            name = &server->name;
+        }
+
+        nc_key_string(key, sizeof(key), se->key,
+                      MIN(se->keylen, SLOWLOG_KEY_LEN), se->keylen, false);
+
+        status = admin_reply(sess, "%"PRIu64" %"PRIi64".%06"PRIi64" %.*s %s "
+                             "keys %"PRIu32" server %.*s client %s "
+                             "usec %"PRIi64" recv %"PRIi64" route %"PRIi64" "
+                             "queue %"PRIi64" backend %"PRIi64" reply %"PRIi64"",
+                             se->id, se->start / 1000000, se->start % 1000000,
+                             type->len, type->data,
+                             se->nkey > 0 ? key : "-", se->nkey,
+                             name->len, name->data, se->peer, se->duration,
+                             se->phase[SLOWLOG_RECV], se->phase[SLOWLOG_ROUTE],
+                             se->phase[SLOWLOG_QUEUE], se->phase[SLOWLOG_SERVER],
+                             se->phase[SLOWLOG_REPLY]);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return admin_reply(sess, "END");
+}
+
+static rstatus_t
+admin_cmd_quit(struct context *ctx, struct admin_session *sess, int argc,
+               char **argv)
+{
+    sess->quit = 1;
+
+    return NC_OK;
+}
+
+static struct admin_command admin_commands[] = {
+    { "pools",   1, 1, admin_cmd_pools },
+    { "servers", 2, 2, admin_cmd_servers },
+    { "add",     3, 4, admin_cmd_add },
+    { "remove",  3, 3, admin_cmd_remove },
+    { "weight",  4, 4, admin_cmd_weight },
+    { "eject",   3, 3, admin_cmd_eject },
+    { "drain",   3, 3, admin_cmd_drain },
+    { "uneject", 3, 3, admin_cmd_uneject },
+    { "hotkeys", 2, 2, admin_cmd_hotkeys },
+    { "slowlog", 2, 3, admin_cmd_slowlog },
+    { "quit",    1, 1, admin_cmd_quit },
+    { NULL,      0, 0, NULL }
+};
+
+static rstatus_t
+admin_exec(struct context *ctx, struct admin_session *sess, char *line)
+{
+    struct admin_command *cmd;
+    char *argv[ADMIN_MAX_ARGC + 1];
+    int argc;
+    char *p;
+
+    for (argc = 0, p = line; ; ) {
+        while (*p == ' ' || *p == '\t' || *p == '\r') {
+            *p++ = '\0';
+        }
+        if (*p == '\0') {
+            break;
+        }
+
+        if (argc == ADMIN_MAX_ARGC + 1) {
+            return admin_reply(sess, "ERR wrong number of arguments");
+        }
+        argv[argc++] = p;
+
+        while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r') {
+            p++;
+        }
+    }
+
+    if (argc == 0) {
+        return NC_OK;
+    }
+
+    for (cmd = admin_commands; cmd->name != NULL; cmd++) {
+        if (strcmp(cmd->name, argv[0]) != 0) {
+            continue;
+        }
+
+        if (argc < cmd->argc_min || argc > cmd->argc_max) {
+            return admin_reply(sess, "ERR wrong number of arguments");
+        }
+
+        return cmd->handler(ctx, sess, argc, argv);
+    }
+
+    return admin_reply(sess, "ERR unknown command");
+}
+
+static rstatus_t
+admin_accept(struct context *ctx, struct conn *p)
+{
+    rstatus_t status;
+    struct admin *adm = p->owner;
+    struct admin_session *sess;
+    struct conn *c;
+    int sd;
+
+    ASSERT(p->admin && p->proxy);
+    ASSERT(p->recv_active && p->recv_ready);
+
+    for (;;) {
+        sd = accept(p->sd, NULL, NULL);
+        if (sd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) {
+                p->recv_ready = 0;
+                return NC_OK;
+            }
+
+            log_error("accept on admin %d failed: %s", p->sd, strerror(errno));
+            return NC_ERROR;
+        }
+
+        break;
+    }
+
+    sess = nc_alloc(sizeof(*sess));
+    if (sess == NULL) {
+        close(sd);
+        return NC_ENOMEM;
+    }
+    sess->admin = adm;
+    sess->rlen = 0;
+    sess->sbuf = NULL;
+    sess->ssize = 0;
+    sess->slen = 0;
+    sess->spos = 0;
+    sess->quit = 0;
+
+    c = conn_get_admin(sess, true);
+    if (c == NULL) {
+        nc_free(sess);
+        close(sd);
+        return NC_ENOMEM;
+    }
+    c->sd = sd;
+
+    status = nc_set_nonblocking(c->sd);
+    if (status < 0) {
+        log_error("set nonblock on admin %d failed: %s", c->sd,
+                  strerror(errno));
+        c->close(ctx, c);
+        return NC_OK;
+    }
+
+    status = event_add_conn(ctx->evb, c);
+    if (status < 0) {
+        log_error("event add conn admin %d failed: %s", c->sd,
+                  strerror(errno));
+        c->close(ctx, c);
+        return NC_OK;
+    }
+
+    log_debug(LOG_INFO, "accepted admin %d from '%s'", c->sd,
+              nc_unresolve_peer_desc(c->sd));
+
+    return NC_OK;
+}
+
+/*
+ * Execute the complete command lines read into the session buffer
+ */
+static rstatus_t
+admin_parse(struct context *ctx, struct admin_session *sess)
+{
+    rstatus_t status;
+    char *line, *end;
+    size_t len;
+
+    line = sess->rbuf;
+    while (!sess->quit) {
+        end = memchr(line, '\n', sess->rlen - (size_t)(line - sess->rbuf));
+        if (end == NULL) {
+            break;
+        }
+        *end = '\0';
+
+        status = admin_exec(ctx, sess, line);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        line = end + 1;
+    }
+
+    len = sess->rlen - (size_t)(line - sess->rbuf);
+    memmove(sess->rbuf, line, len);
+    sess->rlen = len;
+
+    if (sess->rlen == sizeof(sess->rbuf)) {
+        sess->quit = 1;
+        return admin_reply(sess, "ERR line too long");
+    }
+
+    return NC_OK;
+}
+
+rstatus_t
+admin_recv(struct context *ctx, struct conn *conn)
+{
+    rstatus_t status;
+    struct admin_session *sess;
+    ssize_t n;
+
+    ASSERT(conn->admin);
+    ASSERT(conn->recv_active);
+
+    conn->recv_ready = 1;
+
+    if (conn->proxy) {
+        do {
+            status = admin_accept(ctx, conn);
+            if (status != NC_OK) {
+                return status;
+            }
+        } while (conn->recv_ready);
+
+        return NC_OK;
+    }
+
+    sess = conn->owner;
+
+    while (conn->recv_ready && !sess->quit) {
+        n = conn_recv(conn, sess->rbuf + sess->rlen,
+                      sizeof(sess->rbuf) - sess->rlen);
+        if (n == NC_EAGAIN) {
+            break;
+        }
+        if (n < 0) {
+            return NC_ERROR;
+        }
+        if (n == 0) {
+            break;
+        }
+        sess->rlen += (size_t)n;
+
+        status = admin_parse(ctx, sess);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return admin_send(ctx, conn);
+}
+
+rstatus_t
+admin_send(struct context *ctx, struct conn *conn)
+{
+    struct admin_session *sess = conn->owner;
+    ssize_t n;
+
+    ASSERT(conn->admin && !conn->proxy);
+
+    while (sess->spos < sess->slen) {
+        n = nc_write(conn->sd, sess->sbuf + sess->spos, sess->slen - sess->spos);
+        if (n > 0) {
+            sess->spos += (size_t)n;
+            conn->send_bytes += (size_t)n;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return event_add_out(ctx->evb, conn) < 0 ? NC_ERROR : NC_OK;
+        }
+
+        conn->err = n < 0 ? errno : EPIPE;
+        return NC_ERROR;
+    }
+
+    sess->slen = 0;
+    sess->spos = 0;
+
+    if (conn->send_active) {
+        event_del_out(ctx->evb, conn);
+    }
+
+    if (sess->quit || conn->eof) {
+        conn->done = 1;
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+admin_listen(struct context *ctx, struct admin *adm, struct conn *p)
+{
+    rstatus_t status;
+
+    p->sd = upgrade_inherit(&adm->addrstr);
+    if (p->sd >= 0) {
+        log_debug(LOG_NOTICE, "admin %d inherited on addr '%.*s'", p->sd,
+                  adm->addrstr.len, adm->addrstr.data);
+        goto inherited;
+    }
+
+    p->sd = socket(p->family, SOCK_STREAM, 0);
+    if (p->sd < 0) {
+        log_error("socket failed: %s", strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = nc_set_reuseaddr(p->sd);
+    if (status < 0) {
+        log_error("set reuseaddr on admin %d failed: %s", p->sd,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = bind(p->sd, p->addr, p->addrlen);
+    if (status < 0) {
+        log_error("bind on admin %d to addr '%.*s' failed: %s", p->sd,
+                  adm->addrstr.len, adm->addrstr.data, strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = listen(p->sd, ADMIN_BACKLOG);
+    if (status < 0) {
+        log_error("listen on admin %d on addr '%.*s' failed: %s", p->sd,
+                  adm->addrstr.len, adm->addrstr.data, strerror(errno));
+        return NC_ERROR;
+    }
+
+inherited:
+    status = nc_set_nonblocking(p->sd);
+    if (status < 0) {
+        log_error("set nonblock on admin %d failed: %s", p->sd,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = event_add_conn(ctx->evb, p);
+    if (status < 0) {
+        log_error("event add conn admin %d failed: %s", p->sd,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = event_del_out(ctx->evb, p);
+    if (status < 0) {
+        log_error("event del out admin %d failed: %s", p->sd,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+rstatus_t
+admin_init(struct context *ctx, uint16_t port)
+{
+    rstatus_t status;
+    struct admin *adm;
+    struct string addr = string(ADMIN_ADDR);
+    struct conn *p;
+    int n;
+
+    ctx->admin = NULL;
+
+    if (port == 0) {
+        return NC_OK;
+    }
+
+    adm = nc_alloc(sizeof(*adm));
+    if (adm == NULL) {
+        return NC_ENOMEM;
+    }
+
+    adm->ctx = ctx;
+    n = nc_scnprintf(adm->addrbuf, sizeof(adm->addrbuf), "%s:%"PRIu16"",
+                     ADMIN_ADDR, port);
+    adm->addrstr.data = (uint8_t *)adm->addrbuf;
+    adm->addrstr.len = (uint32_t)n;
+    adm->p_conn = NULL;
+    TAILQ_INIT(&adm->c_conn_q);
+    adm->nc_conn_q = 0;
+    adm->ndraining = 0;
+
+    status = nc_resolve(&addr, port, &adm->info);
+    if (status != NC_OK) {
+        nc_free(adm);
+        return status;
+    }
+
+    p = conn_get_admin(adm, false);
+    if (p == NULL) {
+        nc_free(adm);
+        return NC_ENOMEM;
+    }
+
+    status = admin_listen(ctx, adm, p);
+    if (status != NC_OK) {
+        p->close(ctx, p);
+        nc_free(adm);
+        return status;
+    }
+
+    ctx->admin = adm;
+
+    log_debug(LOG_NOTICE, "admin %d listening on '%.*s'", p->sd,
+              adm->addrstr.len, adm->addrstr.data);
+
+    return NC_OK;
+}
+
+void
+admin_deinit(struct context *ctx)
+{
+    struct admin *adm = ctx->admin;
+
+    if (adm == NULL) {
+        return;
+    }
+
+    while (!TAILQ_EMPTY(&adm->c_conn_q)) {
+        struct conn *conn = TAILQ_FIRST(&adm->c_conn_q);
+        conn->close(ctx, conn);
+    }
+
+    if (adm->p_conn != NULL) {
+        adm->p_conn->close(ctx, adm->p_conn);
+    }
+
+    nc_free(adm);
+    ctx->admin = NULL;
+}
+
+/*
+ * Close the idle connections of draining servers, so that they can be
+ * shut down once drained
+ */
+void
+admin_loop(struct context *ctx)
+{
+    struct admin *adm = ctx->admin;
+    uint32_t i, j, npool, nserver;
+
+    if (adm == NULL || adm->ndraining == 0) {
+        return;
+    }
+
+    adm->ndraining = 0;
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+
+        for (j = 0, nserver = array_n(&pool->server); j < nserver; j++) {
+            struct server *server = array_get(&pool->server, j);
+            struct conn *conn, *nconn;
+
+            if (!server->draining) {
+                continue;
+            }
+
+            for (conn = TAILQ_FIRST(&server->s_conn_q); conn != NULL;
+                 conn = nconn) {
+                nconn = TAILQ_NEXT(conn, conn_tqe);
+
+                if (conn->sd < 0 || conn->active(conn)) {
+                    continue;
+                }
+
+                log_debug(LOG_INFO, "close s %d of draining server '%.*s'",
+                          conn->sd, server->pname.len, server->pname.data);
+
+                conn->eof = 1;
+                event_del_conn(ctx->evb, conn);
+                conn->close(ctx, conn);
+            }
+
+            if (server->ns_conn_q != 0) {
+                adm->ndraining++;
+            }
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_ADMIN_H_
+#define _NC_ADMIN_H_
+
+#include <nc_core.h>
+
+#define ADMIN_ADDR          "127.0.0.1"
+#define ADMIN_BACKLOG       16
+#define ADMIN_RBUF_SIZE     1024    /* max length of a command line */
+#define ADMIN_SBUF_SIZE     1024    /* initial size of a reply buffer */
+#define ADMIN_MAX_ARGC      4       /* max # arguments in a command line */
+
+struct admin {
+    struct context     *ctx;                /* owner context */
+    struct string      addrstr;             /* listen address */
+    char               addrbuf[sizeof(ADMIN_ADDR) + NC_UINTMAX_MAXLEN];
+    struct sockinfo    info;                /* listen socket info */
+    struct conn        *p_conn;             /* listening connection */
+    struct conn_tqh    c_conn_q;            /* session connection q */
+    uint32_t           nc_conn_q;           /* # session connections */
+    uint32_t           ndraining;           /* # draining servers with connections */
+};
+
+struct admin_session {
+    struct admin       *admin;              /* owner admin */
+    char               rbuf[ADMIN_RBUF_SIZE]; /* partial command line */
+    size_t             rlen;                /* # bytes in rbuf */
+    char               *sbuf;               /* reply buffer */
+    size_t             ssize;               /* size of sbuf */
+    size_t             slen;                /* # bytes in sbuf */
+    size_t             spos;                /* # bytes of sbuf sent */
+    unsigned           quit:1;              /* close once reply is sent? */
+};
+
+rstatus_t admin_init(struct context *ctx, uint16_t port);
+void admin_deinit(struct context *ctx);
+
+struct context *admin_ctx(struct conn *conn);
+void admin_ref(struct conn *conn, void *owner);
+void admin_unref(struct conn *conn);
+void admin_close(struct context *ctx, struct conn *conn);
+bool admin_active(struct conn *conn);
+rstatus_t admin_recv(struct context *ctx, struct conn *conn);
+rstatus_t admin_send(struct context *ctx, struct conn *conn);
+
+void admin_loop(struct context *ctx);
+
+#endif
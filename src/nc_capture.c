@@ -0,0 +1,264 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_capture.h>
+
+/*
+ * Request capture samples one in every capture_nsample requests received
+ * from clients, and records its shape when the response is forwarded:
+ * receive time, pool, type, hash of the first key, request and response
+ * sizes and latency. Keys and values themselves are not recorded.
+ *
+ * Records go to a ring in a file mapped shared, so capturing costs a few
+ * stores and the file can be read while twemproxy runs. The record count
+ * lives in the file and is bumped atomically, which lets the old and the
+ * new process of an upgrade share the file. An existing file with the
+ * same layout and msg types is appended to; any other is recreated.
+ *
+ * scripts/nc-replay.py replays a capture against a running twemproxy.
+ */
+
+static struct capture_header *capture_hdr;  /* mapped capture file */
+static struct capture_record *capture_rec;  /* ring in capture file */
+static size_t capture_size;                 /* size of capture file */
+static uint32_t capture_nsample;            /* capture 1 in these many requests */
+static uint32_t capture_nseen;              /* # requests since last captured one */
+
+static void
+capture_layout(struct capture_header *h)
+{
+    size_t type_size;
+
+    type_size = (size_t)(MSG_SENTINEL + 1) * CAPTURE_TYPE_LEN;
+
+    h->magic = CAPTURE_MAGIC;
+    h->version = CAPTURE_VERSION;
+    h->rsize = (uint32_t)sizeof(struct capture_record);
+    h->nrec = CAPTURE_NREC;
+    h->ntype = (uint32_t)(MSG_SENTINEL + 1);
+    h->type_off = (uint32_t)sizeof(struct capture_header);
+    h->rec_off = (uint32_t)NC_ALIGN(h->type_off + type_size, NC_ALIGNMENT);
+    h->reserved = 0;
+    h->count = 0;
+}
+
+static bool
+capture_compatible(struct capture_header *h, struct capture_header *want)
+{
+    char *name;
+    struct string *type;
+    uint32_t i;
+
+    if (h->magic != want->magic || h->version != want->version ||
+        h->rsize != want->rsize || h->nrec != want->nrec ||
+        h->ntype != want->ntype || h->type_off != want->type_off ||
+        h->rec_off != want->rec_off) {
+        return false;
+    }
+
+    /* msg type numbering differs between builds */
+    for (i = 0; i < h->ntype; i++) {
+        name = (char *)h + h->type_off + i * CAPTURE_TYPE_LEN;
+        type = msg_type_string((msg_type_t)i);
+        if (strncmp(name, (char *)type->data, CAPTURE_TYPE_LEN) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void
+capture_format(struct capture_header *h, struct capture_header *want)
+{
+    char *name;
+    struct string *type;
+    uint32_t i;
+
+    *h = *want;
+
+    for (i = 0; i < h->ntype; i++) {
+        name = (char *)h + h->type_off + i * CAPTURE_TYPE_LEN;
+        type = msg_type_string((msg_type_t)i);
+        nc_memcpy(name, type->data, MIN(type->len, CAPTURE_TYPE_LEN - 1));
+    }
+}
+
+rstatus_t
+capture_init(char *filename, int sample)
+{
+    struct capture_header want;
+    struct stat st;
+    void *addr;
+    bool reuse;
+    int fd, status;
+
+    if (filename == NULL) {
+        return NC_OK;
+    }
+
+    capture_layout(&want);
+    capture_size = want.rec_off + (size_t)want.nrec * want.rsize;
+
+    fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        log_error("open capture file '%s' failed: %s", filename,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = fstat(fd, &st);
+    if (status < 0) {
+        log_error("fstat capture file '%s' failed: %s", filename,
+                  strerror(errno));
+        close(fd);
+        return NC_ERROR;
+    }
+
+    reuse = ((size_t)st.st_size == capture_size) ? true : false;
+    if (!reuse) {
+        status = ftruncate(fd, 0);
+        if (status == 0) {
+            status = ftruncate(fd, (off_t)capture_size);
+        }
+        if (status < 0) {
+            log_error("resize capture file '%s' to %zu bytes failed: %s",
+                      filename, capture_size, strerror(errno));
+            close(fd);
+            return NC_ERROR;
+        }
+    }
+
+    addr = mmap(NULL, capture_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        log_error("mmap capture file '%s' failed: %s", filename,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    capture_hdr = addr;
+    if (!reuse || !capture_compatible(capture_hdr, &want)) {
+        if (reuse) {
+            memset(addr, 0, capture_size);
+        }
+        capture_format(capture_hdr, &want);
+        reuse = false;
+    }
+    capture_rec = (struct capture_record *)((char *)addr + capture_hdr->rec_off);
+
+    capture_nsample = (uint32_t)MAX(sample, 1);
+    capture_nseen = 0;
+
+    loga("capturing 1 in %"PRIu32" requests to '%s'%s", capture_nsample,
+         filename, reuse ? ", appending" : "");
+
+    return NC_OK;
+}
+
+void
+capture_deinit(void)
+{
+    if (capture_hdr == NULL) {
+        return;
+    }
+
+    munmap(capture_hdr, capture_size);
+    capture_hdr = NULL;
+    capture_rec = NULL;
+}
+
+/*
+ * Decide whether a request just received from a client is captured
+ */
+void
+capture_sample(struct msg *msg)
+{
+    ASSERT(msg->request);
+
+    if (capture_hdr == NULL) {
+        return;
+    }
+
+    if (++capture_nseen < capture_nsample) {
+        return;
+    }
+    capture_nseen = 0;
+
+    msg->capture = 1;
+    if (msg->start_ts == 0) {
+        msg->start_ts = nc_usec_now();
+    }
+}
+
+/*
+ * Record a captured request as its response is sent to the client. A
+ * request split into fragments is recorded once, by its fragment owner
+ */
+void
+capture_record(struct msg *req, struct msg *rsp)
+{
+    struct capture_record *rec;
+    struct server_pool *pool;
+    struct conn *c_conn;
+    struct keypos *kpos;
+    uint64_t idx;
+    int64_t now;
+    uint32_t hash, keylen, nkey;
+
+    if (!req->capture || capture_hdr == NULL) {
+        return;
+    }
+
+    if (req->frag_id != 0 && req->frag_owner != req) {
+        return;
+    }
+
+    c_conn = req->owner;
+    pool = c_conn->owner;
+
+    hash = 0;
+    nkey = array_n(&req->keys);
+    if (nkey > 0) {
+        kpos = array_get(&req->keys, 0);
+        keylen = (uint32_t)(kpos->end - kpos->start);
+        if (keylen > 0) {
+            hash = pool->key_hash((char *)kpos->start, keylen);
+        }
+    }
+
+    now = nc_usec_now();
+
+    idx = __atomic_fetch_add(&capture_hdr->count, 1, __ATOMIC_RELAXED);
+    rec = &capture_rec[idx % CAPTURE_NREC];
+
+    rec->usec = req->start_ts != 0 ? req->start_ts : now;
+    rec->latency = (uint32_t)MIN(MAX(now - rec->usec, 0), UINT32_MAX);
+    rec->hash = hash;
+    rec->req_len = req->mlen;
+    rec->rsp_len = rsp->mlen;
+    rec->pool = (uint16_t)pool->idx;
+    rec->type = (uint16_t)req->type;
+    rec->rsp_type = (uint16_t)rsp->type;
+    rec->nkey = (uint16_t)MIN(nkey, UINT16_MAX);
+}
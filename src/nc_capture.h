@@ -0,0 +1,68 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_CAPTURE_H_
+#define _NC_CAPTURE_H_
+
+#include <nc_core.h>
+
+#define CAPTURE_MAGIC       0x5043434e  /* "NCCP" */
+#define CAPTURE_VERSION     1
+#define CAPTURE_NREC        (1 << 20)   /* # records in the ring */
+#define CAPTURE_SAMPLE      100         /* capture 1 in these many requests */
+#define CAPTURE_TYPE_LEN    32          /* size of a msg type name */
+
+/*
+ * Capture file layout, all integers in host byte order:
+ *
+ *   capture_header
+ *   ntype msg type names, CAPTURE_TYPE_LEN bytes each, at type_off
+ *   nrec capture_record, at rec_off
+ *
+ * Record i of the ring is at rec_off + (i % nrec) * rsize; count is the
+ * # records ever written, so the ring holds the last min(count, nrec).
+ */
+struct capture_header {
+    uint32_t magic;         /* CAPTURE_MAGIC */
+    uint32_t version;       /* CAPTURE_VERSION */
+    uint32_t rsize;         /* size of a record */
+    uint32_t nrec;          /* # records in the ring */
+    uint32_t ntype;         /* # msg type names */
+    uint32_t type_off;      /* offset of msg type names */
+    uint32_t rec_off;       /* offset of the ring */
+    uint32_t reserved;
+    uint64_t count;         /* # records written */
+};
+
+struct capture_record {
+    int64_t  usec;          /* request receive time in usec */
+    uint32_t latency;       /* usec from request receive to response */
+    uint32_t hash;          /* hash of the first key */
+    uint32_t req_len;       /* request length in bytes */
+    uint32_t rsp_len;       /* response length in bytes */
+    uint16_t pool;          /* pool index */
+    uint16_t type;          /* request msg type */
+    uint16_t rsp_type;      /* response msg type */
+    uint16_t nkey;          /* # keys in request */
+};
+
+rstatus_t capture_init(char *filename, int sample);
+void capture_deinit(void);
+void capture_sample(struct msg *msg);
+void capture_record(struct msg *req, struct msg *rsp);
+
+#endif
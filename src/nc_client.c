@@ -42,6 +42,7 @@ client_ref(struct conn *conn, void *owner) //
 
     pool->nc_conn_q++;
     TAILQ_INSERT_TAIL(&pool->c_conn_q, conn, conn_tqe);
+    conn->last_active = nc_msec_now();
 
     /* owner of the client connection is the server pool */
     conn->owner = owner;
@@ -63,12 +64,75 @@ client_unref(struct conn *conn)
 
     ASSERT(pool->nc_conn_q != 0);
     pool->nc_conn_q--;
-    TAILQ_REMOVE(&pool->c_conn_q, conn, conn_tqe);
+    if (conn->parked) {
+        TAILQ_REMOVE(&pool->c_park_q, conn, conn_tqe);
+    } else {
+        TAILQ_REMOVE(&pool->c_conn_q, conn, conn_tqe);
+    }
 
     log_debug(LOG_VVERB, "unref conn %p owner %p from pool '%.*s'", conn,
               pool, pool->name.len, pool->name.data);
 }
 
+/*
+ * Note io on client connection 'conn'. The client connections of a pool
+ * are kept in the order they were last active in, the least recently
+ * active first, so the idle ones are found at the head of the queues
+ */
+void
+client_touch(struct context *ctx, struct conn *conn)
+{
+    struct server_pool *pool = conn->owner;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    if (conn->parked) {
+        TAILQ_REMOVE(&pool->c_park_q, conn, conn_tqe);
+        conn->parked = 0;
+
+        stats_pool_decr(ctx, pool, client_parked);
+
+        log_debug(LOG_VERB, "unpark c %d", conn->sd);
+    } else {
+        TAILQ_REMOVE(&pool->c_conn_q, conn, conn_tqe);
+    }
+    TAILQ_INSERT_TAIL(&pool->c_conn_q, conn, conn_tqe);
+
+    conn->last_active = nc_msec_now();
+}
+
+/*
+ * Park idle client connection 'conn': put back the msg and mbuf it holds
+ * for the next request, if nothing of that request has arrived, and move
+ * it to the parked q of its pool. The next read allocates them again
+ */
+void
+client_park(struct context *ctx, struct conn *conn)
+{
+    struct server_pool *pool = conn->owner;
+    struct msg *msg;
+
+    ASSERT(conn->client && !conn->proxy);
+    ASSERT(!conn->parked);
+    ASSERT(TAILQ_EMPTY(&conn->omsg_q) && conn->smsg == NULL);
+
+    msg = conn->rmsg;
+    if (msg != NULL && msg->mlen == 0) {
+        ASSERT(msg->request && msg->peer == NULL);
+        conn->rmsg = NULL;
+        req_put(msg);
+    }
+
+    TAILQ_REMOVE(&pool->c_conn_q, conn, conn_tqe);
+    TAILQ_INSERT_TAIL(&pool->c_park_q, conn, conn_tqe);
+    conn->parked = 1;
+
+    stats_pool_incr(ctx, pool, client_parked);
+
+    log_debug(LOG_VERB, "park c %d idle for %"PRId64" msec", conn->sd,
+              nc_msec_now() - conn->last_active);
+}
+
 bool
 client_active(struct conn *conn)
 {
@@ -96,6 +160,167 @@ client_active(struct conn *conn)
     return false;
 }
 
+/*
+ * Return true if client connection 'conn' has no request outstanding and
+ * nothing of its next request has arrived. Unlike client_active, a msg
+ * allocated for the next request that is still empty does not count
+ */
+bool
+client_idle(struct conn *conn)
+{
+    ASSERT(conn->client && !conn->proxy);
+
+    return TAILQ_EMPTY(&conn->omsg_q) && conn->smsg == NULL &&
+           (conn->rmsg == NULL || conn->rmsg->mlen == 0);
+}
+
+/*
+ * Return true if client connection 'conn' has a partially read request
+ * but no outstanding ones, so that the memory it holds is only freed by
+ * reading the rest of the request
+ */
+bool
+client_partial(struct conn *conn)
+{
+    ASSERT(conn->client && !conn->proxy);
+
+    return TAILQ_EMPTY(&conn->omsg_q) && conn->rmsg != NULL &&
+           conn->rmsg->mlen != 0;
+}
+
+/*
+ * Return the # bytes of the partially read requests of paused clients
+ * without outstanding requests
+ */
+size_t
+client_paused_partial(struct context *ctx)
+{
+    uint32_t i, n;
+    size_t held;
+
+    held = 0;
+    for (i = 0, n = array_n(&ctx->paused); i < n; i++) {
+        struct conn *conn = *(struct conn **)array_get(&ctx->paused, i);
+
+        if (client_partial(conn)) {
+            held += conn->rmsg->mlen;
+        }
+    }
+
+    return held;
+}
+
+/*
+ * Over the soft memory limit, stop reading from client connection 'conn'
+ * if it holds more than its fair share of the buffered data, so that the
+ * biggest clients are throttled first; over the hard memory limit, any
+ * client is. Clients with outstanding requests are resumed once the
+ * replies to those requests free memory (see core_resume).
+ *
+ * A client with a partially read request and no outstanding ones frees
+ * nothing while paused, so it is only paused while the memory used
+ * elsewhere keeps us over the soft limit. When partial requests are what
+ * takes us over the hard limit, they could not be forwarded anyway, and
+ * the client is closed instead.
+ *
+ * Returns true if reads from the client are to stop.
+ */
+bool
+client_pause(struct context *ctx, struct conn *conn)
+{
+    struct conn **pconn;
+    struct msg *msg;
+    size_t used, held;
+    uint32_t nconn;
+    bool partial;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    if (conn->recv_paused) {
+        return true;
+    }
+
+    if (ctx->mem_soft == 0) {
+        return false;
+    }
+
+    partial = client_partial(conn);
+    if (TAILQ_EMPTY(&conn->omsg_q) && !partial) {
+        return false;
+    }
+
+    used = core_mem_used();
+    if (used < ctx->mem_soft) {
+        return false;
+    }
+
+    held = conn->rmsg != NULL ? conn->rmsg->mlen : 0;
+    TAILQ_FOREACH(msg, &conn->omsg_q, c_tqe) {
+        held += msg->mlen;
+        if (msg->peer != NULL) {
+            held += msg->peer->mlen;
+        }
+    }
+
+    nconn = conn_ncurr_cconn();
+
+    if (partial && used < held + client_paused_partial(ctx) + ctx->mem_soft) {
+        if (used < ctx->mem_hard || (nconn > 1 && held < used / nconn)) {
+            return false;
+        }
+
+        stats_pool_incr(ctx, conn->owner, oom_rejected);
+
+        log_warn("close c %d with a partial request of %zu bytes over the "
+                 "memory limit", conn->sd, held);
+
+        conn->err = ENOMEM;
+        return true;
+    }
+
+    /* over the hard limit every client with outstanding requests is paused */
+    if (used < ctx->mem_hard && nconn > 1 && held < used / nconn) {
+        return false;
+    }
+
+    pconn = array_push(&ctx->paused);
+    if (pconn == NULL) {
+        return false;
+    }
+    *pconn = conn;
+    conn->recv_paused = 1;
+
+    stats_pool_incr(ctx, conn->owner, client_paused);
+
+    log_debug(LOG_INFO, "pause c %d holding %zu of %zu bytes", conn->sd, held,
+              used);
+
+    return true;
+}
+
+void
+client_unpause(struct context *ctx, struct conn *conn)
+{
+    uint32_t i, n;
+
+    ASSERT(conn->client && !conn->proxy);
+    ASSERT(conn->recv_paused);
+
+    n = array_n(&ctx->paused);
+    for (i = n; i-- > 0;) {
+        struct conn **pconn = array_get(&ctx->paused, i);
+
+        if (*pconn == conn) {
+            *pconn = *(struct conn **)array_get(&ctx->paused, n - 1);
+            array_pop(&ctx->paused);
+            break;
+        }
+    }
+    conn->recv_paused = 0;
+
+    log_debug(LOG_INFO, "resume c %d", conn->sd);
+}
+
 static void
 client_close_stats(struct context *ctx, struct server_pool *pool, err_t err,
                    unsigned eof)
@@ -133,6 +358,26 @@ client_close(struct context *ctx, struct conn *conn)
 
     client_close_stats(ctx, conn->owner, conn->err, conn->eof);
 
+    if (conn->recv_paused) {
+        client_unpause(ctx, conn);
+    }
+
+    if (conn->recv_throttled) {
+        limit_unthrottle(ctx, conn);
+    }
+
+    if (conn->parked) {
+        stats_pool_decr(ctx, conn->owner, client_parked);
+    }
+
+    /* noreply requests still queued on servers outlive their client */
+    while (!TAILQ_EMPTY(&conn->nmsg_q)) {
+        msg = TAILQ_FIRST(&conn->nmsg_q);
+        TAILQ_REMOVE(&conn->nmsg_q, msg, c_tqe);
+        msg->routed = 0;
+        conn->nrouted--;
+    }
+
     if (conn->sd < 0) {
         conn->unref(conn);
         conn_put(conn);
@@ -172,6 +417,10 @@ client_close(struct context *ctx, struct conn *conn)
             //ͻѾתȡ˻ûеõӦʱproxyͿͻ˹رӣߵ
             msg->swallow = 1;
 
+            if (msg->peer != NULL) {
+                rsp_stream_detach(ctx, msg);
+            }
+
             ASSERT(msg->request);
             ASSERT(msg->peer == NULL);
 
@@ -21,8 +21,15 @@
 #include <nc_core.h>
 
 bool client_active(struct conn *conn);
+bool client_idle(struct conn *conn);
+bool client_partial(struct conn *conn);
+size_t client_paused_partial(struct context *ctx);
 void client_ref(struct conn *conn, void *owner);
 void client_unref(struct conn *conn);
+void client_touch(struct context *ctx, struct conn *conn);
+void client_park(struct context *ctx, struct conn *conn);
 void client_close(struct context *ctx, struct conn *conn);
+bool client_pause(struct context *ctx, struct conn *conn);
+void client_unpause(struct context *ctx, struct conn *conn);
 
 #endif
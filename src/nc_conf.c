@@ -102,6 +102,18 @@ static struct command conf_commands[] = {
       conf_set_num,
       offsetof(struct conf_pool, server_connections) },
 
+    { string("server_window"),
+      conf_set_num,
+      offsetof(struct conf_pool, server_window) },
+
+    { string("bulk_commands"),
+      conf_add_command,
+      offsetof(struct conf_pool, bulk_command) },
+
+    { string("bulk_connections"),
+      conf_set_num,
+      offsetof(struct conf_pool, bulk_connections) },
+
     { string("server_retry_timeout"),
       conf_set_num,
       offsetof(struct conf_pool, server_retry_timeout) },
@@ -110,6 +122,50 @@ static struct command conf_commands[] = {
       conf_set_num,
       offsetof(struct conf_pool, server_failure_limit) },
 
+    { string("hotkey_sample"),
+      conf_set_num,
+      offsetof(struct conf_pool, hotkey_sample) },
+
+    { string("hotkey_topk"),
+      conf_set_num,
+      offsetof(struct conf_pool, hotkey_topk) },
+
+    { string("slowlog_slower_than"),
+      conf_set_num,
+      offsetof(struct conf_pool, slowlog_slower_than) },
+
+    { string("slowlog_max_len"),
+      conf_set_num,
+      offsetof(struct conf_pool, slowlog_max_len) },
+
+    { string("splice_threshold"),
+      conf_set_num,
+      offsetof(struct conf_pool, splice_threshold) },
+
+    { string("client_park_timeout"),
+      conf_set_num,
+      offsetof(struct conf_pool, client_park_timeout) },
+
+    { string("client_idle_timeout"),
+      conf_set_num,
+      offsetof(struct conf_pool, client_idle_timeout) },
+
+    { string("client_rate"),
+      conf_set_num,
+      offsetof(struct conf_pool, client_rate) },
+
+    { string("pool_rate"),
+      conf_set_num,
+      offsetof(struct conf_pool, pool_rate) },
+
+    { string("client_limits"),
+      conf_add_limit,
+      offsetof(struct conf_pool, client_limit) },
+
+    { string("fair_queue"),
+      conf_set_bool,
+      offsetof(struct conf_pool, fair_queue) },
+
     { string("servers"),
       conf_add_server,
       offsetof(struct conf_pool, server) },
@@ -117,7 +173,7 @@ static struct command conf_commands[] = {
     null_command
 };
 
-static void
+void
 conf_server_init(struct conf_server *cs)
 {
     string_init(&cs->pname);
@@ -127,13 +183,14 @@ conf_server_init(struct conf_server *cs)
     cs->weight = 0;
 
     memset(&cs->info, 0, sizeof(cs->info));
+    cs->resolved_at = 0LL;
 
     cs->valid = 0;
 
     log_debug(LOG_VVERB, "init conf server %p", cs);
 }
 
-static void
+void
 conf_server_deinit(struct conf_server *cs)
 {
     string_deinit(&cs->pname);
@@ -166,12 +223,18 @@ conf_server_each_transform(void *elem, void *data)
     s->weight = (uint32_t)cs->weight;
 
     nc_memcpy(&s->info, &cs->info, sizeof(cs->info));
+    s->resolved_at = cs->resolved_at;
+    s->resolve_next = 0LL;
 
     s->ns_conn_q = 0;
+    s->nb_conn_q = 0;
     TAILQ_INIT(&s->s_conn_q);
 
     s->next_retry = 0LL;
     s->failure_count = 0;
+    s->ejected = 0;
+    s->draining = 0;
+    s->resolving = 0;
 
     log_debug(LOG_VERB, "transform to server %"PRIu32" '%.*s'",
               s->idx, s->pname.len, s->pname.data);
@@ -208,10 +271,24 @@ conf_pool_init(struct conf_pool *cp, struct string *name)
     cp->preconnect = CONF_UNSET_NUM;
     cp->auto_eject_hosts = CONF_UNSET_NUM;
     cp->server_connections = CONF_UNSET_NUM;
+    cp->server_window = CONF_UNSET_NUM;
+    cp->bulk_connections = CONF_UNSET_NUM;
     cp->server_retry_timeout = CONF_UNSET_NUM;
     cp->server_failure_limit = CONF_UNSET_NUM;
+    cp->hotkey_sample = CONF_UNSET_NUM;
+    cp->hotkey_topk = CONF_UNSET_NUM;
+    cp->slowlog_slower_than = CONF_UNSET_NUM;
+    cp->slowlog_max_len = CONF_UNSET_NUM;
+    cp->splice_threshold = CONF_UNSET_NUM;
+    cp->client_park_timeout = CONF_UNSET_NUM;
+    cp->client_idle_timeout = CONF_UNSET_NUM;
+    cp->client_rate = CONF_UNSET_NUM;
+    cp->pool_rate = CONF_UNSET_NUM;
+    cp->fair_queue = CONF_UNSET_NUM;
 
     array_null(&cp->server);
+    array_null(&cp->client_limit);
+    array_null(&cp->bulk_command);
 
     cp->valid = 0;
 
@@ -227,6 +304,23 @@ conf_pool_init(struct conf_pool *cp, struct string *name)
         return status;
     }
 
+    status = array_init(&cp->client_limit, CONF_DEFAULT_LIMITS,
+                        sizeof(struct limit_rule));
+    if (status != NC_OK) {
+        array_deinit(&cp->server);
+        string_deinit(&cp->name);
+        return status;
+    }
+
+    status = array_init(&cp->bulk_command, CONF_DEFAULT_COMMANDS,
+                        sizeof(struct string));
+    if (status != NC_OK) {
+        array_deinit(&cp->client_limit);
+        array_deinit(&cp->server);
+        string_deinit(&cp->name);
+        return status;
+    }
+
     log_debug(LOG_VVERB, "init conf pool %p, '%.*s'", cp, name->len, name->data);
 
     return NC_OK;
@@ -249,6 +343,16 @@ conf_pool_deinit(struct conf_pool *cp)
     }
     array_deinit(&cp->server);
 
+    while (array_n(&cp->client_limit) != 0) {
+        array_pop(&cp->client_limit);
+    }
+    array_deinit(&cp->client_limit);
+
+    while (array_n(&cp->bulk_command) != 0) {
+        string_deinit(array_pop(&cp->bulk_command));
+    }
+    array_deinit(&cp->bulk_command);
+
     log_debug(LOG_VVERB, "deinit conf pool %p", cp);
 }
 
@@ -260,6 +364,7 @@ conf_pool_each_transform(void *elem, void *data)
     struct conf_pool *cp = elem;
     struct array *server_pool = data;
     struct server_pool *sp;
+    uint32_t i, nrule;
 
     ASSERT(cp->valid);
 
@@ -272,8 +377,10 @@ conf_pool_each_transform(void *elem, void *data)
     sp->p_conn = NULL;
     sp->nc_conn_q = 0;
     TAILQ_INIT(&sp->c_conn_q);
+    TAILQ_INIT(&sp->c_park_q);
 
     array_null(&sp->server);
+    array_null(&sp->client_limit);
     sp->ncontinuum = 0;
     sp->nserver_continuum = 0;
     sp->continuum = NULL;
@@ -304,11 +411,65 @@ conf_pool_each_transform(void *elem, void *data)
 
     sp->client_connections = (uint32_t)cp->client_connections;
     sp->server_connections = (uint32_t)cp->server_connections;
+    sp->server_window = (uint32_t)cp->server_window;
+    sp->bulk_connections = (uint32_t)cp->bulk_connections;
     sp->server_retry_timeout = (int64_t)cp->server_retry_timeout * 1000LL;
     sp->server_failure_limit = (uint32_t)cp->server_failure_limit;
+    sp->splice_threshold = (uint32_t)cp->splice_threshold;
+    sp->client_park_timeout = (int64_t)cp->client_park_timeout;
+    sp->client_idle_timeout = (int64_t)cp->client_idle_timeout;
+    sp->client_rate = (uint32_t)cp->client_rate;
+    sp->pool_rate = (uint32_t)cp->pool_rate;
+    sp->bucket.tokens = 0;
+    sp->bucket.last = 0;
+    sp->vtime = 0;
+    sp->fair_queue = cp->fair_queue ? 1 : 0;
     sp->auto_eject_hosts = cp->auto_eject_hosts ? 1 : 0;
     sp->preconnect = cp->preconnect ? 1 : 0;
 
+    sp->hotkey = NULL;
+    if (cp->hotkey_sample > 0) {
+        sp->hotkey = hotkey_create((uint32_t)cp->hotkey_sample,
+                                   (uint32_t)cp->hotkey_topk);
+        if (sp->hotkey == NULL) {
+            return NC_ENOMEM;
+        }
+    }
+
+    sp->slowlog = NULL;
+    if (cp->slowlog_slower_than > 0) {
+        sp->slowlog = slowlog_create((int64_t)cp->slowlog_slower_than,
+                                     (uint32_t)cp->slowlog_max_len);
+        if (sp->slowlog == NULL) {
+            return NC_ENOMEM;
+        }
+    }
+
+    /* rules carry their buckets, so every pool built gets its own copy */
+    nrule = array_n(&cp->client_limit);
+    if (nrule != 0) {
+        status = array_init(&sp->client_limit, nrule,
+                            sizeof(struct limit_rule));
+        if (status != NC_OK) {
+            return status;
+        }
+
+        for (i = 0; i < nrule; i++) {
+            struct limit_rule *rule = array_push(&sp->client_limit);
+
+            *rule = *(struct limit_rule *)array_get(&cp->client_limit, i);
+        }
+    }
+
+    memset(sp->bulk_type, 0, sizeof(sp->bulk_type));
+    for (i = 0; i < array_n(&cp->bulk_command); i++) {
+        msg_type_t type = msg_type_lookup(array_get(&cp->bulk_command, i),
+                                          cp->redis);
+
+        ASSERT(type != MSG_UNKNOWN);
+        sp->bulk_type[type >> 3] |= (uint8_t)(1 << (type & 7));
+    }
+
     status = server_init(&sp->server, &cp->server, sp);
     if (status != NC_OK) {
         return status;
@@ -373,10 +534,29 @@ conf_dump(struct conf *cf)
         log_debug(LOG_VVERB, "  auto_eject_hosts: %d", cp->auto_eject_hosts);
         log_debug(LOG_VVERB, "  server_connections: %d",
                   cp->server_connections);
+        log_debug(LOG_VVERB, "  server_window: %d", cp->server_window);
+        log_debug(LOG_VVERB, "  bulk_commands: %"PRIu32"",
+                  array_n(&cp->bulk_command));
+        log_debug(LOG_VVERB, "  bulk_connections: %d", cp->bulk_connections);
         log_debug(LOG_VVERB, "  server_retry_timeout: %d",
                   cp->server_retry_timeout);
         log_debug(LOG_VVERB, "  server_failure_limit: %d",
                   cp->server_failure_limit);
+        log_debug(LOG_VVERB, "  hotkey_sample: %d", cp->hotkey_sample);
+        log_debug(LOG_VVERB, "  hotkey_topk: %d", cp->hotkey_topk);
+        log_debug(LOG_VVERB, "  slowlog_slower_than: %d",
+                  cp->slowlog_slower_than);
+        log_debug(LOG_VVERB, "  slowlog_max_len: %d", cp->slowlog_max_len);
+        log_debug(LOG_VVERB, "  splice_threshold: %d", cp->splice_threshold);
+        log_debug(LOG_VVERB, "  client_park_timeout: %d",
+                  cp->client_park_timeout);
+        log_debug(LOG_VVERB, "  client_idle_timeout: %d",
+                  cp->client_idle_timeout);
+        log_debug(LOG_VVERB, "  client_rate: %d", cp->client_rate);
+        log_debug(LOG_VVERB, "  pool_rate: %d", cp->pool_rate);
+        log_debug(LOG_VVERB, "  client_limits: %"PRIu32"",
+                  array_n(&cp->client_limit));
+        log_debug(LOG_VVERB, "  fair_queue: %d", cp->fair_queue);
 
         nserver = array_n(&cp->server);
         log_debug(LOG_VVERB, "  servers: %"PRIu32"", nserver);
@@ -1001,7 +1181,7 @@ conf_validate_structure(struct conf *cf)
     rstatus_t status;
     int type, depth;
     uint32_t i, count[CONF_MAX_DEPTH + 1];
-    bool done, error, seq;
+    bool done, error, seq, inseq;
 
     status = conf_yaml_init(cf);
     if (status != NC_OK) {
@@ -1011,6 +1191,7 @@ conf_validate_structure(struct conf *cf)
     done = false;
     error = false;
     seq = false;
+    inseq = false;
     depth = 0;
     for (i = 0; i < CONF_MAX_DEPTH + 1; i++) {
         count[i] = 0;
@@ -1028,6 +1209,8 @@ conf_validate_structure(struct conf *cf)
      *     - elem2
      *     - elem3
      *   key3: value3
+     *   seq2:
+     *     - elem1
      *
      * keyy:
      *   key1: value1
@@ -1088,9 +1271,9 @@ conf_validate_structure(struct conf *cf)
             break;
 
         case YAML_SEQUENCE_START_EVENT:
-            if (seq) {
+            if (inseq) {
                 error = true;
-                log_error("conf: '%s' has more than one sequence directive",
+                log_error("conf: '%s' has a sequence within a sequence",
                           cf->fname);
             } else if (depth != CONF_MAX_DEPTH) {
                 error = true;
@@ -1102,11 +1285,13 @@ conf_validate_structure(struct conf *cf)
                           cf->fname, depth);
             }
             seq = true;
+            inseq = true;
             break;
 
         case YAML_SEQUENCE_END_EVENT:
             ASSERT(depth == CONF_MAX_DEPTH);
             count[depth] = 0;
+            inseq = false;
             break;
 
         case YAML_SCALAR_EVENT:
@@ -1233,6 +1418,7 @@ static rstatus_t
 conf_validate_pool(struct conf *cf, struct conf_pool *cp)
 {
     rstatus_t status;
+    uint32_t i;
 
     ASSERT(!cp->valid);
     ASSERT(!string_empty(&cp->name));
@@ -1289,6 +1475,19 @@ conf_validate_pool(struct conf *cf, struct conf_pool *cp)
         return NC_ERROR;
     }
 
+    if (cp->server_window == CONF_UNSET_NUM) {
+        cp->server_window = CONF_DEFAULT_SERVER_WINDOW;
+    }
+
+    if (cp->bulk_connections == CONF_UNSET_NUM) {
+        cp->bulk_connections = CONF_DEFAULT_BULK_CONNECTIONS;
+    } else if (cp->bulk_connections != 0 &&
+               array_n(&cp->bulk_command) == 0) {
+        log_error("conf: directive \"bulk_connections:\" requires "
+                  "\"bulk_commands:\"");
+        return NC_ERROR;
+    }
+
     if (cp->server_retry_timeout == CONF_UNSET_NUM) {
         cp->server_retry_timeout = CONF_DEFAULT_SERVER_RETRY_TIMEOUT;
     }
@@ -1297,11 +1496,69 @@ conf_validate_pool(struct conf *cf, struct conf_pool *cp)
         cp->server_failure_limit = CONF_DEFAULT_SERVER_FAILURE_LIMIT;
     }
 
+    if (cp->hotkey_sample == CONF_UNSET_NUM) {
+        cp->hotkey_sample = CONF_DEFAULT_HOTKEY_SAMPLE;
+    }
+
+    if (cp->hotkey_topk == CONF_UNSET_NUM) {
+        cp->hotkey_topk = CONF_DEFAULT_HOTKEY_TOPK;
+    } else if (cp->hotkey_topk == 0 || cp->hotkey_topk > HOTKEY_MAX_TOPK) {
+        log_error("conf: directive \"hotkey_topk:\" must be between 1 and %d",
+                  HOTKEY_MAX_TOPK);
+        return NC_ERROR;
+    }
+
+    if (cp->slowlog_slower_than == CONF_UNSET_NUM) {
+        cp->slowlog_slower_than = CONF_DEFAULT_SLOWLOG_SLOWER_THAN;
+    }
+
+    if (cp->slowlog_max_len == CONF_UNSET_NUM) {
+        cp->slowlog_max_len = CONF_DEFAULT_SLOWLOG_MAX_LEN;
+    } else if (cp->slowlog_max_len == 0) {
+        log_error("conf: directive \"slowlog_max_len:\" must be a positive number");
+        return NC_ERROR;
+    }
+
+    if (cp->splice_threshold == CONF_UNSET_NUM) {
+        cp->splice_threshold = CONF_DEFAULT_SPLICE_THRESHOLD;
+    }
+
+    if (cp->client_park_timeout == CONF_UNSET_NUM) {
+        cp->client_park_timeout = CONF_DEFAULT_CLIENT_PARK_TIMEOUT;
+    }
+
+    if (cp->client_idle_timeout == CONF_UNSET_NUM) {
+        cp->client_idle_timeout = CONF_DEFAULT_CLIENT_IDLE_TIMEOUT;
+    }
+
+    if (cp->client_rate == CONF_UNSET_NUM) {
+        cp->client_rate = CONF_DEFAULT_CLIENT_RATE;
+    }
+
+    if (cp->pool_rate == CONF_UNSET_NUM) {
+        cp->pool_rate = CONF_DEFAULT_POOL_RATE;
+    }
+
+    if (cp->fair_queue == CONF_UNSET_NUM) {
+        cp->fair_queue = CONF_DEFAULT_FAIR_QUEUE;
+    }
+
     if (!cp->redis && cp->redis_auth.len > 0) {
         log_error("conf: directive \"redis_auth:\" is only valid for a redis pool");
         return NC_ERROR;
     }
 
+    for (i = 0; i < array_n(&cp->bulk_command); i++) {
+        struct string *name = array_get(&cp->bulk_command, i);
+
+        if (msg_type_lookup(name, cp->redis) == MSG_UNKNOWN) {
+            log_error("conf: directive \"bulk_commands:\" has an unknown %s "
+                      "command '%.*s'", cp->redis ? "redis" : "memcache",
+                      name->len, name->data);
+            return NC_ERROR;
+        }
+    }
+
     status = conf_validate_server(cf, cp);
     if (status != NC_OK) {
         return status;
@@ -1560,30 +1817,19 @@ conf_set_listen(struct conf *cf, struct command *cmd, void *conf)
     return CONF_OK;
 }
 
+/*
+ * Parse server "hostname:port:weight [name]" or "/path/unix_socket:weight
+ * [name]" in 'value' into the initialized conf server 'field'
+ */
 char *
-conf_add_server(struct conf *cf, struct command *cmd, void *conf)
+conf_server_parse(struct conf_server *field, struct string *value)
 {
     rstatus_t status;
-    struct array *a;
-    struct string *value;
-    struct conf_server *field;
     uint8_t *p, *q, *start;
     uint8_t *pname, *addr, *port, *weight, *name;
     uint32_t k, delimlen, pnamelen, addrlen, portlen, weightlen, namelen;
     char delim[] = " ::";
 
-    p = conf;
-    a = (struct array *)(p + cmd->offset);
-
-    field = array_push(a);
-    if (field == NULL) {
-        return CONF_ERROR;
-    }
-
-    conf_server_init(field);
-
-    value = array_top(&cf->arg);
-
     /* parse "hostname:port:weight [name]" or "/path/unix_socket:weight [name]" from the end */
     p = value->data + value->len - 1;
     start = value->data;
@@ -1642,7 +1888,6 @@ conf_add_server(struct conf *cf, struct command *cmd, void *conf)
     pnamelen = namelen > 0 ? value->len - (namelen + 1) : value->len;
     status = string_copy(&field->pname, pname, pnamelen);
     if (status != NC_OK) {
-        array_pop(a);
         return CONF_ERROR;
     }
 
@@ -1689,10 +1934,9 @@ conf_add_server(struct conf *cf, struct command *cmd, void *conf)
     }
 
     /*
-     * The address resolution of the backend server hostname is lazy.
-     * The resolution occurs when a new connection to the server is
-     * created, which could either be the first time or every time
-     * the server gets re-added to the pool after an auto ejection
+     * The address resolution of the backend server hostname is done
+     * separately by conf_resolve(), and then refreshed in the background
+     * while the server is in use, see resolver_refresh()
      */
 
     field->valid = 1;
@@ -1700,6 +1944,197 @@ conf_add_server(struct conf *cf, struct command *cmd, void *conf)
     return CONF_OK;
 }
 
+/*
+ * Set the weight of conf server 'cs' along with the weight in its pname
+ */
+rstatus_t
+conf_server_set_weight(struct conf_server *cs, int weight)
+{
+    rstatus_t status;
+    char buf[NC_MAXHOSTNAMELEN + 2 * NC_UINTMAX_MAXLEN];
+    struct string pname;
+    int n;
+
+    ASSERT(weight > 0);
+
+    if (cs->addrstr.data[0] == '/') {
+        n = nc_scnprintf(buf, sizeof(buf), "%.*s:%d", cs->addrstr.len,
+                         cs->addrstr.data, weight);
+    } else {
+        n = nc_scnprintf(buf, sizeof(buf), "%.*s:%d:%d", cs->addrstr.len,
+                         cs->addrstr.data, cs->port, weight);
+    }
+
+    string_init(&pname);
+    status = string_copy(&pname, (uint8_t *)buf, (uint32_t)n);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    string_deinit(&cs->pname);
+    cs->pname = pname;
+    cs->weight = weight;
+
+    return NC_OK;
+}
+
+/*
+ * Deep copy conf servers 'src' into the uninitialized array 'dst', leaving
+ * room for one more server
+ */
+rstatus_t
+conf_server_copy(struct array *dst, struct array *src)
+{
+    rstatus_t status;
+    uint32_t i, nserver;
+
+    nserver = array_n(src);
+
+    status = array_init(dst, nserver + 1, sizeof(struct conf_server));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < nserver; i++) {
+        struct conf_server *cs1 = array_get(src, i);
+        struct conf_server *cs2 = array_push(dst);
+
+        conf_server_init(cs2);
+
+        if (string_duplicate(&cs2->pname, &cs1->pname) != NC_OK ||
+            string_duplicate(&cs2->name, &cs1->name) != NC_OK ||
+            string_duplicate(&cs2->addrstr, &cs1->addrstr) != NC_OK) {
+            conf_server_destroy(dst);
+            return NC_ENOMEM;
+        }
+
+        cs2->port = cs1->port;
+        cs2->weight = cs1->weight;
+        nc_memcpy(&cs2->info, &cs1->info, sizeof(cs2->info));
+        cs2->resolved_at = cs1->resolved_at;
+        cs2->valid = cs1->valid;
+    }
+
+    return NC_OK;
+}
+
+void
+conf_server_sort(struct array *server)
+{
+    array_sort(server, conf_server_name_cmp);
+}
+
+/*
+ * Resolve the server hostnames of all pools in 'cf'. This can block, so it
+ * is only done before serving or off the event loop; servers that fail to
+ * resolve are resolved again in the background on connect
+ */
+void
+conf_resolve(struct conf *cf)
+{
+    rstatus_t status;
+    uint32_t i, j, npool, nserver;
+
+    for (i = 0, npool = array_n(&cf->pool); i < npool; i++) {
+        struct conf_pool *cp = array_get(&cf->pool, i);
+
+        for (j = 0, nserver = array_n(&cp->server); j < nserver; j++) {
+            struct conf_server *cs = array_get(&cp->server, j);
+
+            status = nc_resolve(&cs->addrstr, cs->port, &cs->info);
+            if (status != NC_OK) {
+                log_warn("resolve of server '%.*s' in pool '%.*s' failed, "
+                         "retrying on connect", cs->pname.len, cs->pname.data,
+                         cp->name.len, cp->name.data);
+                continue;
+            }
+
+            cs->resolved_at = nc_usec_now();
+        }
+    }
+}
+
+void
+conf_server_destroy(struct array *server)
+{
+    while (array_n(server) != 0) {
+        conf_server_deinit(array_pop(server));
+    }
+    array_deinit(server);
+}
+
+char *
+conf_add_server(struct conf *cf, struct command *cmd, void *conf)
+{
+    struct array *a;
+    struct conf_server *field;
+    uint8_t *p;
+
+    p = conf;
+    a = (struct array *)(p + cmd->offset);
+
+    field = array_push(a);
+    if (field == NULL) {
+        return CONF_ERROR;
+    }
+
+    conf_server_init(field);
+
+    return conf_server_parse(field, array_top(&cf->arg));
+}
+
+char *
+conf_add_limit(struct conf *cf, struct command *cmd, void *conf)
+{
+    struct array *a;
+    struct limit_rule *field;
+    uint8_t *p;
+
+    p = conf;
+    a = (struct array *)(p + cmd->offset);
+
+    field = array_push(a);
+    if (field == NULL) {
+        return CONF_ERROR;
+    }
+
+    if (limit_rule_parse(field, array_top(&cf->arg)) != NC_OK) {
+        array_pop(a);
+        return "has an invalid \"network/prefix rate [weight]\" value";
+    }
+
+    return CONF_OK;
+}
+
+char *
+conf_add_command(struct conf *cf, struct command *cmd, void *conf)
+{
+    rstatus_t status;
+    struct array *a;
+    struct string *field, *value;
+    uint8_t *p;
+
+    p = conf;
+    a = (struct array *)(p + cmd->offset);
+
+    field = array_push(a);
+    if (field == NULL) {
+        return CONF_ERROR;
+    }
+
+    string_init(field);
+
+    value = array_top(&cf->arg);
+
+    status = string_duplicate(field, value);
+    if (status != NC_OK) {
+        array_pop(a);
+        return CONF_ERROR;
+    }
+
+    return CONF_OK;
+}
+
 char *
 conf_set_num(struct conf *cf, struct command *cmd, void *conf)
 {
@@ -35,6 +35,8 @@
 #define CONF_DEFAULT_ARGS       3
 #define CONF_DEFAULT_POOL       8
 #define CONF_DEFAULT_SERVERS    8
+#define CONF_DEFAULT_LIMITS     4
+#define CONF_DEFAULT_COMMANDS   8
 
 #define CONF_UNSET_NUM  -1
 #define CONF_UNSET_PTR  NULL
@@ -53,6 +55,18 @@
 #define CONF_DEFAULT_SERVER_RETRY_TIMEOUT    30 * 1000      /* in msec */
 #define CONF_DEFAULT_SERVER_FAILURE_LIMIT    2
 #define CONF_DEFAULT_SERVER_CONNECTIONS      1
+#define CONF_DEFAULT_SERVER_WINDOW           0
+#define CONF_DEFAULT_BULK_CONNECTIONS        0
+#define CONF_DEFAULT_HOTKEY_SAMPLE           HOTKEY_SAMPLE
+#define CONF_DEFAULT_HOTKEY_TOPK             HOTKEY_TOPK
+#define CONF_DEFAULT_SLOWLOG_SLOWER_THAN     0
+#define CONF_DEFAULT_SLOWLOG_MAX_LEN         SLOWLOG_MAX_LEN
+#define CONF_DEFAULT_SPLICE_THRESHOLD        0
+#define CONF_DEFAULT_CLIENT_PARK_TIMEOUT     0              /* in msec */
+#define CONF_DEFAULT_CLIENT_IDLE_TIMEOUT     0              /* in msec */
+#define CONF_DEFAULT_CLIENT_RATE             0              /* in req/s */
+#define CONF_DEFAULT_POOL_RATE               0              /* in req/s */
+#define CONF_DEFAULT_FAIR_QUEUE              false
 #define CONF_DEFAULT_KETAMA_PORT             11211
 #define CONF_DEFAULT_TCPKEEPALIVE            false
 
@@ -77,6 +91,7 @@ struct conf_server { //
     int             port;       /* port */
     int             weight;     /* weight */
     struct sockinfo info;       /* connect socket info */
+    int64_t         resolved_at; /* time info was resolved in usec, 0 if never */
     unsigned        valid:1;    /* valid? */
 };
 
@@ -130,11 +145,25 @@ struct conf_pool { //
     int                auto_eject_hosts;      /* auto_eject_hosts: */
     //ÿserverԱ򿪵Ĭϣÿһӡ
     int                server_connections;    /* server_connections: */
+    int                server_window;         /* server_window: */
+    int                bulk_connections;      /* bulk_connections: */
+    struct array       bulk_command;          /* bulk_commands: string[] */
     //λǺ룬Ʒӵʱauto_eject_hostΪtrueʱáĬ30000 롣
     //ʱ䣨룩һʱժĹϽڵļжϽڵԶӵһHash
     int                server_retry_timeout;  /* server_retry_timeout: in msec */
     //ӷĴauto_eject_hostΪtrueʱáĬ2  ڵ޷ӦٴδһHashʱժĬ2
-    int                server_failure_limit;  /* server_failure_limit: */ 
+    int                server_failure_limit;  /* server_failure_limit: */
+    int                hotkey_sample;         /* hotkey_sample: */
+    int                hotkey_topk;           /* hotkey_topk: */
+    int                slowlog_slower_than;   /* slowlog_slower_than: in usec */
+    int                slowlog_max_len;       /* slowlog_max_len: */
+    int                splice_threshold;      /* splice_threshold: in bytes */
+    int                client_park_timeout;   /* client_park_timeout: in msec */
+    int                client_idle_timeout;   /* client_idle_timeout: in msec */
+    int                client_rate;           /* client_rate: in req/s */
+    int                pool_rate;             /* pool_rate: in req/s */
+    int                fair_queue;            /* fair_queue: */
+    struct array       client_limit;          /* client_limits: limit_rule[] */
     /*
     һpoolеķĵַ˿ںȨصбһѡķ֣ṩ֣ʹserver
     Ĵ򣬴ӶṩӦһhashhash ring򣬽ʹserverĴ
@@ -205,12 +234,23 @@ struct command {
 char *conf_set_string(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_listen(struct conf *cf, struct command *cmd, void *conf);
 char *conf_add_server(struct conf *cf, struct command *cmd, void *conf);
+char *conf_add_limit(struct conf *cf, struct command *cmd, void *conf);
+char *conf_add_command(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_num(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_bool(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_hash(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_distribution(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_hashtag(struct conf *cf, struct command *cmd, void *conf);
 
+void conf_server_init(struct conf_server *cs);
+void conf_server_deinit(struct conf_server *cs);
+char *conf_server_parse(struct conf_server *cs, struct string *value);
+rstatus_t conf_server_set_weight(struct conf_server *cs, int weight);
+rstatus_t conf_server_copy(struct array *dst, struct array *src);
+void conf_server_sort(struct array *server);
+void conf_server_destroy(struct array *server);
+void conf_resolve(struct conf *cf);
+
 rstatus_t conf_server_each_transform(void *elem, void *data);
 rstatus_t conf_pool_each_transform(void *elem, void *data);
 
@@ -21,6 +21,7 @@
 #include <nc_server.h>
 #include <nc_client.h>
 #include <nc_proxy.h>
+#include <nc_admin.h>
 #include <proto/nc_proto.h>
 
 /*
@@ -97,6 +98,10 @@ conn_to_ctx(struct conn *conn)
 {
     struct server_pool *pool;
 
+    if (conn->admin) {
+        return admin_ctx(conn);
+    }
+
     if (conn->proxy || conn->client) {
         pool = conn->owner;
     } else {
@@ -134,6 +139,9 @@ _conn_get(void)
     TAILQ_INIT(&conn->imsg_q);
     TAILQ_INIT(&conn->omsg_q);
     conn->rmsg = NULL;
+    conn->splice = NULL;
+    STAILQ_INIT(&conn->rbuf_q);
+    conn->rwin = 1;
     conn->smsg = NULL;
 
     /*
@@ -142,9 +150,26 @@ _conn_get(void)
      * {enqueue_outq, dequeue_outq} are initialized by the wrapper.
      */
 
+    conn->last_active = 0;
     conn->send_bytes = 0;
     conn->recv_bytes = 0;
 
+    conn->window = 0;
+    conn->nout = 0;
+    conn->nsend = 0;
+    conn->nack = 0;
+    conn->nrtt = 0;
+    conn->rtt_min = 0;
+    conn->rtt_epoch_min = 0;
+    conn->rtt_ack_min = 0;
+
+    conn->limit = NULL;
+    conn->bucket.tokens = 0;
+    conn->bucket.last = 0;
+    conn->vfinish = 0;
+    conn->nrouted = 0;
+    TAILQ_INIT(&conn->nmsg_q);
+
     conn->events = 0;
     conn->err = 0;
     conn->recv_active = 0;
@@ -160,6 +185,16 @@ _conn_get(void)
     conn->done = 0;
     conn->redis = 0;
     conn->authenticated = 0;
+    conn->resp3 = 0;
+    conn->resp3_next = 0;
+    conn->hello_err = 0;
+    conn->window_ss = 0;
+    conn->recv_paused = 0;
+    conn->recv_throttled = 0;
+    conn->parked = 0;
+    conn->admin = 0;
+    conn->bulk = 0;
+    conn->routed_bulk = 0;
 
     ntotal_conn++;
     ncurr_conn++;
@@ -294,6 +329,59 @@ conn_get_proxy(void *owner) //owner
     return conn;
 }
 
+/*
+ * Get a connection of the admin command port, either its listening
+ * connection or a client session on it
+ */
+struct conn *
+conn_get_admin(void *owner, bool client)
+{
+    struct conn *conn;
+
+    conn = _conn_get();
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    conn->admin = 1;
+
+    if (client) {
+        conn->client = 1;
+        conn->active = admin_active;
+        conn->send = admin_send;
+        ncurr_cconn++;
+    } else {
+        conn->proxy = 1;
+        conn->active = NULL;
+        conn->send = NULL;
+    }
+
+    conn->recv = admin_recv;
+    conn->recv_next = NULL;
+    conn->recv_done = NULL;
+
+    conn->send_next = NULL;
+    conn->send_done = NULL;
+
+    conn->close = admin_close;
+
+    conn->ref = admin_ref;
+    conn->unref = admin_unref;
+
+    conn->enqueue_inq = NULL;
+    conn->dequeue_inq = NULL;
+    conn->enqueue_outq = NULL;
+    conn->dequeue_outq = NULL;
+    conn->post_connect = NULL;
+    conn->swallow_msg = NULL;
+
+    conn->ref(conn, owner);
+
+    log_debug(LOG_VVERB, "get conn %p admin client %d", conn, conn->client);
+
+    return conn;
+}
+
 static void
 conn_free(struct conn *conn)
 {
@@ -304,11 +392,20 @@ conn_free(struct conn *conn)
 void
 conn_put(struct conn *conn)
 {
+    struct mbuf *mbuf;
+
     ASSERT(conn->sd < 0);
     ASSERT(conn->owner == NULL);
 
     log_debug(LOG_VVERB, "put conn %p", conn);
 
+    /* discard data read ahead that was never parsed */
+    while (!STAILQ_EMPTY(&conn->rbuf_q)) {
+        mbuf = STAILQ_FIRST(&conn->rbuf_q);
+        mbuf_remove(&conn->rbuf_q, mbuf);
+        mbuf_put(mbuf);
+    }
+
     nfree_connq++;
     TAILQ_INSERT_HEAD(&free_connq, conn, conn_tqe);
 
@@ -390,6 +487,57 @@ conn_recv(struct conn *conn, void *buf, size_t size)
     return NC_ERROR;
 }
 
+ssize_t
+conn_recvv(struct conn *conn, struct array *recvv, size_t size)
+{
+    ssize_t n;
+
+    ASSERT(array_n(recvv) > 0);
+    ASSERT(size > 0);
+    ASSERT(conn->recv_ready);
+
+    for (;;) {
+        n = nc_readv(conn->sd, recvv->elem, recvv->nelem);
+
+        log_debug(LOG_VERB, "recvv on sd %d %zd of %zu in %"PRIu32" buffers",
+                  conn->sd, n, size, recvv->nelem);
+
+        if (n > 0) {
+            if (n < (ssize_t) size) {
+                conn->recv_ready = 0;
+            }
+            conn->recv_bytes += (size_t)n;
+            return n;
+        }
+
+        if (n == 0) {
+            conn->recv_ready = 0;
+            conn->eof = 1;
+            log_debug(LOG_INFO, "recvv on sd %d eof rb %zu sb %zu", conn->sd,
+                      conn->recv_bytes, conn->send_bytes);
+            return n;
+        }
+
+        if (errno == EINTR) {
+            log_debug(LOG_VERB, "recvv on sd %d not ready - eintr", conn->sd);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            conn->recv_ready = 0;
+            log_debug(LOG_VERB, "recvv on sd %d not ready - eagain", conn->sd);
+            return NC_EAGAIN;
+        } else {
+            conn->recv_ready = 0;
+            conn->err = errno;
+            log_error("recvv on sd %d failed: %s", conn->sd, strerror(errno));
+            return NC_ERROR;
+        }
+    }
+
+    NOT_REACHED();
+
+    return NC_ERROR;
+}
+
 //ݷconn_sendv
 ssize_t
 conn_sendv(struct conn *conn, struct array *sendv, size_t nsend)
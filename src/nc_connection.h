@@ -80,6 +80,9 @@ struct conn { //
     //ɹݴ浽smsgУҪʵreq_send_next
     //req_send_nextrsp_send_nextиֵ
     struct msg          *smsg;           /* current message being sent */
+    struct splice       *splice;         /* value being spliced to a client (server) */
+    struct mhdr         rbuf_q;          /* mbufs read ahead of the parser */
+    uint32_t            rwin;            /* # mbufs in read window */
 
     //msg_recv proxy_recv
     conn_recv_t         recv;            /* recv (read) handler */
@@ -136,9 +139,29 @@ struct conn { //
     //rsp_send_doneӿͻconn->dequeue_outqг  rsp_forwardӷs_conn->dequeue_outqг
     conn_msgq_t         dequeue_outq;    /* connection outq msg dequeue handler */
 
+    int64_t             last_active;     /* time of last io in msec (client) */
     size_t              recv_bytes;      /* received (read) bytes */
     size_t              send_bytes;      /* sent (written) bytes */
 
+    /*
+     * Adaptive in-flight window of a server connection, see
+     * server_window_update(). Requests beyond the window are held in imsg_q
+     */
+    uint32_t            window;          /* # in-flight requests allowed */
+    uint32_t            nout;            /* # requests in outq */
+    uint32_t            nsend;           /* # requests in inq being sent */
+    uint32_t            nack;            /* # replies since last window change */
+    uint32_t            nrtt;            /* # latency samples in rtt epoch */
+    int64_t             rtt_min;         /* base reply latency in usec */
+    int64_t             rtt_epoch_min;   /* min reply latency in rtt epoch in usec */
+    int64_t             rtt_ack_min;     /* min reply latency since last window change */
+
+    struct limit_rule   *limit;          /* client_limits rule of a client, NULL if none */
+    struct limit_bucket bucket;          /* client_rate bucket of a client */
+    uint64_t            vfinish;         /* virtual finish time of last request (client) */
+    uint32_t            nrouted;         /* # requests in flight in the group of routed_bulk (client) */
+    struct msg_tqh      nmsg_q;          /* noreply requests counted in nrouted (client) */
+
     uint32_t            events;          /* connection io events */
     //ǺӦʱֵΪETIMEDOUTcore_timeout  
     //err1core_coreлر
@@ -174,6 +197,16 @@ struct conn { //
     unsigned            redis:1;         /* redis? */
     //ǷѾɹ
     unsigned            authenticated:1; /* authenticated? */
+    unsigned            resp3:1;         /* speaking RESP3 after HELLO 3? (redis) */
+    unsigned            resp3_next:1;    /* RESP3 once the HELLOs sent succeed? (redis) */
+    unsigned            hello_err:1;     /* server failed HELLO? (redis) */
+    unsigned            window_ss:1;     /* in-flight window in slow start? */
+    unsigned            recv_paused:1;   /* reads paused over memory limit? */
+    unsigned            recv_throttled:1; /* reads throttled over a rate limit? */
+    unsigned            parked:1;        /* idle, with read buffers released? */
+    unsigned            admin:1;         /* admin command connection? */
+    unsigned            bulk:1;          /* server connection of the bulk group? */
+    unsigned            routed_bulk:1;   /* requests in flight routed to the bulk group? (client) */
 };
 
 TAILQ_HEAD(conn_tqh, conn);
@@ -181,8 +214,10 @@ TAILQ_HEAD(conn_tqh, conn);
 struct context *conn_to_ctx(struct conn *conn);
 struct conn *conn_get(void *owner, bool client, bool redis);
 struct conn *conn_get_proxy(void *owner);
+struct conn *conn_get_admin(void *owner, bool client);
 void conn_put(struct conn *conn);
 ssize_t conn_recv(struct conn *conn, void *buf, size_t size);
+ssize_t conn_recvv(struct conn *conn, struct array *recvv, size_t size);
 ssize_t conn_sendv(struct conn *conn, struct array *sendv, size_t nsend);
 void conn_init(void);
 void conn_deinit(void);
@@ -21,6 +21,16 @@
 #include <nc_conf.h>
 #include <nc_server.h>
 #include <nc_proxy.h>
+#include <nc_client.h>
+#include <nc_signal.h>
+#include <nc_upgrade.h>
+#include <nc_reload.h>
+#include <nc_admin.h>
+#include <nc_resolver.h>
+
+#define CORE_PAUSED_NCONN       16  /* initial # client conns with paused reads */
+#define CORE_THROTTLED_NCONN    16  /* initial # client conns with throttled reads */
+
 //ÿһcore_ctx_createֵ+1
 static uint32_t ctx_id; /* context generation */
 
@@ -59,6 +69,7 @@ core_ctx_create(struct instance *nci)
     ctx->id = ++ctx_id;
     ctx->cf = NULL;
     ctx->stats = NULL;
+    ctx->admin = NULL;
     ctx->evb = NULL;
     array_null(&ctx->pool);
     ctx->max_timeout = nci->stats_interval;
@@ -67,18 +78,44 @@ core_ctx_create(struct instance *nci)
     ctx->max_ncconn = 0;
     ctx->max_nsconn = 0;
 
+    /* soft limit is at 80% of the hard limit */
+    ctx->mem_hard = nci->mem_limit;
+    ctx->mem_soft = nci->mem_limit - nci->mem_limit / 5;
+    ctx->draining = 0;
+
+    status = array_init(&ctx->paused, CORE_PAUSED_NCONN, sizeof(struct conn *));
+    if (status != NC_OK) {
+        nc_free(ctx);
+        return NULL;
+    }
+
+    status = array_init(&ctx->throttled, CORE_THROTTLED_NCONN,
+                        sizeof(struct conn *));
+    if (status != NC_OK) {
+        array_deinit(&ctx->paused);
+        nc_free(ctx);
+        return NULL;
+    }
+
     /* parse and create configuration */ 
     //洢Ŀռ䣬ͬʱϢ
     ctx->cf = conf_create(nci->conf_filename); //ļĽҲڸú
     if (ctx->cf == NULL) {
+        array_deinit(&ctx->throttled);
+        array_deinit(&ctx->paused);
         nc_free(ctx);
         return NULL;
     }
 
+    /* resolve server names before serving, as this can block */
+    conf_resolve(ctx->cf);
+
     /* initialize server pool from configuration */
     status = server_pool_init(&ctx->pool, &ctx->cf->pool, ctx);
     if (status != NC_OK) {
         conf_destroy(ctx->cf);
+        array_deinit(&ctx->throttled);
+        array_deinit(&ctx->paused);
         nc_free(ctx);
         return NULL;
     }
@@ -91,16 +128,20 @@ core_ctx_create(struct instance *nci)
     if (status != NC_OK) {
         server_pool_deinit(&ctx->pool);
         conf_destroy(ctx->cf);
+        array_deinit(&ctx->throttled);
+        array_deinit(&ctx->paused);
         nc_free(ctx);
         return NULL;
     }
 
     /* create stats per server pool */ //stats״̬Ϣʼ
     ctx->stats = stats_create(nci->stats_port, nci->stats_addr, nci->stats_interval,
-                              nci->hostname, &ctx->pool);
+                              nci->hostname, nci->mem_limit, &ctx->pool);
     if (ctx->stats == NULL) {
         server_pool_deinit(&ctx->pool);
         conf_destroy(ctx->cf);
+        array_deinit(&ctx->throttled);
+        array_deinit(&ctx->paused);
         nc_free(ctx);
         return NULL;
     }
@@ -112,6 +153,8 @@ core_ctx_create(struct instance *nci)
         stats_destroy(ctx->stats);
         server_pool_deinit(&ctx->pool);
         conf_destroy(ctx->cf);
+        array_deinit(&ctx->throttled);
+        array_deinit(&ctx->paused);
         nc_free(ctx);
         return NULL;
     }
@@ -125,6 +168,8 @@ core_ctx_create(struct instance *nci)
         stats_destroy(ctx->stats);
         server_pool_deinit(&ctx->pool);
         conf_destroy(ctx->cf);
+        array_deinit(&ctx->throttled);
+        array_deinit(&ctx->paused);
         nc_free(ctx);
         return NULL;
     }
@@ -137,6 +182,39 @@ core_ctx_create(struct instance *nci)
         stats_destroy(ctx->stats);
         server_pool_deinit(&ctx->pool);
         conf_destroy(ctx->cf);
+        array_deinit(&ctx->throttled);
+        array_deinit(&ctx->paused);
+        nc_free(ctx);
+        return NULL;
+    }
+
+    /* initialize admin command port, if enabled */
+    status = admin_init(ctx, nci->admin_port);
+    if (status != NC_OK) {
+        proxy_deinit(ctx);
+        server_pool_disconnect(ctx);
+        event_base_destroy(ctx->evb);
+        stats_destroy(ctx->stats);
+        server_pool_deinit(&ctx->pool);
+        conf_destroy(ctx->cf);
+        array_deinit(&ctx->throttled);
+        array_deinit(&ctx->paused);
+        nc_free(ctx);
+        return NULL;
+    }
+
+    /* ack listeners handed off by the process we upgrade, if any */
+    status = upgrade_done();
+    if (status != NC_OK) {
+        admin_deinit(ctx);
+        proxy_deinit(ctx);
+        server_pool_disconnect(ctx);
+        event_base_destroy(ctx->evb);
+        stats_destroy(ctx->stats);
+        server_pool_deinit(&ctx->pool);
+        conf_destroy(ctx->cf);
+        array_deinit(&ctx->throttled);
+        array_deinit(&ctx->paused);
         nc_free(ctx);
         return NULL;
     }
@@ -150,12 +228,21 @@ static void
 core_ctx_destroy(struct context *ctx)
 {
     log_debug(LOG_VVERB, "destroy ctx %p id %"PRIu32"", ctx, ctx->id);
+    admin_deinit(ctx);
     proxy_deinit(ctx);
     server_pool_disconnect(ctx);
     event_base_destroy(ctx->evb);
     stats_destroy(ctx->stats);
     server_pool_deinit(&ctx->pool);
     conf_destroy(ctx->cf);
+    while (array_n(&ctx->paused) != 0) {
+        array_pop(&ctx->paused);
+    }
+    array_deinit(&ctx->paused);
+    while (array_n(&ctx->throttled) != 0) {
+        array_pop(&ctx->throttled);
+    }
+    array_deinit(&ctx->throttled);
     nc_free(ctx);
 }
 
@@ -166,6 +253,7 @@ core_start(struct instance *nci)
 
     mbuf_init(nci);
     msg_init();
+    splice_init();
     conn_init();
 
     ctx = core_ctx_create(nci);
@@ -176,6 +264,7 @@ core_start(struct instance *nci)
 
     //쳣msg conn mbufͷſռ
     conn_deinit();
+    splice_deinit();
     msg_deinit();
     mbuf_deinit();
 
@@ -186,6 +275,7 @@ void
 core_stop(struct context *ctx)
 {
     conn_deinit();
+    splice_deinit();
     msg_deinit();
     mbuf_deinit();
     core_ctx_destroy(ctx);
@@ -363,12 +453,184 @@ core_core(void *arg, uint32_t events)
         }
     }
 
+    /* clients are only kept in order of activity for the idle timeouts */
+    if (conn->client && !conn->admin) {
+        struct server_pool *pool = conn->owner;
+
+        if (pool->client_park_timeout || pool->client_idle_timeout) {
+            client_touch(ctx, conn);
+        }
+    }
+
+    /* once upgraded, client connections are closed as they go idle */
+    if (ctx->draining && conn->client && !conn->active(conn)) {
+        core_close(ctx, conn);
+        return NC_ERROR;
+    }
+
     return NC_OK;
 }
 
+/*
+ * Close the client connections of all pools that are idle, once the upgrade
+ * has handed the listeners off. The others are closed by core_core as they
+ * go idle
+ */
+void
+core_drain(struct context *ctx)
+{
+    uint32_t i, npool;
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+        struct conn *conn, *nconn;
+
+        TAILQ_FOREACH_SAFE(conn, &pool->c_conn_q, conn_tqe, nconn) {
+            if (client_idle(conn)) {
+                core_close(ctx, conn);
+            }
+        }
+
+        TAILQ_FOREACH_SAFE(conn, &pool->c_park_q, conn_tqe, nconn) {
+            if (client_idle(conn)) {
+                core_close(ctx, conn);
+            }
+        }
+    }
+}
+
+/*
+ * Return the # bytes of buffered data, that is the mbufs and msgs in use
+ */
+size_t
+core_mem_used(void)
+{
+    return mbuf_memory() + msg_memory();
+}
+
+bool
+core_mem_exhausted(struct context *ctx)
+{
+    return ctx->mem_hard != 0 && core_mem_used() >= ctx->mem_hard;
+}
+
+/*
+ * Resume reads on paused client connections once the memory in use drops
+ * below the soft limit. A paused client with a partially read request and
+ * no outstanding ones is resumed as soon as the memory used elsewhere
+ * does, as its own request can only complete (or be rejected) by reading
+ * the rest of it; a paused client with nothing left is resumed regardless
+ */
+static void
+core_resume(struct context *ctx)
+{
+    uint32_t i;
+    size_t used, partial;
+    bool pressure;
+
+    if (array_n(&ctx->paused) == 0) {
+        return;
+    }
+
+    used = core_mem_used();
+    pressure = used >= ctx->mem_soft;
+    partial = pressure ? client_paused_partial(ctx) : 0;
+
+    for (i = array_n(&ctx->paused); i-- > 0;) {
+        struct conn *conn = *(struct conn **)array_get(&ctx->paused, i);
+
+        if (pressure && !TAILQ_EMPTY(&conn->omsg_q)) {
+            continue;
+        }
+
+        if (pressure && client_partial(conn) &&
+            used >= partial + ctx->mem_soft) {
+            continue;
+        }
+
+        client_unpause(ctx, conn);
+
+        /* data that arrived while paused raises no new edge-triggered event */
+        core_core(conn, EVENT_READ);
+    }
+}
+
+static void
+core_idle_wait(struct context *ctx, int64_t delta)
+{
+    if (ctx->timeout < 0 || ctx->timeout > delta) {
+        ctx->timeout = (int)delta;
+    }
+}
+
+/*
+ * Park the client connections of each pool that have been idle for
+ * client_park_timeout and close those idle for client_idle_timeout. A
+ * client waiting for replies is not idle. The least recently active
+ * clients are at the head of the queues, so only the clients that are
+ * due are visited
+ */
+static void
+core_idle(struct context *ctx)
+{
+    uint32_t i, npool;
+    int64_t now, delta, tmo;
+
+    now = nc_msec_now();
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+        int64_t park = pool->client_park_timeout;
+        int64_t idle = pool->client_idle_timeout;
+        struct conn *conn;
+
+        if (park <= 0 && idle <= 0) {
+            continue;
+        }
+        tmo = (park <= 0 || (idle > 0 && idle < park)) ? idle : park;
+
+        while ((conn = TAILQ_FIRST(&pool->c_conn_q)) != NULL) {
+            delta = now - conn->last_active;
+            if (delta < tmo) {
+                core_idle_wait(ctx, tmo - delta);
+                break;
+            }
+
+            if (!TAILQ_EMPTY(&conn->omsg_q) || conn->recv_paused) {
+                client_touch(ctx, conn);
+                continue;
+            }
+
+            if (idle > 0 && delta >= idle) {
+                log_debug(LOG_INFO, "close c %d idle for %"PRId64" msec",
+                          conn->sd, delta);
+                stats_pool_incr(ctx, pool, client_idle_closed);
+                core_close(ctx, conn);
+                continue;
+            }
+
+            client_park(ctx, conn);
+        }
+
+        while (idle > 0 && (conn = TAILQ_FIRST(&pool->c_park_q)) != NULL) {
+            delta = now - conn->last_active;
+            if (delta < idle) {
+                core_idle_wait(ctx, idle - delta);
+                break;
+            }
+
+            log_debug(LOG_INFO, "close parked c %d idle for %"PRId64" msec",
+                      conn->sd, delta);
+            stats_pool_incr(ctx, pool, client_idle_closed);
+            core_close(ctx, conn);
+        }
+    }
+}
+
 rstatus_t
 core_loop(struct context *ctx)
 {
+    rstatus_t status;
     int nsd;
 
     nsd = event_wait(ctx->evb, ctx->timeout);
@@ -376,8 +638,33 @@ core_loop(struct context *ctx)
         return nsd;
     }
 
+    if (signal_exiting() != 0) {
+        return NC_ERROR;
+    }
+
     core_timeout(ctx);
 
+    core_resume(ctx);
+
+    limit_loop(ctx);
+
+    core_idle(ctx);
+
+    proxy_loop(ctx);
+
+    status = upgrade_loop(ctx);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    reload_loop(ctx);
+
+    resolver_loop(ctx);
+
+    admin_loop(ctx);
+
+    hotkey_loop(ctx);
+
     stats_swap(ctx->stats);
 
     return NC_OK;
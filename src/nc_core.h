@@ -73,6 +73,7 @@ typedef int err_t;     /* error type */
 struct array;
 struct string;
 struct context;
+struct admin;
 struct conn;
 struct conn_tqh;
 struct msg;
@@ -82,6 +83,7 @@ struct server_pool;
 struct mbuf;
 struct mhdr;
 struct conf;
+struct conf_pool;
 struct stats;
 struct instance;
 struct event_base;
@@ -113,9 +115,13 @@ struct event_base;
 #include <nc_log.h>
 #include <nc_util.h>
 #include <event/nc_event.h>
+#include <nc_hotkey.h>
 #include <nc_stats.h>
 #include <nc_mbuf.h>
 #include <nc_message.h>
+#include <nc_splice.h>
+#include <nc_slowlog.h>
+#include <nc_limit.h>
 #include <nc_connection.h>
 #include <nc_server.h>
 
@@ -126,6 +132,7 @@ struct context { //
     //ļеϢ ctx->cf = conf_create(nci->conf_filename);  Ϣ
     struct conf        *cf;         /* configuration */
     struct stats       *stats;      /* stats */
+    struct admin       *admin;      /* admin */
 /*
     alpha:
   listen: 127.0.0.1:22121
@@ -168,6 +175,12 @@ beta:
     uint32_t           max_ncconn;  /* max # client connections */
     //ֵserver_pool_each_calc_connections   ͺ˷ܵ
     uint32_t           max_nsconn;  /* max # server connections */
+
+    size_t             mem_soft;    /* soft memory limit in bytes */
+    size_t             mem_hard;    /* hard memory limit in bytes */
+    struct array       paused;      /* client conn[] with paused reads */
+    struct array       throttled;   /* client conn[] with reads throttled over a rate limit */
+    unsigned           draining:1;  /* listeners handed off on upgrade? */
 };
 
 //صĽṹ·instance->context->conf->conf_pool(conf_server)->server_pool(server)
@@ -209,6 +222,12 @@ struct instance { //ȫ
     */ 
 //עһmsgmsgǲͷŵģöУԸֵڸ߲²̫࣬ʵĵڴΪµڴ棬ʹӶϿڴҲͷ
     size_t          mbuf_chunk_size;             /* mbuf chunk size */ //mbufС  ĬֵMBUF_SIZE
+    size_t          mem_limit;                   /* memory limit for buffered data in bytes */
+    size_t          mbuf_arena_size;             /* mbuf arena slab size in bytes */
+    uint16_t        admin_port;                  /* admin command port */
+    char            *capture_filename;           /* request capture filename */
+    int             capture_sample;              /* capture 1 in these many requests */
+    char            **argv;                      /* command line arguments */
     pid_t           pid;                         /* process id */ //̺
     char            *pid_filename;               /* pid filename */ //-pָ
     //ʶǷ񴴽pidļ
@@ -219,5 +238,8 @@ struct context *core_start(struct instance *nci);
 void core_stop(struct context *ctx);
 rstatus_t core_core(void *arg, uint32_t events);
 rstatus_t core_loop(struct context *ctx);
+size_t core_mem_used(void);
+bool core_mem_exhausted(struct context *ctx);
+void core_drain(struct context *ctx);
 
 #endif
@@ -0,0 +1,287 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_hotkey.h>
+#include <nc_hashkit.h>
+
+/*
+ * Hot key detection samples about one in every hotkey_sample: requests
+ * forwarded by a pool and feeds their keys to a sketch of the pool:
+ *
+ * - a count-min sketch of HOTKEY_DEPTH rows of HOTKEY_WIDTH counters,
+ *   updated conservatively, estimates the frequency of any key, and
+ * - a space-saving table of HOTKEY_SLOTS_PER_K slots per reported key
+ *   tracks the heavy hitters. A key that is not in the table replaces the
+ *   least frequent one only once its estimate beats it, so a stream of
+ *   one-off keys does not churn the table.
+ *
+ * All counts are halved every HOTKEY_DECAY_INTERVAL msec, so the table
+ * follows the keys that are hot now. A sampled request costs a hash and a
+ * scan of the table; the others a decrement. Counts are reported scaled
+ * by the sample rate, as estimated requests.
+ */
+
+static uint32_t
+hotkey_countdown(struct hotkey *hk)
+{
+    /* jitter the interval so periodic traffic does not alias the sample */
+    if (hk->sample <= 1) {
+        return 1;
+    }
+
+    return 1 + (uint32_t)random() % (2 * hk->sample - 1);
+}
+
+struct hotkey *
+hotkey_create(uint32_t sample, uint32_t topk)
+{
+    struct hotkey *hk;
+
+    ASSERT(sample > 0);
+    ASSERT(topk > 0 && topk <= HOTKEY_MAX_TOPK);
+
+    hk = nc_zalloc(sizeof(*hk));
+    if (hk == NULL) {
+        return NULL;
+    }
+
+    hk->sample = sample;
+    hk->topk = topk;
+    hk->nslot = topk * HOTKEY_SLOTS_PER_K;
+    hk->nused = 0;
+    hk->countdown = hotkey_countdown(hk);
+    hk->next_decay = nc_msec_now() + HOTKEY_DECAY_INTERVAL;
+
+    hk->slot = nc_zalloc(sizeof(*hk->slot) * hk->nslot);
+    hk->cms = nc_zalloc(sizeof(*hk->cms) * HOTKEY_DEPTH * HOTKEY_WIDTH);
+    if (hk->slot == NULL || hk->cms == NULL) {
+        hotkey_destroy(hk);
+        return NULL;
+    }
+
+    return hk;
+}
+
+void
+hotkey_destroy(struct hotkey *hk)
+{
+    if (hk == NULL) {
+        return;
+    }
+
+    nc_free(hk->slot);
+    nc_free(hk->cms);
+    nc_free(hk);
+}
+
+/*
+ * Count one more occurrence of the key with 'hash' and return its new
+ * estimate. Only the counters at the minimum are incremented, which keeps
+ * the overestimate of a count-min sketch down
+ */
+static uint32_t
+hotkey_cms_incr(struct hotkey *hk, uint32_t hash)
+{
+    uint32_t idx[HOTKEY_DEPTH];
+    uint32_t i, h2, min;
+
+    /* derive the row hashes from one hash by double hashing */
+    h2 = ((hash >> 16) | (hash << 16)) * 0x9e3779b1U | 1;
+
+    min = UINT32_MAX;
+    for (i = 0; i < HOTKEY_DEPTH; i++) {
+        idx[i] = i * HOTKEY_WIDTH + ((hash + i * h2) & (HOTKEY_WIDTH - 1));
+        min = MIN(min, hk->cms[idx[i]]);
+    }
+
+    if (min == UINT32_MAX) {
+        return min;
+    }
+
+    for (i = 0; i < HOTKEY_DEPTH; i++) {
+        if (hk->cms[idx[i]] == min) {
+            hk->cms[idx[i]]++;
+        }
+    }
+
+    return min + 1;
+}
+
+static void
+hotkey_add(struct hotkey *hk, uint8_t *key, uint32_t keylen, uint32_t server)
+{
+    struct hotkey_entry *he, *victim;
+    uint32_t i, hash, len, estimate;
+
+    len = MIN(keylen, HOTKEY_KEY_LEN);
+    hash = hash_murmur((char *)key, keylen);
+
+    estimate = hotkey_cms_incr(hk, hash);
+
+    victim = NULL;
+    for (i = 0; i < hk->nused; i++) {
+        he = &hk->slot[i];
+
+        if (he->hash == hash && he->keylen == keylen &&
+            memcmp(he->key, key, len) == 0) {
+            he->count++;
+            he->server = server;
+            return;
+        }
+
+        if (victim == NULL || he->count < victim->count) {
+            victim = he;
+        }
+    }
+
+    if (hk->nused < hk->nslot) {
+        he = &hk->slot[hk->nused++];
+        he->count = estimate;
+        he->error = estimate - 1;
+    } else if (estimate > victim->count) {
+        he = victim;
+        he->error = he->count;
+        he->count = estimate;
+    } else {
+        return;
+    }
+
+    he->hash = hash;
+    he->keylen = keylen;
+    he->server = server;
+    nc_memcpy(he->key, key, len);
+}
+
+/*
+ * Count the keys of a sampled request msg forwarded to server. Fragments
+ * of a multi-key request carry the keys that went to the same server
+ */
+void
+_hotkey_sample(struct hotkey *hk, struct msg *msg, struct server *server)
+{
+    uint32_t i, nkey;
+
+    hk->countdown = hotkey_countdown(hk);
+
+    for (i = 0, nkey = array_n(&msg->keys); i < nkey; i++) {
+        struct keypos *kpos = array_get(&msg->keys, i);
+
+        if (kpos->end <= kpos->start) {
+            continue;
+        }
+
+        hotkey_add(hk, kpos->start, (uint32_t)(kpos->end - kpos->start),
+                   server->idx);
+    }
+}
+
+static int
+hotkey_cmp(const void *t1, const void *t2)
+{
+    const struct hotkey_entry *he1 = t1, *he2 = t2;
+
+    if (he1->count != he2->count) {
+        return he1->count > he2->count ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Copy up to n of the hottest keys, hottest first and with counts in
+ * requests, to top. Returns the # keys copied
+ */
+uint32_t
+hotkey_top(struct hotkey *hk, struct hotkey_entry *top, uint32_t n)
+{
+    uint32_t i;
+
+    if (hk == NULL || hk->nused == 0) {
+        return 0;
+    }
+
+    qsort(hk->slot, hk->nused, sizeof(*hk->slot), hotkey_cmp);
+
+    n = MIN(n, MIN(hk->topk, hk->nused));
+    for (i = 0; i < n; i++) {
+        top[i] = hk->slot[i];
+        top[i].count *= hk->sample;
+        top[i].error *= hk->sample;
+    }
+
+    return n;
+}
+
+/*
+ * Write the key of he to buf as a printable string; as a json string
+ * body if json is set. Returns the length of the string
+ */
+size_t
+hotkey_key_string(struct hotkey_entry *he, char *buf, size_t size, bool json)
+{
+    return nc_key_string(buf, size, he->key, MIN(he->keylen, HOTKEY_KEY_LEN),
+                         he->keylen, json);
+}
+
+/*
+ * Decay the sketches of all pools and hand the hot keys to stats
+ */
+void
+hotkey_loop(struct context *ctx)
+{
+    static int64_t next_publish;
+    uint32_t i, j, k, npool;
+    int64_t now;
+
+    now = nc_msec_now();
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+        struct hotkey *hk = pool->hotkey;
+
+        if (hk == NULL || now < hk->next_decay) {
+            continue;
+        }
+        hk->next_decay = now + HOTKEY_DECAY_INTERVAL;
+
+        for (j = 0; j < HOTKEY_DEPTH * HOTKEY_WIDTH; j++) {
+            hk->cms[j] >>= 1;
+        }
+
+        for (j = 0, k = 0; j < hk->nused; j++) {
+            struct hotkey_entry *he = &hk->slot[j];
+
+            he->count >>= 1;
+            he->error >>= 1;
+            if (he->count > 0) {
+                hk->slot[k++] = *he;
+            }
+        }
+        hk->nused = k;
+    }
+
+    if (now < next_publish) {
+        return;
+    }
+    next_publish = now + HOTKEY_PUBLISH_INTERVAL;
+
+    stats_hotkey(ctx->stats, &ctx->pool);
+}
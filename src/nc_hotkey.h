@@ -0,0 +1,71 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_HOTKEY_H_
+#define _NC_HOTKEY_H_
+
+#include <nc_core.h>
+
+#define HOTKEY_SAMPLE           100     /* sample 1 in these many requests */
+#define HOTKEY_TOPK             10      /* # hot keys reported per pool */
+#define HOTKEY_MAX_TOPK         64
+#define HOTKEY_KEY_LEN          64      /* # key bytes kept, longer keys are truncated */
+#define HOTKEY_SLOTS_PER_K      4       /* heavy hitter slots per reported key */
+#define HOTKEY_DEPTH            4       /* # count-min rows */
+#define HOTKEY_WIDTH            1024    /* # counters per count-min row, a power of 2 */
+#define HOTKEY_DECAY_INTERVAL   10000   /* halve all counts every these many msec */
+#define HOTKEY_PUBLISH_INTERVAL 1000    /* copy hot keys to stats every these many msec */
+
+struct hotkey_entry {
+    uint32_t          hash;                 /* hash of the full key */
+    uint32_t          keylen;               /* length of the full key */
+    uint32_t          server;               /* index of the server the key was sent to */
+    uint64_t          count;                /* estimated # requests */
+    uint64_t          error;                /* max overestimate of count */
+    uint8_t           key[HOTKEY_KEY_LEN];  /* key, truncated to HOTKEY_KEY_LEN */
+};
+
+/*
+ * Per pool hot key sketch. A count-min sketch estimates the frequency of
+ * every sampled key and admits a key to a space-saving table of heavy
+ * hitters once its estimate beats the least frequent key in the table
+ */
+struct hotkey {
+    uint32_t            countdown;          /* # requests until the next sample */
+    uint32_t            sample;             /* sample 1 in 'sample' requests */
+    uint32_t            topk;               /* # hot keys reported */
+    uint32_t            nslot;              /* # heavy hitter slots */
+    uint32_t            nused;              /* # heavy hitter slots in use */
+    struct hotkey_entry *slot;              /* heavy hitters, count in samples */
+    uint32_t            *cms;               /* count-min counters, row by row */
+    int64_t             next_decay;         /* next decay time in msec */
+};
+
+#define hotkey_sample(_hk, _msg, _server) do {                          \
+    if ((_hk) != NULL && --(_hk)->countdown == 0) {                     \
+        _hotkey_sample(_hk, _msg, _server);                             \
+    }                                                                   \
+} while (0)
+
+struct hotkey *hotkey_create(uint32_t sample, uint32_t topk);
+void hotkey_destroy(struct hotkey *hk);
+void _hotkey_sample(struct hotkey *hk, struct msg *msg, struct server *server);
+uint32_t hotkey_top(struct hotkey *hk, struct hotkey_entry *top, uint32_t n);
+size_t hotkey_key_string(struct hotkey_entry *he, char *buf, size_t size, bool json);
+void hotkey_loop(struct context *ctx);
+
+#endif
@@ -0,0 +1,470 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_client.h>
+#include <nc_limit.h>
+
+/*
+ * Rate limits and fair queuing.
+ *
+ * A pool can limit the requests its clients send with client_rate (per
+ * client connection), pool_rate (all its clients together) and the rules
+ * in client_limits (all clients from a network together). Each limit is a
+ * token bucket, charged in req_recv_done for every request received. A
+ * request is never rejected, as it was already read: a client that drives
+ * one of its buckets into debt is throttled instead, i.e. the proxy stops
+ * reading from it until all its buckets have refilled (see limit_loop).
+ * Its requests then wait in its socket and, once that fills, in the client
+ * itself.
+ *
+ * With fair_queue, the requests of the clients of a pool queue on each
+ * server connection in start-time fair queuing order rather than in the
+ * order they arrived in. Every request is tagged with a virtual start time
+ * of max(pool clock, finish time of the previous request of its client)
+ * and finishes LIMIT_FQ_COST / weight later; the pool clock advances to
+ * the start time of every request written to a server. A client sending
+ * a burst thus runs ahead of the clock and its requests queue behind those
+ * of clients that send a few requests now and then. The requests of one
+ * client keep their order, as their start times only grow. Requests carry
+ * the low 32 bits of their start time, which are compared modulo 2^32: the
+ * requests queued on a server connection at any time start well within
+ * 2^31 of each other (2 million requests at weight 1).
+ */
+
+static void
+limit_refill(struct limit_bucket *b, uint32_t rate, int64_t now)
+{
+    int64_t burst = (int64_t)rate * LIMIT_UNIT;
+
+    if (b->last == 0) {
+        b->tokens = burst;
+    } else if (now > b->last) {
+        if (now - b->last > (burst - b->tokens) / rate) {
+            b->tokens = burst;
+        } else {
+            b->tokens += (now - b->last) * rate;
+        }
+    }
+    b->last = now;
+}
+
+/*
+ * Take a request from bucket 'b' of limit 'rate', returning true if that
+ * left the bucket in debt
+ */
+static bool
+limit_take(struct limit_bucket *b, uint32_t rate, int64_t now)
+{
+    if (rate == 0) {
+        return false;
+    }
+
+    limit_refill(b, rate, now);
+    b->tokens -= LIMIT_UNIT;
+
+    return b->tokens < 0;
+}
+
+/*
+ * Return the usec until bucket 'b' of limit 'rate' is out of debt
+ */
+static int64_t
+limit_wait(struct limit_bucket *b, uint32_t rate, int64_t now)
+{
+    if (rate == 0) {
+        return 0;
+    }
+
+    limit_refill(b, rate, now);
+    if (b->tokens >= 0) {
+        return 0;
+    }
+
+    return (-b->tokens + rate - 1) / rate;
+}
+
+rstatus_t
+limit_rule_parse(struct limit_rule *rule, struct string *value)
+{
+    char buf[INET6_ADDRSTRLEN + 32];
+    char *net, *prefix, *rate, *weight;
+    uint32_t maxprefix, i;
+    int n;
+
+    if (value->len >= sizeof(buf)) {
+        return NC_ERROR;
+    }
+    nc_memcpy(buf, value->data, value->len);
+    buf[value->len] = '\0';
+
+    net = strtok(buf, " \t");
+    rate = strtok(NULL, " \t");
+    weight = strtok(NULL, " \t");
+    if (net == NULL || rate == NULL || strtok(NULL, " \t") != NULL) {
+        return NC_ERROR;
+    }
+
+    prefix = strchr(net, '/');
+    if (prefix != NULL) {
+        *prefix++ = '\0';
+    }
+
+    memset(rule, 0, sizeof(*rule));
+
+    if (inet_pton(AF_INET, net, rule->addr) == 1) {
+        rule->family = AF_INET;
+        maxprefix = 32;
+    } else if (inet_pton(AF_INET6, net, rule->addr) == 1) {
+        rule->family = AF_INET6;
+        maxprefix = 128;
+    } else {
+        return NC_ERROR;
+    }
+
+    rule->prefix = maxprefix;
+    if (prefix != NULL) {
+        n = nc_atoi(prefix, strlen(prefix));
+        if (n < 0 || (uint32_t)n > maxprefix) {
+            return NC_ERROR;
+        }
+        rule->prefix = (uint32_t)n;
+    }
+
+    /* clear the host bits, so that matching only compares whole bytes */
+    for (i = rule->prefix; i < maxprefix; i++) {
+        rule->addr[i / 8] &= (uint8_t)~(0x80 >> (i % 8));
+    }
+
+    n = nc_atoi(rate, strlen(rate));
+    if (n < 0) {
+        return NC_ERROR;
+    }
+    rule->rate = (uint32_t)n;
+
+    rule->weight = 1;
+    if (weight != NULL) {
+        n = nc_atoi(weight, strlen(weight));
+        if (n <= 0 || n > LIMIT_MAX_WEIGHT) {
+            return NC_ERROR;
+        }
+        rule->weight = (uint32_t)n;
+    }
+
+    return NC_OK;
+}
+
+static bool
+limit_rule_match(struct limit_rule *rule, int family, const uint8_t *addr)
+{
+    uint32_t nbyte, nbit;
+
+    if (rule->family != family) {
+        return false;
+    }
+
+    nbyte = rule->prefix / 8;
+    nbit = rule->prefix % 8;
+
+    if (memcmp(rule->addr, addr, nbyte) != 0) {
+        return false;
+    }
+
+    return nbit == 0 ||
+           (addr[nbyte] & (uint8_t)(0xff << (8 - nbit))) == rule->addr[nbyte];
+}
+
+/*
+ * Bind client connection 'conn' to the first rule in client_limits of its
+ * pool that matches the address of its peer, if any
+ */
+void
+limit_bind(struct conn *conn)
+{
+    struct server_pool *pool = conn->owner;
+    struct sockaddr_storage ss;
+    socklen_t addrlen = sizeof(ss);
+    const uint8_t *addr;
+    int family;
+    uint32_t i, nrule;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    conn->limit = NULL;
+
+    nrule = array_n(&pool->client_limit);
+    if (nrule == 0) {
+        return;
+    }
+
+    if (getpeername(conn->sd, (struct sockaddr *)&ss, &addrlen) < 0) {
+        return;
+    }
+
+    if (ss.ss_family == AF_INET) {
+        family = AF_INET;
+        addr = (const uint8_t *)&((struct sockaddr_in *)&ss)->sin_addr;
+    } else if (ss.ss_family == AF_INET6) {
+        struct in6_addr *a6 = &((struct sockaddr_in6 *)&ss)->sin6_addr;
+
+        if (IN6_IS_ADDR_V4MAPPED(a6)) {
+            family = AF_INET;
+            addr = &a6->s6_addr[12];
+        } else {
+            family = AF_INET6;
+            addr = a6->s6_addr;
+        }
+    } else {
+        return;
+    }
+
+    for (i = 0; i < nrule; i++) {
+        struct limit_rule *rule = array_get(&pool->client_limit, i);
+
+        if (limit_rule_match(rule, family, addr)) {
+            conn->limit = rule;
+            log_debug(LOG_VERB, "c %d bound to client limit %"PRIu32"",
+                      conn->sd, i);
+            return;
+        }
+    }
+}
+
+/*
+ * Bind the client connections of 'pool' to its rules again, after a reload
+ * replaced them
+ */
+void
+limit_rebind(struct server_pool *pool)
+{
+    struct conn *conn;
+
+    TAILQ_FOREACH(conn, &pool->c_conn_q, conn_tqe) {
+        limit_bind(conn);
+    }
+
+    TAILQ_FOREACH(conn, &pool->c_park_q, conn_tqe) {
+        limit_bind(conn);
+    }
+}
+
+/*
+ * Charge a request received on client connection 'conn' to the limits it
+ * is under, throttling the client if one of them is exceeded
+ */
+void
+limit_charge(struct context *ctx, struct conn *conn)
+{
+    struct server_pool *pool = conn->owner;
+    struct limit_rule *rule = conn->limit;
+    struct conn **pconn;
+    int64_t now;
+    bool debt;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    if (pool->client_rate == 0 && pool->pool_rate == 0 &&
+        (rule == NULL || rule->rate == 0)) {
+        return;
+    }
+
+    now = nc_usec_now();
+
+    debt = limit_take(&conn->bucket, pool->client_rate, now);
+    if (rule != NULL && limit_take(&rule->bucket, rule->rate, now)) {
+        debt = true;
+    }
+    if (limit_take(&pool->bucket, pool->pool_rate, now)) {
+        debt = true;
+    }
+
+    if (!debt || conn->recv_throttled) {
+        return;
+    }
+
+    pconn = array_push(&ctx->throttled);
+    if (pconn == NULL) {
+        return;
+    }
+    *pconn = conn;
+    conn->recv_throttled = 1;
+
+    stats_pool_incr(ctx, pool, client_throttled);
+
+    log_debug(LOG_INFO, "throttle c %d", conn->sd);
+}
+
+/*
+ * Throttled clients are kept in the order they were throttled in, so that
+ * clients sharing a bucket take turns as it refills
+ */
+void
+limit_unthrottle(struct context *ctx, struct conn *conn)
+{
+    uint32_t i, n;
+
+    ASSERT(conn->client && !conn->proxy);
+    ASSERT(conn->recv_throttled);
+
+    n = array_n(&ctx->throttled);
+    for (i = 0; i < n; i++) {
+        if (*(struct conn **)array_get(&ctx->throttled, i) == conn) {
+            break;
+        }
+    }
+    ASSERT(i < n);
+
+    for (; i + 1 < n; i++) {
+        *(struct conn **)array_get(&ctx->throttled, i) =
+            *(struct conn **)array_get(&ctx->throttled, i + 1);
+    }
+    if (n != 0) {
+        array_pop(&ctx->throttled);
+    }
+    conn->recv_throttled = 0;
+
+    log_debug(LOG_INFO, "unthrottle c %d", conn->sd);
+}
+
+/*
+ * Resume reads on throttled client connections whose buckets are out of
+ * debt, and wake up the event loop in time for the others
+ */
+void
+limit_loop(struct context *ctx)
+{
+    uint32_t i, n;
+    int64_t now, wait;
+    int timeout;
+
+    if (array_n(&ctx->throttled) == 0) {
+        return;
+    }
+
+    now = nc_usec_now();
+
+    /* clients throttled again on resume go to the back and wait a turn */
+    for (i = 0, n = array_n(&ctx->throttled);
+         i < n && i < array_n(&ctx->throttled);) {
+        struct conn *conn = *(struct conn **)array_get(&ctx->throttled, i);
+        struct server_pool *pool = conn->owner;
+        struct limit_rule *rule = conn->limit;
+
+        wait = limit_wait(&conn->bucket, pool->client_rate, now);
+        if (rule != NULL) {
+            wait = MAX(wait, limit_wait(&rule->bucket, rule->rate, now));
+        }
+        wait = MAX(wait, limit_wait(&pool->bucket, pool->pool_rate, now));
+
+        if (wait > 0) {
+            timeout = (int)MIN((wait + 999) / 1000, INT_MAX);
+            if (ctx->timeout < 0 || ctx->timeout > timeout) {
+                ctx->timeout = timeout;
+            }
+            i++;
+            continue;
+        }
+
+        limit_unthrottle(ctx, conn);
+        n--;
+
+        /* data that arrived while throttled raises no new edge-triggered event */
+        core_core(conn, EVENT_READ);
+    }
+}
+
+/*
+ * Tag request 'msg' of client connection 'c_conn' with its virtual start
+ * time, if its pool queues fairly
+ */
+void
+limit_fq_tag(struct conn *c_conn, struct msg *msg)
+{
+    struct server_pool *pool = c_conn->owner;
+    uint64_t start;
+    uint32_t weight;
+
+    ASSERT(c_conn->client && !c_conn->proxy);
+
+    if (!pool->fair_queue) {
+        return;
+    }
+
+    weight = c_conn->limit != NULL ? c_conn->limit->weight : 1;
+
+    start = MAX(pool->vtime, c_conn->vfinish);
+    c_conn->vfinish = start + LIMIT_FQ_COST / weight;
+
+    msg->vstart = (uint32_t)start;
+    msg->fq = 1;
+}
+
+/*
+ * Enqueue tagged request 'msg' into the inq of server connection 's_conn'
+ * after the requests that start no later than it. Untagged requests (such
+ * as AUTH or HELLO the proxy sends on its own), requests already on their
+ * way out and the head of the queue, which may be partially sent, are
+ * never passed. At most LIMIT_FQ_SCAN requests are, which bounds the cost
+ * of an enqueue while keeping the order of the requests of every client
+ */
+void
+limit_fq_enqueue(struct conn *s_conn, struct msg *msg)
+{
+    struct msg *prev;
+    uint32_t nscan;
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+    ASSERT(msg->fq);
+
+    for (prev = TAILQ_LAST(&s_conn->imsg_q, msg_tqh), nscan = 0;
+         prev != NULL && nscan < LIMIT_FQ_SCAN;
+         prev = TAILQ_PREV(prev, msg_tqh, s_tqe), nscan++) {
+        if (!prev->fq || (int32_t)(prev->vstart - msg->vstart) <= 0 ||
+            prev->send_ts != 0 || prev == TAILQ_FIRST(&s_conn->imsg_q)) {
+            break;
+        }
+    }
+
+    if (prev == NULL) {
+        TAILQ_INSERT_TAIL(&s_conn->imsg_q, msg, s_tqe);
+    } else {
+        TAILQ_INSERT_AFTER(&s_conn->imsg_q, prev, msg, s_tqe);
+    }
+}
+
+/*
+ * Advance the virtual clock of the pool of server connection 's_conn' to
+ * the start time of tagged request 'msg' written to it
+ */
+void
+limit_fq_dequeue(struct conn *s_conn, struct msg *msg)
+{
+    struct server *server = s_conn->owner;
+    struct server_pool *pool = server->owner;
+    int32_t ahead;
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+    ASSERT(msg->fq);
+
+    ahead = (int32_t)(msg->vstart - (uint32_t)pool->vtime);
+    if (ahead > 0) {
+        pool->vtime += (uint64_t)ahead;
+    }
+}
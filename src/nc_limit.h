@@ -0,0 +1,64 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_LIMIT_H_
+#define _NC_LIMIT_H_
+
+#include <nc_core.h>
+
+#define LIMIT_UNIT          1000000LL   /* tokens per request, 1 per usec at 1 req/s */
+#define LIMIT_MAX_WEIGHT    1000        /* max fair queuing weight */
+#define LIMIT_FQ_COST       LIMIT_MAX_WEIGHT /* virtual time of a request at weight 1 */
+#define LIMIT_FQ_SCAN       128         /* max # requests passed on enqueue */
+
+/*
+ * Token bucket of a request rate limit. A request takes LIMIT_UNIT tokens
+ * and a limit of rate req/s adds rate tokens every usec, up to a burst of
+ * one second of requests. Requests are taken even when the bucket runs
+ * short, as they were already read, leaving it in debt until it refills
+ */
+struct limit_bucket {
+    int64_t  tokens;    /* tokens left, negative in debt */
+    int64_t  last;      /* time of last refill in usec, 0 if never */
+};
+
+/*
+ * Limit on the clients of a pool from a network, from "client_limits:"
+ * as "network/prefix rate [weight]". The clients from the network share
+ * a bucket of rate req/s (0 if unlimited) and queue on the servers with
+ * the given fair queuing weight
+ */
+struct limit_rule {
+    int                 family;     /* AF_INET or AF_INET6 */
+    uint8_t             addr[16];   /* network address */
+    uint32_t            prefix;     /* network prefix length in bits */
+    uint32_t            rate;       /* shared rate in req/s, 0 if unlimited */
+    uint32_t            weight;     /* fair queuing weight */
+    struct limit_bucket bucket;     /* shared bucket */
+};
+
+rstatus_t limit_rule_parse(struct limit_rule *rule, struct string *value);
+void limit_bind(struct conn *conn);
+void limit_rebind(struct server_pool *pool);
+void limit_charge(struct context *ctx, struct conn *conn);
+void limit_unthrottle(struct context *ctx, struct conn *conn);
+void limit_loop(struct context *ctx);
+void limit_fq_tag(struct conn *c_conn, struct msg *msg);
+void limit_fq_enqueue(struct conn *s_conn, struct msg *msg);
+void limit_fq_dequeue(struct conn *s_conn, struct msg *msg);
+
+#endif
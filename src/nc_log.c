@@ -21,11 +21,54 @@
 #include <time.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include <nc_core.h>
 
+/*
+ * Once log_start is called, messages are not written on the thread that
+ * logs them. Each thread formats its message into a record of its own
+ * single producer, single consumer ring and returns; a writer thread
+ * drains all rings every LOG_FLUSH_INTERVAL msec, adds the timestamp and
+ * call site, and writes the lines out in batches. A thread never blocks
+ * on the log file or on another thread. When a ring is full, its new
+ * messages are dropped and counted, and the count is logged by the
+ * writer thread.
+ *
+ * Before log_start and after log_deinit, and for threads beyond
+ * LOG_MAX_RING, messages are written synchronously as before. Messages
+ * from signal handlers (log_safe) are always written synchronously.
+ */
+
+struct log_record {
+    int64_t           usec;             /* timestamp in usec */
+    const char        *file;            /* call site file or NULL for raw data */
+    int               line;             /* call site line */
+    int               len;              /* length of msg */
+    char              msg[LOG_MAX_LEN]; /* message */
+};
+
+struct log_ring {
+    uint32_t          head;             /* next record to write out */
+    uint32_t          tail;             /* next record to fill */
+    uint32_t          ndrop;            /* # records dropped on a full ring */
+    uint32_t          nreport;          /* # dropped records reported */
+    int               owned;            /* owned by a live thread? */
+    struct log_record rec[LOG_RING_NREC];
+};
+
 static struct logger logger;
 
+static pthread_t log_tid;                   /* writer thread */
+static int log_stop;                        /* writer thread to exit? */
+static pthread_key_t log_key;               /* ring of calling thread */
+static pthread_mutex_t log_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_write_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_ring *log_rings[LOG_MAX_RING];
+static uint32_t log_nring;                  /* # rings in log_rings */
+static char log_wbuf[LOG_WBUF_SIZE];        /* writer thread output buffer */
+
 int
 log_init(int level, char *name)
 {
@@ -52,6 +95,13 @@ log_deinit(void)
 {
     struct logger *l = &logger;
 
+    if (l->async) {
+        /* new messages are written synchronously, the rest by the writer */
+        __atomic_store_n(&l->async, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&log_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(log_tid, NULL);
+    }
+
     if (l->fd < 0 || l->fd == STDERR_FILENO) {
         return;
     }
@@ -59,8 +109,8 @@ log_deinit(void)
     close(l->fd);
 }
 
-void
-log_reopen(void)
+static void
+log_reopen_file(void)
 {
     struct logger *l = &logger;
 
@@ -74,6 +124,20 @@ log_reopen(void)
     }
 }
 
+void
+log_reopen(void)
+{
+    struct logger *l = &logger;
+
+    /* the writer thread may be writing to the log file, it reopens it */
+    if (__atomic_load_n(&l->async, __ATOMIC_ACQUIRE) != 0) {
+        __atomic_store_n(&l->reopen, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    log_reopen_file();
+}
+
 void
 log_level_up(void)
 {
@@ -128,6 +192,377 @@ log_loggable(int level)
     return 1;
 }
 
+/*
+ * Rate limit messages of a call site. At most LOG_LIMIT_BURST messages
+ * are logged in a window of LOG_LIMIT_WINDOW msec; beyond that only one
+ * in LOG_LIMIT_SAMPLE is. The number of messages suppressed is logged
+ * along with the next message that gets through.
+ *
+ * A call site may be hit from several threads at once, so the state is
+ * only accessed atomically; the counts around a window reset are allowed
+ * to be off by a few messages.
+ */
+int
+log_limit(struct log_limit *limit, const char *file, int line)
+{
+    struct timeval tv;
+    int64_t now, start;
+    uint32_t nsuppressed;
+
+    gettimeofday(&tv, NULL);
+    now = (int64_t)tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+
+    start = __atomic_load_n(&limit->start, __ATOMIC_RELAXED);
+    if (now - start >= LOG_LIMIT_WINDOW &&
+        __atomic_compare_exchange_n(&limit->start, &start, now, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&limit->nlogged, 0, __ATOMIC_RELAXED);
+    }
+
+    if (__atomic_fetch_add(&limit->nlogged, 1, __ATOMIC_RELAXED) >=
+        LOG_LIMIT_BURST) {
+        if (__atomic_add_fetch(&limit->nsuppressed, 1, __ATOMIC_RELAXED) <
+            LOG_LIMIT_SAMPLE) {
+            return 0;
+        }
+        /* this one is sampled, so it is logged rather than suppressed */
+        __atomic_sub_fetch(&limit->nsuppressed, 1, __ATOMIC_RELAXED);
+    }
+
+    nsuppressed = __atomic_exchange_n(&limit->nsuppressed, 0, __ATOMIC_RELAXED);
+    if (nsuppressed != 0) {
+        _log(file, line, 0, "suppressed %"PRIu32" similar messages",
+             nsuppressed);
+    }
+
+    return 1;
+}
+
+static int
+log_prefix(char *buf, int size, int64_t usec, const char *file, int line)
+{
+    time_t sec;
+    struct tm tm;
+    int len;
+
+    sec = (time_t)(usec / 1000000LL);
+    localtime_r(&sec, &tm);
+
+    len = 0;
+    buf[len++] = '[';
+    len += nc_strftime(buf + len, size - len, "%Y-%m-%d %H:%M:%S.", &tm);
+    len += nc_scnprintf(buf + len, size - len, "%03ld",
+                        (long)(usec % 1000000LL) / 1000);
+    len += nc_scnprintf(buf + len, size - len, "] %s:%d ", file, line);
+
+    return len;
+}
+
+static void
+log_ring_release(void *arg)
+{
+    struct log_ring *ring = arg;
+
+    /* records left are still written out; the ring goes to a new thread */
+    __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Return the ring of the calling thread, or NULL if messages are to be
+ * written synchronously
+ */
+static struct log_ring *
+log_ring_get(void)
+{
+    struct log_ring *ring;
+    uint32_t i;
+
+    if (__atomic_load_n(&logger.async, __ATOMIC_ACQUIRE) == 0) {
+        return NULL;
+    }
+
+    ring = pthread_getspecific(log_key);
+    if (ring != NULL) {
+        return ring;
+    }
+
+    pthread_mutex_lock(&log_ring_lock);
+
+    for (i = 0; i < log_nring; i++) {
+        if (__atomic_load_n(&log_rings[i]->owned, __ATOMIC_ACQUIRE) == 0) {
+            ring = log_rings[i];
+            break;
+        }
+    }
+
+    /* nc_alloc logs, so calloc is used to not recurse into here */
+    if (ring == NULL && log_nring < LOG_MAX_RING) {
+        ring = calloc(1, sizeof(*ring));
+        if (ring != NULL) {
+            log_rings[log_nring] = ring;
+            __atomic_store_n(&log_nring, log_nring + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (ring != NULL) {
+        ring->owned = 1;
+        pthread_setspecific(log_key, ring);
+    }
+
+    pthread_mutex_unlock(&log_ring_lock);
+
+    return ring;
+}
+
+static struct log_record *
+log_ring_reserve(struct log_ring *ring)
+{
+    uint32_t head;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (ring->tail - head >= LOG_RING_NREC) {
+        __atomic_store_n(&ring->ndrop, ring->ndrop + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    return &ring->rec[ring->tail % LOG_RING_NREC];
+}
+
+static void
+log_ring_commit(struct log_ring *ring)
+{
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+static void
+log_ring_raw(struct log_ring *ring, char *data, int datalen)
+{
+    struct log_record *rec;
+    int len;
+
+    while (datalen > 0) {
+        rec = log_ring_reserve(ring);
+        if (rec == NULL) {
+            return;
+        }
+
+        len = MIN(datalen, LOG_MAX_LEN);
+        rec->usec = 0;
+        rec->file = NULL;
+        rec->line = 0;
+        rec->len = len;
+        nc_memcpy(rec->msg, data, len);
+        log_ring_commit(ring);
+
+        data += len;
+        datalen -= len;
+    }
+}
+
+static void
+log_write(char *buf, int len)
+{
+    struct logger *l = &logger;
+    ssize_t n;
+
+    n = nc_write(l->fd, buf, len);
+    if (n < 0) {
+        l->nerror++;
+    }
+}
+
+/*
+ * Write out the records of all rings. Must be called with log_write_lock
+ * held. Returns the # records written.
+ */
+static int
+log_drain(void)
+{
+    struct log_ring *ring;
+    struct log_record *rec;
+    struct timeval tv;
+    uint32_t i, nring, head, tail, ndrop;
+    int len, count;
+
+    len = 0;
+    count = 0;
+
+    nring = __atomic_load_n(&log_nring, __ATOMIC_ACQUIRE);
+    for (i = 0; i < nring; i++) {
+        ring = log_rings[i];
+
+        ndrop = __atomic_load_n(&ring->ndrop, __ATOMIC_RELAXED);
+        if (ndrop != ring->nreport) {
+            gettimeofday(&tv, NULL);
+            len += log_prefix(log_wbuf + len, LOG_MAX_LEN,
+                              (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec,
+                              __FILE__, __LINE__);
+            len += nc_scnprintf(log_wbuf + len, LOG_MAX_LEN,
+                                "dropped %"PRIu32" log messages on a full "
+                                "ring\n", ndrop - ring->nreport);
+            ring->nreport = ndrop;
+        }
+
+        head = ring->head;
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++) {
+            rec = &ring->rec[head % LOG_RING_NREC];
+
+            if (LOG_WBUF_SIZE - len < 3 * LOG_MAX_LEN) {
+                log_write(log_wbuf, len);
+                len = 0;
+            }
+
+            if (rec->file != NULL) {
+                len += log_prefix(log_wbuf + len, LOG_MAX_LEN, rec->usec,
+                                  rec->file, rec->line);
+            }
+            nc_memcpy(log_wbuf + len, rec->msg, rec->len);
+            len += rec->len;
+            if (rec->file != NULL) {
+                log_wbuf[len++] = '\n';
+            }
+
+            count++;
+        }
+
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+        if (LOG_WBUF_SIZE - len < 3 * LOG_MAX_LEN) {
+            log_write(log_wbuf, len);
+            len = 0;
+        }
+    }
+
+    if (len > 0) {
+        log_write(log_wbuf, len);
+    }
+
+    return count;
+}
+
+static void *
+log_writer(void *arg)
+{
+    struct logger *l = &logger;
+    struct timespec ts;
+    int stop, count;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = LOG_FLUSH_INTERVAL * 1000000L;
+
+    for (;;) {
+        stop = __atomic_load_n(&log_stop, __ATOMIC_ACQUIRE);
+
+        pthread_mutex_lock(&log_write_lock);
+
+        if (__atomic_exchange_n(&l->reopen, 0, __ATOMIC_ACQ_REL) != 0) {
+            log_reopen_file();
+        }
+
+        count = log_drain();
+
+        pthread_mutex_unlock(&log_write_lock);
+
+        if (stop) {
+            break;
+        }
+
+        if (count == 0) {
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Start the writer thread. Must be called after daemonizing, as threads
+ * do not survive a fork.
+ */
+int
+log_start(void)
+{
+    struct logger *l = &logger;
+    int status;
+    sigset_t set, oset;
+
+    if (l->fd < 0) {
+        return 0;
+    }
+
+    status = pthread_key_create(&log_key, log_ring_release);
+    if (status != 0) {
+        log_error("create log key failed: %s", strerror(status));
+        return -1;
+    }
+
+    /* signals are handled on the event loop */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &oset);
+
+    status = pthread_create(&log_tid, NULL, log_writer, NULL);
+
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+    if (status != 0) {
+        log_error("create log writer thread failed: %s", strerror(status));
+        return -1;
+    }
+
+    __atomic_store_n(&l->async, 1, __ATOMIC_RELEASE);
+
+    /* queued messages are not lost on exit */
+    atexit(log_flush);
+
+    return 0;
+}
+
+/*
+ * Write out all queued messages before returning, for use before an
+ * abort
+ */
+void
+log_flush(void)
+{
+    if (__atomic_load_n(&logger.async, __ATOMIC_ACQUIRE) == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&log_write_lock);
+    log_drain();
+    pthread_mutex_unlock(&log_write_lock);
+}
+
+/*
+ * Write out all queued messages from a signal handler on the crash path.
+ * The lock is only tried, as the crashing thread may be the one holding
+ * it; if the writer stays busy, it is left to drain on its own.
+ */
+void
+log_flush_safe(void)
+{
+    struct timespec ts;
+    int i;
+
+    if (__atomic_load_n(&logger.async, __ATOMIC_ACQUIRE) == 0) {
+        return;
+    }
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000L;
+
+    for (i = 0; i < 2 * LOG_FLUSH_INTERVAL; i++) {
+        if (pthread_mutex_trylock(&log_write_lock) == 0) {
+            log_drain();
+            pthread_mutex_unlock(&log_write_lock);
+            return;
+        }
+        nanosleep(&ts, NULL);
+    }
+}
+
 void
 _log(const char *file, int line, int panic, const char *fmt, ...)
 {
@@ -137,12 +572,39 @@ _log(const char *file, int line, int panic, const char *fmt, ...)
     va_list args;
     ssize_t n;
     struct timeval tv;
+    struct log_ring *ring;
+    struct log_record *rec;
 
     if (l->fd < 0) {
         return;
     }
 
     errno_save = errno;
+
+    ring = log_ring_get();
+    if (ring != NULL) {
+        rec = log_ring_reserve(ring);
+        if (rec != NULL) {
+            gettimeofday(&tv, NULL);
+            rec->usec = (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+            rec->file = file;
+            rec->line = line;
+
+            va_start(args, fmt);
+            rec->len = nc_vscnprintf(rec->msg, LOG_MAX_LEN, fmt, args);
+            va_end(args);
+
+            log_ring_commit(ring);
+        }
+
+        errno = errno_save;
+
+        if (panic) {
+            log_flush();
+            abort();
+        }
+        return;
+    }
     len = 0;            /* length of output buffer */
     size = LOG_MAX_LEN; /* size of output buffer */
 
@@ -209,6 +671,7 @@ _log_hexdump(const char *file, int line, char *data, int datalen,
     char buf[8 * LOG_MAX_LEN];
     int i, off, len, size, errno_save;
     ssize_t n;
+    struct log_ring *ring;
 
     if (l->fd < 0) {
         return;
@@ -254,6 +717,16 @@ _log_hexdump(const char *file, int line, char *data, int datalen,
         off += 16;
     }
 
+    ring = log_ring_get();
+    if (ring != NULL) {
+        if (len >= size - 1) {
+            buf[len++] = '\n';
+        }
+        log_ring_raw(ring, buf, len);
+        errno = errno_save;
+        return;
+    }
+
     n = nc_write(l->fd, buf, len);
     if (n < 0) {
         l->nerror++;
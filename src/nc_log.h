@@ -24,6 +24,8 @@ struct logger { //
     int  level;  /* log level */  //Ƿ־ĵطlog_loggable  
     int  fd;     /* log file descriptor */ //־ļfd
     int  nerror; /* # log error */ //nc_writeд־
+    int  async;  /* messages written by writer thread? */
+    int  reopen; /* writer thread to reopen log file? */
 };
 
 #define LOG_EMERG   0   /* system in unusable */
@@ -41,12 +43,27 @@ struct logger { //
 
 #define LOG_MAX_LEN 256 /* max length of log message */
 
+#define LOG_RING_NREC       1024    /* # records in a per-thread ring */
+#define LOG_MAX_RING        32      /* max # threads logging asynchronously */
+#define LOG_WBUF_SIZE       65536   /* size of writer thread output buffer */
+#define LOG_FLUSH_INTERVAL  10      /* msec between writer passes when idle */
+
+#define LOG_LIMIT_WINDOW    1000    /* msec of an error rate limit window */
+#define LOG_LIMIT_BURST     16      /* max # messages per call site in a window */
+#define LOG_LIMIT_SAMPLE    1000    /* log 1 in these many messages over the limit */
+
+struct log_limit {
+    int64_t  start;       /* start of current window in msec */
+    uint32_t nlogged;     /* # messages seen in current window */
+    uint32_t nsuppressed; /* # messages suppressed since last logged one */
+};
+
 /*
  * log_stderr   - log to stderr
  * loga         - log always
  * loga_hexdump - log hexdump always
- * log_error    - error log messages
- * log_warn     - warning log messages
+ * log_error    - error log messages, rate limited per call site
+ * log_warn     - warning log messages, rate limited per call site
  * log_panic    - log messages followed by a panic
  * ...
  * log_debug    - debug log messages based on a log level
@@ -98,13 +115,17 @@ struct logger { //
 } while (0)                                                                 \
 
 #define log_error(...) do {                                                 \
-    if (log_loggable(LOG_ALERT) != 0) {                                     \
+    static struct log_limit _limit;                                         \
+    if (log_loggable(LOG_ALERT) != 0 &&                                     \
+        log_limit(&_limit, __FILE__, __LINE__) != 0) {                      \
         _log(__FILE__, __LINE__, 0, __VA_ARGS__);                           \
     }                                                                       \
 } while (0)
 
 #define log_warn(...) do {                                                  \
-    if (log_loggable(LOG_WARN) != 0) {                                      \
+    static struct log_limit _limit;                                         \
+    if (log_loggable(LOG_WARN) != 0 &&                                      \
+        log_limit(&_limit, __FILE__, __LINE__) != 0) {                      \
         _log(__FILE__, __LINE__, 0, __VA_ARGS__);                           \
     }                                                                       \
 } while (0)
@@ -123,6 +144,10 @@ void log_level_set(int level);
 void log_stacktrace(void);
 void log_reopen(void);
 int log_loggable(int level);
+int log_limit(struct log_limit *limit, const char *file, int line);
+int log_start(void);
+void log_flush(void);
+void log_flush_safe(void);
 void _log(const char *file, int line, int panic, const char *fmt, ...);
 void _log_stderr(const char *fmt, ...);
 void _log_safe(const char *fmt, ...);
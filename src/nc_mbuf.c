@@ -17,11 +17,13 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include <nc_core.h>
 
 static uint32_t nfree_mbufq;   /* # free mbuf */
 static struct mhdr free_mbufq; /* free mbuf q */
+static uint32_t nused_mbuf;    /* # mbuf in use */
 
 /*
 *һmbufռdata+struct(mbuf)ɣעstruct(mbuf)mbuf_chunk_sizeĩβ, ο_mbuf_get
@@ -35,6 +37,182 @@ static struct mhdr free_mbufq; /* free mbuf q */
 static size_t mbuf_chunk_size; /* mbuf chunk size - header + data (const) */
 static size_t mbuf_offset;     /* mbuf offset in chunk (const) */ //Ҳmbuf data
 
+#ifndef MAP_ANONYMOUS
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/*
+ * With an arena (-H), mbuf chunks are carved one after the other from
+ * slabs of mbuf_arena_size bytes mapped on huge pages: explicit ones when
+ * the system has them reserved, else transparent ones. Chunks carved from
+ * a slab are never given back, like those allocated from the heap; they
+ * are reused through the free mbuf q. If the arena cannot grow, mbufs are
+ * allocated from the heap, and the arena tries to grow again only after a
+ * backoff that doubles on each failure.
+ */
+struct mbuf_slab {
+    uint8_t *start; /* start of slab */
+    uint8_t *pos;   /* next chunk to carve */
+    uint8_t *end;   /* end of slab */
+};
+
+static size_t mbuf_arena_size;  /* arena slab size, 0 if no arena (const) */
+static struct array mbuf_arena; /* mbuf_slab[] */
+/*
+ * The arena counters are bumped by the worker and read by the stats
+ * thread, hence the relaxed atomics
+ */
+static size_t mbuf_arena_nbyte; /* # bytes mapped by the arena */
+static size_t mbuf_arena_nused; /* # bytes carved from the arena */
+static int64_t mbuf_arena_retry;   /* msec before which the arena does not grow */
+static int64_t mbuf_arena_backoff; /* msec of the last backoff, 0 if none */
+
+static uint8_t *
+mbuf_arena_map(size_t size, bool *hugetlb)
+{
+    uint8_t *p, *start;
+    size_t head;
+
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        *hugetlb = true;
+        return p;
+    }
+#endif
+    *hugetlb = false;
+
+    /* map one huge page more to align the slab on a huge page boundary */
+    p = mmap(NULL, size + MBUF_ARENA_ALIGN, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    start = NC_ALIGN_PTR(p, MBUF_ARENA_ALIGN);
+    head = (size_t)(start - p);
+    if (head != 0) {
+        munmap(p, head);
+    }
+    munmap(start + size, MBUF_ARENA_ALIGN - head);
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(start, size, MADV_HUGEPAGE) < 0) {
+        log_debug(LOG_INFO, "madvise of mbuf arena failed, ignored: %s",
+                  strerror(errno));
+    }
+#endif
+
+    return start;
+}
+
+static struct mbuf_slab *
+mbuf_arena_grow(void)
+{
+    struct mbuf_slab *slab;
+    uint8_t *start;
+    bool hugetlb;
+    size_t nbyte;
+
+    if (mbuf_arena_backoff != 0 && nc_msec_now() < mbuf_arena_retry) {
+        return NULL;
+    }
+
+    if (mbuf_arena.elem == NULL &&
+        array_init(&mbuf_arena, 16, sizeof(struct mbuf_slab)) != NC_OK) {
+        return NULL;
+    }
+
+    start = mbuf_arena_map(mbuf_arena_size, &hugetlb);
+    if (start == NULL) {
+        mbuf_arena_backoff = mbuf_arena_backoff == 0 ? MBUF_ARENA_RETRY_MIN :
+                             MIN(mbuf_arena_backoff * 2, MBUF_ARENA_RETRY_MAX);
+
+        log_error("mmap of %zu bytes for mbuf arena failed, allocating mbufs "
+                  "from the heap for %"PRId64" msec: %s", mbuf_arena_size,
+                  mbuf_arena_backoff, strerror(errno));
+
+        mbuf_arena_retry = nc_msec_now() + mbuf_arena_backoff;
+        return NULL;
+    }
+    mbuf_arena_backoff = 0;
+
+    slab = array_push(&mbuf_arena);
+    if (slab == NULL) {
+        munmap(start, mbuf_arena_size);
+        return NULL;
+    }
+
+    slab->start = start;
+    slab->pos = start;
+    slab->end = start + mbuf_arena_size;
+
+    nbyte = __atomic_add_fetch(&mbuf_arena_nbyte, mbuf_arena_size,
+                               __ATOMIC_RELAXED);
+
+    log_debug(LOG_NOTICE, "mbuf arena grew by %zu bytes at %p on %s huge "
+              "pages to %zu bytes", mbuf_arena_size, start,
+              hugetlb ? "explicit" : "transparent", nbyte);
+
+    return slab;
+}
+
+static uint8_t *
+mbuf_arena_get(void)
+{
+    struct mbuf_slab *slab;
+    uint8_t *buf;
+
+    slab = array_n(&mbuf_arena) == 0 ? NULL : array_top(&mbuf_arena);
+    if (slab == NULL || (size_t)(slab->end - slab->pos) < mbuf_chunk_size) {
+        slab = mbuf_arena_grow();
+        if (slab == NULL) {
+            return NULL;
+        }
+    }
+
+    buf = slab->pos;
+    slab->pos += mbuf_chunk_size;
+    __atomic_add_fetch(&mbuf_arena_nused, mbuf_chunk_size, __ATOMIC_RELAXED);
+
+    return buf;
+}
+
+static bool
+mbuf_arena_owns(uint8_t *buf)
+{
+    uint32_t i, nslab;
+
+    for (i = 0, nslab = array_n(&mbuf_arena); i < nslab; i++) {
+        struct mbuf_slab *slab = array_get(&mbuf_arena, i);
+
+        if (buf >= slab->start && buf < slab->end) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+mbuf_arena_deinit(void)
+{
+    while (array_n(&mbuf_arena) != 0) {
+        struct mbuf_slab *slab = array_pop(&mbuf_arena);
+        munmap(slab->start, (size_t)(slab->end - slab->start));
+    }
+    if (mbuf_arena.elem != NULL) {
+        array_deinit(&mbuf_arena);
+    }
+    array_null(&mbuf_arena);
+
+    mbuf_arena_nbyte = 0;
+    mbuf_arena_nused = 0;
+    mbuf_arena_retry = 0;
+    mbuf_arena_backoff = 0;
+}
+
 static struct mbuf *
 _mbuf_get(void)
 {
@@ -52,9 +230,12 @@ _mbuf_get(void)
         goto done;
     }
 
-    buf = nc_alloc(mbuf_chunk_size);
+    buf = mbuf_arena_size != 0 ? mbuf_arena_get() : NULL;
     if (buf == NULL) {
-        return NULL;
+        buf = nc_alloc(mbuf_chunk_size);
+        if (buf == NULL) {
+            return NULL;
+        }
     }
 
     /*
@@ -115,6 +296,8 @@ mbuf_get(void)
     mbuf->pos = mbuf->start;
     mbuf->last = mbuf->start;
 
+    nused_mbuf++;
+
     log_debug(LOG_VVERB, "get mbuf %p", mbuf);
 
     return mbuf;
@@ -132,7 +315,9 @@ mbuf_free(struct mbuf *mbuf)
     ASSERT(mbuf->magic == MBUF_MAGIC);
 
     buf = (uint8_t *)mbuf - mbuf_offset;
-    nc_free(buf);
+    if (!mbuf_arena_owns(buf)) {
+        nc_free(buf);
+    }
 }
 
 //mbufѸmbufظöУԱ´ӵʱֱʹãעﲻͷſռ
@@ -143,11 +328,40 @@ mbuf_put(struct mbuf *mbuf)
 
     ASSERT(STAILQ_NEXT(mbuf, next) == NULL);
     ASSERT(mbuf->magic == MBUF_MAGIC);
+    ASSERT(nused_mbuf > 0);
 
+    nused_mbuf--;
     nfree_mbufq++;
     STAILQ_INSERT_HEAD(&free_mbufq, mbuf, next);
 }
 
+/*
+ * Return the # bytes held by mbufs in use
+ */
+size_t
+mbuf_memory(void)
+{
+    return (size_t)nused_mbuf * mbuf_chunk_size;
+}
+
+/*
+ * Return the # bytes mapped by the mbuf arena
+ */
+size_t
+mbuf_arena_reserved(void)
+{
+    return __atomic_load_n(&mbuf_arena_nbyte, __ATOMIC_RELAXED);
+}
+
+/*
+ * Return the # bytes of the mbuf arena carved into mbufs
+ */
+size_t
+mbuf_arena_used(void)
+{
+    return __atomic_load_n(&mbuf_arena_nused, __ATOMIC_RELAXED);
+}
+
 /*
  * Rewind the mbuf by discarding any of the read or unread data that it
  * might hold.
@@ -291,6 +505,13 @@ mbuf_init(struct instance *nci)
     mbuf_chunk_size = nci->mbuf_chunk_size;
     mbuf_offset = mbuf_chunk_size - MBUF_HSIZE;
 
+    /* a slab holds at least one chunk and is a multiple of huge pages */
+    mbuf_arena_size = 0;
+    if (nci->mbuf_arena_size != 0) {
+        mbuf_arena_size = NC_ALIGN(MAX(nci->mbuf_arena_size, mbuf_chunk_size),
+                                   MBUF_ARENA_ALIGN);
+    }
+
     log_debug(LOG_DEBUG, "mbuf hsize %d chunk size %zu offset %zu length %zu",
               MBUF_HSIZE, mbuf_chunk_size, mbuf_offset, mbuf_offset); 
 }
@@ -305,4 +526,6 @@ mbuf_deinit(void)
         nfree_mbufq--;
     }
     ASSERT(nfree_mbufq == 0);
+
+    mbuf_arena_deinit();
 }
@@ -40,6 +40,10 @@ STAILQ_HEAD(mhdr, mbuf);
 #define MBUF_SIZE       16384  //16k
 #define MBUF_HSIZE      sizeof(struct mbuf)
 
+#define MBUF_ARENA_ALIGN ((size_t)2 * 1024 * 1024) /* huge page size */
+#define MBUF_ARENA_RETRY_MIN    100     /* min msec before mapping a slab again */
+#define MBUF_ARENA_RETRY_MAX    60000   /* max msec before mapping a slab again */
+
 static inline bool
 mbuf_empty(struct mbuf *mbuf)
 {
@@ -56,6 +60,9 @@ void mbuf_init(struct instance *nci);
 void mbuf_deinit(void);
 struct mbuf *mbuf_get(void);
 void mbuf_put(struct mbuf *mbuf);
+size_t mbuf_memory(void);
+size_t mbuf_arena_reserved(void);
+size_t mbuf_arena_used(void);
 void mbuf_rewind(struct mbuf *mbuf);
 uint32_t mbuf_length(struct mbuf *mbuf);
 uint32_t mbuf_size(struct mbuf *mbuf);
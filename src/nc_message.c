@@ -24,12 +24,6 @@
 #include <nc_server.h>
 #include <proto/nc_proto.h>
 
-#if (IOV_MAX > 128)
-#define NC_IOV_MAX 128
-#else
-#define NC_IOV_MAX IOV_MAX
-#endif
-
 /*
  *            nc_message.[ch]
  *         message (struct msg)
@@ -117,6 +111,7 @@ static uint64_t frag_id;         /* fragment id counter */
 //עmsgֻҪ˿ռͲͷظ
 static uint32_t nfree_msgq;      /* # free msg q */ //ظõmsg
 static struct msg_tqh free_msgq; /* free msg q */ //ظmsgб
+static uint32_t nused_msg;       /* # msg in use */
 //¼ʱʱ
 static struct rbtree tmo_rbt;    /* timeout rbtree */
 static struct rbnode tmo_rbs;    /* timeout rbtree sentinel */
@@ -128,6 +123,32 @@ static struct string msg_type_strings[] = {
 };
 #undef DEFINE_ACTION
 
+static const struct msg_ops redis_ops = {
+    redis_parse_req,
+    redis_parse_rsp,
+    redis_fragment,
+    redis_reply,
+    redis_add_auth,
+    redis_add_hello,
+    redis_failure,
+    redis_skip,
+    redis_pre_coalesce,
+    redis_post_coalesce,
+};
+
+static const struct msg_ops memcache_ops = {
+    memcache_parse_req,
+    memcache_parse_rsp,
+    memcache_fragment,
+    memcache_reply,
+    memcache_add_auth,
+    memcache_add_hello,
+    memcache_failure,
+    memcache_skip,
+    memcache_pre_coalesce,
+    memcache_post_coalesce,
+};
+
 static struct msg *
 msg_from_rbe(struct rbnode *node)
 {
@@ -213,12 +234,14 @@ _msg_get(void) //
         goto done;
     }
 
-    msg = nc_alloc(sizeof(*msg));
+    msg = nc_memalign(NC_CACHELINE_SIZE, sizeof(*msg));
     if (msg == NULL) {
         return NULL;
     }
 
 done:
+    nused_msg++;
+
     /* c_tqe, s_tqe, and m_tqe are left uninitialized */
     msg->id = ++msg_id;
     msg->peer = NULL;
@@ -229,35 +252,30 @@ done:
     STAILQ_INIT(&msg->mhdr);
     msg->mlen = 0;
     msg->start_ts = 0;
+    msg->send_ts = 0;
+    msg->parse_ts = 0;
+    msg->enqueue_ts = 0;
+    msg->write_ts = 0;
+    msg->rsp_ts = 0;
 
     msg->state = 0;
     msg->pos = NULL;
     msg->token = NULL;
 
     msg->parser = NULL;
-    msg->add_auth = NULL;
+    msg->ops = NULL;
     msg->result = MSG_PARSE_OK;
 
-    msg->fragment = NULL;
-    msg->reply = NULL;
-    msg->pre_coalesce = NULL;
-    msg->post_coalesce = NULL;
-
     msg->type = MSG_UNKNOWN;
 
-    msg->keys = array_create(1, sizeof(struct keypos));
-    if (msg->keys == NULL) {
-        nc_free(msg);
-        return NULL;
-    }
+    array_set(&msg->keys, msg->key_inline, sizeof(struct keypos),
+              MSG_NKEY_INLINE);
 
     msg->vlen = 0;
     msg->end = NULL;
 
     msg->frag_owner = NULL;
-    msg->frag_seq = NULL;
-    msg->nfrag = 0;
-    msg->nfrag_done = 0;
+    msg->frag = NULL;
     msg->frag_id = 0;
 
     msg->narg_start = NULL;
@@ -273,11 +291,19 @@ done:
     msg->request = 0;
     msg->quit = 0;
     msg->noreply = 0;
+    msg->quiet = 0;
     msg->noforward = 0;
     msg->done = 0;
     msg->fdone = 0;
     msg->swallow = 0;
     msg->redis = 0;
+    msg->capture = 0;
+    msg->timed = 0;
+    msg->invalue = 0;
+    msg->fq = 0;
+    msg->bulk = 0;
+    msg->routed = 0;
+    msg->vstart = 0;
 
     return msg;
 }
@@ -297,32 +323,11 @@ msg_get(struct conn *conn, bool request, bool redis)
     msg->request = request ? 1 : 0;
     msg->redis = redis ? 1 : 0;
 
-    if (redis) {//redis
-        if (request) {
-            msg->parser = redis_parse_req;
-        } else {
-            msg->parser = redis_parse_rsp;
-        }
-        msg->add_auth = redis_add_auth;
-        msg->fragment = redis_fragment;
-        msg->reply = redis_reply;
-        msg->failure = redis_failure;
-        msg->pre_coalesce = redis_pre_coalesce;
-        msg->post_coalesce = redis_post_coalesce;
-    } else { //memcached
-        if (request) {
-            msg->parser = memcache_parse_req;
-        } else {
-            msg->parser = memcache_parse_rsp;
-        }
-        msg->add_auth = memcache_add_auth;
-        msg->fragment = memcache_fragment;
-        msg->failure = memcache_failure;
-        msg->pre_coalesce = memcache_pre_coalesce;
-        msg->post_coalesce = memcache_post_coalesce;
-    }
+    msg->ops = redis ? &redis_ops : &memcache_ops;
+    msg->parser = request ? msg->ops->parse_req : msg->ops->parse_rsp;
 
-    if (log_loggable(LOG_NOTICE) != 0) {
+    msg->timed = slowlog_timed(conn) ? 1 : 0;
+    if (msg->timed || log_loggable(LOG_NOTICE) != 0) {
         msg->start_ts = nc_usec_now();
     }
 
@@ -342,6 +347,11 @@ msg_get_error(bool redis, err_t err)
     char *errstr = err ? strerror(err) : "unknown";
     char *protstr = redis ? "-ERR" : "SERVER_ERROR";
 
+    if (err == ENOMEM) {
+        errstr = "out of memory";
+        protstr = redis ? "-OOM" : "SERVER_ERROR";
+    }
+
     msg = _msg_get();
     if (msg == NULL) {
         return NULL;
@@ -388,21 +398,32 @@ msg_put(struct msg *msg)
         mbuf_put(mbuf);
     }
 
-    if (msg->frag_seq) {
-        nc_free(msg->frag_seq);
-        msg->frag_seq = NULL;
+    if (msg->frag != NULL) {
+        nc_free(msg->frag);
+        msg->frag = NULL;
     }
 
-    if (msg->keys) {
-        msg->keys->nelem = 0; /* a hack here */
-        array_destroy(msg->keys);
-        msg->keys = NULL;
+    if (msg->keys.elem != msg->key_inline) {
+        nc_free(msg->keys.elem);
     }
+    array_null(&msg->keys);
+
+    ASSERT(nused_msg > 0);
+    nused_msg--;
 
     nfree_msgq++;
     TAILQ_INSERT_HEAD(&free_msgq, msg, m_tqe);
 }
 
+/*
+ * Return the # bytes held by msgs in use
+ */
+size_t
+msg_memory(void)
+{
+    return (size_t)nused_msg * sizeof(struct msg);
+}
+
 void
 msg_dump(struct msg *msg, int level)
 {
@@ -459,6 +480,52 @@ msg_type_string(msg_type_t type)
     return &msg_type_strings[type];
 }
 
+/*
+ * Return the request type named 'name' in a redis or memcache pool, or
+ * MSG_UNKNOWN. The name is either a command (hgetall) or a msg_type
+ * (REQ_REDIS_HGETALL), in any case
+ */
+msg_type_t
+msg_type_lookup(struct string *name, bool redis)
+{
+    char type[64];
+    const char *prefix;
+    size_t plen, len, i;
+    msg_type_t t;
+
+    prefix = redis ? "REQ_REDIS_" : "REQ_MC_";
+    plen = nc_strlen(prefix);
+
+    if (name->len == 0 || plen + name->len >= sizeof(type)) {
+        return MSG_UNKNOWN;
+    }
+
+    for (i = 0; i < name->len; i++) {
+        type[i] = (char)toupper(name->data[i]);
+    }
+    len = name->len;
+
+    if (len < 4 || nc_strncmp(type, "REQ_", 4) != 0) {
+        nc_memmove(type + plen, type, len);
+        nc_memcpy(type, prefix, plen);
+        len += plen;
+    }
+
+    if (len <= plen || nc_strncmp(type, prefix, plen) != 0) {
+        return MSG_UNKNOWN;
+    }
+
+    for (t = MSG_UNKNOWN + 1; t < MSG_SENTINEL; t++) {
+        struct string *s = &msg_type_strings[t];
+
+        if (s->len == len && nc_strncmp(s->data, type, len) == 0) {
+            return t;
+        }
+    }
+
+    return MSG_UNKNOWN;
+}
+
 bool
 msg_empty(struct msg *msg)
 {
@@ -466,12 +533,12 @@ msg_empty(struct msg *msg)
 }
 
 uint32_t
-msg_backend_idx(struct msg *msg, uint8_t *key, uint32_t keylen)
+msg_backend_idx(struct msg *msg, struct keypos *kpos)
 {
     struct conn *conn = msg->owner;
     struct server_pool *pool = conn->owner;
 
-    return server_pool_idx(pool, key, keylen);
+    return server_pool_idx(pool, kpos->hash);
 }
 
 struct mbuf *
@@ -580,6 +647,81 @@ msg_gen_frag_id(void)
     return ++frag_id;
 }
 
+/*
+ * Create the fragment bookkeeping of request r that is split over the
+ * servers of its nkey keys
+ */
+struct msg_frag *
+msg_frag_create(struct msg *r, uint32_t nkey)
+{
+    struct msg_frag *frag;
+
+    ASSERT(r->request && r->frag == NULL);
+
+    frag = nc_zalloc(sizeof(*frag) + nkey * sizeof(frag->seq[0]));
+    if (frag == NULL) {
+        return NULL;
+    }
+
+    r->frag = frag;
+
+    return frag;
+}
+
+/*
+ * Push a keypos to the keys of msg. The first MSG_NKEY_INLINE keys are
+ * stored in the msg itself, so only a request with more keys allocates
+ */
+struct keypos *
+msg_key_push(struct msg *msg)
+{
+    struct array *keys = &msg->keys;
+    struct keypos *kpos;
+
+    if (keys->elem == msg->key_inline && keys->nelem == keys->nalloc) {
+        kpos = nc_alloc(2 * keys->nalloc * sizeof(*kpos));
+        if (kpos == NULL) {
+            return NULL;
+        }
+
+        nc_memcpy(kpos, msg->key_inline, keys->nelem * sizeof(*kpos));
+        keys->elem = kpos;
+        keys->nalloc *= 2;
+    }
+
+    return array_push(keys);
+}
+
+/*
+ * Hash the key at kpos of request r, just parsed, for the distribution of
+ * the pool of its client, so that routing and fragmenting the request do
+ * not hash the key again
+ */
+void
+msg_key_hash(struct msg *r, struct keypos *kpos)
+{
+    struct conn *conn = r->owner;
+
+    ASSERT(r->request && conn->client);
+
+    kpos->hash = server_pool_hash(conn->owner, kpos->start,
+                                  (uint32_t)(kpos->end - kpos->start));
+}
+
+/*
+ * Hash the keys parsed so far of request r again, as the distribution of
+ * the pool of its client changed while r was being parsed
+ */
+void
+msg_key_rehash(struct msg *r)
+{
+    uint32_t i, nkey;
+
+    for (i = 0, nkey = array_n(&r->keys); i < nkey; i++) {
+        msg_key_hash(r, array_get(&r->keys, i));
+    }
+}
+
 static rstatus_t
 msg_parsed(struct context *ctx, struct conn *conn, struct msg *msg)
 {
@@ -686,6 +828,137 @@ msg_parse(struct context *ctx, struct conn *conn, struct msg *msg)
     return conn->err != 0 ? NC_ERROR : status;
 }
 
+/*
+ * Return the # mbufs a connection may read into with one readv
+ */
+static uint32_t
+msg_rwin_max(void)
+{
+    size_t n = NC_RECV_WINDOW / mbuf_data_size();
+
+    return (uint32_t)MAX(1, MIN(n, NC_IOV_MAX));
+}
+
+/*
+ * Fill the last mbuf of msg with the next bytes for the parser, either
+ * from the mbufs read ahead on conn or from the socket. The socket is read
+ * with a single readv into the last mbuf and as many more as the read
+ * window of conn allows; bytes beyond the last mbuf are queued on conn
+ * until the parser gets to them. The window doubles while reads fill it
+ * and falls back to the mbufs a read did fill when it comes up short, so
+ * a connection that bursts reads in bulk and one that idles holds no more
+ * than a single mbuf. Returns the # bytes added to msg, 0 on eof, or
+ * NC_EAGAIN, NC_ENOMEM or NC_ERROR
+ */
+static ssize_t
+msg_read(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    struct mbuf *mbuf, *rbuf, *nbuf;  /* last, read ahead and next mbuf */
+    struct iovec *ciov, iov[NC_IOV_MAX];
+    struct array recvv;
+    size_t size, len, nrecv, nlast;
+    uint32_t rwin, nfill;
+    ssize_t n;
+
+    mbuf = STAILQ_LAST(&msg->mhdr, mbuf, next);
+    rbuf = STAILQ_FIRST(&conn->rbuf_q);
+
+    if (rbuf != NULL) {
+        if (mbuf == NULL || mbuf_full(mbuf)) {
+            /* hand the mbuf read ahead over as it is */
+            mbuf_remove(&conn->rbuf_q, rbuf);
+            mbuf_insert(&msg->mhdr, rbuf);
+            msg->pos = rbuf->pos;
+            len = mbuf_length(rbuf);
+        } else {
+            /* the parser wants these bytes right after those in mbuf */
+            len = MIN(mbuf_size(mbuf), mbuf_length(rbuf));
+            mbuf_copy(mbuf, rbuf->pos, len);
+            rbuf->pos += len;
+            if (mbuf_empty(rbuf)) {
+                mbuf_remove(&conn->rbuf_q, rbuf);
+                mbuf_put(rbuf);
+            }
+        }
+        msg->mlen += (uint32_t)len;
+        return (ssize_t)len;
+    }
+
+    if (mbuf == NULL || mbuf_full(mbuf)) {
+        mbuf = mbuf_get();
+        if (mbuf == NULL) {
+            return NC_ENOMEM;
+        }
+        mbuf_insert(&msg->mhdr, mbuf);
+        msg->pos = mbuf->pos;
+    }
+    ASSERT(mbuf->end - mbuf->last > 0);
+
+    /* read ahead only while there is memory to spare */
+    rwin = conn->rwin;
+    if (rwin > 1 && ctx->mem_soft != 0 && core_mem_used() >= ctx->mem_soft) {
+        rwin = 1;
+    }
+
+    array_set(&recvv, iov, sizeof(iov[0]), NC_IOV_MAX);
+
+    ciov = array_push(&recvv);
+    ciov->iov_base = mbuf->last;
+    ciov->iov_len = mbuf_size(mbuf);
+    size = ciov->iov_len;
+
+    while (array_n(&recvv) < rwin) {
+        rbuf = mbuf_get();
+        if (rbuf == NULL) {
+            break;
+        }
+        mbuf_insert(&conn->rbuf_q, rbuf);
+
+        ciov = array_push(&recvv);
+        ciov->iov_base = rbuf->last;
+        ciov->iov_len = mbuf_size(rbuf);
+        size += ciov->iov_len;
+    }
+
+    n = conn_recvv(conn, &recvv, size);
+
+    /* spread the bytes read over the mbufs, releasing those left empty */
+    nrecv = n > 0 ? (size_t)n : 0;
+
+    nlast = MIN(nrecv, mbuf_size(mbuf));
+    mbuf->last += nlast;
+    nrecv -= nlast;
+    nfill = 1;
+
+    for (rbuf = STAILQ_FIRST(&conn->rbuf_q); rbuf != NULL; rbuf = nbuf) {
+        nbuf = STAILQ_NEXT(rbuf, next);
+
+        if (nrecv == 0) {
+            mbuf_remove(&conn->rbuf_q, rbuf);
+            mbuf_put(rbuf);
+            continue;
+        }
+
+        len = MIN(nrecv, mbuf_size(rbuf));
+        rbuf->last += len;
+        nrecv -= len;
+        nfill++;
+    }
+
+    if (n <= 0) {
+        return n;
+    }
+
+    if ((size_t)n == size) {
+        conn->rwin = MIN(conn->rwin * 2, msg_rwin_max());
+    } else {
+        conn->rwin = nfill;
+    }
+
+    msg->mlen += (uint32_t)nlast;
+    return (ssize_t)nlast;
+}
+
 /*
 *             Client+             Proxy           Server+
 *                              (nutcracker)
@@ -729,36 +1002,16 @@ msg_recv_chain(struct context *ctx, struct conn *conn, struct msg *msg)
 {//տͻ˷͹ģ߽˷Ӧ
     rstatus_t status;
     struct msg *nmsg;
-    struct mbuf *mbuf;
-    size_t msize;
     ssize_t n;
 
-    mbuf = STAILQ_LAST(&msg->mhdr, mbuf, next); //msgе
-    //KVݹָmsgһmbufûУ߸msgmbufѾ
-    if (mbuf == NULL || mbuf_full(mbuf)) {//ȡmsgӦmbufǷпռ䣬û·һmbuf뵽mhdr
-        mbuf = mbuf_get(); //»ȡһmbuf   㺯req_recv_nextֻǻȡһmsgûmbufȡmbuf뵽msg
-        if (mbuf == NULL) {   
-            return NC_ENOMEM;
-        }
-        mbuf_insert(&msg->mhdr, mbuf); //
-        msg->pos = mbuf->pos;
-    }
-    ASSERT(mbuf->end - mbuf->last > 0); 
-
-    msize = mbuf_size(mbuf); //mbufÿռ
-
-    n = conn_recv(conn, mbuf->last, msize); //ȡЭջе
+    n = msg_read(ctx, conn, msg);
     if (n < 0) {
-        if (n == NC_EAGAIN) { //
+        if (n == NC_EAGAIN) {
             return NC_OK;
         }
-        return NC_ERROR;
+        return (rstatus_t)n;
     }
 
-    ASSERT((mbuf->last + n) <= mbuf->end);
-    mbuf->last += n;
-    msg->mlen += (uint32_t)n;
-
     for (;;) {
         //ÿζȡںЭջݺ󶼻øú
         status = msg_parse(ctx, conn, msg);
@@ -778,6 +1031,11 @@ msg_recv_chain(struct context *ctx, struct conn *conn, struct msg *msg)
         msg = nmsg; //ѭ
     }
 
+    /* forward what is complete of a response still being received */
+    if (nmsg == msg && !msg->request) {
+        rsp_stream(ctx, conn, msg);
+    }
+
     return NC_OK;
 }
 
@@ -826,10 +1084,17 @@ msg_recv(struct context *ctx, struct conn *conn)
     rstatus_t status;
     struct msg *msg;
 
-    ASSERT(conn->recv_active);
+    ASSERT(conn->recv_active || conn->splice != NULL);
 
     conn->recv_ready = 1;
     do {
+        if (conn->splice != NULL) {
+            status = splice_recv(ctx, conn);
+            if (status != NC_OK || conn->splice != NULL) {
+                return status;
+            }
+        }
+
         //յͻִreq_recv_next   պ˷صִrsp_recv_next
         msg = conn->recv_next(ctx, conn, true);  //ȡһmsg
         if (msg == NULL) {
@@ -840,7 +1105,7 @@ msg_recv(struct context *ctx, struct conn *conn)
         if (status != NC_OK) {
             return status;
         }
-    } while (conn->recv_ready); //Эջݶȡconn_recv0˳
+    } while (conn->recv_ready || !STAILQ_EMPTY(&conn->rbuf_q)); //Эջݶȡconn_recv0˳
 
     return NC_OK;
 }
@@ -1041,3 +1306,72 @@ msg_send(struct context *ctx, struct conn *conn)
     return NC_OK;
 }
 
+/*
+ * Send the mbufs of msg to conn ahead of the rest of msg: all of them if
+ * 'all' is set, else all but the last one, which may still be filling up.
+ * Mbufs sent completely are released, except for the last one. Returns
+ * NC_OK once they are all sent and NC_EAGAIN if conn cannot take more yet
+ */
+rstatus_t
+msg_send_partial(struct context *ctx, struct conn *conn, struct msg *msg,
+                 bool all)
+{
+    struct mbuf *mbuf, *nbuf, *last;     /* current, next and last mbuf */
+    struct iovec *ciov, iov[NC_IOV_MAX]; /* current iovec */
+    struct array sendv;                  /* send iovec */
+    size_t nsend, nsent, mlen;           /* bytes to send; bytes sent */
+    ssize_t n;                           /* bytes sent by sendv */
+
+    last = STAILQ_LAST(&msg->mhdr, mbuf, next);
+
+    for (;;) {
+        array_set(&sendv, iov, sizeof(iov[0]), NC_IOV_MAX);
+
+        nsend = 0;
+        for (mbuf = STAILQ_FIRST(&msg->mhdr);
+             mbuf != NULL && array_n(&sendv) < NC_IOV_MAX;
+             mbuf = STAILQ_NEXT(mbuf, next)) {
+            if (mbuf == last && !all) {
+                break;
+            }
+
+            if (mbuf_empty(mbuf)) {
+                continue;
+            }
+
+            ciov = array_push(&sendv);
+            ciov->iov_base = mbuf->pos;
+            ciov->iov_len = mbuf_length(mbuf);
+            nsend += ciov->iov_len;
+        }
+
+        if (nsend == 0) {
+            return NC_OK;
+        }
+
+        n = conn_sendv(conn, &sendv, nsend);
+        if (n < 0) {
+            return n == NC_EAGAIN ? NC_EAGAIN : NC_ERROR;
+        }
+
+        nsent = (size_t)n;
+        for (mbuf = STAILQ_FIRST(&msg->mhdr); mbuf != NULL; mbuf = nbuf) {
+            nbuf = STAILQ_NEXT(mbuf, next);
+
+            mlen = MIN(nsent, mbuf_length(mbuf));
+            mbuf->pos += mlen;
+            nsent -= mlen;
+
+            if (!mbuf_empty(mbuf) || mbuf == last) {
+                break;
+            }
+
+            mbuf_remove(&msg->mhdr, mbuf);
+            mbuf_put(mbuf);
+        }
+
+        if ((size_t)n < nsend) {
+            return NC_EAGAIN;
+        }
+    }
+}
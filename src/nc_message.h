@@ -20,12 +20,24 @@
 
 #include <nc_core.h>
 
+#if (IOV_MAX > 128)
+#define NC_IOV_MAX 128
+#else
+#define NC_IOV_MAX IOV_MAX
+#endif
+
+#define NC_RECV_WINDOW  (256 * 1024)    /* max bytes read with one readv */
+#define MSG_NKEY_INLINE 2               /* # keypos stored in the msg itself */
+#define MSG_BULK_SCAN   128             /* max # bulk requests a request is queued ahead of */
+
 typedef void (*msg_parse_t)(struct msg *);
 typedef rstatus_t (*msg_add_auth_t)(struct context *ctx, struct conn *c_conn, struct conn *s_conn);
+typedef rstatus_t (*msg_add_hello_t)(struct context *ctx, struct conn *c_conn, struct conn *s_conn);
 typedef rstatus_t (*msg_fragment_t)(struct msg *, uint32_t, struct msg_tqh *);
 typedef void (*msg_coalesce_t)(struct msg *r);
 typedef rstatus_t (*msg_reply_t)(struct msg *r);
 typedef bool (*msg_failure_t)(struct msg *r);
+typedef uint32_t (*msg_skip_t)(struct msg *r, uint32_t n);
 
 typedef enum msg_parse_result {
     MSG_PARSE_OK,                         /* parsing ok */
@@ -49,6 +61,12 @@ typedef enum msg_parse_result {
     ACTION( REQ_MC_DECR )                                                                           \
     ACTION( REQ_MC_TOUCH )                     /* memcache touch request */                         \
     ACTION( REQ_MC_QUIT )                      /* memcache quit request */                          \
+    ACTION( REQ_MC_MG )                        /* memcache meta requests */                         \
+    ACTION( REQ_MC_MS )                                                                             \
+    ACTION( REQ_MC_MD )                                                                             \
+    ACTION( REQ_MC_MA )                                                                             \
+    ACTION( REQ_MC_MN )                                                                             \
+    ACTION( REQ_MC_ME )                                                                             \
     ACTION( RSP_MC_NUM )                       /* memcache arithmetic response */                   \
     ACTION( RSP_MC_STORED )                    /* memcache cas and storage response */              \
     ACTION( RSP_MC_NOT_STORED )                                                                     \
@@ -61,6 +79,14 @@ typedef enum msg_parse_result {
     ACTION( RSP_MC_ERROR )                     /* memcache error responses */                       \
     ACTION( RSP_MC_CLIENT_ERROR )                                                                   \
     ACTION( RSP_MC_SERVER_ERROR )                                                                   \
+    ACTION( RSP_MC_VA )                        /* memcache meta responses */                        \
+    ACTION( RSP_MC_HD )                                                                             \
+    ACTION( RSP_MC_EN )                                                                             \
+    ACTION( RSP_MC_NS )                                                                             \
+    ACTION( RSP_MC_EX )                                                                             \
+    ACTION( RSP_MC_NF )                                                                             \
+    ACTION( RSP_MC_MN )                                                                             \
+    ACTION( RSP_MC_ME )                                                                             \
     ACTION( REQ_REDIS_DEL )                    /* redis commands - keys */                          \
     ACTION( REQ_REDIS_EXISTS )                                                                      \
     ACTION( REQ_REDIS_EXPIRE )                                                                      \
@@ -72,6 +98,8 @@ typedef enum msg_parse_result {
     ACTION( REQ_REDIS_SORT )                                                                        \
     ACTION( REQ_REDIS_TTL )                                                                         \
     ACTION( REQ_REDIS_TYPE )                                                                        \
+    ACTION( REQ_REDIS_TOUCH )                                                                       \
+    ACTION( REQ_REDIS_UNLINK )                                                                      \
     ACTION( REQ_REDIS_APPEND )                 /* redis requests - string */                        \
     ACTION( REQ_REDIS_BITCOUNT )                                                                    \
     ACTION( REQ_REDIS_BITPOS )                                                                    \
@@ -166,6 +194,7 @@ typedef enum msg_parse_result {
     ACTION( REQ_REDIS_PING )                   /* redis requests - ping/quit */                     \
     ACTION( REQ_REDIS_QUIT)                                                                         \
     ACTION( REQ_REDIS_AUTH)                                                                         \
+    ACTION( REQ_REDIS_HELLO )                                                                       \
     ACTION( REQ_REDIS_SELECT)                  /* only during init */                               \
     ACTION( RSP_REDIS_STATUS )                 /* redis response */                                 \
     ACTION( RSP_REDIS_ERROR )                                                                       \
@@ -185,6 +214,16 @@ typedef enum msg_parse_result {
     ACTION( RSP_REDIS_INTEGER )                                                                     \
     ACTION( RSP_REDIS_BULK )                                                                        \
     ACTION( RSP_REDIS_MULTIBULK )                                                                   \
+    ACTION( RSP_REDIS_DOUBLE )                 /* redis resp3 response */                           \
+    ACTION( RSP_REDIS_BIGNUM )                                                                      \
+    ACTION( RSP_REDIS_BOOLEAN )                                                                     \
+    ACTION( RSP_REDIS_NULL )                                                                        \
+    ACTION( RSP_REDIS_BLOB_ERROR )                                                                  \
+    ACTION( RSP_REDIS_VERBATIM )                                                                    \
+    ACTION( RSP_REDIS_MAP )                                                                         \
+    ACTION( RSP_REDIS_SET )                                                                         \
+    ACTION( RSP_REDIS_ATTRIBUTE )                                                                   \
+    ACTION( RSP_REDIS_PUSH )                                                                        \
     ACTION( SENTINEL )                                                                              \
 
 
@@ -197,8 +236,53 @@ typedef enum msg_type {
 struct keypos {//msg->keyposеĳԱ
     uint8_t             *start;           /* key start pos */
     uint8_t             *end;             /* key end pos */
+    uint32_t            hash;             /* key hash for the distribution of the pool */
+};
+
+/*
+ * Protocol hooks of a msg, shared by all the msgs of a protocol
+ */
+struct msg_ops {
+    msg_parse_t          parse_req;       /* request parser */
+    msg_parse_t          parse_rsp;       /* response parser */
+    // memcache_fragment  redis_fragment  req_recv_doneִ        Ƭ
+    //Ƭ  mget msetеĲͬKVֲܷں˲ͬҪ  mget gets漰ַϲοhttp://www.codesec.net/view/218217.html
+    msg_fragment_t       fragment;        /* message fragment */
+    //redis_replymemcache_reply
+    msg_reply_t          reply;           /* generate message reply (example: ping) */
+    //redis_add_auth  memcache_add_auth      req_forwardִ
+    msg_add_auth_t       add_auth;        /* add auth message when we forward msg */
+    msg_add_hello_t      add_hello;       /* add hello message when client and server protocol differ */
+    msg_failure_t        failure;         /* transient failure response? */
+    msg_skip_t           skip;            /* skip value bytes in the response */
+
+    //memcache_pre_coalesce   redis_pre_coalesce
+    msg_coalesce_t       pre_coalesce;    /* message pre-coalesce */
+    //memcache_post_coalesce  redis_post_coalesce
+    msg_coalesce_t       post_coalesce;   /* message post-coalesce */
+};
+
+/*
+ * Fragment bookkeeping of a request that is split over several servers;
+ * allocated by msg_frag_create() for the owner of the fragments only
+ */
+struct msg_frag {
+    uint32_t             nfrag;           /* # fragment */
+    uint32_t             nfrag_done;      /* # fragment done */
+    //¼ָͬһ˷msgϢ
+    struct msg           *seq[];          /* sequence of fragment message, map from keys to fragments */
 };
 
+/*
+ * The fields of a msg are laid out from hot to cold, and msgs are cache
+ * line aligned (see _msg_get). The first three cache lines hold all that
+ * the receive, forward and send paths touch on every message. Timeout
+ * tracking follows, then the parser state of the protocol of the msg, as
+ * memcache and redis state overlay each other, the storage of the first
+ * keys of a request, and last the slow log timestamps that are only
+ * written for timed requests
+ */
+
 //msgռ͸ֵmsg_get
 struct msg { //洢ݵmbufmsg->posָmbufռλãmsgҵmsg->mhdr棬ΪеݺܴһmbufܲãҪmbuf
     TAILQ_ENTRY(msg)     c_tqe;           /* link in client q */
@@ -211,86 +295,31 @@ struct msg { //
     //conn,msg_get
     struct conn          *owner;          /* message owner - client | server */
 
-    //ͨóԱ뵽tmo_rbt
-    struct rbnode        tmo_rbe;         /* entry in rbtree */
-
     //mhdrmbufĹϵοmbuf_insert  mlenΪmbufݳ
     //д洢ǽõmbufпݺܴһmbufãԻжmbufӵmhdrУͨmbuf_insertmbuf
     //һmbuf洢ȡKVKV1MmbufĬϴСΪ16KҪ·䣬msg_recv_chainлһµmbufͨmbuf_insertmsgȡ
     struct mhdr          mhdr;            /* message mbuf header */
-    //msgеmbufд洢ʵݳ
-    uint32_t             mlen;            /* message length */
-    int64_t              start_ts;        /* request start timestamp in usec */
-
-    int                  state;           /* current parser state */
     //ִmbuf->posmsg_parsed   
     //ֵmsg_recv_chainmsgmbufλã¼mbufеǸλãĿǿmbufеKVЭʽǷȷƶmbuf->posָλ
     //οmsg_parsedmsg->pos == mbuf->last˵msgеЭʽǷȷ
     uint8_t              *pos;            /* parser position marker */ 
-    
     //ָȡredisЭеÿһַͷ
     uint8_t              *token;          /* token marker */
-
-
-    /*
-    if (request) {
-        msg->parser = memcache_parse_req;
-    } else {
-        msg->parser = memcache_parse_rsp;
-    }
-    msg->add_auth = memcache_add_auth;
-    msg->fragment = memcache_fragment;
-    msg->failure = memcache_failure;
-    msg->pre_coalesce = memcache_pre_coalesce;
-    msg->post_coalesce = memcache_post_coalesce;
-    */
-
     //redis_parse_req  redis_parse_rsp  memcache_parse_req  memcache_parse_rsp
     msg_parse_t          parser;          /* message parser */ //msg_parseִ
-    //ͻ˷͹ıݣɹMSG_PARSE_OK
-    msg_parse_result_t   result;          /* message parsing result */
-    // memcache_fragment  redis_fragment  req_recv_doneִ        Ƭ
-    //Ƭ  mget msetеĲͬKVֲܷں˲ͬҪ  mget gets漰ַϲοhttp://www.codesec.net/view/218217.html
-    msg_fragment_t       fragment;        /* message fragment */
-    //redis_replymemcache_reply
-    msg_reply_t          reply;           /* generate message reply (example: ping) */
-    //redis_add_auth  memcache_add_auth      req_forwardִ
-    msg_add_auth_t       add_auth;        /* add auth message when we forward msg */
-    msg_failure_t        failure;         /* transient failure response? */
-
-    //memcache_pre_coalesce   redis_pre_coalesce
-    msg_coalesce_t       pre_coalesce;    /* message pre-coalesce */
-    //memcache_post_coalesce  redis_post_coalesce
-    msg_coalesce_t       post_coalesce;   /* message post-coalesce */
+    const struct msg_ops *ops;            /* protocol hooks */
+    //ԱΪkeypos  memcache_parse_req  redis_parse_reqеkeyУset yang xxxxyang
+    struct array         keys;            /* array of keypos, for req */ //set key valueеkey
 
+    //msgеmbufд洢ʵݳ
+    uint32_t             mlen;            /* message length */
+    int                  state;           /* current parser state */
     //typeͼmsg_type_strings  ¼set get
     msg_type_t           type;            /* message type */
-
-    //ԱΪkeypos  memcache_parse_req  redis_parse_reqеkeyУset yang xxxxyang
-    struct array         *keys;           /* array of keypos, for req */ //set key valueеkey
-
-    uint32_t             vlen;            /* value length (memcache) */
-    uint8_t              *end;            /* end marker (memcache) */
-    //ȡвĲַϢset yang 111,narg_startָ*3, nargs_endָ*3ĩβ
-    uint8_t              *narg_start;     /* narg start (redis) */
-    uint8_t              *narg_end;       /* narg end (redis) */
+    //ͻ˷͹ıݣɹMSG_PARSE_OK
+    msg_parse_result_t   result;          /* message parsing result */
     //set yang xxx rnarg=3
     uint32_t             narg;            /* # arguments (redis) */
-    //set yang xxx rnarg=3ÿһַڽsetַϣ-1˵2ַҪձʾkeyм
-    //set yang 11key1exist yangkey0HSET key field valuekey2Դơÿһrnargs-1
-    uint32_t             rnarg;           /* running # arg used by parsing fsa (redis) */
-    //¼set yang xxxsetyangxxxַĳȷֱΪ3 4 3
-    uint32_t             rlen;            /* running length in parsing fsa (redis) */
-    uint32_t             integer;         /* integer reply value (redis) */
-
-    struct msg           *frag_owner;     /* owner of fragment message */
-    uint32_t             nfrag;           /* # fragment */
-    uint32_t             nfrag_done;      /* # fragment done */
-    //msg_gen_frag_id
-    uint64_t             frag_id;         /* id of fragmented message */
-    //¼ָͬһ˷msgϢ
-    struct msg           **frag_seq;      /* sequence of fragment message, map from keys to fragments*/
-
     err_t                err;             /* errno on error? */ //ȡ쳣Ĵ
     //req_forward_error1 Чжϼreq_errorΪ1Ȼִrsp_make_error
     unsigned             error:1;         /* error? */ //쳣  
@@ -301,6 +330,7 @@ struct msg { //
     unsigned             quit:1;          /* quit request? */
     //ֻmemcache_parse_req1ֻпͻ˷͹noreplyʱ1
     unsigned             noreply:1;       /* noreply? */ //msgҪõӦӵʱʱοreq_server_enqueue_imsgq
+    unsigned             quiet:1;         /* quiet meta command? (memcache) */
     //ͻ˷͹AUTH֤1req_filter
     unsigned             noforward:1;     /* not need forward (example: ping) */ 
     //ӦҪɾʱcore_timeout
@@ -309,6 +339,48 @@ struct msg { //
     unsigned             swallow:1;       /* swallow response? */
     //Ƿredis
     unsigned             redis:1;         /* redis? */
+    unsigned             capture:1;       /* sampled for request capture? */
+    unsigned             timed:1;         /* timed for the slow log? */
+    unsigned             invalue:1;       /* parser stopped within a value? */
+    unsigned             fq:1;            /* tagged for fair queuing? */
+    unsigned             bulk:1;          /* in the bulk command class of its pool? */
+    unsigned             routed:1;        /* counted in nrouted of its client? */
+    uint32_t             vstart;          /* virtual start time for fair queuing, low 32 bits */
+
+    //msg_gen_frag_id
+    uint64_t             frag_id;         /* id of fragmented message */
+    struct msg           *frag_owner;     /* owner of fragment message */
+    struct msg_frag      *frag;           /* fragment bookkeeping, for the owner */
+    int64_t              start_ts;        /* request start timestamp in usec */
+    int64_t              send_ts;         /* request send start timestamp in usec */
+
+    //ͨóԱ뵽tmo_rbt
+    struct rbnode        tmo_rbe;         /* entry in rbtree */
+
+    union {
+        struct {
+            uint8_t              *end;            /* end marker (memcache) */
+            uint32_t             vlen;            /* value length (memcache) */
+        };
+        struct {
+            //ȡвĲַϢset yang 111,narg_startָ*3, nargs_endָ*3ĩβ
+            uint8_t              *narg_start;     /* narg start (redis) */
+            uint8_t              *narg_end;       /* narg end (redis) */
+            //set yang xxx rnarg=3ÿһַڽsetַϣ-1˵2ַҪձʾkeyм
+            //set yang 11key1exist yangkey0HSET key field valuekey2Դơÿһrnargs-1
+            uint32_t             rnarg;           /* running # arg used by parsing fsa (redis) */
+            //¼set yang xxxsetyangxxxַĳȷֱΪ3 4 3
+            uint32_t             rlen;            /* running length in parsing fsa (redis) */
+            uint32_t             integer;         /* integer reply value (redis) */
+        };
+    };
+
+    struct keypos        key_inline[MSG_NKEY_INLINE]; /* keys storage until a msg has more keys */
+
+    int64_t              parse_ts;        /* request parsed timestamp in usec (slowlog) */
+    int64_t              enqueue_ts;      /* request enqueued on server timestamp in usec (slowlog) */
+    int64_t              write_ts;        /* request written to server timestamp in usec (slowlog) */
+    int64_t              rsp_ts;          /* response first byte timestamp in usec (slowlog) */
 };
 
 TAILQ_HEAD(msg_tqh, msg);
@@ -320,15 +392,22 @@ void msg_tmo_delete(struct msg *msg);
 void msg_init(void);
 void msg_deinit(void);
 struct string *msg_type_string(msg_type_t type);
+msg_type_t msg_type_lookup(struct string *name, bool redis);
 struct msg *msg_get(struct conn *conn, bool request, bool redis);
 void msg_put(struct msg *msg);
 struct msg *msg_get_error(bool redis, err_t err);
+size_t msg_memory(void);
 void msg_dump(struct msg *msg, int level);
 bool msg_empty(struct msg *msg);
 rstatus_t msg_recv(struct context *ctx, struct conn *conn);
 rstatus_t msg_send(struct context *ctx, struct conn *conn);
+rstatus_t msg_send_partial(struct context *ctx, struct conn *conn, struct msg *msg, bool all);
 uint64_t msg_gen_frag_id(void);
-uint32_t msg_backend_idx(struct msg *msg, uint8_t *key, uint32_t keylen);
+struct msg_frag *msg_frag_create(struct msg *r, uint32_t nkey);
+struct keypos *msg_key_push(struct msg *msg);
+void msg_key_hash(struct msg *r, struct keypos *kpos);
+void msg_key_rehash(struct msg *r);
+uint32_t msg_backend_idx(struct msg *msg, struct keypos *kpos);
 struct mbuf *msg_ensure_mbuf(struct msg *msg, size_t len);
 rstatus_t msg_append(struct msg *msg, uint8_t *pos, size_t n);
 rstatus_t msg_prepend(struct msg *msg, uint8_t *pos, size_t n);
@@ -356,5 +435,9 @@ struct msg *rsp_recv_next(struct context *ctx, struct conn *conn, bool alloc);
 void rsp_recv_done(struct context *ctx, struct conn *conn, struct msg *msg, struct msg *nmsg);
 struct msg *rsp_send_next(struct context *ctx, struct conn *conn);
 void rsp_send_done(struct context *ctx, struct conn *conn, struct msg *msg);
+struct msg *rsp_stream_peer(struct conn *s_conn, struct msg *msg);
+void rsp_stream(struct context *ctx, struct conn *s_conn, struct msg *msg);
+void rsp_stream_detach(struct context *ctx, struct msg *pmsg);
+void rsp_stream_abort(struct context *ctx, struct conn *s_conn);
 
 #endif
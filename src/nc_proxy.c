@@ -15,12 +15,24 @@
  * limitations under the License.
  */
 
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE /* accept4 */
+#endif
+
 #include <sys/stat.h>
 #include <sys/un.h>
 
 #include <nc_core.h>
 #include <nc_server.h>
 #include <nc_proxy.h>
+#include <nc_upgrade.h>
+
+#define PROXY_ACCEPT_BATCH      64      /* max # connections accepted per event */
+#define PROXY_THROTTLE_RETRY    1000    /* retry throttled accepts every these many msec */
+
+static uint32_t nthrottled;             /* # listeners throttled on fd exhaustion */
+static uint32_t throttle_nconn;         /* # connections when last throttled */
+static int64_t throttle_retry;          /* next retry of throttled listeners in msec */
 
 //twemproxyΪ,Ҳproxy,proxỵԶ˾ǿͻˣӵļеlistenڼÿͻˣownerָserver server_pool
 //twemproxyΪͻˣserveṛԶΪʵredisownerָʵstruct server
@@ -133,6 +145,14 @@ proxy_listen(struct context *ctx, struct conn *p)
 
     ASSERT(p->proxy);
 
+    /* take over the listening socket handed off on upgrade, if any */
+    p->sd = upgrade_inherit(&pool->addrstr);
+    if (p->sd >= 0) {
+        log_debug(LOG_NOTICE, "p %d inherited on addr '%.*s'", p->sd,
+                  pool->addrstr.len, pool->addrstr.data);
+        goto inherited;
+    }
+
     p->sd = socket(p->family, SOCK_STREAM, 0);
     if (p->sd < 0) {
         log_error("socket failed: %s", strerror(errno));
@@ -171,6 +191,7 @@ proxy_listen(struct context *ctx, struct conn *p)
         return NC_ERROR;
     }
 
+inherited:
     status = nc_set_nonblocking(p->sd);
     if (status < 0) {
         log_error("set nonblock on p %d on addr '%.*s' failed: %s", p->sd,
@@ -273,6 +294,29 @@ proxy_deinit(struct context *ctx)
               array_n(&ctx->pool));
 }
 
+/*
+ * Stop accepting on listener p when we run out of fds
+ */
+static void
+proxy_throttle(struct context *ctx, struct conn *p)
+{
+    rstatus_t status;
+
+    p->recv_ready = 0;
+
+    status = event_del_in(ctx->evb, p);
+    if (status != NC_OK) {
+        return;
+    }
+
+    nthrottled++;
+    throttle_nconn = conn_ncurr_conn();
+    throttle_retry = nc_msec_now() + PROXY_THROTTLE_RETRY;
+
+    log_warn("throttle accept on p %d with %"PRIu32" connections", p->sd,
+             throttle_nconn);
+}
+
 //յͻӺ󣬷µfdΪfdµconnȡ
 static rstatus_t
 proxy_accept(struct context *ctx, struct conn *p) //pӦproxy conn Ҳڼͻ˵connϢ
@@ -287,7 +331,12 @@ proxy_accept(struct context *ctx, struct conn *p) //p
     ASSERT(p->recv_active && p->recv_ready);
 
     for (;;) {
-        sd = accept(p->sd, NULL, NULL); //ȡµĿͻӣµfd
+#ifdef HAVE_ACCEPT4
+        sd = accept4(p->sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        sd = accept(p->sd, NULL, NULL);
+#endif
+        //ȡµĿͻӣµfd
         if (sd < 0) {
             if (errno == EINTR) {
                 log_debug(LOG_VERB, "accept on p %d not ready - eintr", p->sd);
@@ -300,17 +349,14 @@ proxy_accept(struct context *ctx, struct conn *p) //p
                 return NC_OK;
             }
 
-            /* 
-             * Workaround of https://github.com/twitter/twemproxy/issues/97
+            /*
+             * See https://github.com/twitter/twemproxy/issues/97
              *
              * We should never reach here because the check for conn_ncurr_cconn()
              * against ctx->max_ncconn should catch this earlier in the cycle.
-             * If we reach here ignore EMFILE/ENFILE, return NC_OK will enable
-             * the server continue to run instead of close the server socket
-             *
-             * The right solution however, is on EMFILE/ENFILE to mask out IN
-             * event on the proxy and mask it back in when some existing
-             * connections gets closed
+             * If we do, the pending connections stay in the backlog, so mask
+             * out the IN event on the proxy instead of spinning on it, and
+             * mask it back in once some connection is closed (proxy_loop)
              */
             if (errno == EMFILE || errno == ENFILE) {
                 log_debug(LOG_CRIT, "accept on p %d with max fds %"PRIu32" "
@@ -319,7 +365,7 @@ proxy_accept(struct context *ctx, struct conn *p) //p
                           p->sd, ctx->max_nfd, conn_ncurr_conn(),
                           ctx->max_ncconn, conn_ncurr_cconn(), strerror(errno));
 
-                p->recv_ready = 0;
+                proxy_throttle(ctx, p);
 
                 return NC_OK;
             }
@@ -356,6 +402,9 @@ proxy_accept(struct context *ctx, struct conn *p) //p
 
     stats_pool_incr(ctx, c->owner, client_connections);
 
+    limit_bind(c);
+
+#ifndef HAVE_ACCEPT4
     status = nc_set_nonblocking(c->sd);
     if (status < 0) {
         log_error("set nonblock on c %d from p %d failed: %s", c->sd, p->sd,
@@ -363,6 +412,7 @@ proxy_accept(struct context *ctx, struct conn *p) //p
         c->close(ctx, c);
         return status;
     }
+#endif
 
     if (pool->tcpkeepalive) {
         status = nc_set_tcpkeepalive(c->sd);
@@ -399,18 +449,78 @@ rstatus_t
 proxy_recv(struct context *ctx, struct conn *conn)
 {
     rstatus_t status;
+    uint32_t n;
 
     ASSERT(conn->proxy && !conn->client);
     ASSERT(conn->recv_active);
 
+    /*
+     * Accept at most a batch of connections at a time, so that a storm of
+     * connections does not starve the ones already accepted. A listener
+     * left with recv_ready set is picked up again by proxy_loop
+     */
     conn->recv_ready = 1;
-    do {
+    for (n = 0; n < PROXY_ACCEPT_BATCH && conn->recv_ready; n++) {
         status = proxy_accept(ctx, conn);
         if (status != NC_OK) {
             return status;
         }
-    } while (conn->recv_ready); //proxy_acceptапͻӶϺrecv_readyΪ0
+    }
 
     return NC_OK;
 }
 
+/*
+ * Resume accepting on the listeners that stopped short of draining their
+ * backlog, at the end of a batch or on running out of fds
+ */
+void
+proxy_loop(struct context *ctx)
+{
+    uint32_t i, npool;
+    bool resume, pending;
+
+    resume = false;
+    if (nthrottled != 0 && (conn_ncurr_conn() < throttle_nconn ||
+                            nc_msec_now() >= throttle_retry)) {
+        resume = true;
+        nthrottled = 0;
+    }
+
+    pending = false;
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+        struct conn *p = pool->p_conn;
+
+        if (p == NULL || p->sd < 0) {
+            continue;
+        }
+
+        if (!p->recv_active) {
+            if (!resume) {
+                continue;
+            }
+            if (event_add_in(ctx->evb, p) != NC_OK) {
+                nthrottled++;
+                continue;
+            }
+            log_warn("resume accept on p %d with %"PRIu32" connections",
+                     p->sd, conn_ncurr_conn());
+        } else if (!p->recv_ready) {
+            continue;
+        }
+
+        core_core(p, EVENT_READ);
+
+        if (pool->p_conn == p && p->recv_ready) {
+            pending = true;
+        }
+    }
+
+    if (pending) {
+        ctx->timeout = 0;
+    } else if (nthrottled != 0) {
+        ctx->timeout = MIN(ctx->timeout, PROXY_THROTTLE_RETRY);
+    }
+}
+
@@ -0,0 +1,173 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <signal.h>
+
+#include <nc_core.h>
+#include <nc_conf.h>
+#include <nc_server.h>
+#include <nc_reload.h>
+
+static char *reload_filename;              /* configuration to reload */
+static volatile sig_atomic_t reload_signo; /* reload requested? */
+static pthread_t reload_tid;               /* configuration parser thread */
+static bool reload_running;                /* parser thread running? */
+static volatile int reload_parsed;         /* parser thread done? */
+
+/*
+ * Parse the configuration off the event loop, as resolving server names
+ * can block for long
+ */
+static void *
+reload_parse(void *arg)
+{
+    struct conf *cf;
+
+    cf = conf_create(reload_filename);
+    if (cf != NULL) {
+        conf_resolve(cf);
+    }
+
+    reload_parsed = 1;
+
+    return cf;
+}
+
+static void
+reload_start(void)
+{
+    int status;
+    sigset_t set, oset;
+
+    /* signals are handled on the event loop */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &oset);
+
+    reload_parsed = 0;
+    status = pthread_create(&reload_tid, NULL, reload_parse, NULL);
+
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+    if (status != 0) {
+        log_error("reload of '%s' failed: create parser thread: %s",
+                  reload_filename, strerror(status));
+        return;
+    }
+
+    reload_running = true;
+
+    loga("reload of '%s' started", reload_filename);
+}
+
+static void
+reload_apply(struct context *ctx, struct conf *cf)
+{
+    rstatus_t status;
+
+    status = server_pool_reload(ctx, &cf->pool);
+    if (status != NC_OK) {
+        log_error("reload of '%s' failed, keeping current configuration",
+                  reload_filename);
+        conf_destroy(cf);
+        return;
+    }
+
+    /* pools and servers now refer to strings in the new configuration */
+    conf_destroy(ctx->cf);
+    ctx->cf = cf;
+
+    loga("reload of '%s' done", reload_filename);
+}
+
+rstatus_t
+reload_init(struct instance *nci)
+{
+    /* resolve a relative path before daemonizing changes the directory */
+    reload_filename = realpath(nci->conf_filename, NULL);
+    if (reload_filename == NULL) {
+        log_error("realpath of '%s' failed: %s", nci->conf_filename,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+void
+reload_deinit(void)
+{
+    if (reload_running) {
+        void *cf;
+
+        pthread_join(reload_tid, &cf);
+        if (cf != NULL) {
+            conf_destroy(cf);
+        }
+        reload_running = false;
+    }
+
+    free(reload_filename);
+    reload_filename = NULL;
+}
+
+/*
+ * Called from the signal handler, so only sets a flag that reload_loop
+ * picks up
+ */
+void
+reload_request(void)
+{
+    reload_signo = 1;
+}
+
+/*
+ * Drive the reload from the event loop. The new configuration is parsed
+ * on a separate thread and applied here in one go, between events.
+ */
+void
+reload_loop(struct context *ctx)
+{
+    if (reload_running && reload_parsed) {
+        void *cf;
+
+        pthread_join(reload_tid, &cf);
+        reload_running = false;
+
+        if (cf != NULL) {
+            reload_apply(ctx, cf);
+        } else {
+            log_error("reload of '%s' failed: invalid configuration",
+                      reload_filename);
+        }
+    }
+
+    /* a reload requested while parsing starts once the parse is done */
+    if (reload_signo && !reload_running) {
+        reload_signo = 0;
+        if (ctx->draining) {
+            log_warn("reload ignored while upgrading");
+        } else {
+            reload_start();
+        }
+    }
+
+    /* poll for the parse to finish more often than usual */
+    if (reload_running && (ctx->timeout < 0 || ctx->timeout > RELOAD_POLL)) {
+        ctx->timeout = RELOAD_POLL;
+    }
+}
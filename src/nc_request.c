@@ -17,6 +17,8 @@
 
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_capture.h>
+#include <nc_client.h>
 
 //ȡһmsgṹ
 struct msg *
@@ -72,11 +74,11 @@ req_log(struct msg *req)
     req_len = req->mlen;
     rsp_len = (rsp != NULL) ? rsp->mlen : 0;
 
-    if (array_n(req->keys) < 1) {
+    if (array_n(&req->keys) < 1) {
         return;
     }
 
-    kpos = array_get(req->keys, 0);
+    kpos = array_get(&req->keys, 0);
     if (kpos->end != NULL) {
         *(kpos->end) = '\0';
     }
@@ -110,6 +112,17 @@ req_put(struct msg *msg)
 
     req_log(msg);
 
+    /* the client of a swallowed request is gone */
+    if (msg->routed && !msg->swallow) {
+        struct conn *c_conn = msg->owner;
+
+        ASSERT(c_conn->client && c_conn->nrouted != 0);
+        if (msg->noreply) {
+            TAILQ_REMOVE(&c_conn->nmsg_q, msg, c_tqe);
+        }
+        c_conn->nrouted--;
+    }
+
     pmsg = msg->peer;
     if (pmsg != NULL) {
         ASSERT(!pmsg->request && pmsg->peer == msg);
@@ -156,7 +169,7 @@ req_done(struct conn *conn, struct msg *msg)
         return true;
     }
 
-    if (msg->nfrag_done < msg->nfrag) {
+    if (msg->frag != NULL && msg->frag->nfrag_done < msg->frag->nfrag) {
         return false;
     }
 
@@ -205,9 +218,9 @@ req_done(struct conn *conn, struct msg *msg)
         nfragment++;
     }
 
-    ASSERT(msg->frag_owner->nfrag == nfragment);
+    ASSERT(msg->frag_owner->frag->nfrag == nfragment);
 
-    msg->post_coalesce(msg->frag_owner);
+    msg->ops->post_coalesce(msg->frag_owner);
 
     log_debug(LOG_DEBUG, "req from c %d with fid %"PRIu64" and %"PRIu32" "
               "fragments is done", conn->sd, id, nfragment);
@@ -310,6 +323,36 @@ ferror:
 
 //յĿͻmsgϢͨreq_server_enqueue_imsgqӵö req_send_nextзʵ
 //msgӵconn->imsg_qӣreq_send_nextзʵ
+/*
+ * Enqueue request 'msg' ahead of the bulk requests of other clients that
+ * wait in server inq, so that it never waits behind them. The head of the
+ * queue may be partially sent, and a request already on its way out is
+ * never overtaken. Neither is a HELLO, as the requests queued ahead of it
+ * are sent in another protocol
+ */
+static void
+req_server_enqueue_ahead(struct conn *conn, struct msg *msg)
+{
+    struct msg *prev;
+    uint32_t nscan;
+
+    for (prev = TAILQ_LAST(&conn->imsg_q, msg_tqh), nscan = 0;
+         prev != NULL && nscan < MSG_BULK_SCAN;
+         prev = TAILQ_PREV(prev, msg_tqh, s_tqe), nscan++) {
+        if (!prev->bulk || prev->type == MSG_REQ_REDIS_HELLO ||
+            prev->owner == msg->owner || prev->send_ts != 0 ||
+            prev == TAILQ_FIRST(&conn->imsg_q)) {
+            break;
+        }
+    }
+
+    if (prev == NULL) {
+        TAILQ_INSERT_TAIL(&conn->imsg_q, msg, s_tqe);
+    } else {
+        TAILQ_INSERT_AFTER(&conn->imsg_q, prev, msg, s_tqe);
+    }
+}
+
 void   //req_server_enqueue_imsgqӵβreq_server_enqueue_imsgq_headӵͷ
 req_server_enqueue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg)
 {//req_forwardִ  req_forward->req_server_enqueue_imsgq
@@ -329,7 +372,22 @@ req_server_enqueue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg
         msg_tmo_insert(msg, conn); //ӵtmo_rbt   msgҪʵҪȴԷӦ
     }
 
-    TAILQ_INSERT_TAIL(&conn->imsg_q, msg, s_tqe);//core_coreед¼imsg_qеmsgͳȥ
+    /*
+     * requests generated by the proxy itself (AUTH, HELLO) stay at the tail,
+     * as they change the state of the connection for the requests that
+     * follow them. Requests tagged for fair queuing go in virtual start time
+     * order, and other requests go ahead of the bulk requests of other
+     * clients
+     */
+    if (msg->swallow) {
+        TAILQ_INSERT_TAIL(&conn->imsg_q, msg, s_tqe);
+    } else if (msg->fq) {
+        limit_fq_enqueue(conn, msg);
+    } else if (!msg->bulk) {
+        req_server_enqueue_ahead(conn, msg);
+    } else {
+        TAILQ_INSERT_TAIL(&conn->imsg_q, msg, s_tqe);//core_coreед¼imsg_qеmsgͳȥ
+    }
 
     stats_server_incr(ctx, conn->owner, in_queue); 
     stats_server_incr_by(ctx, conn->owner, in_queue_bytes, msg->mlen);
@@ -423,6 +481,7 @@ req_server_enqueue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg
     ASSERT(!conn->client && !conn->proxy);
 
     TAILQ_INSERT_TAIL(&conn->omsg_q, msg, s_tqe);
+    conn->nout++;
 
     stats_server_incr(ctx, conn->owner, out_queue);
     stats_server_incr_by(ctx, conn->owner, out_queue_bytes, msg->mlen);
@@ -446,6 +505,8 @@ req_server_dequeue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg
     msg_tmo_delete(msg);
 
     TAILQ_REMOVE(&conn->omsg_q, msg, s_tqe);
+    ASSERT(conn->nout > 0);
+    conn->nout--;
 
     stats_server_decr(ctx, conn->owner, out_queue);
     stats_server_decr_by(ctx, conn->owner, out_queue_bytes, msg->mlen);
@@ -527,6 +588,21 @@ req_recv_next(struct context *ctx, struct conn *conn, bool alloc)
         return NULL;
     }
 
+    /*
+     * Over the memory soft limit, stop reading from a client that holds a
+     * big share of the buffered data, until its outstanding requests are
+     * answered. Only done at the start of a read, so that any data already
+     * read is always parsed
+     */
+    if (alloc && client_pause(ctx, conn)) {
+        return NULL;
+    }
+
+    /* likewise, a client over a rate limit is read again once it refills */
+    if (alloc && conn->recv_throttled) {
+        return NULL;
+    }
+
     msg = conn->rmsg; //req_recv_next  req_recv_doneиֵ
     if (msg != NULL) { //˵֮ǰĳKVûȡϣ˾ͲתλʹømsgжȡǵKVΪKV
         ASSERT(msg->request);
@@ -664,6 +740,8 @@ req_forward_error(struct context *ctx, struct conn *conn, struct msg *msg)
               "c %d failed: %s", msg->id, msg->mlen, msg->type, conn->sd,
               strerror(errno));
 
+    slowlog_mark(msg, rsp_ts, nc_usec_now());
+
     msg->done = 1;
     //rsp_make_errorַݷ
     msg->error = 1;
@@ -732,6 +810,41 @@ req_forward_stats(struct context *ctx, struct server *server, struct msg *msg)
 * server.
 */
 
+/*
+ * Classify request 'msg' by the bulk_commands of its pool and return true
+ * if it goes to the bulk group of server connections. While a client has
+ * requests in flight in one group, its next requests follow them there, so
+ * its requests are never reordered across the groups. A noreply request is
+ * not in the client outq, so it is kept in the client nmsg_q until it is
+ * sent, which lets client_close() detach it
+ */
+static bool
+req_route(struct context *ctx, struct conn *c_conn, struct msg *msg)
+{
+    struct server_pool *pool = c_conn->owner;
+
+    if (server_pool_bulk(pool, msg->type)) {
+        msg->bulk = 1;
+        stats_pool_incr(ctx, pool, bulk_requests);
+    }
+
+    if (pool->bulk_connections == 0) {
+        return false;
+    }
+
+    if (c_conn->nrouted == 0) {
+        c_conn->routed_bulk = msg->bulk;
+    }
+
+    if (msg->noreply) {
+        TAILQ_INSERT_TAIL(&c_conn->nmsg_q, msg, c_tqe);
+    }
+    c_conn->nrouted++;
+    msg->routed = 1;
+
+    return c_conn->routed_bulk ? true : false;
+}
+
 //ת˷
 static void
 req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
@@ -739,8 +852,6 @@ req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
     rstatus_t status;
     struct conn *s_conn;
     struct server_pool *pool;
-    uint8_t *key;
-    uint32_t keylen;
     struct keypos *kpos;
 
     ASSERT(c_conn->client && !c_conn->proxy);
@@ -753,19 +864,20 @@ req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
 
     pool = c_conn->owner;
 
-    ASSERT(array_n(msg->keys) > 0);
-    kpos = array_get(msg->keys, 0);
-    key = kpos->start;
-    keylen = (uint32_t)(kpos->end - kpos->start);
+    ASSERT(array_n(&msg->keys) > 0);
+    kpos = array_get(&msg->keys, 0);
 
     //ѡٺ˷
-    s_conn = server_pool_conn(ctx, c_conn->owner, key, keylen);
+    s_conn = server_pool_conn(ctx, c_conn->owner, kpos,
+                              req_route(ctx, c_conn, msg));
     if (s_conn == NULL) {
         req_forward_error(ctx, c_conn, msg);
         return;
     }
     ASSERT(!s_conn->client && !s_conn->proxy);
 
+    hotkey_sample(pool->hotkey, msg, s_conn->owner);
+
     /* enqueue the message (request) into server inq */
     if (TAILQ_EMPTY(&s_conn->imsg_q)) { 
     //ڶûmsg,öмmsg,˵Ķmsg,Щ¼ͨepollͳȥ
@@ -778,7 +890,7 @@ req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
     }
 
     if (!conn_authenticated(s_conn)) { //ڻû֤ɹȽ֤
-        status = msg->add_auth(ctx, c_conn, s_conn);
+        status = msg->ops->add_auth(ctx, c_conn, s_conn);
         if (status != NC_OK) {
             req_forward_error(ctx, c_conn, msg);
             s_conn->err = errno;
@@ -786,14 +898,34 @@ req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
         }
     }
  
+    /*
+     * Server connections are shared by all clients of the pool, so switch
+     * the protocol of this connection to the one negotiated by the client
+     * (HELLO) before its request goes out. The HELLOs already sent decide
+     * what the server speaks by the time the request gets there
+     */
+    if (s_conn->resp3_next != c_conn->resp3) {
+        status = msg->ops->add_hello(ctx, c_conn, s_conn);
+        if (status != NC_OK) {
+            req_forward_error(ctx, c_conn, msg);
+            s_conn->err = errno;
+            return;
+        }
+    }
+
     //req_server_enqueue_imsgq
+    slowlog_mark(msg, enqueue_ts, nc_usec_now());
+
+    limit_fq_tag(c_conn, msg);
+
     s_conn->enqueue_inq(ctx, s_conn, msg);//core_coreед¼imsg_qеmsgͳȥ
 
     req_forward_stats(ctx, s_conn->owner, msg);
 
     log_debug(LOG_VERB, "forward from c %d to s %d req %"PRIu64" len %"PRIu32
               " type %d with key '%.*s'", c_conn->sd, s_conn->sd, msg->id,
-              msg->mlen, msg->type, keylen, key);
+              msg->mlen, msg->type, (int)(kpos->end - kpos->start),
+              kpos->start);
 }
 /*
 *             Client+             Proxy           Server+
@@ -852,6 +984,8 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
     ASSERT(nmsg == NULL || nmsg->request);
 
     //ȡKVģconn->rmsg = NULL,ȡںЭջһKVûжȡconn->rmsg = nmsg(Ҳµһmsg)
+    slowlog_mark(msg, parse_ts, nc_usec_now());
+
     /* enqueue next message (request), if any */
     conn->rmsg = nmsg; //һKVrmsgֵΪNULL
 
@@ -859,6 +993,11 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
         return; //ͻ˷quitٴKV
     }
 
+    /* every request received counts against the rate limits of the client */
+    limit_charge(ctx, conn);
+
+    capture_sample(msg);
+
     if (msg->noforward) { //Ҫת˷Ϊû֤ɹ
         status = req_make_reply(ctx, conn, msg);
         if (status != NC_OK) {
@@ -866,12 +1005,14 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
             return;
         }
 
-        status = msg->reply(msg); //redis_reply
+        status = msg->ops->reply(msg); //redis_reply
         if (status != NC_OK) {
             conn->err = errno;
             return;
         }
 
+        slowlog_mark(msg, rsp_ts, nc_usec_now());
+
         //ͨcore_coreед¼д
         status = event_add_out(ctx->evb, conn);
         if (status != NC_OK) {
@@ -881,11 +1022,23 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
         return;
     }
 
-    /* do fragment */
     pool = conn->owner;
+
+    /* reject request over the memory hard limit */
+    if (core_mem_exhausted(ctx)) {
+        stats_pool_incr(ctx, pool, oom_rejected);
+        if (!msg->noreply) {
+            conn->enqueue_outq(ctx, conn, msg);
+        }
+        errno = ENOMEM;
+        req_forward_error(ctx, conn, msg);
+        return;
+    }
+
+    /* do fragment */
     TAILQ_INIT(&frag_msgq);
     //Ƭ  mget msetеĲͬKVֲܷں˲ͬҪ
-    status = msg->fragment(msg, pool->ncontinuum, &frag_msgq);//Ҫַ˷frag_msgqΪ
+    status = msg->ops->fragment(msg, pool->ncontinuum, &frag_msgq);//Ҫַ˷frag_msgqΪ
     if (status != NC_OK) { 
         if (!msg->noreply) {
             conn->enqueue_outq(ctx, conn, msg);
@@ -989,6 +1142,22 @@ req_send_next(struct context *ctx, struct conn *conn) //
         nmsg = TAILQ_NEXT(msg, s_tqe);  //ָimsg_qһmsg
     }
 
+    /*
+     * Hold the requests in server inq while the in-flight window is full;
+     * a reply from the server reopens the window and re-arms the write
+     * event (see server_window_update). A request that is already on its
+     * way out (send_ts set) is always allowed to complete
+     */
+    if (nmsg != NULL && nmsg->send_ts == 0 && !server_window_open(conn)) {
+        if (msg == NULL) {
+            status = event_del_out(ctx->evb, conn);
+            if (status != NC_OK) {
+                conn->err = errno;
+            }
+        }
+        return NULL;
+    }
+
     conn->smsg = nmsg; //Ҫʵʵmsgȫ浽conn->smsg
 
     if (nmsg == NULL) {
@@ -997,6 +1166,11 @@ req_send_next(struct context *ctx, struct conn *conn) //
 
     ASSERT(nmsg->request && !nmsg->done);
 
+    if (conn->window != 0 && nmsg->send_ts == 0) {
+        nmsg->send_ts = nc_usec_now();
+        conn->nsend++;
+    }
+
     log_debug(LOG_VVERB, "send next req %"PRIu64" len %"PRIu32" type %d on "
               "s %d", nmsg->id, nmsg->mlen, nmsg->type, conn->sd);
 
@@ -1057,6 +1231,17 @@ req_send_done(struct context *ctx, struct conn *conn, struct msg *msg) //
     /* dequeue the message (request) from server inq */
     conn->dequeue_inq(ctx, conn, msg);
 
+    if (msg->fq) {
+        limit_fq_dequeue(conn, msg);
+    }
+
+    slowlog_mark(msg, write_ts, nc_usec_now());
+
+    if (msg->send_ts != 0) {
+        ASSERT(conn->nsend > 0);
+        conn->nsend--;
+    }
+
     /*
      * noreply request instructs the server not to send any response. So,
      * enqueue message (request) in server outq, if response is expected.
@@ -0,0 +1,347 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+#include <arpa/inet.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_resolver.h>
+
+/*
+ * Asynchronous resolution of server hostnames.
+ *
+ * Server addresses are resolved once when the configuration is loaded, and
+ * cached in the server for RESOLVER_TTL msec. Stale addresses are refreshed
+ * on connect and every RESOLVER_TTL msec, while the cached one stays in use,
+ * so getaddrinfo() never runs on the event loop. The refresh runs on a
+ * resolver thread and resolver_loop() picks up the result between events.
+ * New connections then use the new address; existing connections are kept
+ * until they close. Numeric addresses and unix sockets need no lookup and
+ * are resolved in place.
+ */
+
+struct resolver_job {
+    STAILQ_ENTRY(resolver_job) next;  /* link in pending or done q */
+    struct string              name;  /* hostname */
+    int                        port;  /* port */
+    struct sockinfo            info;  /* resolved socket info */
+    rstatus_t                  status; /* resolution status */
+    int64_t                    at;    /* resolution time in usec */
+};
+
+STAILQ_HEAD(resolver_jobq, resolver_job);
+
+static pthread_t resolver_tid;             /* resolver thread */
+static bool resolver_running;              /* resolver thread running? */
+static bool resolver_stop;                 /* resolver thread to exit? */
+static uint32_t resolver_njob;             /* # jobs not yet picked up */
+static int64_t resolver_scan;              /* next refresh of all servers in usec */
+static pthread_mutex_t resolver_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolver_cond = PTHREAD_COND_INITIALIZER;
+static struct resolver_jobq resolver_pendq = STAILQ_HEAD_INITIALIZER(resolver_pendq);
+static struct resolver_jobq resolver_doneq = STAILQ_HEAD_INITIALIZER(resolver_doneq);
+
+static void
+resolver_job_put(struct resolver_job *job)
+{
+    string_deinit(&job->name);
+    nc_free(job);
+}
+
+static void *
+resolver_thread(void *arg)
+{
+    struct resolver_job *job;
+
+    pthread_mutex_lock(&resolver_lock);
+
+    for (;;) {
+        while (STAILQ_EMPTY(&resolver_pendq) && !resolver_stop) {
+            pthread_cond_wait(&resolver_cond, &resolver_lock);
+        }
+
+        if (resolver_stop) {
+            break;
+        }
+
+        job = STAILQ_FIRST(&resolver_pendq);
+        STAILQ_REMOVE_HEAD(&resolver_pendq, next);
+
+        pthread_mutex_unlock(&resolver_lock);
+
+        job->status = nc_resolve(&job->name, job->port, &job->info);
+        job->at = nc_usec_now();
+
+        pthread_mutex_lock(&resolver_lock);
+
+        STAILQ_INSERT_TAIL(&resolver_doneq, job, next);
+    }
+
+    pthread_mutex_unlock(&resolver_lock);
+
+    return NULL;
+}
+
+static rstatus_t
+resolver_start(void)
+{
+    int status;
+    sigset_t set, oset;
+
+    /* signals are handled on the event loop */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &oset);
+
+    status = pthread_create(&resolver_tid, NULL, resolver_thread, NULL);
+
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+    if (status != 0) {
+        log_error("create resolver thread failed: %s", strerror(status));
+        return NC_ERROR;
+    }
+
+    resolver_running = true;
+
+    return NC_OK;
+}
+
+static rstatus_t
+resolver_request(struct server *server)
+{
+    rstatus_t status;
+    struct resolver_job *job;
+
+    if (!resolver_running) {
+        status = resolver_start();
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    job = nc_alloc(sizeof(*job));
+    if (job == NULL) {
+        return NC_ENOMEM;
+    }
+
+    string_init(&job->name);
+    status = string_duplicate(&job->name, &server->addrstr);
+    if (status != NC_OK) {
+        nc_free(job);
+        return status;
+    }
+    job->port = server->port;
+
+    pthread_mutex_lock(&resolver_lock);
+    STAILQ_INSERT_TAIL(&resolver_pendq, job, next);
+    pthread_cond_signal(&resolver_cond);
+    pthread_mutex_unlock(&resolver_lock);
+
+    resolver_njob++;
+    server->resolving = 1;
+
+    log_debug(LOG_VERB, "resolve of server '%.*s' queued", server->pname.len,
+              server->pname.data);
+
+    return NC_OK;
+}
+
+/*
+ * Return true if hostname 'name' needs no lookup to be resolved
+ */
+static bool
+resolver_numeric(struct string *name)
+{
+    struct in6_addr addr;
+    char *host = (char *)name->data;
+
+    if (host[0] == '/') {
+        return true;
+    }
+
+    return inet_pton(AF_INET, host, &addr) == 1 ||
+           inet_pton(AF_INET6, host, &addr) == 1;
+}
+
+/*
+ * Refresh the address of a server once it is stale, without blocking. A
+ * server that was never resolved stays unresolved until the refresh is
+ * picked up by resolver_loop()
+ */
+void
+resolver_refresh(struct server *server)
+{
+    rstatus_t status;
+    int64_t now;
+
+    now = nc_usec_now();
+
+    if (server->resolving || now < server->resolve_next) {
+        return;
+    }
+
+    if (server->resolved_at != 0 &&
+        now - server->resolved_at < RESOLVER_TTL * 1000LL) {
+        return;
+    }
+
+    if (resolver_numeric(&server->addrstr)) {
+        status = nc_resolve(&server->addrstr, server->port, &server->info);
+        if (status == NC_OK) {
+            server->resolved_at = now;
+        } else {
+            server->resolve_next = now + RESOLVER_RETRY * 1000LL;
+        }
+        return;
+    }
+
+    status = resolver_request(server);
+    if (status != NC_OK) {
+        server->resolve_next = now + RESOLVER_RETRY * 1000LL;
+    }
+}
+
+static void
+resolver_apply(struct context *ctx, struct resolver_job *job)
+{
+    uint32_t i, j, npool, nserver;
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+
+        for (j = 0, nserver = array_n(&pool->server); j < nserver; j++) {
+            struct server *server = array_get(&pool->server, j);
+
+            if (server->port != job->port ||
+                string_compare(&server->addrstr, &job->name) != 0) {
+                continue;
+            }
+
+            server->resolving = 0;
+
+            if (job->status != NC_OK) {
+                log_warn("resolve of server '%.*s' failed, %s",
+                         server->pname.len, server->pname.data,
+                         server->resolved_at != 0 ? "keeping stale address" :
+                         "retrying");
+                server->resolve_next = job->at + RESOLVER_RETRY * 1000LL;
+                continue;
+            }
+
+            if (server->resolved_at != 0 &&
+                (server->info.addrlen != job->info.addrlen ||
+                 memcmp(&server->info.addr, &job->info.addr,
+                        job->info.addrlen) != 0)) {
+                loga("server '%.*s' resolved to new address '%s'",
+                     server->pname.len, server->pname.data,
+                     nc_unresolve_addr((struct sockaddr *)&job->info.addr,
+                                       job->info.addrlen));
+            }
+
+            nc_memcpy(&server->info, &job->info, sizeof(server->info));
+            server->resolved_at = job->at;
+            server->resolve_next = 0;
+
+            stats_server_incr(ctx, server, server_resolves);
+        }
+    }
+}
+
+static void
+resolver_refresh_all(struct context *ctx)
+{
+    uint32_t i, j, npool, nserver;
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+
+        for (j = 0, nserver = array_n(&pool->server); j < nserver; j++) {
+            resolver_refresh(array_get(&pool->server, j));
+        }
+    }
+}
+
+/*
+ * Refresh stale server addresses and apply the ones resolved by the
+ * resolver thread, between events
+ */
+void
+resolver_loop(struct context *ctx)
+{
+    struct resolver_jobq doneq;
+    struct resolver_job *job;
+    int64_t now;
+
+    now = nc_usec_now();
+    if (now >= resolver_scan) {
+        resolver_scan = now + RESOLVER_TTL * 1000LL;
+        resolver_refresh_all(ctx);
+    }
+
+    if (resolver_njob == 0) {
+        return;
+    }
+
+    STAILQ_INIT(&doneq);
+
+    pthread_mutex_lock(&resolver_lock);
+    STAILQ_CONCAT(&doneq, &resolver_doneq);
+    pthread_mutex_unlock(&resolver_lock);
+
+    while (!STAILQ_EMPTY(&doneq)) {
+        job = STAILQ_FIRST(&doneq);
+        STAILQ_REMOVE_HEAD(&doneq, next);
+
+        ASSERT(resolver_njob > 0);
+        resolver_njob--;
+
+        resolver_apply(ctx, job);
+        resolver_job_put(job);
+    }
+
+    /* poll for outstanding resolutions more often than usual */
+    if (resolver_njob != 0 && (ctx->timeout < 0 || ctx->timeout > RESOLVER_POLL)) {
+        ctx->timeout = RESOLVER_POLL;
+    }
+}
+
+void
+resolver_deinit(void)
+{
+    struct resolver_job *job;
+
+    if (!resolver_running) {
+        return;
+    }
+
+    pthread_mutex_lock(&resolver_lock);
+    resolver_stop = true;
+    pthread_cond_signal(&resolver_cond);
+    pthread_mutex_unlock(&resolver_lock);
+
+    pthread_join(resolver_tid, NULL);
+    resolver_running = false;
+
+    STAILQ_CONCAT(&resolver_pendq, &resolver_doneq);
+    while (!STAILQ_EMPTY(&resolver_pendq)) {
+        job = STAILQ_FIRST(&resolver_pendq);
+        STAILQ_REMOVE_HEAD(&resolver_pendq, next);
+        resolver_job_put(job);
+    }
+    resolver_njob = 0;
+}
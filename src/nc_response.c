@@ -17,6 +17,7 @@
 
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_capture.h>
 
 struct msg *
 rsp_get(struct conn *conn)
@@ -138,6 +139,9 @@ rsp_recv_next(struct context *ctx, struct conn *conn, bool alloc)
 
         /* server sent eof before sending the entire request */
         if (msg != NULL) {
+            if (msg->peer != NULL) {
+                rsp_stream_abort(ctx, conn);
+            }
             conn->rmsg = NULL;
 
             ASSERT(msg->peer == NULL);
@@ -235,6 +239,19 @@ rsp_filter(struct context *ctx, struct conn *conn, struct msg *msg)
         return true;
     }
 
+    /*
+     * RESP3 push frames (redis) are out-of-band data that is not a reply
+     * to any request, so they never consume the head of the outq. Since
+     * the server connection is shared by many clients there is no client
+     * to route them to, and we discard them.
+     */
+    if (msg->type == MSG_RSP_REDIS_PUSH) {
+        log_debug(LOG_INFO, "filter push rsp %"PRIu64" len %"PRIu32" on s %d",
+                  msg->id, msg->mlen, conn->sd);
+        rsp_put(msg);
+        return true;
+    }
+
     pmsg = TAILQ_FIRST(&conn->omsg_q);
     if (pmsg == NULL) {
         log_debug(LOG_ERR, "filter stray rsp %"PRIu64" len %"PRIu32" on s %d",
@@ -263,7 +280,7 @@ rsp_filter(struct context *ctx, struct conn *conn, struct msg *msg)
         conn->done = 1;
         return true;
     }
-    ASSERT(pmsg->peer == NULL);
+    ASSERT(pmsg->peer == NULL || pmsg->peer == msg);
     ASSERT(pmsg->request && !pmsg->done);
 
     /*
@@ -274,7 +291,7 @@ rsp_filter(struct context *ctx, struct conn *conn, struct msg *msg)
      * If auto_eject_host is enabled, this will also update the failure_count
      * and eject the server if it exceeds the failure_limit
      */
-    if (msg->failure(msg)) {
+    if (msg->ops->failure(msg)) {
         log_debug(LOG_INFO, "server failure rsp %"PRIu64" len %"PRIu32" "
                   "type %d on s %d", msg->id, msg->mlen, msg->type, conn->sd);
         rsp_put(msg);
@@ -292,6 +309,8 @@ rsp_filter(struct context *ctx, struct conn *conn, struct msg *msg)
         conn->dequeue_outq(ctx, conn, pmsg);
         pmsg->done = 1;
 
+        server_window_update(ctx, conn, pmsg);
+
         log_debug(LOG_INFO, "swallow rsp %"PRIu64" len %"PRIu32" of req "
                   "%"PRIu64" on s %d", msg->id, msg->mlen, pmsg->id,
                   conn->sd);
@@ -370,19 +389,23 @@ rsp_forward(struct context *ctx, struct conn *s_conn, struct msg *msg)
     
     /* dequeue peer message (request) from server */
     pmsg = TAILQ_FIRST(&s_conn->omsg_q); //omsg_q¼ͻ˵msgַ
-    ASSERT(pmsg != NULL && pmsg->peer == NULL);
+    ASSERT(pmsg != NULL && (pmsg->peer == NULL || pmsg->peer == msg));
     ASSERT(pmsg->request && !pmsg->done);
 
     /* pmsgΪտͻ˱ĵmsgϢmsgΪӦmsgϢ */
     s_conn->dequeue_outq(ctx, s_conn, pmsg);  //req_server_dequeue_omsgq 
     pmsg->done = 1;
 
+    server_window_update(ctx, s_conn, pmsg);
+
     /* ѽյĿͻmsgϢͺӦmsgϢй */
     /* establish msg <-> pmsg (response <-> request) link */
     pmsg->peer = msg; //msgrsp_send_nextзͣΪͻ˶ӦpeerҲǺӦmsg
     msg->peer = pmsg;
 
-    msg->pre_coalesce(msg); //memcache_pre_coalesce
+    slowlog_mark(pmsg, rsp_ts, msg->start_ts);
+
+    msg->ops->pre_coalesce(msg); //memcache_pre_coalesce
 
     c_conn = pmsg->owner;
     ASSERT(c_conn->client && !c_conn->proxy);
@@ -459,6 +482,171 @@ rsp_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
     rsp_forward(ctx, conn, msg);
 }
 
+/*
+ * Return the request that response msg, still being received on server
+ * connection s_conn, may be streamed to before it is complete, or NULL if
+ * it has to be received completely first. Only a response to a request
+ * that is not fragmented and heads the outq of its client is streamed, so
+ * all the responses before it have been sent and none is coalesced
+ */
+struct msg *
+rsp_stream_peer(struct conn *s_conn, struct msg *msg)
+{
+    struct msg *pmsg;
+    struct conn *c_conn;
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+    ASSERT(!msg->request && s_conn->rmsg == msg);
+
+    if (msg->peer != NULL) {
+        return msg->peer;
+    }
+
+    /* push frames and transient failures are never forwarded as they are */
+    if (msg->type == MSG_RSP_REDIS_PUSH || msg->ops->failure(msg)) {
+        return NULL;
+    }
+
+    pmsg = TAILQ_FIRST(&s_conn->omsg_q);
+    if (pmsg == NULL || pmsg->swallow || pmsg->quiet || pmsg->frag_id != 0) {
+        return NULL;
+    }
+    ASSERT(pmsg->request && !pmsg->done && pmsg->peer == NULL);
+
+    c_conn = pmsg->owner;
+    if (TAILQ_FIRST(&c_conn->omsg_q) != pmsg || c_conn->err || c_conn->done) {
+        return NULL;
+    }
+
+    return pmsg;
+}
+
+/*
+ * Stream the completed mbufs of response msg, which has been parsed as far
+ * as it has been received on server connection s_conn, to its client. All
+ * but the last mbuf of msg are complete; they are sent by rsp_send_next
+ * and released, so a large response does not pile up in the proxy
+ */
+void
+rsp_stream(struct context *ctx, struct conn *s_conn, struct msg *msg)
+{
+    rstatus_t status;
+    struct msg *pmsg;
+    struct conn *c_conn;
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+    ASSERT(!msg->request && s_conn->rmsg == msg);
+
+    if (splice_start(ctx, s_conn, msg)) {
+        return;
+    }
+
+    if (STAILQ_FIRST(&msg->mhdr) == STAILQ_LAST(&msg->mhdr, mbuf, next)) {
+        /* nothing complete to send yet */
+        return;
+    }
+
+    pmsg = rsp_stream_peer(s_conn, msg);
+    if (pmsg == NULL) {
+        return;
+    }
+
+    if (msg->peer == NULL) {
+        msg->peer = pmsg;
+        pmsg->peer = msg;
+
+        stats_server_incr(ctx, s_conn->owner, streamed_responses);
+
+        log_debug(LOG_VERB, "stream rsp %"PRIu64" of req %"PRIu64" from s %d "
+                  "to c %d", msg->id, pmsg->id, s_conn->sd,
+                  ((struct conn *)pmsg->owner)->sd);
+    }
+
+    c_conn = pmsg->owner;
+    status = event_add_out(ctx->evb, c_conn);
+    if (status != NC_OK) {
+        c_conn->err = errno;
+    }
+}
+
+/*
+ * Send the completed mbufs of response msg, which is still being received
+ * from its server, to client connection conn, whose outq it heads
+ */
+static void
+rsp_send_stream(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    rstatus_t status;
+
+    status = msg_send_partial(ctx, conn, msg, false);
+    if (status != NC_OK) {
+        /* on eagain, wait for the client socket to drain */
+        return;
+    }
+
+    /* wait for more of the response */
+    status = event_del_out(ctx->evb, conn);
+    if (status != NC_OK) {
+        conn->err = errno;
+    }
+}
+
+/*
+ * Unlink request pmsg, whose client is closing, from the response that is
+ * being streamed to it. The rest of the response is swallowed
+ */
+void
+rsp_stream_detach(struct context *ctx, struct msg *pmsg)
+{
+    struct msg *msg = pmsg->peer;
+    struct conn *s_conn = msg->owner;
+
+    ASSERT(pmsg->request && !pmsg->done);
+    ASSERT(!msg->request && msg->peer == pmsg && s_conn->rmsg == msg);
+
+    msg->peer = NULL;
+    pmsg->peer = NULL;
+
+    if (s_conn->splice != NULL) {
+        splice_detach(ctx, s_conn);
+    }
+}
+
+/*
+ * Abort the response being received on server connection s_conn, which
+ * is closing. If part of it has been streamed to its client already, no
+ * error response can follow, and the client is closed as well
+ */
+void
+rsp_stream_abort(struct context *ctx, struct conn *s_conn)
+{
+    struct msg *msg = s_conn->rmsg;
+    struct msg *pmsg;
+    struct conn *c_conn;
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+
+    splice_close(ctx, s_conn);
+
+    if (msg == NULL || msg->peer == NULL) {
+        return;
+    }
+
+    pmsg = msg->peer;
+    ASSERT(pmsg->request && !pmsg->done);
+
+    msg->peer = NULL;
+    pmsg->peer = NULL;
+
+    c_conn = pmsg->owner;
+    c_conn->err = s_conn->err != 0 ? s_conn->err : ECONNABORTED;
+
+    log_warn("close c %d after a partial rsp %"PRIu64" from s %d", c_conn->sd,
+             msg->id, s_conn->sd);
+
+    event_add_out(ctx->evb, c_conn);
+}
+
 /*
 *             Client+             Proxy           Server+
 *                              (nutcracker)
@@ -506,9 +694,25 @@ rsp_send_next(struct context *ctx, struct conn *conn)
 
     ASSERT(conn->client && !conn->proxy);
 
+    /* no error response follows a response that has been sent in part */
+    if (conn->err != 0) {
+        return NULL;
+    }
+
     //pmsgΪ,msgΪӦ
     
     pmsg = TAILQ_FIRST(&conn->omsg_q); //ֻһmsgݷϲŻͨmsg_send_chain->rsp_send_doneӶժ
+    if (pmsg != NULL && !pmsg->done && pmsg->peer != NULL) {
+        /* the response to the head request is still being received */
+        msg = pmsg->peer;
+        if (((struct conn *)msg->owner)->splice != NULL) {
+            splice_send(ctx, conn, msg);
+        } else {
+            rsp_send_stream(ctx, conn, msg);
+        }
+        return NULL;
+    }
+
     if (pmsg == NULL || !req_done(conn, pmsg)) {
         /* nothing is outstanding, initiate close? */
         //ֻomsg_qΪյʱ򣬲ſdoneǣȻcore_coreclose
@@ -621,5 +825,8 @@ rsp_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
     conn->dequeue_outq(ctx, conn, pmsg); 
     //rsp_send_doneӿͻconn->dequeue_outqг  rsp_forwardӷs_conn->dequeue_outqг
 
+    slowlog_record(ctx, conn, pmsg);
+    capture_record(pmsg, msg);
+
     req_put(pmsg);
 }
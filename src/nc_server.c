@@ -21,14 +21,15 @@
 #include <nc_core.h>
 #include <nc_server.h>
 #include <nc_conf.h>
+#include <nc_resolver.h>
 
 static void
 server_resolve(struct server *server, struct conn *conn)
 {
-    rstatus_t status;
+    /* never blocks; a stale address is used until refreshed */
+    resolver_refresh(server);
 
-    status = nc_resolve(&server->addrstr, server->port, &server->info);
-    if (status != NC_OK) {
+    if (server->resolved_at == 0) {
         conn->err = EHOSTDOWN;
         conn->done = 1;
         return;
@@ -62,6 +63,9 @@ server_ref(struct conn *conn, void *owner)
         //if(conn_t == NULL)
     printf("yang test xxxxxxxxxxxxxxxxxxxxxxxxxxxxx %p %p %p %p\r\n", conn, conn_t, server->s_conn_q.tqh_last, (&server->s_conn_q)->tqh_first);
 
+    conn->window = server->owner->server_window > 0 ? 1 : 0;
+    conn->window_ss = 1;
+
     conn->owner = owner; //ӶӦĺ˷ַserver
 
     log_debug(LOG_VVERB, "ref conn %p owner %p into '%.*s", conn, server,
@@ -81,6 +85,10 @@ server_unref(struct conn *conn)
 
     ASSERT(server->ns_conn_q != 0);
     server->ns_conn_q--;
+    if (conn->bulk) {
+        ASSERT(server->nb_conn_q != 0);
+        server->nb_conn_q--;
+    }
     TAILQ_REMOVE(&server->s_conn_q, conn, conn_tqe);
 
     log_debug(LOG_VVERB, "unref conn %p owner %p from '%.*s'", conn, server,
@@ -198,10 +206,11 @@ server_deinit(struct array *server)
 
 //Ϊserver׼conn
 struct conn *
-server_conn(struct server *server)
+server_conn(struct server *server, bool bulk)
 {
     struct server_pool *pool;
     struct conn *conn;
+    uint32_t nconn, max;
 
     pool = server->owner;//þĺserverӦĴserver,
 
@@ -211,20 +220,58 @@ server_conn(struct server *server)
      * 'server_connections:' > 0 key
      */
 
-    if (server->ns_conn_q < pool->server_connections) {
-        return conn_get(server, false, pool->redis);
+    /*
+     * Requests of the bulk command class have a group of connections of
+     * their own, so that point reads never queue behind them
+     */
+    if (bulk) {
+        nconn = server->nb_conn_q;
+        max = pool->bulk_connections;
+    } else {
+        nconn = server->ns_conn_q - server->nb_conn_q;
+        max = pool->server_connections;
+    }
+
+    if (nconn < max || nconn == 0) {
+        conn = conn_get(server, false, pool->redis);
+        if (conn != NULL && bulk) {
+            conn->bulk = 1;
+            server->nb_conn_q++;
+        }
+        return conn;
     }
-    ASSERT(server->ns_conn_q == pool->server_connections);
 
     /*
-     * Pick a server connection from the head of the queue and insert
-     * it back into the tail of queue to maintain the lru order
+     * Pick the first server connection of the group from the head of the
+     * queue and insert it back into the tail of queue to maintain the lru
+     * order
      */
 
      //ѯúͺ˵conn
-    conn = TAILQ_FIRST(&server->s_conn_q);
+    TAILQ_FOREACH(conn, &server->s_conn_q, conn_tqe) {
+        if (conn->bulk == bulk) {
+            break;
+        }
+    }
+    ASSERT(conn != NULL);
     ASSERT(!conn->client && !conn->proxy);
 
+    /*
+     * When the in-flight window of the lru connection is full, prefer
+     * a connection that still has room so that requests spread over all
+     * the server connections instead of queueing behind a slow one
+     */
+    if (!server_window_open(conn)) {
+        struct conn *c;
+
+        TAILQ_FOREACH(c, &server->s_conn_q, conn_tqe) {
+            if (c->bulk == bulk && server_window_open(c)) {
+                conn = c;
+                break;
+            }
+        }
+    }
+
     TAILQ_REMOVE(&server->s_conn_q, conn, conn_tqe);
     TAILQ_INSERT_TAIL(&server->s_conn_q, conn, conn_tqe);
 
@@ -243,7 +290,7 @@ server_each_preconnect(void *elem, void *data)
     server = elem;
     pool = server->owner; // - 127.0.0.1:6379:1 ӦĴserveralpha
 
-    conn = server_conn(server); //Ϊserver׼conn
+    conn = server_conn(server, false); //Ϊserver׼conn
     if (conn == NULL) {
         return NC_ENOMEM;
     }
@@ -374,6 +421,10 @@ server_close(struct context *ctx, struct conn *conn)
     server_close_stats(ctx, conn->owner, conn->err, conn->eof,
                        conn->connected);
 
+    if (conn->connected) {
+        stats_server_decr_by(ctx, conn->owner, server_window, conn->window);
+    }
+
     conn->connected = false;
 
     if (conn->sd < 0) {
@@ -383,6 +434,8 @@ server_close(struct context *ctx, struct conn *conn)
         return;
     }
 
+    rsp_stream_abort(ctx, conn);
+
     for (msg = TAILQ_FIRST(&conn->imsg_q); msg != NULL; msg = nmsg) {
         nmsg = TAILQ_NEXT(msg, s_tqe);
 
@@ -407,7 +460,7 @@ server_close(struct context *ctx, struct conn *conn)
             msg->err = conn->err;
 
             if (msg->frag_owner != NULL) {
-                msg->frag_owner->nfrag_done++;
+                msg->frag_owner->frag->nfrag_done++;
             }
 
             if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
@@ -440,7 +493,7 @@ server_close(struct context *ctx, struct conn *conn)
             msg->error = 1;
             msg->err = conn->err;
             if (msg->frag_owner != NULL) {
-                msg->frag_owner->nfrag_done++;
+                msg->frag_owner->frag->nfrag_done++;
             }
 
             if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
@@ -577,6 +630,7 @@ server_connected(struct context *ctx, struct conn *conn)
     ASSERT(conn->connecting && !conn->connected);
 
     stats_server_incr(ctx, server, server_connections);
+    stats_server_incr_by(ctx, server, server_window, conn->window);
 
     conn->connecting = 0;
     conn->connected = 1;
@@ -605,6 +659,105 @@ server_ok(struct context *ctx, struct conn *conn)
     }
 }
 
+/*
+ * Return true if server connection 'conn' may take another request. The
+ * requests still being written out count against the in-flight window
+ * as well as those waiting for a reply.
+ */
+bool
+server_window_open(struct conn *conn)
+{
+    ASSERT(!conn->client && !conn->proxy);
+
+    return conn->window == 0 || conn->nout + conn->nsend < conn->window;
+}
+
+/*
+ * Adapt the in-flight window of server connection 'conn' on a reply to
+ * request 'msg' (AIMD). Once a window worth of replies has come back,
+ * the window is halved if even the fastest of them was well above the
+ * base latency of the connection (requests are queueing on the server),
+ * and grows by one otherwise. Like tcp slow start, a new connection
+ * starts with a window of one so that it learns the base latency of an
+ * idle server, and doubles its window until the first sign of queueing.
+ * The base latency is the minimum latency seen over the last
+ * SERVER_WINDOW_EPOCH replies, so that it follows a server whose latency
+ * drifts over time.
+ */
+void
+server_window_update(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    struct server *server = conn->owner;
+    struct server_pool *pool = server->owner;
+    int64_t now, rtt, limit;
+    uint32_t window;
+    rstatus_t status;
+
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(msg->request);
+
+    if (conn->window == 0 || msg->send_ts <= 0) {
+        return;
+    }
+
+    now = nc_usec_now();
+    if (now < 0) {
+        return;
+    }
+    rtt = now - msg->send_ts;
+
+    if (conn->nrtt == 0 || rtt < conn->rtt_epoch_min) {
+        conn->rtt_epoch_min = rtt;
+    }
+    if (++conn->nrtt >= SERVER_WINDOW_EPOCH) {
+        conn->rtt_min = conn->rtt_epoch_min;
+        conn->nrtt = 0;
+    }
+    if (conn->rtt_min == 0 || rtt < conn->rtt_min) {
+        conn->rtt_min = rtt;
+    }
+
+    if (conn->nack == 0 || rtt < conn->rtt_ack_min) {
+        conn->rtt_ack_min = rtt;
+    }
+
+    if (++conn->nack >= conn->window) {
+        limit = conn->rtt_min + MAX(conn->rtt_min, SERVER_WINDOW_SLACK);
+        window = conn->window;
+
+        if (conn->rtt_ack_min > limit) {
+            conn->window = MAX(conn->window / 2, 1);
+            conn->window_ss = 0;
+        } else if (conn->window_ss) {
+            conn->window = MIN(conn->window * 2, pool->server_window);
+        } else if (conn->window < pool->server_window) {
+            conn->window++;
+        }
+        conn->nack = 0;
+
+        if (conn->window > window) {
+            stats_server_incr_by(ctx, server, server_window,
+                                 conn->window - window);
+        } else if (conn->window < window) {
+            stats_server_decr_by(ctx, server, server_window,
+                                 window - conn->window);
+        }
+
+        log_debug(LOG_VERB, "s %d window %"PRIu32" rtt %"PRId64" base %"PRId64
+                  " usec", conn->sd, conn->window, conn->rtt_ack_min,
+                  conn->rtt_min);
+    }
+
+    /* requests held back by a full window can go out again */
+    if (!TAILQ_EMPTY(&conn->imsg_q) && server_window_open(conn) &&
+        !conn->done && conn->err == 0) {
+        status = event_add_out(ctx->evb, conn);
+        if (status != NC_OK) {
+            conn->err = errno;
+        }
+    }
+}
+
 static rstatus_t
 server_pool_update(struct server_pool *pool)
 {
@@ -653,32 +806,20 @@ server_pool_update(struct server_pool *pool)
     return NC_OK;
 }
 
-static uint32_t
+/*
+ * Hash key for the distribution of pool; the parser hashes every key of a
+ * request once, see msg_key_hash(), and a reload hashes the keys of requests
+ * still being parsed again, see server_pool_rehash()
+ */
+uint32_t
 server_pool_hash(struct server_pool *pool, uint8_t *key, uint32_t keylen)
 {
-    ASSERT(array_n(&pool->server) != 0);
     ASSERT(key != NULL);
 
-    if (array_n(&pool->server) == 1) {
+    if (array_n(&pool->server) <= 1 || pool->dist_type == DIST_RANDOM) {
         return 0;
     }
 
-    if (keylen == 0) {
-        return 0;
-    }
-
-    return pool->key_hash((char *)key, keylen); //YANG ADD XXXXXXXXXX TODOҪΪredisһ
-}
-
-//keyѡٺָidxķ     memcachedslot
-uint32_t
-server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen)
-{
-    uint32_t hash, idx;
-
-    ASSERT(array_n(&pool->server) != 0);
-    ASSERT(key != NULL);
-
     /*
      * If hash_tag: is configured for this server pool, we use the part of
      * the key within the hash tag as an input to the distributor. Otherwise
@@ -698,14 +839,27 @@ server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen)
         }
     }
 
+    if (keylen == 0) {
+        return 0;
+    }
+
+    return pool->key_hash((char *)key, keylen); //YANG ADD XXXXXXXXXX TODOҪΪredisһ
+}
+
+//keyѡٺָidxķ     memcachedslot
+uint32_t
+server_pool_idx(struct server_pool *pool, uint32_t hash)
+{
+    uint32_t idx;
+
+    ASSERT(array_n(&pool->server) != 0);
+
     switch (pool->dist_type) {
     case DIST_KETAMA:
-        hash = server_pool_hash(pool, key, keylen);
         idx = ketama_dispatch(pool->continuum, pool->ncontinuum, hash);
         break;
 
     case DIST_MODULA:
-        hash = server_pool_hash(pool, key, keylen);
         idx = modula_dispatch(pool->continuum, pool->ncontinuum, hash);
         break;
 
@@ -724,23 +878,24 @@ server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen)
 //server_pool_serverѡٺ˷ketama_updateΪһhashصketama㷨
 //keyѡٺ˷
 static struct server *
-server_pool_server(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+server_pool_server(struct server_pool *pool, struct keypos *kpos)
 {
     struct server *server;
     uint32_t idx;
 
-    idx = server_pool_idx(pool, key, keylen);
+    idx = server_pool_idx(pool, kpos->hash);
     server = array_get(&pool->server, idx);
 
-    log_debug(LOG_VERB, "key '%.*s' on dist %d maps to server '%.*s'", keylen,
-              key, pool->dist_type, server->pname.len, server->pname.data);
+    log_debug(LOG_VERB, "key '%.*s' on dist %d maps to server '%.*s'",
+              (int)(kpos->end - kpos->start), kpos->start, pool->dist_type,
+              server->pname.len, server->pname.data);
 
     return server;
 }
 
 struct conn *
-server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
-                 uint32_t keylen)
+server_pool_conn(struct context *ctx, struct server_pool *pool,
+                 struct keypos *kpos, bool bulk)
 {//ѡٺ˷
     rstatus_t status;
     struct server *server;
@@ -751,14 +906,14 @@ server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
         return NULL;
     }
 
-    /* from a given {key, keylen} pick a server from pool */
-    server = server_pool_server(pool, key, keylen);//ѡٺ˷
+    /* from a given key pick a server from pool */
+    server = server_pool_server(pool, kpos);//ѡٺ˷
     if (server == NULL) {
         return NULL;
     }
 
     /* pick a connection to a given server */
-    conn = server_conn(server);  //Ϊѡٳĺserver׼conn
+    conn = server_conn(server, bulk);  //Ϊѡٳĺserver׼conn
     if (conn == NULL) {
         return NULL;
     }
@@ -772,6 +927,13 @@ server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
     return conn;
 }
 
+/* Return true if requests of 'type' are in the bulk command class of pool */
+bool
+server_pool_bulk(struct server_pool *pool, msg_type_t type)
+{
+    return (pool->bulk_type[type >> 3] & (1 << (type & 7))) != 0;
+}
+
 static rstatus_t
 server_pool_each_preconnect(void *elem, void *data)
 {
@@ -843,7 +1005,8 @@ server_pool_each_calc_connections(void *elem, void *data)
     struct server_pool *sp = elem;
     struct context *ctx = data;
 
-    ctx->max_nsconn += sp->server_connections * array_n(&sp->server);
+    ctx->max_nsconn += (sp->server_connections + sp->bulk_connections) *
+                       array_n(&sp->server);
     ctx->max_nsconn += 1; /* pool listening socket */
 
     return NC_OK;
@@ -952,6 +1115,7 @@ server_pool_deinit(struct array *server_pool)
         sp = array_pop(server_pool);
         ASSERT(sp->p_conn == NULL);
         ASSERT(TAILQ_EMPTY(&sp->c_conn_q) && sp->nc_conn_q == 0);
+        ASSERT(TAILQ_EMPTY(&sp->c_park_q));
 
         if (sp->continuum != NULL) {
             nc_free(sp->continuum);
@@ -962,6 +1126,17 @@ server_pool_deinit(struct array *server_pool)
 
         server_deinit(&sp->server);
 
+        hotkey_destroy(sp->hotkey);
+        sp->hotkey = NULL;
+
+        slowlog_destroy(sp->slowlog);
+        sp->slowlog = NULL;
+
+        while (array_n(&sp->client_limit) != 0) {
+            array_pop(&sp->client_limit);
+        }
+        array_deinit(&sp->client_limit);
+
         log_debug(LOG_DEBUG, "deinit pool %"PRIu32" '%.*s'", sp->idx,
                   sp->name.len, sp->name.data);
     }
@@ -970,3 +1145,360 @@ server_pool_deinit(struct array *server_pool)
 
     log_debug(LOG_DEBUG, "deinit %"PRIu32" pools", npool);
 }
+
+/*
+ * Return the server in 'server' that 's' replaces across a reload, i.e.
+ * the one with the same name at the same address, or NULL if there is none
+ */
+static struct server *
+server_pool_reload_match(struct array *server, struct server *s)
+{
+    uint32_t i, nserver;
+
+    for (i = 0, nserver = array_n(server); i < nserver; i++) {
+        struct server *os = array_get(server, i);
+
+        if (string_compare(&os->name, &s->name) == 0 &&
+            string_compare(&os->addrstr, &s->addrstr) == 0 &&
+            os->port == s->port) {
+            return os;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Build the reloaded pool 'sp' from the conf pool 'cp' in place of 'pool',
+ * including its continuum, without touching 'pool' itself
+ */
+static rstatus_t
+server_pool_reload_prepare(struct server_pool *pool, struct conf_pool *cp,
+                           struct array *server_pool)
+{
+    rstatus_t status;
+    struct server_pool *sp;
+    uint32_t i, nserver;
+
+    status = conf_pool_each_transform(cp, server_pool);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    sp = array_top(server_pool);
+    sp->idx = pool->idx;
+    sp->ctx = pool->ctx;
+
+    if (string_compare(&sp->addrstr, &pool->addrstr) != 0 ||
+        sp->perm != pool->perm || sp->redis != pool->redis) {
+        log_error("reload of pool %"PRIu32" '%.*s' failed: listen and "
+                  "protocol can only change on upgrade", pool->idx,
+                  pool->name.len, pool->name.data);
+        return NC_ERROR;
+    }
+
+    /* surviving servers keep their health, so ejected ones stay ejected */
+    for (i = 0, nserver = array_n(&sp->server); i < nserver; i++) {
+        struct server *s = array_get(&sp->server, i);
+        struct server *os = server_pool_reload_match(&pool->server, s);
+
+        if (os != NULL) {
+            /* keep whichever address was resolved last */
+            if (os->resolved_at > s->resolved_at) {
+                nc_memcpy(&s->info, &os->info, sizeof(s->info));
+                s->resolved_at = os->resolved_at;
+            }
+            s->resolve_next = os->resolve_next;
+            s->resolving = os->resolving;
+            s->next_retry = os->next_retry;
+            s->failure_count = os->failure_count;
+            s->ejected = os->ejected;
+            s->draining = os->draining;
+        }
+    }
+
+    return server_pool_run(sp);
+}
+
+/*
+ * Hash the keys of the requests that the clients of 'pool' are in the middle
+ * of sending again, as the number of servers, hash, hash_tag or distribution
+ * they were hashed for may have changed
+ */
+static void
+server_pool_rehash(struct server_pool *pool)
+{
+    struct conn *conn;
+
+    TAILQ_FOREACH(conn, &pool->c_conn_q, conn_tqe) {
+        if (conn->rmsg != NULL) {
+            msg_key_rehash(conn->rmsg);
+        }
+    }
+
+    TAILQ_FOREACH(conn, &pool->c_park_q, conn_tqe) {
+        if (conn->rmsg != NULL) {
+            msg_key_rehash(conn->rmsg);
+        }
+    }
+}
+
+/*
+ * Swap the servers, continuum and settings of the reloaded pool 'sp' into
+ * 'pool', moving the connections of surviving servers along. 'sp' is left
+ * holding the old servers and continuum.
+ */
+static void
+server_pool_reload_swap(struct server_pool *pool, struct server_pool *sp)
+{
+    struct server_pool opool;
+    struct conn *conn;
+    uint32_t i, nserver, nkept;
+    int64_t now;
+
+    for (i = 0, nkept = 0, nserver = array_n(&sp->server); i < nserver; i++) {
+        struct server *s = array_get(&sp->server, i);
+        struct server *os = server_pool_reload_match(&pool->server, s);
+
+        s->owner = pool;
+
+        if (os == NULL) {
+            continue;
+        }
+
+        nkept++;
+
+        while (!TAILQ_EMPTY(&os->s_conn_q)) {
+            conn = TAILQ_FIRST(&os->s_conn_q);
+            TAILQ_REMOVE(&os->s_conn_q, conn, conn_tqe);
+            TAILQ_INSERT_TAIL(&s->s_conn_q, conn, conn_tqe);
+            conn->owner = s;
+            conn->addr = (struct sockaddr *)&s->info.addr;
+        }
+        s->ns_conn_q = os->ns_conn_q;
+        s->nb_conn_q = os->nb_conn_q;
+        os->ns_conn_q = 0;
+        os->nb_conn_q = 0;
+    }
+
+    log_debug(LOG_NOTICE, "reload pool %"PRIu32" '%.*s' keeping %"PRIu32" of "
+              "%"PRIu32" servers and adding %"PRIu32"", pool->idx,
+              pool->name.len, pool->name.data, nkept, array_n(&pool->server),
+              nserver - nkept);
+
+    opool = *pool;
+    *pool = *sp;
+
+    /* the listener and client connections stay with the pool */
+    pool->idx = opool.idx;
+    pool->ctx = opool.ctx;
+    pool->p_conn = opool.p_conn;
+    pool->nc_conn_q = opool.nc_conn_q;
+    pool->c_conn_q = opool.c_conn_q;
+    pool->c_park_q = opool.c_park_q;
+
+    /*
+     * Without idle timeouts client activity is not tracked (see core_core),
+     * so clients start out active when the reload turns them on
+     */
+    if (!opool.client_park_timeout && !opool.client_idle_timeout &&
+        (pool->client_park_timeout || pool->client_idle_timeout)) {
+        now = nc_msec_now();
+        TAILQ_FOREACH(conn, &pool->c_conn_q, conn_tqe) {
+            conn->last_active = now;
+        }
+    }
+
+    sp->server = opool.server;
+    sp->continuum = opool.continuum;
+    sp->ncontinuum = opool.ncontinuum;
+    sp->nserver_continuum = opool.nserver_continuum;
+    sp->nlive_server = opool.nlive_server;
+
+    /* server indices changed, so the pool starts a new hot key sketch */
+    sp->hotkey = opool.hotkey;
+
+    /* and a new slow log, with the threshold and length it is reloaded with */
+    sp->slowlog = opool.slowlog;
+
+    /*
+     * The pool keeps its bucket and fair queuing clock, while the clients
+     * are bound to the reloaded client_limits rules, which start full
+     */
+    pool->bucket = opool.bucket;
+    pool->vtime = opool.vtime;
+    sp->client_limit = opool.client_limit;
+    limit_rebind(pool);
+
+    server_pool_rehash(pool);
+}
+
+/*
+ * Close the connections of 'pool' to servers that are gone from the
+ * reloaded pool 'sp' or moved. This is done while the stats still map
+ * the old servers.
+ */
+static void
+server_pool_reload_disconnect(struct server_pool *pool, struct server_pool *sp)
+{
+    uint32_t i;
+
+    for (i = 0; i < array_n(&pool->server); i++) {
+        struct server *os = array_get(&pool->server, i);
+
+        if (server_pool_reload_match(&sp->server, os) == NULL) {
+            server_each_disconnect(os, NULL);
+        }
+    }
+}
+
+/*
+ * Swap the reloaded pool 'sp' into 'pool', and resolve and connect the
+ * servers that are new
+ */
+static void
+server_pool_reload_apply(struct server_pool *pool, struct server_pool *sp)
+{
+    uint32_t i;
+
+    server_pool_reload_swap(pool, sp);
+
+    for (i = 0; i < array_n(&pool->server); i++) {
+        struct server *s = array_get(&pool->server, i);
+
+        /* servers added unresolved are resolved in the background */
+        if (s->resolved_at == 0) {
+            resolver_refresh(s);
+        }
+
+        if (pool->preconnect && s->ns_conn_q == 0) {
+            server_each_preconnect(s, NULL);
+        }
+    }
+}
+
+static void
+server_pool_reload_done(struct context *ctx)
+{
+    ctx->max_nsconn = 0;
+    array_each(&ctx->pool, server_pool_each_calc_connections, ctx);
+    ctx->max_ncconn = ctx->max_nfd - ctx->max_nsconn - RESERVED_FDS;
+}
+
+/*
+ * Reload the server pools from 'conf_pool', keeping the listeners, client
+ * connections and connections to servers that did not change. Pools can
+ * neither be added nor removed, and their listen address and protocol are
+ * fixed; those changes need an upgrade.
+ */
+rstatus_t
+server_pool_reload(struct context *ctx, struct array *conf_pool)
+{
+    rstatus_t status;
+    struct array server_pool;
+    uint32_t i, j, npool;
+
+    npool = array_n(&ctx->pool);
+    if (array_n(conf_pool) != npool) {
+        log_error("reload failed: pools can only be added or removed on "
+                  "upgrade");
+        return NC_ERROR;
+    }
+
+    status = array_init(&server_pool, npool, sizeof(struct server_pool));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    /* build the reloaded pools in the order of the pools they replace */
+    for (i = 0; i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+        struct conf_pool *cp;
+
+        for (j = 0; j < npool; j++) {
+            cp = array_get(conf_pool, j);
+            if (string_compare(&cp->name, &pool->name) == 0) {
+                break;
+            }
+        }
+
+        if (j == npool) {
+            log_error("reload failed: pool %"PRIu32" '%.*s' can only be "
+                      "removed on upgrade", pool->idx, pool->name.len,
+                      pool->name.data);
+            status = NC_ERROR;
+            goto done;
+        }
+
+        status = server_pool_reload_prepare(pool, cp, &server_pool);
+        if (status != NC_OK) {
+            goto done;
+        }
+    }
+
+    /* connections to servers that are gone or moved are closed */
+    for (i = 0; i < npool; i++) {
+        server_pool_reload_disconnect(array_get(&ctx->pool, i),
+                                      array_get(&server_pool, i));
+    }
+
+    status = stats_remap(ctx->stats, &server_pool);
+    if (status != NC_OK) {
+        goto done;
+    }
+
+    for (i = 0; i < npool; i++) {
+        server_pool_reload_apply(array_get(&ctx->pool, i),
+                                 array_get(&server_pool, i));
+    }
+
+    server_pool_reload_done(ctx);
+
+done:
+    server_pool_deinit(&server_pool);
+    return status;
+}
+
+/*
+ * Apply the servers of conf pool 'cp' to 'pool' alone, as the admin port
+ * does for a single server change. The other pools are not touched, and
+ * 'pool' keeps its client_limits rules and their buckets, which did not
+ * change; its hot key sketch and slow log restart as on a reload.
+ */
+rstatus_t
+server_pool_reload_one(struct context *ctx, struct server_pool *pool,
+                       struct conf_pool *cp)
+{
+    rstatus_t status;
+    struct array server_pool;
+    struct server_pool *sp;
+
+    status = array_init(&server_pool, 1, sizeof(struct server_pool));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = server_pool_reload_prepare(pool, cp, &server_pool);
+    if (status != NC_OK) {
+        goto done;
+    }
+
+    sp = array_get(&server_pool, 0);
+
+    server_pool_reload_disconnect(pool, sp);
+
+    status = stats_remap(ctx->stats, &server_pool);
+    if (status != NC_OK) {
+        goto done;
+    }
+
+    array_swap(&sp->client_limit, &pool->client_limit);
+
+    server_pool_reload_apply(pool, sp);
+
+    server_pool_reload_done(ctx);
+
+done:
+    server_pool_deinit(&server_pool);
+    return status;
+}
@@ -20,6 +20,9 @@
 
 #include <nc_core.h>
 
+#define SERVER_WINDOW_EPOCH     1024        /* # replies per base latency epoch */
+#define SERVER_WINDOW_SLACK     1000        /* min latency headroom in usec */
+
 /*
  * server_pool is a collection of servers and their continuum. Each
  * server_pool is the owner of a single proxy connection and one or
@@ -82,15 +85,21 @@ struct server { //server_pool->server
     uint16_t           port;          /* port */
     uint32_t           weight;        /* weight */
     struct sockinfo    info;          /* server socket info */
+    int64_t            resolved_at;   /* time info was resolved in usec, 0 if never */
+    int64_t            resolve_next;  /* no resolution retry before this time in usec */
 
     //server_ref  ʾtwemproxy̺͸úserver
     uint32_t           ns_conn_q;     /* # server connection */
+    uint32_t           nb_conn_q;     /* # server connection of the bulk group */
     //connӶУserver_ref  
     struct conn_tqh    s_conn_q;      /* server connection q */
     //ԷֹߺˣǾѡٲ⣬ߺômsԼѡٸ÷
     int64_t            next_retry;    /* next retry time in usec */
     //failure_countserver_failure_limitϣserver_failure
     uint32_t           failure_count; /* # consecutive failures */ //дʧܴserver_failure
+    unsigned           ejected:1;     /* ejected through admin? */
+    unsigned           draining:1;    /* drained through admin? */
+    unsigned           resolving:1;   /* resolution in progress? */
 };
 
 
@@ -142,6 +151,7 @@ struct server_pool { //
     uint32_t           nc_conn_q;            /* # client connection */
     //ÿһserver_poolжclientÿһclientӶserver_pool->c_conn_qС
     struct conn_tqh    c_conn_q;             /* client connection q */
+    struct conn_tqh    c_park_q;             /* parked client connection q */
 
     //ռserver_init͸ֵconf_pool_each_transform      conf_pool->serverпݹ
     //ļÿserverжӦservers: 
@@ -178,10 +188,23 @@ struct server_pool { //
     uint32_t           client_connections;   /* maximum # client connection */
     //ÿserverĬΪ1
     uint32_t           server_connections;   /* maximum # server connection */
+    uint32_t           server_window;        /* maximum # in-flight requests per server connection */
+    uint32_t           bulk_connections;     /* maximum # bulk server connection, 0 to queue bulk requests last */
+    uint8_t            bulk_type[(MSG_SENTINEL + 7) / 8]; /* msg_type bitmap of bulk_commands */
     //⵽ߺ󣬹ôʱֿʵѡú
     int64_t            server_retry_timeout; /* server retry timeout in usec */
     //failure_countserver_failure_limitϣserver_failure
     uint32_t           server_failure_limit; /* server failure limit */
+    struct hotkey      *hotkey;              /* hot key sketch, NULL if disabled */
+    struct slowlog     *slowlog;             /* slow log, NULL if disabled */
+    uint32_t           splice_threshold;     /* min value bytes to splice, 0 if disabled */
+    int64_t            client_park_timeout;  /* park idle clients after msec, 0 if never */
+    int64_t            client_idle_timeout;  /* close idle clients after msec, 0 if never */
+    uint32_t           client_rate;          /* max req/s per client connection, 0 if unlimited */
+    uint32_t           pool_rate;            /* max req/s of all clients, 0 if unlimited */
+    struct limit_bucket bucket;              /* pool_rate bucket */
+    struct array       client_limit;         /* limit_rule[] of client networks */
+    uint64_t           vtime;                /* virtual clock for fair queuing */
     struct string      redis_auth;           /* redis_auth password (matches requirepass on redis) */
     //ǷҪ  redis_auth Ҫ
     unsigned           require_auth;         /* require_auth? */
@@ -191,6 +214,7 @@ struct server_pool { //
     unsigned           preconnect:1;         /* preconnect? */ //ǷӺú˷ǵȵһںͺ˷
     unsigned           redis:1;              /* redis? */
     unsigned           tcpkeepalive:1;       /* tcpkeepalive? */ //conf_pool_each_transform
+    unsigned           fair_queue:1;         /* queue requests fairly across clients? */
 };
 
 void server_ref(struct conn *conn, void *owner);
@@ -199,18 +223,24 @@ int server_timeout(struct conn *conn);
 bool server_active(struct conn *conn);
 rstatus_t server_init(struct array *server, struct array *conf_server, struct server_pool *sp);
 void server_deinit(struct array *server);
-struct conn *server_conn(struct server *server);
+struct conn *server_conn(struct server *server, bool bulk);
 rstatus_t server_connect(struct context *ctx, struct server *server, struct conn *conn);
 void server_close(struct context *ctx, struct conn *conn);
 void server_connected(struct context *ctx, struct conn *conn);
 void server_ok(struct context *ctx, struct conn *conn);
+bool server_window_open(struct conn *conn);
+void server_window_update(struct context *ctx, struct conn *conn, struct msg *msg);
 
-uint32_t server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen);
-struct conn *server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key, uint32_t keylen);
+uint32_t server_pool_hash(struct server_pool *pool, uint8_t *key, uint32_t keylen);
+uint32_t server_pool_idx(struct server_pool *pool, uint32_t hash);
+struct conn *server_pool_conn(struct context *ctx, struct server_pool *pool, struct keypos *kpos, bool bulk);
+bool server_pool_bulk(struct server_pool *pool, msg_type_t type);
 rstatus_t server_pool_run(struct server_pool *pool);
 rstatus_t server_pool_preconnect(struct context *ctx);
 void server_pool_disconnect(struct context *ctx);
 rstatus_t server_pool_init(struct array *server_pool, struct array *conf_pool, struct context *ctx);
 void server_pool_deinit(struct array *server_pool);
+rstatus_t server_pool_reload(struct context *ctx, struct array *conf_pool);
+rstatus_t server_pool_reload_one(struct context *ctx, struct server_pool *pool, struct conf_pool *cp);
 
 #endif
@@ -20,6 +20,8 @@
 
 #include <nc_core.h>
 #include <nc_signal.h>
+#include <nc_upgrade.h>
+#include <nc_reload.h>
 
 static struct signal signals[] = {
     { SIGUSR1, "SIGUSR1", 0,                 signal_handler },
@@ -28,11 +30,21 @@ static struct signal signals[] = {
     { SIGTTOU, "SIGTTOU", 0,                 signal_handler },
     { SIGHUP,  "SIGHUP",  0,                 signal_handler },
     { SIGINT,  "SIGINT",  0,                 signal_handler },
+    { SIGTERM, "SIGTERM", 0,                 signal_handler },
     { SIGSEGV, "SIGSEGV", (int)SA_RESETHAND, signal_handler },
     { SIGPIPE, "SIGPIPE", 0,                 SIG_IGN },
     { 0,        NULL,     0,                 NULL }
 };
 
+static volatile sig_atomic_t signal_exit_signo; /* signal asking to exit */
+
+static void
+signal_reload(void)
+{
+    log_reopen();
+    reload_request();
+}
+
 rstatus_t
 signal_init(void)
 {
@@ -63,13 +75,37 @@ signal_deinit(void)
 {
 }
 
+/*
+ * Return the signal that asked us to exit, if any. The event loop stops on
+ * it, so that the process exits outside of the signal handler.
+ */
+int
+signal_exiting(void)
+{
+    return signal_exit_signo;
+}
+
+/*
+ * Exit on SIGTERM with its default action once shutdown is done, which
+ * keeps the exit status the process had before it handled SIGTERM
+ */
+void
+signal_exit(void)
+{
+    if (signal_exit_signo != SIGTERM) {
+        return;
+    }
+
+    signal(SIGTERM, SIG_DFL);
+    raise(SIGTERM);
+}
+
 void
 signal_handler(int signo)
 {
     struct signal *sig;
     void (*action)(void);
     char *actionstr;
-    bool done;
 
     for (sig = signals; sig->signo != 0; sig++) {
         if (sig->signo == signo) {
@@ -80,13 +116,14 @@ signal_handler(int signo)
 
     actionstr = "";
     action = NULL;
-    done = false;
 
     switch (signo) {
     case SIGUSR1:
         break;
 
     case SIGUSR2:
+        actionstr = ", upgrading binary";
+        action = upgrade_request;
         break;
 
     case SIGTTIN:
@@ -100,16 +137,18 @@ signal_handler(int signo)
         break;
 
     case SIGHUP:
-        actionstr = ", reopening log file";
-        action = log_reopen;
+        actionstr = ", reopening log file and reloading configuration";
+        action = signal_reload;
         break;
 
     case SIGINT:
-        done = true;
+    case SIGTERM:
+        signal_exit_signo = signo;
         actionstr = ", exiting";
         break;
 
     case SIGSEGV:
+        log_flush_safe();
         log_stacktrace();
         actionstr = ", core dumping";
         raise(SIGSEGV);
@@ -124,8 +163,4 @@ signal_handler(int signo)
     if (action != NULL) {
         action();
     }
-
-    if (done) {
-        exit(1);
-    }
 }
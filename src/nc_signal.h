@@ -29,6 +29,8 @@ struct signal {
 
 rstatus_t signal_init(void);
 void signal_deinit(void);
+int signal_exiting(void);
+void signal_exit(void);
 void signal_handler(int signo);
 
 #endif
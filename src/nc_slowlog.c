@@ -0,0 +1,200 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_slowlog.h>
+#include <nc_hashkit.h>
+
+/*
+ * Slow log.
+ *
+ * When a pool has a slow log, every request it receives is timestamped
+ * as it goes through the proxy: first byte received (start_ts), parsed
+ * (parse_ts), enqueued on a server connection (enqueue_ts), written to
+ * the server (write_ts) and first response byte received (rsp_ts). Once
+ * the response is sent to the client, a request that took longer than
+ * slowlog_slower_than is logged with the time it spent in each phase, so
+ * a slow client, a long proxy queue and a slow server can be told apart.
+ */
+
+struct slowlog *
+slowlog_create(int64_t slower_than, uint32_t max_len)
+{
+    struct slowlog *sl;
+
+    ASSERT(slower_than > 0);
+    ASSERT(max_len > 0);
+
+    sl = nc_zalloc(sizeof(*sl));
+    if (sl == NULL) {
+        return NULL;
+    }
+
+    sl->entry = nc_zalloc(sizeof(*sl->entry) * max_len);
+    if (sl->entry == NULL) {
+        nc_free(sl);
+        return NULL;
+    }
+
+    sl->slower_than = slower_than;
+    sl->max_len = max_len;
+    sl->len = 0;
+    sl->next_id = 0;
+
+    return sl;
+}
+
+void
+slowlog_destroy(struct slowlog *sl)
+{
+    if (sl == NULL) {
+        return;
+    }
+
+    nc_free(sl->entry);
+    nc_free(sl);
+}
+
+/*
+ * Return true if messages received on conn are timed for the slow log
+ */
+bool
+slowlog_timed(struct conn *conn)
+{
+    struct server_pool *pool;
+
+    if (conn->proxy) {
+        return false;
+    }
+
+    if (conn->client) {
+        pool = conn->owner;
+    } else {
+        struct server *server = conn->owner;
+        pool = server->owner;
+    }
+
+    return pool->slowlog != NULL;
+}
+
+/*
+ * Log request req if it was slow. Called as its response has been sent
+ * to the client on conn
+ */
+void
+slowlog_record(struct context *ctx, struct conn *conn, struct msg *req)
+{
+    struct server_pool *pool;
+    struct slowlog *sl;
+    struct slowlog_entry *se;
+    struct keypos *kpos;
+    int64_t ts[SLOWLOG_NPHASE + 1];
+    uint32_t i;
+
+    ASSERT(conn->client && !conn->proxy);
+    ASSERT(req->request);
+
+    pool = conn->owner;
+    sl = pool->slowlog;
+
+    if (sl == NULL || !req->timed || req->start_ts == 0) {
+        return;
+    }
+
+    /* a fragment? its owner is logged for the whole request */
+    if (req->frag_id != 0 && req->frag_owner != req) {
+        return;
+    }
+
+    ts[SLOWLOG_NPHASE] = nc_usec_now();
+    if (ts[SLOWLOG_NPHASE] - req->start_ts < sl->slower_than) {
+        return;
+    }
+
+    stats_pool_incr(ctx, pool, slow_requests);
+
+    se = &sl->entry[sl->next_id % sl->max_len];
+    se->id = sl->next_id++;
+    sl->len = MIN(sl->len + 1, sl->max_len);
+
+    /*
+     * A request that never reached a phase, like one answered by the
+     * proxy or one that timed out on the server, has the time it waited
+     * charged to the last phase it reached
+     */
+    ts[SLOWLOG_RECV] = req->start_ts;
+    ts[SLOWLOG_ROUTE] = req->parse_ts;
+    ts[SLOWLOG_QUEUE] = req->enqueue_ts;
+    ts[SLOWLOG_SERVER] = req->write_ts;
+    ts[SLOWLOG_REPLY] = req->rsp_ts;
+    for (i = SLOWLOG_NPHASE - 1; i > 0; i--) {
+        if (ts[i] == 0) {
+            ts[i] = ts[i + 1];
+        }
+    }
+
+    se->start = ts[0];
+    se->duration = ts[SLOWLOG_NPHASE] - ts[0];
+    for (i = 0; i < SLOWLOG_NPHASE; i++) {
+        se->phase[i] = MAX(ts[i + 1] - ts[i], 0);
+    }
+
+    se->type = req->type;
+    se->nkey = array_n(&req->keys);
+    se->server = UINT32_MAX;
+    se->keylen = 0;
+
+    if (se->nkey > 0) {
+        kpos = array_get(&req->keys, 0);
+        se->keylen = (uint32_t)(kpos->end - kpos->start);
+        nc_memcpy(se->key, kpos->start, MIN(se->keylen, SLOWLOG_KEY_LEN));
+
+        if (pool->dist_type != DIST_RANDOM && pool->ncontinuum != 0) {
+            se->server = server_pool_idx(pool, kpos->hash);
+        }
+    }
+
+    nc_scnprintf(se->peer, sizeof(se->peer), "%s",
+                 nc_unresolve_peer_desc(conn->sd));
+}
+
+uint32_t
+slowlog_len(struct slowlog *sl)
+{
+    return sl->len;
+}
+
+/*
+ * Return the n-th most recent entry of the slow log, or NULL if there
+ * are not that many
+ */
+struct slowlog_entry *
+slowlog_get(struct slowlog *sl, uint32_t n)
+{
+    if (n >= sl->len) {
+        return NULL;
+    }
+
+    return &sl->entry[(sl->next_id - 1 - n) % sl->max_len];
+}
+
+void
+slowlog_reset(struct slowlog *sl)
+{
+    sl->len = 0;
+}
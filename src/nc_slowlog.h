@@ -0,0 +1,89 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_SLOWLOG_H_
+#define _NC_SLOWLOG_H_
+
+#include <nc_core.h>
+
+#define SLOWLOG_MAX_LEN     128     /* # entries kept per pool */
+#define SLOWLOG_GET         10      /* # entries listed by default */
+#define SLOWLOG_KEY_LEN     64      /* # key bytes kept, longer keys are truncated */
+#define SLOWLOG_PEER_LEN    64      /* # client address bytes kept */
+
+/*
+ * Phases of a request, each ending at the timestamp of the same name
+ * on struct msg
+ */
+typedef enum slowlog_phase {
+    SLOWLOG_RECV,       /* first request byte to request parsed */
+    SLOWLOG_ROUTE,      /* parsed to enqueued on a server connection */
+    SLOWLOG_QUEUE,      /* enqueued to written to the server */
+    SLOWLOG_SERVER,     /* written to the first response byte */
+    SLOWLOG_REPLY,      /* first response byte to sent to the client */
+    SLOWLOG_NPHASE
+} slowlog_phase_t;
+
+struct slowlog_entry {
+    uint64_t          id;                    /* entry id, unique in the pool */
+    int64_t           start;                 /* first request byte in usec since epoch */
+    int64_t           duration;              /* request duration in usec */
+    int64_t           phase[SLOWLOG_NPHASE]; /* phase durations in usec */
+    msg_type_t        type;                  /* request type */
+    uint32_t          nkey;                  /* # keys */
+    uint32_t          server;                /* index of the server of the first key */
+    uint32_t          keylen;                /* length of the first key */
+    uint8_t           key[SLOWLOG_KEY_LEN];  /* first key, truncated to SLOWLOG_KEY_LEN */
+    char              peer[SLOWLOG_PEER_LEN]; /* client address */
+};
+
+/*
+ * Per pool slow log, a ring of the last max_len requests that took longer
+ * than slower_than usec from their first byte received to their response
+ * sent
+ */
+struct slowlog {
+    int64_t              slower_than;   /* threshold in usec */
+    uint32_t             max_len;       /* # entries in ring */
+    uint32_t             len;           /* # entries logged since last reset */
+    uint64_t             next_id;       /* id of the next entry */
+    struct slowlog_entry *entry;        /* ring of entries */
+};
+
+/*
+ * Timestamp a phase of a request timed for the slow log. The fragments of
+ * a multi-key request also carry the timestamp to the request they were
+ * split from, so that it ends up with the time of the last fragment
+ */
+#define slowlog_mark(_msg, _ts, _usec) do {                             \
+    if ((_msg)->timed) {                                                \
+        (_msg)->_ts = (_usec);                                          \
+        if ((_msg)->frag_owner != NULL) {                               \
+            (_msg)->frag_owner->_ts = (_msg)->_ts;                      \
+        }                                                               \
+    }                                                                   \
+} while (0)
+
+struct slowlog *slowlog_create(int64_t slower_than, uint32_t max_len);
+void slowlog_destroy(struct slowlog *sl);
+bool slowlog_timed(struct conn *conn);
+void slowlog_record(struct context *ctx, struct conn *conn, struct msg *req);
+uint32_t slowlog_len(struct slowlog *sl);
+struct slowlog_entry *slowlog_get(struct slowlog *sl, uint32_t n);
+void slowlog_reset(struct slowlog *sl);
+
+#endif
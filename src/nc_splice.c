@@ -0,0 +1,488 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_splice.h>
+
+/*
+ * Once the response parser of a server connection stops within a value
+ * and at least splice_threshold bytes of it are still to come, the rest
+ * of the value is moved from the server socket to the client socket with
+ * splice(2) through a pipe, and never copied into mbufs:
+ *
+ * - the server leg (splice_recv) fills the pipe and pauses reading from
+ *   the server while the pipe holds data, so a slow client pushes back on
+ *   the server instead of buffering the value in memory,
+ * - the client leg (splice_send) first sends the head of the response from
+ *   its mbufs, then drains the pipe and resumes the server leg.
+ *
+ * Once the whole value has gone through, the server connection reads and
+ * parses the rest of the response into mbufs, which are streamed to the
+ * client as usual (see rsp_stream). If the client goes away, the rest of
+ * the value is read and discarded.
+ */
+
+#ifdef HAVE_SPLICE
+
+static uint32_t nfree_spliceq;          /* # free splice q */
+static struct splice_hdr free_spliceq;  /* free splice q */
+
+static struct splice *
+splice_get(void)
+{
+    struct splice *sp;
+    int size;
+
+    if (!STAILQ_EMPTY(&free_spliceq)) {
+        ASSERT(nfree_spliceq > 0);
+
+        sp = STAILQ_FIRST(&free_spliceq);
+        nfree_spliceq--;
+        STAILQ_REMOVE_HEAD(&free_spliceq, next);
+        return sp;
+    }
+
+    sp = nc_alloc(sizeof(*sp));
+    if (sp == NULL) {
+        return NULL;
+    }
+
+    if (pipe2(sp->fd, O_NONBLOCK | O_CLOEXEC) < 0) {
+        log_error("pipe failed: %s", strerror(errno));
+        nc_free(sp);
+        return NULL;
+    }
+
+    size = fcntl(sp->fd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    if (size < 0) {
+        size = fcntl(sp->fd[1], F_GETPIPE_SZ);
+    }
+    if (size <= 0) {
+        log_error("fcntl on pipe %d failed: %s", sp->fd[1], strerror(errno));
+        close(sp->fd[0]);
+        close(sp->fd[1]);
+        nc_free(sp);
+        return NULL;
+    }
+    sp->size = (uint32_t)size;
+
+    return sp;
+}
+
+static void
+splice_free(struct splice *sp)
+{
+    close(sp->fd[0]);
+    close(sp->fd[1]);
+    nc_free(sp);
+}
+
+static void
+splice_put(struct splice *sp)
+{
+    /* a pipe that still holds bytes of an aborted value is not reused */
+    if (sp->npipe != 0 || nfree_spliceq >= SPLICE_MAX_FREE) {
+        splice_free(sp);
+        return;
+    }
+
+    nfree_spliceq++;
+    STAILQ_INSERT_HEAD(&free_spliceq, sp, next);
+}
+
+void
+splice_init(void)
+{
+    nfree_spliceq = 0;
+    STAILQ_INIT(&free_spliceq);
+}
+
+void
+splice_deinit(void)
+{
+    struct splice *sp;
+
+    while (!STAILQ_EMPTY(&free_spliceq)) {
+        ASSERT(nfree_spliceq > 0);
+
+        sp = STAILQ_FIRST(&free_spliceq);
+        nfree_spliceq--;
+        STAILQ_REMOVE_HEAD(&free_spliceq, next);
+        splice_free(sp);
+    }
+    ASSERT(nfree_spliceq == 0);
+}
+
+/*
+ * Splice the rest of the value that the parser of response msg on server
+ * connection s_conn stopped within, if it is large enough and msg answers
+ * the request at the head of its client outq. Returns true if it does
+ */
+bool
+splice_start(struct context *ctx, struct conn *s_conn, struct msg *msg)
+{
+    struct server_pool *pool;
+    struct splice *sp;
+    struct msg *pmsg;
+    struct conn *c_conn;
+    uint32_t rlen;
+    rstatus_t status;
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+    ASSERT(!msg->request && s_conn->rmsg == msg);
+
+    pool = ((struct server *)s_conn->owner)->owner;
+    if (pool->splice_threshold == 0 || s_conn->splice != NULL) {
+        return false;
+    }
+
+    /* bytes read ahead of the parser have to go through the mbufs first */
+    if (!STAILQ_EMPTY(&s_conn->rbuf_q)) {
+        return false;
+    }
+
+    rlen = msg->ops->skip(msg, 0);
+    if (rlen < pool->splice_threshold) {
+        return false;
+    }
+
+    pmsg = rsp_stream_peer(s_conn, msg);
+    if (pmsg == NULL) {
+        return false;
+    }
+    c_conn = pmsg->owner;
+
+    sp = splice_get();
+    if (sp == NULL) {
+        return false;
+    }
+    sp->rlen = rlen;
+    sp->npipe = 0;
+    sp->head = 0;
+
+    msg->ops->skip(msg, rlen);
+
+    msg->peer = pmsg;
+    pmsg->peer = msg;
+    s_conn->splice = sp;
+
+    stats_server_incr(ctx, s_conn->owner, spliced_responses);
+
+    log_debug(LOG_VERB, "splice %"PRIu32" bytes of rsp %"PRIu64" from s %d "
+              "to c %d", rlen, msg->id, s_conn->sd, c_conn->sd);
+
+    status = event_add_out(ctx->evb, c_conn);
+    if (status != NC_OK) {
+        c_conn->err = errno;
+    }
+
+    return true;
+}
+
+/*
+ * End the splice on server connection conn, whose value has gone through
+ * completely, and resume reading the rest of the response into mbufs
+ */
+static rstatus_t
+splice_done(struct context *ctx, struct conn *conn)
+{
+    struct splice *sp = conn->splice;
+
+    ASSERT(sp != NULL && sp->rlen == 0 && sp->npipe == 0);
+
+    log_debug(LOG_VERB, "splice on s %d done", conn->sd);
+
+    conn->splice = NULL;
+    splice_put(sp);
+
+    if (event_add_in(ctx->evb, conn) != NC_OK) {
+        conn->err = errno;
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+/* discard the bytes in the pipe of a value whose client has gone away */
+static void
+splice_drain(struct splice *sp)
+{
+    char buf[4096];
+    ssize_t n;
+
+    while (sp->npipe > 0) {
+        n = read(sp->fd[0], buf, MIN(sizeof(buf), sp->npipe));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        sp->npipe -= (uint32_t)n;
+    }
+}
+
+/*
+ * Move value bytes from server connection conn into its pipe
+ */
+rstatus_t
+splice_recv(struct context *ctx, struct conn *conn)
+{
+    struct splice *sp = conn->splice;
+    struct msg *msg = conn->rmsg;
+    struct conn *c_conn;
+    rstatus_t status;
+    ssize_t n;
+
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(sp != NULL && msg != NULL && !msg->request);
+
+    while (sp->rlen > 0) {
+        if (msg->peer == NULL) {
+            splice_drain(sp);
+        }
+
+        if (sp->npipe == sp->size) {
+            break;
+        }
+
+        n = splice(conn->sd, NULL, sp->fd[1], NULL,
+                   MIN(sp->rlen, sp->size - sp->npipe),
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        log_debug(LOG_VERB, "splice recv on sd %d %zd of %"PRIu32"", conn->sd,
+                  n, sp->rlen);
+
+        if (n > 0) {
+            sp->rlen -= (uint32_t)n;
+            sp->npipe += (uint32_t)n;
+            conn->recv_bytes += (size_t)n;
+            msg->mlen += (uint32_t)n;
+            stats_server_incr_by(ctx, conn->owner, spliced_bytes, n);
+            continue;
+        }
+
+        if (n == 0) {
+            conn->recv_ready = 0;
+            conn->eof = 1;
+            conn->done = 1;
+            log_error("eof s %d within spliced rsp %"PRIu64" with %"PRIu32" "
+                      "bytes to go", conn->sd, msg->id, sp->rlen);
+            return NC_OK;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (sp->npipe == 0) {
+                /* the socket is drained; wait for the next read event */
+                conn->recv_ready = 0;
+                return NC_OK;
+            }
+            break;
+        } else {
+            conn->recv_ready = 0;
+            conn->err = errno;
+            log_error("splice recv on sd %d failed: %s", conn->sd,
+                      strerror(errno));
+            return NC_ERROR;
+        }
+    }
+
+    if (msg->peer == NULL) {
+        splice_drain(sp);
+    }
+
+    if (sp->rlen == 0 && sp->npipe == 0) {
+        return splice_done(ctx, conn);
+    }
+
+    /* wait for the client to drain the pipe */
+    conn->recv_ready = 0;
+    status = event_del_in(ctx->evb, conn);
+    if (status != NC_OK) {
+        conn->err = errno;
+        return NC_ERROR;
+    }
+
+    if (msg->peer != NULL && sp->npipe > 0) {
+        c_conn = msg->peer->owner;
+        status = event_add_out(ctx->evb, c_conn);
+        if (status != NC_OK) {
+            c_conn->err = errno;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Move the spliced response msg from the pipe to client connection conn,
+ * whose outq it heads
+ */
+void
+splice_send(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    struct conn *s_conn = msg->owner;
+    struct splice *sp = s_conn->splice;
+    rstatus_t status;
+    uint32_t npipe;
+    ssize_t n;
+
+    ASSERT(conn->client && !conn->proxy);
+    ASSERT(!msg->request && msg->peer == TAILQ_FIRST(&conn->omsg_q));
+    ASSERT(sp != NULL && s_conn->rmsg == msg);
+
+    if (!sp->head) {
+        /* the head of the response goes first */
+        status = msg_send_partial(ctx, conn, msg, true);
+        if (status != NC_OK) {
+            return;
+        }
+        sp->head = 1;
+    }
+
+    while (sp->npipe > 0) {
+        n = splice(sp->fd[0], NULL, conn->sd, NULL, sp->npipe,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        log_debug(LOG_VERB, "splice send on sd %d %zd of %"PRIu32"", conn->sd,
+                  n, sp->npipe);
+
+        if (n > 0) {
+            sp->npipe -= (uint32_t)n;
+            conn->send_bytes += (size_t)n;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            conn->send_ready = 0;
+            break;
+        } else {
+            conn->send_ready = 0;
+            conn->err = n < 0 ? errno : EPIPE;
+            log_error("splice send on sd %d failed: %s", conn->sd,
+                      strerror(conn->err));
+            return;
+        }
+    }
+
+    npipe = sp->npipe;
+
+    if (sp->rlen == 0 && npipe == 0) {
+        splice_done(ctx, s_conn);
+    } else if (npipe < sp->size) {
+        /* there is room in the pipe again */
+        status = event_add_in(ctx->evb, s_conn);
+        if (status != NC_OK) {
+            s_conn->err = errno;
+        }
+    }
+
+    if (npipe > 0) {
+        /* wait for the client socket to drain */
+        return;
+    }
+
+    status = event_del_out(ctx->evb, conn);
+    if (status != NC_OK) {
+        conn->err = errno;
+    }
+}
+
+/*
+ * Discard the rest of the value spliced on server connection conn, as its
+ * client has gone away
+ */
+void
+splice_detach(struct context *ctx, struct conn *conn)
+{
+    struct splice *sp = conn->splice;
+
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(sp != NULL && conn->rmsg->peer == NULL);
+
+    splice_drain(sp);
+    if (sp->rlen == 0) {
+        splice_done(ctx, conn);
+    } else if (event_add_in(ctx->evb, conn) != NC_OK) {
+        conn->err = errno;
+    }
+}
+
+/*
+ * Release the splice of server connection conn, which is closing
+ */
+void
+splice_close(struct context *ctx, struct conn *conn)
+{
+    ASSERT(!conn->client && !conn->proxy);
+
+    if (conn->splice != NULL) {
+        splice_put(conn->splice);
+        conn->splice = NULL;
+    }
+}
+
+#else
+
+void
+splice_init(void)
+{
+}
+
+void
+splice_deinit(void)
+{
+}
+
+bool
+splice_start(struct context *ctx, struct conn *s_conn, struct msg *msg)
+{
+    return false;
+}
+
+rstatus_t
+splice_recv(struct context *ctx, struct conn *s_conn)
+{
+    NOT_REACHED();
+    return NC_ERROR;
+}
+
+void
+splice_send(struct context *ctx, struct conn *c_conn, struct msg *msg)
+{
+    NOT_REACHED();
+}
+
+void
+splice_detach(struct context *ctx, struct conn *s_conn)
+{
+    NOT_REACHED();
+}
+
+void
+splice_close(struct context *ctx, struct conn *s_conn)
+{
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_SPLICE_H_
+#define _NC_SPLICE_H_
+
+#include <nc_core.h>
+
+#define SPLICE_PIPE_SIZE    (256 * 1024)    /* requested pipe capacity in bytes */
+#define SPLICE_MAX_FREE     16              /* max # idle pipes kept for reuse */
+
+/*
+ * A splice forwards the rest of a large value in a response from the
+ * server to the client through a pipe, so the bytes never pass through
+ * mbufs. The response bytes before the value (its head) are in the mbufs
+ * of the response and are sent to the client first; those after it are
+ * read into mbufs and parsed as usual once the splice is done.
+ */
+struct splice {
+    STAILQ_ENTRY(splice) next;      /* next in free q */
+    int                  fd[2];     /* pipe read and write end */
+    uint32_t             size;      /* pipe capacity */
+    uint32_t             rlen;      /* # value bytes still to read from server */
+    uint32_t             npipe;     /* # value bytes in the pipe */
+    unsigned             head:1;    /* head of the response sent to client? */
+};
+
+STAILQ_HEAD(splice_hdr, splice);
+
+void splice_init(void);
+void splice_deinit(void);
+bool splice_start(struct context *ctx, struct conn *s_conn, struct msg *msg);
+rstatus_t splice_recv(struct context *ctx, struct conn *s_conn);
+void splice_send(struct context *ctx, struct conn *c_conn, struct msg *msg);
+void splice_detach(struct context *ctx, struct conn *s_conn);
+void splice_close(struct context *ctx, struct conn *s_conn);
+
+#endif
@@ -22,9 +22,11 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <signal.h>
 
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_upgrade.h>
 
 struct stats_desc {
     char *name; /* stats name */
@@ -263,6 +265,8 @@ stats_pool_init(struct stats_pool *stp, struct server_pool *sp)
     stp->name = sp->name;
     array_null(&stp->metric);
     array_null(&stp->server);
+    stp->hotkey_max = sp->hotkey != NULL ? sp->hotkey->topk : 0;
+    stp->nhotkey = 0;
 
     //stats_pool_codecеĳԱstats_pool->metric
     status = stats_pool_metric_init(&stp->metric);//stats_pool_codecԱֵstats_pool->metric
@@ -361,6 +365,7 @@ stats_create_buf(struct stats *st)
     uint32_t key_value_extra = 8;   /* "key": "value", */
     uint32_t pool_extra = 8;        /* '"pool_name": { ' + ' }' */
     uint32_t server_extra = 8;      /* '"server_name": { ' + ' }' */
+    uint32_t hotkey_extra = 64;     /* '{"key":"", "server":"", ... }, ' */
     size_t size = 0;
     uint32_t i;
 
@@ -398,6 +403,26 @@ stats_create_buf(struct stats *st)
     size += int64_max_digits;
     size += key_value_extra;
 
+    size += st->mem_used_str.len;
+    size += int64_max_digits;
+    size += key_value_extra;
+
+    size += st->mem_limit_str.len;
+    size += int64_max_digits;
+    size += key_value_extra;
+
+    size += st->arena_rsv_str.len;
+    size += int64_max_digits;
+    size += key_value_extra;
+
+    size += st->arena_used_str.len;
+    size += int64_max_digits;
+    size += key_value_extra;
+
+    /* hot keys, nested by pool */
+    size += st->hotkeys_str.len;
+    size += pool_extra;
+
     /* server pools */
     for (i = 0; i < array_n(&st->sum); i++) {
         struct stats_pool *stp = array_get(&st->sum, i);
@@ -414,6 +439,22 @@ stats_create_buf(struct stats *st)
             size += key_value_extra;
         }
 
+        /* hot keys per pool */
+        if (stp->hotkey_max > 0) {
+            uint32_t name_max = 0;
+
+            for (j = 0; j < array_n(&stp->server); j++) {
+                struct stats_server *sts = array_get(&stp->server, j);
+
+                name_max = MAX(name_max, sts->name.len);
+            }
+
+            size += stp->name.len;
+            size += sizeof("\"\":[], ");
+            size += stp->hotkey_max * (hotkey_extra + HOTKEY_KEY_LEN * 6 + 3 +
+                                       name_max + 2 * int64_max_digits);
+        }
+
         /* servers per pool */
         for (j = 0; j < array_n(&stp->server); j++) {
             struct stats_server *sts = array_get(&stp->server, j);
@@ -560,6 +601,28 @@ stats_add_header(struct stats *st)
         return status;
     }
 
+    status = stats_add_num(st, &st->mem_used_str,
+                           (int64_t)__atomic_load_n(&st->mem_used, __ATOMIC_RELAXED));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_add_num(st, &st->mem_limit_str, (int64_t)st->mem_limit);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_add_num(st, &st->arena_rsv_str,
+                           (int64_t)mbuf_arena_reserved());
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_add_num(st, &st->arena_used_str, (int64_t)mbuf_arena_used());
+    if (status != NC_OK) {
+        return status;
+    }
+
     return NC_OK;
 }
 
@@ -662,6 +725,103 @@ stats_copy_metric(struct stats *st, struct array *metric)
     return NC_OK;
 }
 
+/*
+ * Add the hot keys of pool stp as '"<pool>":[{...}, ...], '
+ */
+static rstatus_t
+stats_add_hotkeys(struct stats *st, struct stats_pool *stp)
+{
+    struct stats_buffer *buf;
+    char key[HOTKEY_KEY_LEN * 6 + 4];
+    uint32_t i;
+    size_t room;
+    int n;
+
+    if (stp->hotkey_max == 0) {
+        return NC_OK;
+    }
+
+    buf = &st->buf;
+
+    room = buf->size - buf->len - 1;
+    n = nc_snprintf(buf->data + buf->len, room, "\"%.*s\":[", stp->name.len,
+                    stp->name.data);
+    if (n < 0 || n >= (int)room) {
+        return NC_ERROR;
+    }
+    buf->len += (size_t)n;
+
+    for (i = 0; i < stp->nhotkey; i++) {
+        struct hotkey_entry *he = &stp->hotkey[i];
+        struct string *server;
+        struct string unknown = string("");
+
+        server = &unknown;
+        if (he->server < array_n(&stp->server)) {
+            struct stats_server *sts = array_get(&stp->server, he->server);
+            server = &sts->name;
+        }
+
+        hotkey_key_string(he, key, sizeof(key), true);
+
+        room = buf->size - buf->len - 1;
+        n = nc_snprintf(buf->data + buf->len, room, "%s{\"key\":\"%s\", "
+                        "\"server\":\"%.*s\", \"requests\":%"PRIu64", "
+                        "\"error\":%"PRIu64"}", i == 0 ? "" : ", ", key,
+                        server->len, server->data, he->count, he->error);
+        if (n < 0 || n >= (int)room) {
+            return NC_ERROR;
+        }
+        buf->len += (size_t)n;
+    }
+
+    room = buf->size - buf->len - 1;
+    n = nc_snprintf(buf->data + buf->len, room, "], ");
+    if (n < 0 || n >= (int)room) {
+        return NC_ERROR;
+    }
+    buf->len += (size_t)n;
+
+    return NC_OK;
+}
+
+/*
+ * Add the hot keys of the pools that track them, keyed by pool, as
+ * '"hot_keys": {"<pool>":[...], ...}, '
+ */
+static rstatus_t
+stats_add_hotkeys_nesting(struct stats *st)
+{
+    rstatus_t status;
+    uint32_t i, npool;
+
+    for (i = 0, npool = 0; i < array_n(&st->sum); i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+
+        if (stp->hotkey_max > 0) {
+            npool++;
+        }
+    }
+
+    if (npool == 0) {
+        return NC_OK;
+    }
+
+    status = stats_begin_nesting(st, &st->hotkeys_str);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < array_n(&st->sum); i++) {
+        status = stats_add_hotkeys(st, array_get(&st->sum, i));
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return stats_end_nesting(st);
+}
+
 static void
 stats_aggregate_metric(struct array *dst, struct array *src)
 {
@@ -827,6 +987,11 @@ stats_make_rsp(struct stats *st)
         }
     }
 
+    status = stats_add_hotkeys_nesting(st);
+    if (status != NC_OK) {
+        return status;
+    }
+
     status = stats_add_footer(st);
     if (status != NC_OK) {
         return status;
@@ -875,15 +1040,29 @@ stats_loop_callback(void *arg1, void *arg2)
     struct stats *st = arg1;
     int n = *((int *)arg2);
 
+    /*
+     * The listener is shared with the new process after an upgrade, so it
+     * is closed here, before accepting anything on it, and the event loop
+     * ends
+     */
+    if (__atomic_load_n(&st->handoff, __ATOMIC_RELAXED)) {
+        log_debug(LOG_INFO, "m %d handed off, stop aggregator", st->sd);
+        close(st->sd);
+        st->sd = -1;
+        return;
+    }
+
+    pthread_mutex_lock(&st->lock);
+
     /* aggregate stats from shadow (b) -> sum (c) */
     stats_aggregate(st);
 
-    if (n == 0) {
-        return;
+    if (n != 0) {
+        /* send aggregate stats sum (c) to collector */
+        stats_send_rsp(st);
     }
 
-    /* send aggregate stats sum (c) to collector */
-    stats_send_rsp(st);
+    pthread_mutex_unlock(&st->lock);
 }
 
 //statsרһ߳
@@ -901,6 +1080,12 @@ stats_listen(struct stats *st)
     rstatus_t status;
     struct sockinfo si;
 
+    /* take over the listening socket handed off on upgrade, if any */
+    st->sd = upgrade_inherit_stats(st);
+    if (st->sd >= 0) {
+        goto inherited;
+    }
+
     status = nc_resolve(&st->addr, st->port, &si);
     if (status < 0) {
         return status;
@@ -931,6 +1116,7 @@ stats_listen(struct stats *st)
         return NC_ERROR;
     }
 
+inherited:
     log_debug(LOG_INFO, "m %d listening on '%.*s:%u'", st->sd,
               st->addr.len, st->addr.data, st->port);
 
@@ -942,6 +1128,7 @@ static rstatus_t
 stats_start_aggregator(struct stats *st)
 {
     rstatus_t status;
+    sigset_t set, oset;
 
     if (!stats_enabled) {
         return NC_OK;
@@ -952,7 +1139,18 @@ stats_start_aggregator(struct stats *st)
         return status;
     }
 
+    /*
+     * Signals are handled by the main thread, which acts on them from its
+     * event loop; so the aggregator is created with them blocked
+     */
+    sigfillset(&set);
+    sigdelset(&set, SIGSEGV);
+    pthread_sigmask(SIG_BLOCK, &set, &oset);
+
     status = pthread_create(&st->tid, NULL, stats_loop, st);
+
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
     if (status < 0) {
         log_error("stats aggregator create failed: %s", strerror(status));
         return NC_ERROR;
@@ -964,7 +1162,8 @@ stats_start_aggregator(struct stats *st)
 static void
 stats_stop_aggregator(struct stats *st)
 {
-    if (!stats_enabled) {
+    /* a handed off listener is closed by the aggregator */
+    if (!stats_enabled || __atomic_load_n(&st->handoff, __ATOMIC_RELAXED)) {
         return;
     }
 
@@ -973,7 +1172,7 @@ stats_stop_aggregator(struct stats *st)
 
 struct stats *
 stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
-             char *source, struct array *server_pool) 
+             char *source, size_t mem_limit, struct array *server_pool)
 {
     rstatus_t status;
     struct stats *st;
@@ -985,6 +1184,9 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
 
     st->port = stats_port;
     st->interval = stats_interval;
+    st->mem_limit = mem_limit;
+    st->mem_used = 0;
+    st->handoff = 0;
     string_set_raw(&st->addr, stats_ip);
 
     st->start_ts = (int64_t)time(NULL);
@@ -998,6 +1200,7 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
     array_null(&st->sum);
 
     st->tid = (pthread_t) -1;
+    pthread_mutex_init(&st->lock, NULL);
     st->sd = -1;
 
     string_set_text(&st->service_str, "service");
@@ -1014,6 +1217,11 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
 
     string_set_text(&st->ntotal_conn_str, "total_connections");
     string_set_text(&st->ncurr_conn_str, "curr_connections");
+    string_set_text(&st->mem_used_str, "memory_used");
+    string_set_text(&st->mem_limit_str, "memory_limit");
+    string_set_text(&st->arena_rsv_str, "mbuf_arena_reserved");
+    string_set_text(&st->arena_used_str, "mbuf_arena_used");
+    string_set_text(&st->hotkeys_str, "hot_keys");
 
     st->updated = 0;
     st->aggregate = 0;
@@ -1061,6 +1269,7 @@ stats_destroy(struct stats *st)
     stats_pool_unmap(&st->shadow);
     stats_pool_unmap(&st->current);
     stats_destroy_buf(st);
+    pthread_mutex_destroy(&st->lock);
     nc_free(st);
 }
 
@@ -1077,6 +1286,12 @@ stats_swap(struct stats *st)
         return;
     }
 
+    /*
+     * The mbuf and msg counters belong to the worker; the aggregator only
+     * ever reads this copy of their sum
+     */
+    __atomic_store_n(&st->mem_used, core_mem_used(), __ATOMIC_RELAXED);
+
     if (st->aggregate == 1) { /* ͻ */
         log_debug(LOG_PVERB, "skip swap of current %p shadow %p as aggregator "
                   "is busy", st->current.elem, st->shadow.elem);
@@ -1104,6 +1319,134 @@ stats_swap(struct stats *st)
 
     st->aggregate = 1;
 }
+
+/*
+ * Stop serving stats, as the listener was handed off to the new process on
+ * upgrade. The aggregator closes it the next time it wakes up
+ */
+void
+stats_handoff(struct stats *st)
+{
+    if (!stats_enabled) {
+        return;
+    }
+
+    __atomic_store_n(&st->handoff, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Carry the metrics of servers that survive a reload over to the server
+ * stats remapped for the new servers[]
+ */
+static rstatus_t
+stats_server_remap(struct array *stats_server, struct array *ostats_server,
+                   struct array *server)
+{
+    rstatus_t status;
+    uint32_t i, j;
+
+    status = stats_server_map(stats_server, server);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < array_n(stats_server); i++) {
+        struct stats_server *sts = array_get(stats_server, i);
+
+        for (j = 0; j < array_n(ostats_server); j++) {
+            struct stats_server *osts = array_get(ostats_server, j);
+
+            if (string_compare(&sts->name, &osts->name) != 0) {
+                continue;
+            }
+
+            ASSERT(array_n(&sts->metric) == array_n(&osts->metric));
+            nc_memcpy(sts->metric.elem, osts->metric.elem,
+                      array_n(&sts->metric) * sts->metric.size);
+            break;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Remap current (a), shadow (b) and sum (c) to the servers[] of the
+ * reloaded pools in 'server_pool', each at the index of the pool it
+ * replaces; the stats of the other pools are left alone. Either all the
+ * stats are remapped or none are.
+ */
+rstatus_t
+stats_remap(struct stats *st, struct array *server_pool)
+{
+    rstatus_t status;
+    struct array *stats_pool[3], *remap;
+    struct stats_buffer buf;
+    uint32_t i, j, k, npool, nremap;
+
+    stats_pool[0] = &st->current;
+    stats_pool[1] = &st->shadow;
+    stats_pool[2] = &st->sum;
+
+    npool = array_n(server_pool);
+    ASSERT(npool <= array_n(&st->current));
+
+    remap = nc_zalloc(sizeof(*remap) * npool * 3);
+    if (remap == NULL) {
+        return NC_ENOMEM;
+    }
+
+    for (nremap = 0; nremap < npool * 3; nremap++) {
+        struct server_pool *sp = array_get(server_pool, nremap / 3);
+        struct stats_pool *stp = array_get(stats_pool[nremap % 3], sp->idx);
+
+        status = stats_server_remap(&remap[nremap], &stp->server, &sp->server);
+        if (status != NC_OK) {
+            stats_server_unmap(&remap[nremap]);
+            goto done;
+        }
+    }
+
+    pthread_mutex_lock(&st->lock);
+
+    for (i = 0, k = 0; i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+
+        for (j = 0; j < 3; j++, k++) {
+            struct stats_pool *stp = array_get(stats_pool[j], sp->idx);
+
+            stp->name = sp->name;
+            array_swap(&stp->server, &remap[k]);
+
+            /* reloaded pools start new hot key sketches */
+            stp->hotkey_max = sp->hotkey != NULL ? sp->hotkey->topk : 0;
+            stp->nhotkey = 0;
+        }
+    }
+
+    /* names changed, so resize the output buffer; keep the old one on error */
+    buf = st->buf;
+    st->buf.data = NULL;
+    st->buf.size = 0;
+    if (stats_create_buf(st) == NC_OK) {
+        st->buf.len = 0;
+        nc_free(buf.data);
+    } else {
+        st->buf = buf;
+    }
+
+    pthread_mutex_unlock(&st->lock);
+
+    status = NC_OK;
+
+done:
+    for (k = 0; k < nremap; k++) {
+        stats_server_unmap(&remap[k]);
+    }
+    nc_free(remap);
+
+    return status;
+}
 //ͯӱ
 
 static struct stats_metric *
@@ -1307,3 +1650,32 @@ _stats_server_set_ts(struct context *ctx, struct server *server,
     log_debug(LOG_VVVERB, "set ts field '%.*s' to %"PRId64"", stm->name.len,
               stm->name.data, stm->value.timestamp);
 }
+
+/*
+ * Copy the hot keys of each pool to sum (c) for the aggregator to report.
+ * Skipped while the aggregator holds the stats, rather than waiting on it
+ */
+void
+stats_hotkey(struct stats *st, struct array *server_pool)
+{
+    uint32_t i, npool;
+
+    if (!stats_enabled) {
+        return;
+    }
+
+    if (pthread_mutex_trylock(&st->lock) != 0) {
+        return;
+    }
+
+    npool = MIN(array_n(server_pool), array_n(&st->sum));
+    for (i = 0; i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+        struct stats_pool *stp = array_get(&st->sum, i);
+
+        stp->nhotkey = hotkey_top(sp->hotkey, stp->hotkey,
+                                  MIN(stp->hotkey_max, HOTKEY_MAX_TOPK));
+    }
+
+    pthread_mutex_unlock(&st->lock);
+}
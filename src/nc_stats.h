@@ -31,6 +31,14 @@
     /* forwarder behavior */                                                                                        \
     ACTION( forward_error,          STATS_COUNTER,      "# times we encountered a forwarding error")                \
     ACTION( fragments,              STATS_COUNTER,      "# fragments created from a multi-vector request")          \
+    ACTION( slow_requests,          STATS_COUNTER,      "# requests slower than slowlog_slower_than")               \
+    ACTION( bulk_requests,          STATS_COUNTER,      "# requests of the bulk command class")                     \
+    /* memory behavior */                                                                                           \
+    ACTION( client_parked,          STATS_GAUGE,        "# idle client connections parked")                         \
+    ACTION( client_idle_closed,     STATS_COUNTER,      "# client connections closed after client_idle_timeout")    \
+    ACTION( client_paused,          STATS_COUNTER,      "# times client reads were paused over the memory limit")   \
+    ACTION( client_throttled,       STATS_COUNTER,      "# times client reads were throttled over a rate limit")    \
+    ACTION( oom_rejected,           STATS_COUNTER,      "# requests rejected over the memory limit")                \
 
 //Բοstats_server_field÷   
 #define STATS_SERVER_CODEC(ACTION)                                                                                  \
@@ -39,6 +47,8 @@
     ACTION( server_err,             STATS_COUNTER,      "# errors on server connections")                           \
     ACTION( server_timedout,        STATS_COUNTER,      "# timeouts on server connections")                         \
     ACTION( server_connections,     STATS_GAUGE,        "# active server connections")                              \
+    ACTION( server_window,          STATS_GAUGE,        "# requests allowed in flight over all server connections") \
+    ACTION( server_resolves,        STATS_COUNTER,      "# times the server name was resolved in the background")   \
     ACTION( server_ejected_at,      STATS_TIMESTAMP,    "timestamp when server was ejected in usec since epoch")    \
     /* data behavior */                                                                                             \
     /*ͻ  ο req_forward_stats //ͻֽ  ο req_forward_stats*/         \
@@ -46,6 +56,9 @@
     ACTION( request_bytes,          STATS_COUNTER,      "total request bytes")                                      \
     ACTION( responses,              STATS_COUNTER,      "# responses")                                              \
     ACTION( response_bytes,         STATS_COUNTER,      "total response bytes")                                     \
+    ACTION( streamed_responses,     STATS_COUNTER,      "# responses forwarded before they were complete")          \
+    ACTION( spliced_responses,      STATS_COUNTER,      "# responses with a value forwarded by splice")             \
+    ACTION( spliced_bytes,          STATS_COUNTER,      "total response bytes forwarded by splice")                 \
     /* req_server_dequeue_imsgq */   \
     ACTION( in_queue,               STATS_GAUGE,        "# requests in incoming queue")                             \
     ACTION( in_queue_bytes,         STATS_GAUGE,        "current request bytes in incoming queue")                  \
@@ -127,6 +140,9 @@ struct stats_pool {
     //ռ͸ֵstats_pool_init->stats_server_mapԱΪstats_server
     //serverеserver:бжٸ 
     struct array  server; /* stats_server[] */ //еԴnutcracker.yulļеserverбϢ
+    uint32_t      hotkey_max; /* max # hot keys */
+    uint32_t      nhotkey;    /* # hot keys, in sum (c) only */
+    struct hotkey_entry hotkey[HOTKEY_MAX_TOPK]; /* hot keys, hottest first */
 };
 
 struct stats_buffer {
@@ -176,6 +192,8 @@ struct stats {//
     //˿  //ַͶ˿ ͨ-sãֵstats_create
     uint16_t            port;            /* stats monitoring port */
     int                 interval;        /* stats aggregation interval */ //-i
+    size_t              mem_limit;       /* memory limit in bytes */
+    size_t              mem_used;        /* memory in use in bytes, published on swap */
     struct string       addr;            /* stats monitoring address */
 
     //һοͻ˻ȡͳϢʱĿļͻͳ֮˶
@@ -200,6 +218,7 @@ struct stats {//
     struct array        sum;             /* stats_pool[] (c = a + b) */
 
     pthread_t           tid;             /* stats aggregator thread */
+    pthread_mutex_t     lock;            /* stats pool[] remap lock */
     //׽ּstats_listen  epoll¼event_loop_stats  ܿͻӼstatsӦstats_send_rsp
     int                 sd;              /* stats descriptor */
 
@@ -214,11 +233,17 @@ struct stats {//
     struct string       timestamp_str;   /* timestamp string */
     struct string       ntotal_conn_str; /* total connections string */
     struct string       ncurr_conn_str;  /* curr connections string */
+    struct string       mem_used_str;    /* memory used string */
+    struct string       mem_limit_str;   /* memory limit string */
+    struct string       arena_rsv_str;   /* mbuf arena reserved string */
+    struct string       arena_used_str;  /* mbuf arena used string */
+    struct string       hotkeys_str;     /* hot keys string */
 
     //stats_swap1  ֻпͻ˷ȡstatsϢʱstats_aggregateͳ0
     volatile int        aggregate;       /* shadow (b) aggregate? */
     //stats_server_to_metric1  ֻҪͳϢ˸ͻ1
     volatile int        updated;         /* current (a) updated? */
+    int                 handoff;         /* listener handed off on upgrade? */
 };
 
 #define DEFINE_ACTION(_name, _type, _desc) STATS_POOL_##_name,
@@ -333,8 +358,11 @@ void _stats_server_incr_by(struct context *ctx, struct server *server, stats_ser
 void _stats_server_decr_by(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
 void _stats_server_set_ts(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
 
-struct stats *stats_create(uint16_t stats_port, char *stats_ip, int stats_interval, char *source, struct array *server_pool);
+struct stats *stats_create(uint16_t stats_port, char *stats_ip, int stats_interval, char *source, size_t mem_limit, struct array *server_pool);
 void stats_destroy(struct stats *stats);
 void stats_swap(struct stats *stats);
+void stats_handoff(struct stats *stats);
+rstatus_t stats_remap(struct stats *stats, struct array *server_pool);
+void stats_hotkey(struct stats *stats, struct array *server_pool);
 
 #endif
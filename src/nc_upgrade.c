@@ -0,0 +1,733 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <nc_core.h>
+#include <nc_upgrade.h>
+#include <nc_admin.h>
+
+/*
+ * Zero downtime binary upgrade.
+ *
+ * On SIGUSR2, the running (old) process creates a unix socket pair, forks
+ * and execs the binary it was started from, with the same arguments. The
+ * listening sockets of all the pools, the stats and the admin port are passed
+ * to the new process over the socket pair using SCM_RIGHTS, along with the
+ * address each of them listens on, as a single message:
+ *
+ *   <addr>\n<addr>\n...\n\n
+ *
+ * The new process picks up the listening socket for an address instead of
+ * creating one, so that no connection is ever refused. Once it is up and
+ * running, it acks the handoff with a single '.' byte. The old process
+ * then stops accepting connections and serving stats, closes the idle
+ * client connections, closes the others as they go idle and exits once
+ * all of them are gone, or after UPGRADE_DRAIN msec.
+ */
+
+#define UPGRADE_BUFSIZE     4096
+
+/* declared by unistd.h only with _GNU_SOURCE */
+#ifndef _GNU_SOURCE
+extern char **environ;
+#endif
+
+struct upgrade_listener {
+    struct string addr; /* listen address */
+    int           sd;   /* inherited socket descriptor */
+};
+
+static struct instance *upgrade_nci;        /* instance */
+static char *upgrade_path;                  /* binary to exec on upgrade */
+static char *upgrade_cwd;                   /* directory to exec it in */
+static volatile sig_atomic_t upgrade_signo; /* upgrade requested? */
+static int upgrade_sd = -1;                 /* handoff socket */
+static pid_t upgrade_pid = -1;              /* pid of new process */
+static int64_t upgrade_deadline;            /* handoff or drain deadline in usec */
+static char upgrade_envstr[sizeof(UPGRADE_ENV) + NC_UINTMAX_MAXLEN]; /* handoff socket env */
+
+static struct upgrade_listener inherited[UPGRADE_MAX_NFD]; /* inherited listeners */
+static uint32_t ninherited;                                /* # inherited listeners */
+
+static void
+upgrade_stats_addr(struct stats *st, struct string *addr, char *buf, size_t size)
+{
+    int n;
+
+    n = nc_scnprintf(buf, size, "%.*s:%u", st->addr.len, st->addr.data,
+                     st->port);
+    addr->len = (uint32_t)n;
+    addr->data = (uint8_t *)buf;
+}
+
+static rstatus_t
+upgrade_recv(int sd)
+{
+    char buf[UPGRADE_BUFSIZE];
+    char control[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_NFD)];
+    int fds[UPGRADE_MAX_NFD];
+    uint32_t i, nfd;
+    size_t len;
+    char *p, *q;
+
+    len = 0;
+    nfd = 0;
+
+    for (;;) {
+        struct msghdr mh;
+        struct iovec iov;
+        struct cmsghdr *cm;
+        ssize_t n;
+
+        if (len == sizeof(buf)) {
+            log_error("recv handoff on sd %d failed: message too long", sd);
+            goto error;
+        }
+
+        iov.iov_base = buf + len;
+        iov.iov_len = sizeof(buf) - len;
+
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+
+        n = recvmsg(sd, &mh, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("recv handoff on sd %d failed: %s", sd, strerror(errno));
+            goto error;
+        }
+
+        if (n == 0) {
+            log_error("recv handoff on sd %d failed: eof", sd);
+            goto error;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&mh); cm != NULL; cm = CMSG_NXTHDR(&mh, cm)) {
+            uint32_t ncmfd;
+            int *cmfd;
+
+            if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+
+            ncmfd = (uint32_t)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            cmfd = (int *)CMSG_DATA(cm);
+            for (i = 0; i < ncmfd && nfd < UPGRADE_MAX_NFD; i++) {
+                fds[nfd++] = cmfd[i];
+            }
+        }
+
+        if (mh.msg_flags & MSG_CTRUNC) {
+            log_error("recv handoff on sd %d failed: descriptors truncated", sd);
+            goto error;
+        }
+
+        len += (size_t)n;
+        if ((len == 1 && buf[0] == '\n') ||
+            (len > 1 && buf[len - 2] == '\n' && buf[len - 1] == '\n')) {
+            break;
+        }
+    }
+
+    /* one listen address per line, in the order of the descriptors */
+    for (p = buf, ninherited = 0; *p != '\n'; p = q + 1, ninherited++) {
+        struct upgrade_listener *l;
+
+        q = memchr(p, '\n', (size_t)(buf + len - p));
+        ASSERT(q != NULL);
+
+        if (ninherited == nfd) {
+            log_error("recv handoff on sd %d failed: %"PRIu32" descriptors for "
+                      "more addresses", sd, nfd);
+            goto error;
+        }
+
+        l = &inherited[ninherited];
+        string_init(&l->addr);
+        if (string_copy(&l->addr, (uint8_t *)p, (uint32_t)(q - p)) != NC_OK) {
+            goto error;
+        }
+        l->sd = fds[ninherited];
+
+        log_debug(LOG_NOTICE, "inherited sd %d listening on '%.*s'", l->sd,
+                  l->addr.len, l->addr.data);
+    }
+
+    if (ninherited != nfd) {
+        log_error("recv handoff on sd %d failed: %"PRIu32" descriptors for "
+                  "%"PRIu32" addresses", sd, nfd, ninherited);
+        goto error;
+    }
+
+    return NC_OK;
+
+error:
+    for (i = 0; i < ninherited; i++) {
+        string_deinit(&inherited[i].addr);
+    }
+    ninherited = 0;
+    for (i = 0; i < nfd; i++) {
+        close(fds[i]);
+    }
+    return NC_ERROR;
+}
+
+static rstatus_t
+upgrade_send(struct context *ctx, int sd)
+{
+    char buf[UPGRADE_BUFSIZE], sbuf[NC_MAXHOSTNAMELEN + 8];
+    char control[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_NFD)];
+    int fds[UPGRADE_MAX_NFD];
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    struct string saddr;
+    struct string *addr;
+    uint32_t i, npool, nfd;
+    size_t len;
+    ssize_t n;
+
+    len = 0;
+    nfd = 0;
+
+    for (i = 0, npool = array_n(&ctx->pool); i <= npool + 1; i++) {
+        int lsd;
+
+        if (i < npool) {
+            struct server_pool *pool = array_get(&ctx->pool, i);
+
+            if (pool->p_conn == NULL) {
+                continue;
+            }
+            addr = &pool->addrstr;
+            lsd = pool->p_conn->sd;
+        } else if (i == npool + 1) {
+            if (ctx->admin == NULL || ctx->admin->p_conn == NULL) {
+                continue;
+            }
+            addr = &ctx->admin->addrstr;
+            lsd = ctx->admin->p_conn->sd;
+        } else {
+            if (ctx->stats->sd < 0) {
+                continue;
+            }
+            upgrade_stats_addr(ctx->stats, &saddr, sbuf, sizeof(sbuf));
+            addr = &saddr;
+            lsd = ctx->stats->sd;
+        }
+
+        if (nfd == UPGRADE_MAX_NFD || len + addr->len + 2 > sizeof(buf)) {
+            log_error("handoff on sd %d failed: too many listeners", sd);
+            return NC_ERROR;
+        }
+
+        nc_memcpy(buf + len, addr->data, addr->len);
+        len += addr->len;
+        buf[len++] = '\n';
+        fds[nfd++] = lsd;
+    }
+    buf[len++] = '\n';
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    if (nfd > 0) {
+        mh.msg_control = control;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfd);
+
+        cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfd);
+        nc_memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfd);
+    }
+
+    n = sendmsg(sd, &mh, 0);
+    if (n < 0 || (size_t)n != len) {
+        log_error("handoff on sd %d failed: %s", sd,
+                  n < 0 ? strerror(errno) : "short write");
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Return the environment of the new process, which is ours with the
+ * handoff socket 'sd' in UPGRADE_ENV. It is built before the fork, as the
+ * child of a multi-threaded process may only make async-signal-safe calls
+ */
+static char **
+upgrade_env(int sd)
+{
+    char **envp;
+    uint32_t i, n;
+    size_t len;
+
+    for (n = 0; environ[n] != NULL; n++) {
+        /* count */
+    }
+
+    envp = nc_alloc(sizeof(*envp) * (n + 2));
+    if (envp == NULL) {
+        return NULL;
+    }
+
+    len = sizeof(UPGRADE_ENV) - 1;
+    for (i = 0, n = 0; environ[i] != NULL; i++) {
+        if (strncmp(environ[i], UPGRADE_ENV, len) == 0 &&
+            environ[i][len] == '=') {
+            continue;
+        }
+        envp[n++] = environ[i];
+    }
+
+    nc_scnprintf(upgrade_envstr, sizeof(upgrade_envstr), "%s=%d", UPGRADE_ENV,
+                 sd);
+    envp[n++] = upgrade_envstr;
+    envp[n] = NULL;
+
+    return envp;
+}
+
+static void
+upgrade_exec(struct context *ctx, int sd, char **envp)
+{
+    int fd;
+
+    /* the new process only gets the handoff socket and stdio */
+    for (fd = 3; fd < (int)ctx->max_nfd; fd++) {
+        if (fd != sd) {
+            close(fd);
+        }
+    }
+
+    /* relative conf, log and pid file paths in argv are relative to it */
+    if (chdir(upgrade_cwd) < 0) {
+        _exit(1);
+    }
+
+    execve(upgrade_path, upgrade_nci->argv, envp);
+
+    _exit(1);
+}
+
+static void
+upgrade_start(struct context *ctx)
+{
+    rstatus_t status;
+    int sv[2];
+    pid_t pid;
+    char **envp;
+
+    if (upgrade_sd >= 0 || ctx->draining) {
+        log_warn("upgrade already in progress, ignored");
+        return;
+    }
+
+    status = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    if (status < 0) {
+        log_error("socketpair for upgrade failed: %s", strerror(errno));
+        return;
+    }
+
+    envp = upgrade_env(sv[1]);
+    if (envp == NULL) {
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        log_error("fork for upgrade failed: %s", strerror(errno));
+        nc_free(envp);
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    }
+
+    if (pid == 0) {
+        /* child */
+        upgrade_exec(ctx, sv[1], envp);
+        NOT_REACHED();
+    }
+
+    nc_free(envp);
+    close(sv[1]);
+
+    status = upgrade_send(ctx, sv[0]);
+    if (status != NC_OK) {
+        close(sv[0]);
+        waitpid(pid, NULL, WNOHANG);
+        return;
+    }
+
+    status = nc_set_nonblocking(sv[0]);
+    if (status < 0) {
+        log_error("set nonblock on sd %d failed: %s", sv[0], strerror(errno));
+        close(sv[0]);
+        waitpid(pid, NULL, WNOHANG);
+        return;
+    }
+
+    upgrade_sd = sv[0];
+    upgrade_pid = pid;
+    upgrade_deadline = nc_usec_now() + UPGRADE_TIMEOUT * 1000LL;
+
+    loga("upgrade started, exec '%s' as pid %d", upgrade_path, pid);
+}
+
+static void
+upgrade_close(void)
+{
+    close(upgrade_sd);
+    upgrade_sd = -1;
+    waitpid(upgrade_pid, NULL, WNOHANG);
+    upgrade_pid = -1;
+}
+
+/*
+ * Stop accepting connections on the listeners handed off to the new
+ * process and start draining the client connections
+ */
+static void
+upgrade_handoff(struct context *ctx)
+{
+    uint32_t i, npool;
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+        struct conn *p = pool->p_conn;
+
+        if (p == NULL) {
+            continue;
+        }
+
+        /*
+         * The listening socket is still open in the new process, so it
+         * must be removed from the event base before it is closed here
+         */
+        event_del_conn(ctx->evb, p);
+        p->close(ctx, p);
+    }
+
+    if (ctx->admin != NULL && ctx->admin->p_conn != NULL) {
+        event_del_conn(ctx->evb, ctx->admin->p_conn);
+        ctx->admin->p_conn->close(ctx, ctx->admin->p_conn);
+    }
+
+    stats_handoff(ctx->stats);
+
+    /* idle clients would otherwise hold us up until their next event */
+    ctx->draining = 1;
+    core_drain(ctx);
+
+    upgrade_deadline = nc_usec_now() + UPGRADE_DRAIN * 1000LL;
+
+    /* pid file now belongs to the new process */
+    upgrade_nci->pidfile = 0;
+
+    loga("upgrade handed off to pid %d, draining %"PRIu32" client "
+         "connections", upgrade_pid, conn_ncurr_cconn());
+}
+
+static void
+upgrade_wait(struct context *ctx)
+{
+    char ack;
+    ssize_t n;
+
+    n = read(upgrade_sd, &ack, 1);
+    if (n == 1 && ack == '.') {
+        upgrade_handoff(ctx);
+        upgrade_close();
+        return;
+    }
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        if (nc_usec_now() < upgrade_deadline) {
+            return;
+        }
+        log_error("upgrade failed: pid %d did not start in %d msec",
+                  upgrade_pid, UPGRADE_TIMEOUT);
+    } else {
+        log_error("upgrade failed: pid %d did not start", upgrade_pid);
+    }
+
+    upgrade_close();
+}
+
+/*
+ * Return the absolute path of executable 'name' in PATH, or NULL if there
+ * is none; the caller frees it
+ */
+static char *
+upgrade_which(const char *name)
+{
+    char buf[PATH_MAX];
+    const char *dir, *end, *env;
+
+    env = getenv("PATH");
+    if (env == NULL) {
+        return NULL;
+    }
+
+    for (dir = env; ; dir = end + 1) {
+        int n;
+
+        end = strchr(dir, ':');
+        if (end == NULL) {
+            end = dir + strlen(dir);
+        }
+
+        /* an empty entry means the current directory */
+        n = nc_scnprintf(buf, sizeof(buf), "%.*s%s%s", (int)(end - dir), dir,
+                         end == dir ? "" : "/", name);
+        if (n < (int)sizeof(buf) - 1 && access(buf, X_OK) == 0) {
+            return realpath(buf, NULL);
+        }
+
+        if (*end == '\0') {
+            return NULL;
+        }
+    }
+}
+
+rstatus_t
+upgrade_init(struct instance *nci)
+{
+    rstatus_t status;
+    char *env;
+    int sd;
+
+    upgrade_nci = nci;
+
+    /*
+     * Resolve a relative path before daemonizing changes the directory,
+     * and look up a bare name in PATH, as the upgrade execs it with execve
+     */
+    upgrade_path = nci->argv[0];
+    if (strchr(upgrade_path, '/') != NULL) {
+        char *path = realpath(upgrade_path, NULL);
+        if (path != NULL) {
+            upgrade_path = path;
+        }
+    } else {
+        char *path = upgrade_which(upgrade_path);
+        if (path != NULL) {
+            upgrade_path = path;
+        }
+    }
+
+    /* and the directory the conf, log and pid file paths are relative to */
+    upgrade_cwd = getcwd(NULL, 0);
+    if (upgrade_cwd == NULL) {
+        log_error("getcwd failed: %s", strerror(errno));
+        return NC_ERROR;
+    }
+
+    env = getenv(UPGRADE_ENV);
+    if (env == NULL) {
+        return NC_OK;
+    }
+
+    sd = nc_atoi(env, strlen(env));
+    unsetenv(UPGRADE_ENV);
+    if (sd < 0) {
+        log_error("invalid handoff socket in %s", UPGRADE_ENV);
+        return NC_ERROR;
+    }
+
+    status = upgrade_recv(sd);
+    if (status != NC_OK) {
+        close(sd);
+        return status;
+    }
+
+    upgrade_sd = sd;
+
+    return NC_OK;
+}
+
+void
+upgrade_deinit(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < ninherited; i++) {
+        string_deinit(&inherited[i].addr);
+    }
+    ninherited = 0;
+
+    if (upgrade_path != NULL && upgrade_path != upgrade_nci->argv[0]) {
+        free(upgrade_path);
+    }
+    upgrade_path = NULL;
+
+    free(upgrade_cwd);
+    upgrade_cwd = NULL;
+}
+
+/*
+ * Called from the signal handler, so only sets a flag that upgrade_loop
+ * picks up
+ */
+void
+upgrade_request(void)
+{
+    upgrade_signo = 1;
+}
+
+/*
+ * Return true if listeners were handed off to us and are yet to be acked
+ */
+bool
+upgrade_pending(void)
+{
+    return upgrade_sd >= 0;
+}
+
+/*
+ * Return the listening socket handed off for address 'addr' by the old
+ * process, or -1 if there is none
+ */
+int
+upgrade_inherit(struct string *addr)
+{
+    uint32_t i;
+
+    for (i = 0; i < ninherited; i++) {
+        struct upgrade_listener *l = &inherited[i];
+        int sd;
+
+        if (l->sd < 0 || string_compare(&l->addr, addr) != 0) {
+            continue;
+        }
+
+        sd = l->sd;
+        l->sd = -1;
+
+        return sd;
+    }
+
+    return -1;
+}
+
+int
+upgrade_inherit_stats(struct stats *st)
+{
+    char buf[NC_MAXHOSTNAMELEN + 8];
+    struct string addr;
+
+    upgrade_stats_addr(st, &addr, buf, sizeof(buf));
+
+    return upgrade_inherit(&addr);
+}
+
+/*
+ * Ack the handoff to the old process once all listeners are up, and close
+ * the listeners no longer in the configuration
+ */
+rstatus_t
+upgrade_done(void)
+{
+    uint32_t i;
+    ssize_t n;
+
+    if (upgrade_sd < 0) {
+        return NC_OK;
+    }
+
+    for (i = 0; i < ninherited; i++) {
+        struct upgrade_listener *l = &inherited[i];
+
+        if (l->sd >= 0) {
+            log_warn("closing handed off sd %d listening on '%.*s' not in "
+                     "configuration", l->sd, l->addr.len, l->addr.data);
+            close(l->sd);
+            l->sd = -1;
+        }
+    }
+
+    n = write(upgrade_sd, ".", 1);
+    close(upgrade_sd);
+    upgrade_sd = -1;
+
+    if (n != 1) {
+        log_error("ack handoff failed: %s", n < 0 ? strerror(errno) : "eof");
+        return NC_ERROR;
+    }
+
+    loga("upgrade took over %"PRIu32" listeners", ninherited);
+
+    return NC_OK;
+}
+
+/*
+ * Drive the upgrade from the event loop; returns NC_ERROR once the old
+ * process is done draining and should exit
+ */
+rstatus_t
+upgrade_loop(struct context *ctx)
+{
+    if (upgrade_signo) {
+        upgrade_signo = 0;
+        upgrade_start(ctx);
+    }
+
+    if (upgrade_sd >= 0) {
+        upgrade_wait(ctx);
+    }
+
+    if (upgrade_sd < 0 && !ctx->draining) {
+        return NC_OK;
+    }
+
+    /* poll for the handoff ack and the drain more often than usual */
+    if (ctx->timeout < 0 || ctx->timeout > UPGRADE_POLL) {
+        ctx->timeout = UPGRADE_POLL;
+    }
+
+    if (ctx->draining) {
+        if (conn_ncurr_cconn() == 0) {
+            loga("upgrade drained all client connections, exiting");
+            return NC_ERROR;
+        }
+
+        if (nc_usec_now() >= upgrade_deadline) {
+            loga("upgrade drain timed out with %"PRIu32" client connections, "
+                 "exiting", conn_ncurr_cconn());
+            return NC_ERROR;
+        }
+    }
+
+    return NC_OK;
+}
@@ -0,0 +1,40 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_UPGRADE_H_
+#define _NC_UPGRADE_H_
+
+#include <nc_core.h>
+
+#define UPGRADE_ENV         "NC_UPGRADE_FD"  /* handoff socket of new process */
+#define UPGRADE_MAX_NFD     64               /* max # listeners handed off */
+#define UPGRADE_TIMEOUT     30000            /* max msec for new process to start */
+#define UPGRADE_DRAIN       30000            /* max msec to drain client connections */
+#define UPGRADE_POLL        100              /* msec between checks while upgrading */
+
+rstatus_t upgrade_init(struct instance *nci);
+void upgrade_deinit(void);
+void upgrade_request(void);
+bool upgrade_pending(void);
+
+int upgrade_inherit(struct string *addr);
+int upgrade_inherit_stats(struct stats *st);
+rstatus_t upgrade_done(void);
+
+rstatus_t upgrade_loop(struct context *ctx);
+
+#endif
@@ -251,6 +251,27 @@ _nc_zalloc(size_t size, const char *name, int line)
     return p;
 }
 
+void *
+_nc_memalign(size_t alignment, size_t size, const char *name, int line)
+{
+    void *p;
+    int status;
+
+    ASSERT(size != 0);
+
+    status = posix_memalign(&p, alignment, size);
+    if (status != 0) {
+        log_error("posix_memalign(%zu, %zu) failed @ %s:%d: %s", alignment,
+                  size, name, line, strerror(status));
+        return NULL;
+    }
+
+    log_debug(LOG_VVERB, "posix_memalign(%zu, %zu) at %p @ %s:%d", alignment,
+              size, p, name, line);
+
+    return p;
+}
+
 void *
 _nc_calloc(size_t nmemb, size_t size, const char *name, int line)
 {
@@ -321,9 +342,14 @@ nc_stacktrace_fd(int fd)
 void
 nc_assert(const char *cond, const char *file, int line, int panic)
 {
-    log_error("assert '%s' failed @ (%s, %d)", cond, file, line);
+    /* all assertions share this call site, so it is not rate limited */
+    if (log_loggable(LOG_ALERT) != 0) {
+        _log(__FILE__, __LINE__, 0, "assert '%s' failed @ (%s, %d)", cond,
+             file, line);
+    }
     if (panic) {
         nc_stacktrace(1);
+        log_flush();
         abort();
     }
 }
@@ -461,6 +487,42 @@ nc_msec_now(void)
     return nc_usec_now() / 1000LL;
 }
 
+/*
+ * Write the first len bytes of a keylen bytes long key to buf as a
+ * printable string; as a json string body if json is set. Truncated keys
+ * end in "...". Returns the length of the string
+ */
+size_t
+nc_key_string(char *buf, size_t size, const uint8_t *key, uint32_t len,
+              uint32_t keylen, bool json)
+{
+    uint32_t i;
+    size_t n;
+
+    ASSERT(size > 0);
+    ASSERT(len <= keylen);
+
+    for (i = 0, n = 0; i < len && n + 7 < size; i++) {
+        uint8_t c = key[i];
+
+        if (c == '"' || c == '\\' || !isgraph(c)) {
+            n += (size_t)nc_scnprintf(buf + n, size - n,
+                                      json ? "\\u%04x" : "\\x%02x", c);
+        } else {
+            buf[n++] = (char)c;
+        }
+    }
+
+    if (keylen > len && n + 3 < size) {
+        nc_memcpy(buf + n, "...", 3);
+        n += 3;
+    }
+
+    buf[n] = '\0';
+
+    return n;
+}
+
 static int
 nc_resolve_inet(struct string *name, int port, struct sockinfo *si)
 {
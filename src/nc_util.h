@@ -38,6 +38,8 @@
 #define NC_INET6_ADDRSTRLEN \
     (sizeof("ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255") - 1)
 #define NC_INET_ADDRSTRLEN  MAX(NC_INET4_ADDRSTRLEN, NC_INET6_ADDRSTRLEN)
+
+#define NC_CACHELINE_SIZE   64
 #define NC_UNIX_ADDRSTRLEN  \
     (sizeof(struct sockaddr_un) - offsetof(struct sockaddr_un, sun_path))
 
@@ -105,6 +107,9 @@ bool nc_valid_port(int n);
 #define nc_zalloc(_s)                   \
     _nc_zalloc((size_t)(_s), __FILE__, __LINE__)
 
+#define nc_memalign(_a, _s)             \
+    _nc_memalign((size_t)(_a), (size_t)(_s), __FILE__, __LINE__)
+
 #define nc_calloc(_n, _s)               \
     _nc_calloc((size_t)(_n), (size_t)(_s), __FILE__, __LINE__)
 
@@ -118,6 +123,7 @@ bool nc_valid_port(int n);
 
 void *_nc_alloc(size_t size, const char *name, int line);
 void *_nc_zalloc(size_t size, const char *name, int line);
+void *_nc_memalign(size_t alignment, size_t size, const char *name, int line);
 void *_nc_calloc(size_t nmemb, size_t size, const char *name, int line);
 void *_nc_realloc(void *ptr, size_t size, const char *name, int line);
 void _nc_free(void *ptr, const char *name, int line);
@@ -194,6 +200,8 @@ int _vscnprintf(char *buf, size_t size, const char *fmt, va_list args);
 int64_t nc_usec_now(void);
 int64_t nc_msec_now(void);
 
+size_t nc_key_string(char *buf, size_t size, const uint8_t *key, uint32_t len, uint32_t keylen, bool json);
+
 /*
  * Address resolution for internet (ipv4 and ipv6) and unix domain
  * socket address.
@@ -135,6 +135,67 @@ memcache_touch(struct msg *r)
     return false;
 }
 
+/*
+ * Return true, if the memcache command is a meta command that carries
+ * a key, otherwise return false
+ */
+static bool
+memcache_meta(struct msg *r)
+{
+    switch (r->type) {
+    case MSG_REQ_MC_MG:
+    case MSG_REQ_MC_MS:
+    case MSG_REQ_MC_MD:
+    case MSG_REQ_MC_MA:
+    case MSG_REQ_MC_ME:
+        return true;
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Return true, if the memcache command is a meta storage command, otherwise
+ * return false
+ */
+static bool
+memcache_meta_storage(struct msg *r)
+{
+    if (r->type == MSG_REQ_MC_MS) {
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Return true, if the response r to the quiet mode meta request is one
+ * that the client asked to be suppressed, otherwise return false
+ */
+static bool
+memcache_quiet_suppressed(struct msg *req, struct msg *r)
+{
+    switch (req->type) {
+    case MSG_REQ_MC_MG:
+        return r->type == MSG_RSP_MC_EN ? true : false;
+
+    case MSG_REQ_MC_MS:
+    case MSG_REQ_MC_MA:
+        return r->type == MSG_RSP_MC_HD ? true : false;
+
+    case MSG_REQ_MC_MD:
+        return (r->type == MSG_RSP_MC_HD || r->type == MSG_RSP_MC_NF) ? true : false;
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
 //֧https://github.com/twitter/twemproxy/blob/master/notes/redis.md
 void
 memcache_parse_req(struct msg *r)
@@ -166,6 +227,9 @@ memcache_parse_req(struct msg *r)
         SW_CRLF,
         SW_NOREPLY,
         SW_AFTER_NOREPLY,
+        SW_META_FLAGS,
+        SW_META_FLAG_Q,
+        SW_META_FLAG,
         SW_ALMOST_DONE,
         SW_SENTINEL
     } state;
@@ -214,6 +278,39 @@ memcache_parse_req(struct msg *r)
 
                 switch (p - m) {
 
+                case 2:
+                    if (str2cmp(m, 'm', 'g')) {
+                        r->type = MSG_REQ_MC_MG;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'm', 's')) {
+                        r->type = MSG_REQ_MC_MS;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'm', 'd')) {
+                        r->type = MSG_REQ_MC_MD;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'm', 'a')) {
+                        r->type = MSG_REQ_MC_MA;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'm', 'n')) {
+                        r->type = MSG_REQ_MC_MN;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'm', 'e')) {
+                        r->type = MSG_REQ_MC_ME;
+                        break;
+                    }
+
+                    break;
+
                 case 3:
                     if (str4cmp(m, 'g', 'e', 't', ' ')) {  //get kye1 key2  getһλȡkey
                         r->type = MSG_REQ_MC_GET;
@@ -309,6 +406,11 @@ memcache_parse_req(struct msg *r)
                 case MSG_REQ_MC_INCR:
                 case MSG_REQ_MC_DECR:
                 case MSG_REQ_MC_TOUCH:
+                case MSG_REQ_MC_MG:
+                case MSG_REQ_MC_MS:
+                case MSG_REQ_MC_MD:
+                case MSG_REQ_MC_MA:
+                case MSG_REQ_MC_ME:
                     if (ch == CR) {
                         goto error;
                     }
@@ -320,6 +422,17 @@ memcache_parse_req(struct msg *r)
                     state = SW_CRLF;
                     break;
 
+                case MSG_REQ_MC_MN:
+                    /*
+                     * Responses to a client are always written in request
+                     * order, so the no-op can be answered by the proxy
+                     * itself once everything pipelined before it is done
+                     */
+                    r->noforward = 1;
+                    p = p - 1; /* go back by 1 byte */
+                    state = SW_CRLF;
+                    break;
+
                 case MSG_UNKNOWN:
                     goto error;
 
@@ -360,18 +473,23 @@ memcache_parse_req(struct msg *r)
                     goto error;
                 }
 
-                kpos = array_push(r->keys);
+                kpos = msg_key_push(r);
                 if (kpos == NULL) {
                     goto enomem;
                 }
                 kpos->start = r->token;
                 kpos->end = p;
+                msg_key_hash(r, kpos);
 
                 r->narg++;
                 r->token = NULL;
 
                 /* get next state */
-                if (memcache_storage(r)) {
+                if (memcache_meta_storage(r)) {
+                    state = SW_SPACES_BEFORE_VLEN;
+                } else if (memcache_meta(r)) {
+                    state = SW_META_FLAGS;
+                } else if (memcache_storage(r)) {
                     state = SW_SPACES_BEFORE_FLAGS;
                 } else if (memcache_arithmetic(r) || memcache_touch(r) ) {
                     state = SW_SPACES_BEFORE_NUM;
@@ -384,7 +502,8 @@ memcache_parse_req(struct msg *r)
                 }
 
                 if (ch == CR) {
-                    if (memcache_storage(r) || memcache_arithmetic(r)) {
+                    if (memcache_storage(r) || memcache_arithmetic(r) ||
+                        memcache_meta_storage(r)) {
                         goto error;
                     }
                     p = p - 1; /* go back by 1 byte */
@@ -486,6 +605,11 @@ memcache_parse_req(struct msg *r)
                 p = p - 1; /* go back by 1 byte */
                 r->token = NULL;
                 state = SW_SPACES_BEFORE_CAS;
+            } else if (memcache_meta_storage(r) && (ch == ' ' || ch == CR)) {
+                /* vlen_end <- p - 1 */
+                p = p - 1; /* go back by 1 byte */
+                r->token = NULL;
+                state = SW_META_FLAGS;
             } else if (ch == ' ' || ch == CR) {
                 /* vlen_end <- p - 1 */
                 p = p - 1; /* go back by 1 byte */
@@ -668,6 +792,74 @@ memcache_parse_req(struct msg *r)
 
             break;
 
+        case SW_META_FLAGS:
+            switch (ch) {
+            case ' ':
+                break;
+
+            case CR:
+                if (memcache_meta_storage(r)) {
+                    state = SW_RUNTO_VAL;
+                } else {
+                    state = SW_ALMOST_DONE;
+                }
+                break;
+
+            case 'q':
+                p = p - 1; /* go back by 1 byte */
+                r->token = NULL;
+                state = SW_META_FLAG_Q;
+                break;
+
+            default:
+                if (!isgraph(ch)) {
+                    goto error;
+                }
+                /* flag_start <- p */
+                state = SW_META_FLAG;
+            }
+
+            break;
+
+        case SW_META_FLAG_Q:
+            if (r->token == NULL) {
+                /* flag_start <- p */
+                r->token = p;
+                break;
+            }
+
+            if (ch == ' ' || ch == CR) {
+                /*
+                 * Quiet mode makes the server skip some replies, which
+                 * would break our in-order matching of responses to
+                 * requests. So we blank out the 'q' flag before forwarding
+                 * and drop the replies that the client asked to be
+                 * suppressed in memcache_pre_coalesce
+                 */
+                *r->token = ' ';
+                r->token = NULL;
+                r->quiet = 1;
+                p = p - 1; /* go back by 1 byte */
+                state = SW_META_FLAGS;
+            } else {
+                /* some other flag with a 'q' prefix */
+                r->token = NULL;
+                state = SW_META_FLAG;
+            }
+
+            break;
+
+        case SW_META_FLAG:
+            if (ch == ' ' || ch == CR) {
+                /* flag_end <- p - 1 */
+                p = p - 1; /* go back by 1 byte */
+                state = SW_META_FLAGS;
+            } else if (!isgraph(ch)) {
+                goto error;
+            }
+
+            break;
+
         case SW_CRLF:
             switch (ch) {
             case ' ':
@@ -857,6 +1049,50 @@ memcache_parse_rsp(struct msg *r)
                 r->type = MSG_UNKNOWN;
 
                 switch (p - m) {
+                case 2:
+                    if (str2cmp(m, 'V', 'A')) {
+                        /* meta get or arithmetic with a value */
+                        r->type = MSG_RSP_MC_VA;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'H', 'D')) {
+                        r->type = MSG_RSP_MC_HD;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'E', 'N')) {
+                        r->type = MSG_RSP_MC_EN;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'N', 'S')) {
+                        r->type = MSG_RSP_MC_NS;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'E', 'X')) {
+                        r->type = MSG_RSP_MC_EX;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'N', 'F')) {
+                        r->type = MSG_RSP_MC_NF;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'M', 'N')) {
+                        r->type = MSG_RSP_MC_MN;
+                        break;
+                    }
+
+                    if (str2cmp(m, 'M', 'E')) {
+                        r->type = MSG_RSP_MC_ME;
+                        break;
+                    }
+
+                    break;
+
                 case 3:
                     if (str4cmp(m, 'E', 'N', 'D', '\r')) {
                         r->type = MSG_RSP_MC_END;
@@ -970,6 +1206,21 @@ memcache_parse_rsp(struct msg *r)
                     state = SW_RUNTO_CRLF;
                     break;
 
+                case MSG_RSP_MC_VA:
+                    state = SW_SPACES_BEFORE_VLEN;
+                    break;
+
+                case MSG_RSP_MC_HD:
+                case MSG_RSP_MC_EN:
+                case MSG_RSP_MC_NS:
+                case MSG_RSP_MC_EX:
+                case MSG_RSP_MC_NF:
+                case MSG_RSP_MC_MN:
+                case MSG_RSP_MC_ME:
+                    /* meta responses are followed by optional return flags */
+                    state = SW_RUNTO_CRLF;
+                    break;
+
                 default:
                     NOT_REACHED();
                 }
@@ -1092,6 +1343,10 @@ memcache_parse_rsp(struct msg *r)
         case SW_VAL_LF:
             switch (ch) {
             case LF:
+                if (r->type == MSG_RSP_MC_VA) {
+                    /* meta responses carry at most one value */
+                    goto done;
+                }
                 /* state = SW_END; */
                 state = SW_RSP_STR;
                 break;
@@ -1132,7 +1387,7 @@ memcache_parse_rsp(struct msg *r)
         case SW_RUNTO_CRLF:
             switch (ch) {
             case CR:
-                if (r->type == MSG_RSP_MC_VALUE) {
+                if (r->type == MSG_RSP_MC_VALUE || r->type == MSG_RSP_MC_VA) {
                     state = SW_RUNTO_VAL;
                 } else {
                     state = SW_ALMOST_DONE;
@@ -1184,6 +1439,7 @@ memcache_parse_rsp(struct msg *r)
     ASSERT(p == b->last);
     r->pos = p;
     r->state = state;
+    r->invalue = (state == SW_VAL) ? 1 : 0;
 
     if (b->last == b->end && r->token != NULL) { //msgѾˣvalueݻû
         if (state <= SW_RUNTO_VAL || state == SW_CRLF || state == SW_ALMOST_DONE) {
@@ -1230,25 +1486,48 @@ memcache_failure(struct msg *r)
     return false;
 }
 
+/*
+ * Skip n bytes of the value that the response parser stopped within, as
+ * if they had been parsed. Returns the # bytes of the value still to come
+ */
+uint32_t
+memcache_skip(struct msg *r, uint32_t n)
+{
+    ASSERT(!r->request);
+
+    if (!r->invalue) {
+        return 0;
+    }
+
+    ASSERT(n <= r->vlen);
+    r->vlen -= n;
+
+    return r->vlen;
+}
+
 static rstatus_t
-memcache_append_key(struct msg *r, uint8_t *key, uint32_t keylen)
+memcache_append_key(struct msg *r, struct keypos *key)
 {
     struct mbuf *mbuf;
     struct keypos *kpos;
+    uint32_t keylen;
+
+    keylen = (uint32_t)(key->end - key->start);
 
     mbuf = msg_ensure_mbuf(r, keylen + 2);
     if (mbuf == NULL) {
         return NC_ENOMEM;
     }
 
-    kpos = array_push(r->keys);
+    kpos = msg_key_push(r);
     if (kpos == NULL) {
         return NC_ENOMEM;
     }
 
     kpos->start = mbuf->last;
     kpos->end = mbuf->last + keylen;
-    mbuf_copy(mbuf, key, keylen);
+    kpos->hash = key->hash;
+    mbuf_copy(mbuf, key->start, keylen);
     r->mlen += keylen;
 
     mbuf_copy(mbuf, (uint8_t *)" ", 1);
@@ -1274,9 +1553,7 @@ memcache_fragment_retrieval(struct msg *r, uint32_t ncontinuum,
         return NC_ENOMEM;
     }
 
-    ASSERT(r->frag_seq == NULL);
-    r->frag_seq = nc_alloc(array_n(r->keys) * sizeof(*r->frag_seq));
-    if (r->frag_seq == NULL) {
+    if (msg_frag_create(r, array_n(&r->keys)) == NULL) {
         nc_free(sub_msgs);
         return NC_ENOMEM;
     }
@@ -1296,15 +1573,14 @@ memcache_fragment_retrieval(struct msg *r, uint32_t ncontinuum,
     mbuf->pos++;
 
     r->frag_id = msg_gen_frag_id();
-    r->nfrag = 0;
     r->frag_owner = r;
 
     /* ѷֲͬһmemcachedgetƴӵһget key1 key2 key3 key4 key5еkey2 key3ֲͬһ
         ַ"key2 key3"ɶӦĺ˷ָ*/
-    for (i = 0; i < array_n(r->keys); i++) {        /* for each  key */
+    for (i = 0; i < array_n(&r->keys); i++) {        /* for each  key */
         struct msg *sub_msg;
-        struct keypos *kpos = array_get(r->keys, i);
-        uint32_t idx = msg_backend_idx(r, kpos->start, kpos->end - kpos->start);
+        struct keypos *kpos = array_get(&r->keys, i);
+        uint32_t idx = msg_backend_idx(r, kpos);
 
         if (sub_msgs[idx] == NULL) {
             sub_msgs[idx] = msg_get(r->owner, r->request, r->redis);
@@ -1315,10 +1591,10 @@ memcache_fragment_retrieval(struct msg *r, uint32_t ncontinuum,
         }
 
         //iѾܹλӦ÷˵һ̨
-        r->frag_seq[i] = sub_msg = sub_msgs[idx];
+        r->frag->seq[i] = sub_msg = sub_msgs[idx];
 
         sub_msg->narg++;
-        status = memcache_append_key(sub_msg, kpos->start, kpos->end - kpos->start);
+        status = memcache_append_key(sub_msg, kpos);
         if (status != NC_OK) {
             nc_free(sub_msgs);
             return status;
@@ -1355,7 +1631,7 @@ memcache_fragment_retrieval(struct msg *r, uint32_t ncontinuum,
         sub_msg->frag_owner = r->frag_owner;
 
         TAILQ_INSERT_TAIL(frag_msgq, sub_msg, m_tqe); //еַúӵfrag_msgq
-        r->nfrag++;
+        r->frag->nfrag++;
     }
 
     nc_free(sub_msgs);
@@ -1385,12 +1661,25 @@ memcache_pre_coalesce(struct msg *r)
     ASSERT(!r->request);
     ASSERT(pr->request);
 
+    if (pr->quiet && memcache_quiet_suppressed(pr, r)) {
+        /*
+         * Drop the reply that the server would have skipped had we
+         * forwarded the quiet mode flag; an empty response is still
+         * needed to retire the request in order
+         */
+        STAILQ_FOREACH(mbuf, &r->mhdr, next) {
+            mbuf->pos = mbuf->last;
+        }
+        r->mlen = 0;
+        return;
+    }
+
     if (pr->frag_id == 0) {
         /* do nothing, if not a response to a fragmented request */
         return;
     }
 
-    pr->frag_owner->nfrag_done++;
+    pr->frag_owner->frag->nfrag_done++;
     switch (r->type) {
 
     case MSG_RSP_MC_VALUE:
@@ -1543,12 +1832,17 @@ memcache_post_coalesce(struct msg *request)
         return;
     }
 
-    for (i = 0; i < array_n(request->keys); i++) {      /* for each  key */
-        sub_msg = request->frag_seq[i]->peer;           /* get it's peer response */
+    response->type = MSG_RSP_MC_END;
+
+    for (i = 0; i < array_n(&request->keys); i++) {      /* for each  key */
+        sub_msg = request->frag->seq[i]->peer;          /* get it's peer response */
         if (sub_msg == NULL) {
             response->owner->err = 1;
             return;
         }
+        if (sub_msg->type == MSG_RSP_MC_VALUE) {
+            response->type = MSG_RSP_MC_VALUE;
+        }
         status = memcache_copy_bulk(response, sub_msg);
         if (status != NC_OK) {
             response->owner->err = 1;
@@ -1582,9 +1876,26 @@ memcache_add_auth(struct context *ctx, struct conn *c_conn, struct conn *s_conn)
 }
 
 rstatus_t
-memcache_reply(struct msg *r)
+memcache_add_hello(struct context *ctx, struct conn *c_conn, struct conn *s_conn)
 {
     NOT_REACHED();
     return NC_OK;
 }
 
+rstatus_t
+memcache_reply(struct msg *r)
+{
+    struct msg *response = r->peer;
+
+    ASSERT(response != NULL && response->owner != NULL);
+
+    switch (r->type) {
+    case MSG_REQ_MC_MN:
+        return msg_append(response, (uint8_t *)"MN"CRLF, 2 + CRLF_LEN);
+
+    default:
+        NOT_REACHED();
+        return NC_ERROR;
+    }
+}
+
@@ -22,6 +22,9 @@
 
 #ifdef NC_LITTLE_ENDIAN
 
+#define str2cmp(m, c0, c1)                                                                  \
+    (*(uint16_t *) m == ((c1 << 8) | c0))
+
 #define str4cmp(m, c0, c1, c2, c3)                                                          \
     (*(uint32_t *) m == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0))
 
@@ -55,6 +58,9 @@
 
 #else
 
+#define str2cmp(m, c0, c1)                                                                  \
+    (m[0] == c0 && m[1] == c1)
+
 #define str4cmp(m, c0, c1, c2, c3)                                                          \
     (m[0] == c0 && m[1] == c1 && m[2] == c2 && m[3] == c3)
 
@@ -141,9 +147,11 @@
 void memcache_parse_req(struct msg *r);
 void memcache_parse_rsp(struct msg *r);
 bool memcache_failure(struct msg *r);
+uint32_t memcache_skip(struct msg *r, uint32_t n);
 void memcache_pre_coalesce(struct msg *r);
 void memcache_post_coalesce(struct msg *r);
 rstatus_t memcache_add_auth(struct context *ctx, struct conn *c_conn, struct conn *s_conn);
+rstatus_t memcache_add_hello(struct context *ctx, struct conn *c_conn, struct conn *s_conn);
 rstatus_t memcache_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq);
 rstatus_t memcache_reply(struct msg *r);
 void memcache_post_connect(struct context *ctx, struct conn *conn, struct server *server);
@@ -152,9 +160,11 @@ void memcache_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg);
 void redis_parse_req(struct msg *r);
 void redis_parse_rsp(struct msg *r);
 bool redis_failure(struct msg *r);
+uint32_t redis_skip(struct msg *r, uint32_t n);
 void redis_pre_coalesce(struct msg *r);
 void redis_post_coalesce(struct msg *r);
 rstatus_t redis_add_auth(struct context *ctx, struct conn *c_conn, struct conn *s_conn);
+rstatus_t redis_add_hello(struct context *ctx, struct conn *c_conn, struct conn *s_conn);
 rstatus_t redis_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq);
 rstatus_t redis_reply(struct msg *r);
 void redis_post_connect(struct context *ctx, struct conn *conn, struct server *server);
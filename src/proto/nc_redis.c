@@ -28,12 +28,16 @@
     ACTION( invalid_password, "-ERR invalid password\r\n"                         ) \
     ACTION( auth_required,    "-NOAUTH Authentication required\r\n"               ) \
     ACTION( no_password,      "-ERR Client sent AUTH, but no password is set\r\n" ) \
+    ACTION( no_proto,         "-NOPROTO unsupported protocol version\r\n"         ) \
+    ACTION( hello_syntax,     "-ERR syntax error in HELLO option\r\n"             ) \
 
 #define DEFINE_ACTION(_var, _str) static struct string rsp_##_var = string(_str);
     RSP_STRING( DEFINE_ACTION )
 #undef DEFINE_ACTION
 
 static rstatus_t redis_handle_auth_req(struct msg *request, struct msg *response);
+static rstatus_t redis_handle_hello_req(struct msg *request, struct msg *response);
+static rstatus_t redis_reply_msg(struct msg *request, struct msg *response);
 
 /*
  * Return true, if the redis command take no key, otherwise
@@ -62,7 +66,6 @@ static bool
 redis_arg0(struct msg *r) ////keyĲΪ0EXISTS yang,keyλyangkeyĲû
 {
     switch (r->type) {
-    case MSG_REQ_REDIS_EXISTS:
     case MSG_REQ_REDIS_PERSIST:
     case MSG_REQ_REDIS_PTTL:
     case MSG_REQ_REDIS_TTL:
@@ -226,12 +229,9 @@ redis_argn(struct msg *r) //key
     case MSG_REQ_REDIS_RPUSH:
 
     case MSG_REQ_REDIS_SADD:
-    case MSG_REQ_REDIS_SDIFF:
     case MSG_REQ_REDIS_SDIFFSTORE:
-    case MSG_REQ_REDIS_SINTER:
     case MSG_REQ_REDIS_SINTERSTORE:
     case MSG_REQ_REDIS_SREM:
-    case MSG_REQ_REDIS_SUNION:
     case MSG_REQ_REDIS_SUNIONSTORE:
     case MSG_REQ_REDIS_SRANDMEMBER:
     case MSG_REQ_REDIS_SSCAN:
@@ -268,6 +268,19 @@ redis_argx(struct msg *r)
     switch (r->type) {
     case MSG_REQ_REDIS_MGET:
     case MSG_REQ_REDIS_DEL:
+    case MSG_REQ_REDIS_EXISTS:
+    case MSG_REQ_REDIS_TOUCH:
+    case MSG_REQ_REDIS_UNLINK:
+    case MSG_REQ_REDIS_SDIFF:
+    case MSG_REQ_REDIS_SINTER:
+    case MSG_REQ_REDIS_SUNION:
+        return true;
+
+    case MSG_REQ_REDIS_HELLO:
+        /*
+         * hello is never forwarded; every argument is kept in keys so that
+         * the options can be examined when we reply to it
+         */
         return true;
 
     default:
@@ -809,6 +822,17 @@ redis_parse_req(struct msg *r) //redis
                     break;
                 }
 
+                if (str5icmp(m, 'h', 'e', 'l', 'l', 'o')) {
+                    r->type = MSG_REQ_REDIS_HELLO;
+                    r->noforward = 1;
+                    break;
+                }
+
+                if (str5icmp(m, 't', 'o', 'u', 'c', 'h')) {
+                    r->type = MSG_REQ_REDIS_TOUCH;
+                    break;
+                }
+
                 break;
 
             case 6:
@@ -832,6 +856,11 @@ redis_parse_req(struct msg *r) //redis
                     break;
                 }
 
+                if (str6icmp(m, 'u', 'n', 'l', 'i', 'n', 'k')) {
+                    r->type = MSG_REQ_REDIS_UNLINK;
+                    break;
+                }
+
                 if (str6icmp(m, 'e', 'x', 'p', 'i', 'r', 'e')) {
                     r->type = MSG_REQ_REDIS_EXPIRE;
                     break;
@@ -1147,6 +1176,9 @@ redis_parse_req(struct msg *r) //redis
             case LF:
                 if (redis_argz(r)) {
                     goto done;
+                } else if (r->narg == 1 && r->type == MSG_REQ_REDIS_HELLO) {
+                    /* 'hello' without protover reports the current protocol */
+                    goto done;
                 } else if (r->narg == 1) { //XXXX
                     goto error;
                 } else if (redis_argeval(r)) {
@@ -1241,12 +1273,13 @@ redis_parse_req(struct msg *r) //redis
                 m = r->token;
                 r->token = NULL;
 
-                kpos = array_push(r->keys); //key浽keys
+                kpos = msg_key_push(r); //key浽keys
                 if (kpos == NULL) {
                     goto enomem;
                 }
                 kpos->start = m;
                 kpos->end = p;
+                msg_key_hash(r, kpos);
 
                 state = SW_KEY_LF;
             }
@@ -1767,6 +1800,17 @@ error:
  * 5). Multi-bulk reply is used by the server to return many binary safe
  *     strings (bulks) with the initial line indicating how many bulks that
  *     will follow. The first byte of a multi bulk reply is always *.
+ *
+ * Redis >= 6 also speaks RESP3 to clients that negotiate it with HELLO 3.
+ * RESP3 adds the following reply kinds:
+ *  - null "_", boolean "#", double "," and big number "(" are single line
+ *    replies just like the status reply
+ *  - blob error "!" and verbatim string "=" are length prefixed just like
+ *    the bulk reply
+ *  - map "%", set "~", attribute "|" and push ">" are aggregates just like
+ *    the multi-bulk reply. The count of map and attribute is the number of
+ *    key-value pairs, and an attribute is followed by the reply it
+ *    describes
  */
 void
 redis_parse_rsp(struct msg *r)
@@ -1774,24 +1818,20 @@ redis_parse_rsp(struct msg *r)
     struct mbuf *b;
     uint8_t *p, *m;
     uint8_t ch;
+    uint32_t nelem;
 
     enum {
         SW_START,
-        SW_STATUS,
         SW_ERROR,
         SW_INTEGER,
         SW_INTEGER_START,
-        SW_SIMPLE,
+        SW_ARGN,
         SW_BULK,
         SW_BULK_LF,
         SW_BULK_ARG,
         SW_BULK_ARG_LF,
         SW_MULTIBULK,
         SW_MULTIBULK_NARG_LF,
-        SW_MULTIBULK_ARGN_LEN,
-        SW_MULTIBULK_ARGN_LEN_LF,
-        SW_MULTIBULK_ARGN,
-        SW_MULTIBULK_ARGN_LF,
         SW_RUNTO_CRLF,
         SW_ALMOST_DONE,
         SW_SENTINEL
@@ -1814,12 +1854,21 @@ redis_parse_rsp(struct msg *r)
 
         switch (state) {
         case SW_START:
+            /*
+             * A response is exactly one reply, but that reply can be an
+             * aggregate of other replies nested to any depth. We track
+             * the number of replies that are yet to be parsed in rnarg,
+             * and the response is done when it drops to zero.
+             */
             r->type = MSG_UNKNOWN;
+            r->rnarg = 1;
+            r->narg_start = NULL;
+            r->narg_end = NULL;
+
             switch (ch) {
             case '+':
-                p = p - 1; /* go back by 1 byte */
                 r->type = MSG_RSP_REDIS_STATUS;
-                state = SW_STATUS;
+                state = SW_RUNTO_CRLF;
                 break;
 
             case '-':
@@ -1834,36 +1883,87 @@ redis_parse_rsp(struct msg *r)
                 state = SW_INTEGER;
                 break;
 
+            case ',':
+                r->type = MSG_RSP_REDIS_DOUBLE;
+                state = SW_RUNTO_CRLF;
+                break;
+
+            case '(':
+                r->type = MSG_RSP_REDIS_BIGNUM;
+                state = SW_RUNTO_CRLF;
+                break;
+
+            case '#':
+                r->type = MSG_RSP_REDIS_BOOLEAN;
+                state = SW_RUNTO_CRLF;
+                break;
+
+            case '_':
+                r->type = MSG_RSP_REDIS_NULL;
+                state = SW_RUNTO_CRLF;
+                break;
+
             case '$':
                 r->type = MSG_RSP_REDIS_BULK;
                 p = p - 1; /* go back by 1 byte */
                 state = SW_BULK;
                 break;
 
+            case '!':
+                r->type = MSG_RSP_REDIS_BLOB_ERROR;
+                p = p - 1; /* go back by 1 byte */
+                state = SW_BULK;
+                break;
+
+            case '=':
+                r->type = MSG_RSP_REDIS_VERBATIM;
+                p = p - 1; /* go back by 1 byte */
+                state = SW_BULK;
+                break;
+
             case '*':
                 r->type = MSG_RSP_REDIS_MULTIBULK;
                 p = p - 1; /* go back by 1 byte */
                 state = SW_MULTIBULK;
                 break;
 
+            case '%':
+                r->type = MSG_RSP_REDIS_MAP;
+                p = p - 1; /* go back by 1 byte */
+                state = SW_MULTIBULK;
+                break;
+
+            case '~':
+                r->type = MSG_RSP_REDIS_SET;
+                p = p - 1; /* go back by 1 byte */
+                state = SW_MULTIBULK;
+                break;
+
+            case '|':
+                r->type = MSG_RSP_REDIS_ATTRIBUTE;
+                p = p - 1; /* go back by 1 byte */
+                state = SW_MULTIBULK;
+                break;
+
+            case '>':
+                r->type = MSG_RSP_REDIS_PUSH;
+                p = p - 1; /* go back by 1 byte */
+                state = SW_MULTIBULK;
+                break;
+
             default:
                 goto error;
             }
 
             break;
 
-        case SW_STATUS:
-            /* rsp_start <- p */
-            state = SW_RUNTO_CRLF;
-            break;
-
         case SW_ERROR:
             if (r->token == NULL) {
                 if (ch != '-') {
                     goto error;
                 }
-              /* rsp_start <- p */
-              r->token = p;
+                /* rsp_start <- p */
+                r->token = p;
             }
             if (ch == ' ' || ch == CR) {
                 m = r->token;
@@ -1985,13 +2085,6 @@ redis_parse_rsp(struct msg *r)
             r->integer = 0;
             break;
 
-        case SW_SIMPLE:
-            if (ch == CR) {
-              state = SW_MULTIBULK_ARGN_LF;
-              r->rnarg--;
-            }
-            break;
-
         case SW_INTEGER_START:
             if (ch == CR) {
                 state = SW_ALMOST_DONE;
@@ -2004,6 +2097,47 @@ redis_parse_rsp(struct msg *r)
             }
             break;
 
+        case SW_ARGN:
+            /*
+             * From: http://redis.io/topics/protocol, every element of an
+             * aggregate reply (multi-bulk, map, set, attribute or push) can
+             * be a reply of any kind, including another aggregate. Only the
+             * outermost reply is classified into r->type; inner replies are
+             * just skipped over.
+             */
+            switch (ch) {
+            case '+':
+            case '-':
+            case ':':
+            case ',':
+            case '(':
+            case '#':
+            case '_':
+                state = SW_RUNTO_CRLF;
+                break;
+
+            case '$':
+            case '!':
+            case '=':
+                p = p - 1; /* go back by 1 byte */
+                state = SW_BULK;
+                break;
+
+            case '*':
+            case '%':
+            case '~':
+            case '|':
+            case '>':
+                p = p - 1; /* go back by 1 byte */
+                state = SW_MULTIBULK;
+                break;
+
+            default:
+                goto error;
+            }
+
+            break;
+
         case SW_RUNTO_CRLF:
             switch (ch) {
             case CR:
@@ -2019,8 +2153,14 @@ redis_parse_rsp(struct msg *r)
         case SW_ALMOST_DONE:
             switch (ch) {
             case LF:
-                /* rsp_end <- p */
-                goto done;
+                r->rnarg--;
+                if (r->rnarg == 0) {
+                    /* rsp_end <- p */
+                    goto done;
+                }
+
+                state = SW_ARGN;
+                break;
 
             default:
                 goto error;
@@ -2030,7 +2170,7 @@ redis_parse_rsp(struct msg *r)
 
         case SW_BULK:
             if (r->token == NULL) {
-                if (ch != '$') {
+                if (ch != '$' && ch != '!' && ch != '=') {
                     goto error;
                 }
                 /* rsp_start <- p */
@@ -2038,6 +2178,7 @@ redis_parse_rsp(struct msg *r)
                 r->rlen = 0;
             } else if (ch == '-') {
                 /* handles null bulk reply = '$-1' */
+                r->token = NULL;
                 state = SW_RUNTO_CRLF;
             } else if (isdigit(ch)) {
                 r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
@@ -2088,7 +2229,13 @@ redis_parse_rsp(struct msg *r)
         case SW_BULK_ARG_LF:
             switch (ch) {
             case LF:
-                goto done;
+                r->rnarg--;
+                if (r->rnarg == 0) {
+                    goto done;
+                }
+
+                state = SW_ARGN;
+                break;
 
             default:
                 goto error;
@@ -2098,157 +2245,65 @@ redis_parse_rsp(struct msg *r)
 
         case SW_MULTIBULK:
             if (r->token == NULL) {
-                if (ch != '*') {
+                if (ch != '*' && ch != '%' && ch != '~' && ch != '|' &&
+                    ch != '>') {
                     goto error;
                 }
                 r->token = p;
-                /* rsp_start <- p */
-                r->narg_start = p;
-                r->rnarg = 0;
+                r->rlen = 0;
+                if (r->narg_end == NULL) {
+                    /* rsp_start <- p */
+                    r->narg_start = p;
+                }
             } else if (ch == '-') {
+                /* handles null multi-bulk reply = '*-1' */
+                r->token = NULL;
                 state = SW_RUNTO_CRLF;
             } else if (isdigit(ch)) {
-                r->rnarg = r->rnarg * 10 + (uint32_t)(ch - '0');
+                r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
             } else if (ch == CR) {
                 if ((p - r->token) <= 1) {
                     goto error;
                 }
 
-                r->narg = r->rnarg;
-                r->narg_end = p;
-                r->token = NULL;
-                state = SW_MULTIBULK_NARG_LF;
-            } else {
-                goto error;
-            }
-
-            break;
-
-        case SW_MULTIBULK_NARG_LF:
-            switch (ch) {
-            case LF:
-                if (r->rnarg == 0) {
-                    /* response is '*0\r\n' */
-                    goto done;
+                nelem = r->rlen;
+                if (*r->token == '%' || *r->token == '|') {
+                    /* map and attribute count key-value pairs */
+                    nelem *= 2;
                 }
-
-                state = SW_MULTIBULK_ARGN_LEN;
-                break;
-
-            default:
-                goto error;
-            }
-
-            break;
-
-        case SW_MULTIBULK_ARGN_LEN:
-            if (r->token == NULL) {
-                /*
-                 * From: http://redis.io/topics/protocol, a multi bulk reply
-                 * is used to return an array of other replies. Every element
-                 * of a multi bulk reply can be of any kind, including a
-                 * nested multi bulk reply.
-                 *
-                 * Here, we only handle a multi bulk reply element that
-                 * are either integer reply or bulk reply.
-                 *
-                 * there is a special case for sscan/hscan/zscan, these command
-                 * replay a nested multi-bulk with a number and a multi bulk like this:
-                 *
-                 * - mulit-bulk
-                 *    - cursor
-                 *    - mulit-bulk
-                 *       - val1
-                 *       - val2
-                 *       - val3
-                 *
-                 * in this case, there is only one sub-multi-bulk,
-                 * and it's the last element of parent,
-                 * we can handle it like tail-recursive.
-                 *
-                 */
-                if (ch == '*') {    /* for sscan/hscan/zscan only */
-                    p = p - 1;      /* go back by 1 byte */
-                    state = SW_MULTIBULK;
-                    break;
-                }
-
-                if (ch == ':' || ch == '+' || ch == '-') {
-                    /* handles not-found reply = '$-1' or integer reply = ':<num>' */
-                    /* and *2\r\n$2\r\nr0\r\n+OK\r\n or *1\r\n+OK\r\n */
-                    state = SW_SIMPLE;
-                    break;
+                if (*r->token == '|') {
+                    /*
+                     * An attribute is auxiliary data that precedes the
+                     * reply it describes, so that reply is still pending
+                     */
+                    nelem++;
                 }
 
-                if (ch != '$') {
-                    goto error;
+                if (r->narg_end == NULL) {
+                    /* narg of the outermost aggregate */
+                    r->narg = r->rlen;
+                    r->narg_end = p;
                 }
 
-                r->token = p;
+                r->rnarg = r->rnarg - 1 + nelem;
                 r->rlen = 0;
-            } else if (isdigit(ch)) {
-                r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
-            } else if (ch == '-') {
-                ;
-            } else if (ch == CR) {
-                if ((p - r->token) <= 1 || r->rnarg == 0) {
-                    goto error;
-                }
-
-                if ((r->rlen == 1 && (p - r->token) == 3)) {
-                    r->rlen = 0;
-                    state = SW_MULTIBULK_ARGN_LF;
-                } else {
-                    state = SW_MULTIBULK_ARGN_LEN_LF;
-                }
-                r->rnarg--;
                 r->token = NULL;
+                state = SW_MULTIBULK_NARG_LF;
             } else {
                 goto error;
             }
 
             break;
 
-        case SW_MULTIBULK_ARGN_LEN_LF:
-            switch (ch) {
-            case LF:
-                state = SW_MULTIBULK_ARGN;
-                break;
-
-            default:
-                goto error;
-            }
-
-            break;
-
-        case SW_MULTIBULK_ARGN:
-            m = p + r->rlen;
-            if (m >= b->last) {
-                r->rlen -= (uint32_t)(b->last - p);
-                m = b->last - 1;
-                p = m;
-                break;
-            }
-
-            if (*m != CR) {
-                goto error;
-            }
-
-            p += r->rlen; /* move forward by rlen bytes */
-            r->rlen = 0;
-
-            state = SW_MULTIBULK_ARGN_LF;
-
-            break;
-
-        case SW_MULTIBULK_ARGN_LF:
+        case SW_MULTIBULK_NARG_LF:
             switch (ch) {
             case LF:
                 if (r->rnarg == 0) {
+                    /* response is '*0\r\n' */
                     goto done;
                 }
 
-                state = SW_MULTIBULK_ARGN_LEN;
+                state = SW_ARGN;
                 break;
 
             default:
@@ -2267,6 +2322,7 @@ redis_parse_rsp(struct msg *r)
     ASSERT(p == b->last);
     r->pos = p;
     r->state = state;
+    r->invalue = (state == SW_BULK_ARG) ? 1 : 0;
 
     if (b->last == b->end && r->token != NULL) {
         r->pos = r->token;
@@ -2335,6 +2391,25 @@ redis_failure(struct msg *r)
     return false;
 }
 
+/*
+ * Skip n bytes of the bulk that the response parser stopped within, as
+ * if they had been parsed. Returns the # bytes of the bulk still to come
+ */
+uint32_t
+redis_skip(struct msg *r, uint32_t n)
+{
+    ASSERT(!r->request);
+
+    if (!r->invalue) {
+        return 0;
+    }
+
+    ASSERT(n <= r->rlen);
+    r->rlen -= n;
+
+    return r->rlen;
+}
+
 /*
  * copy one bulk from src to dst
  *
@@ -2364,19 +2439,22 @@ redis_copy_bulk(struct msg *dst, struct msg *src)
     }
 
     p = mbuf->pos;
-    ASSERT(*p == '$');
-    p++;
-
-    if (p[0] == '-' && p[1] == '1') {
-        len = 1 + 2 + CRLF_LEN;             /* $-1\r\n */
-        p = mbuf->pos + len;
+    if (*p == '_') {
+        len = 1 + CRLF_LEN;                 /* _\r\n (resp3 null) */
     } else {
-        len = 0;
-        for (; p < mbuf->last && isdigit(*p); p++) {
-            len = len * 10 + (uint32_t)(*p - '0');
+        ASSERT(*p == '$');
+        p++;
+
+        if (p[0] == '-' && p[1] == '1') {
+            len = 1 + 2 + CRLF_LEN;         /* $-1\r\n */
+        } else {
+            len = 0;
+            for (; p < mbuf->last && isdigit(*p); p++) {
+                len = len * 10 + (uint32_t)(*p - '0');
+            }
+            len += CRLF_LEN * 2;
+            len += (p - mbuf->pos);
         }
-        len += CRLF_LEN * 2;
-        len += (p - mbuf->pos);
     }
     bytes = len;
 
@@ -2428,12 +2506,15 @@ redis_pre_coalesce(struct msg *r)
         /* do nothing, if not a response to a fragmented request */
         return;
     }
-    pr->frag_owner->nfrag_done++;
+    pr->frag_owner->frag->nfrag_done++;
 
     switch (r->type) {
     case MSG_RSP_REDIS_INTEGER:
-        /* only redis 'del' fragmented request sends back integer reply */
-        ASSERT(pr->type == MSG_REQ_REDIS_DEL);
+        /* only 'del', 'exists', 'touch' and 'unlink' send back integer reply */
+        ASSERT(pr->type == MSG_REQ_REDIS_DEL ||
+               pr->type == MSG_REQ_REDIS_EXISTS ||
+               pr->type == MSG_REQ_REDIS_TOUCH ||
+               pr->type == MSG_REQ_REDIS_UNLINK);
 
         mbuf = STAILQ_FIRST(&r->mhdr);
         /*
@@ -2453,8 +2534,17 @@ redis_pre_coalesce(struct msg *r)
         break;
 
     case MSG_RSP_REDIS_MULTIBULK:
-        /* only redis 'mget' fragmented request sends back multi-bulk reply */
-        ASSERT(pr->type == MSG_REQ_REDIS_MGET);
+    case MSG_RSP_REDIS_SET:
+        if (pr->type != MSG_REQ_REDIS_MGET) {
+            /*
+             * 'sunion', 'sinter' and 'sdiff' replies are kept as is, and
+             * merged into one set once all of them have been received
+             */
+            ASSERT(pr->type == MSG_REQ_REDIS_SUNION ||
+                   pr->type == MSG_REQ_REDIS_SINTER ||
+                   pr->type == MSG_REQ_REDIS_SDIFF);
+            break;
+        }
 
         mbuf = STAILQ_FIRST(&r->mhdr);
         /*
@@ -2496,13 +2586,15 @@ redis_pre_coalesce(struct msg *r)
 }
 
 static rstatus_t
-redis_append_key(struct msg *r, uint8_t *key, uint32_t keylen)
+redis_append_key(struct msg *r, struct keypos *key)
 {
-    uint32_t len;
+    uint32_t len, keylen;
     struct mbuf *mbuf;
     uint8_t printbuf[32];
     struct keypos *kpos;
 
+    keylen = (uint32_t)(key->end - key->start);
+
     /* 1. keylen */
     len = (uint32_t)nc_snprintf(printbuf, sizeof(printbuf), "$%d\r\n", keylen);
     mbuf = msg_ensure_mbuf(r, len);
@@ -2518,14 +2610,15 @@ redis_append_key(struct msg *r, uint8_t *key, uint32_t keylen)
         return NC_ENOMEM;
     }
 
-    kpos = array_push(r->keys);
+    kpos = msg_key_push(r);
     if (kpos == NULL) {
         return NC_ENOMEM;
     }
 
     kpos->start = mbuf->last;
     kpos->end = mbuf->last + keylen;
-    mbuf_copy(mbuf, key, keylen);
+    kpos->hash = key->hash;
+    mbuf_copy(mbuf, key->start, keylen);
     r->mlen += keylen;
 
     /* 3. CRLF */
@@ -2552,7 +2645,7 @@ redis_append_key(struct msg *r, uint8_t *key, uint32_t keylen)
  * frag_owner:
  * All fragments of the message use frag_owner point to the orig msg
  *
- * frag_seq:
+ * frag->seq:
  * the map from each key to it's fragment, (only in the orig msg)
  *
  * For example, a message vector with 3 keys:
@@ -2581,8 +2674,8 @@ redis_append_key(struct msg *r, uint8_t *key, uint32_t keylen)
  *     |           v    v v            |                         |
  *   +--------------------+     +---------------------+     +----+----------------+
  *   |   frag_id = 10     |     |   frag_id = 10      |     |   frag_id = 10      |
- *   |     nfrag = 3      |     |      nfrag = 0      |     |      nfrag = 0      |
- *   | frag_seq = x x x   |     |     key1, key3      |     |         key2        |
+ *   | frag->nfrag = 3    |     |      nfrag = 0      |     |      nfrag = 0      |
+ *   | frag->seq = x x x  |     |     key1, key3      |     |         key2        |
  *   +------------|-|-|---+     +---------------------+     +---------------------+
  *                | | |          ^    ^                          ^
  *                | \ \          |    |                          |
@@ -2600,16 +2693,14 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
     uint32_t i;
     rstatus_t status;
 
-    ASSERT(array_n(r->keys) == (r->narg - 1) / key_step);
+    ASSERT(array_n(&r->keys) == (r->narg - 1) / key_step);
 
     sub_msgs = nc_zalloc(ncontinuum * sizeof(*sub_msgs));
     if (sub_msgs == NULL) {
         return NC_ENOMEM;
     }
 
-    ASSERT(r->frag_seq == NULL);
-    r->frag_seq = nc_alloc(array_n(r->keys) * sizeof(*r->frag_seq));
-    if (r->frag_seq == NULL) {
+    if (msg_frag_create(r, array_n(&r->keys)) == NULL) {
         nc_free(sub_msgs);
         return NC_ENOMEM;
     }
@@ -2631,13 +2722,12 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
     }
 
     r->frag_id = msg_gen_frag_id();
-    r->nfrag = 0;
     r->frag_owner = r;
 
-    for (i = 0; i < array_n(r->keys); i++) {        /* for each key */
+    for (i = 0; i < array_n(&r->keys); i++) {        /* for each key */
         struct msg *sub_msg;
-        struct keypos *kpos = array_get(r->keys, i);
-        uint32_t idx = msg_backend_idx(r, kpos->start, kpos->end - kpos->start);
+        struct keypos *kpos = array_get(&r->keys, i);
+        uint32_t idx = msg_backend_idx(r, kpos);
 
         if (sub_msgs[idx] == NULL) {
             sub_msgs[idx] = msg_get(r->owner, r->request, r->redis);
@@ -2646,10 +2736,10 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
                 return NC_ENOMEM;
             }
         }
-        r->frag_seq[i] = sub_msg = sub_msgs[idx];
+        r->frag->seq[i] = sub_msg = sub_msgs[idx];
 
         sub_msg->narg++;
-        status = redis_append_key(sub_msg, kpos->start, kpos->end - kpos->start);
+        status = redis_append_key(sub_msg, kpos);
         if (status != NC_OK) {
             nc_free(sub_msgs);
             return status;
@@ -2680,17 +2770,68 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
             continue;
         }
 
-        if (r->type == MSG_REQ_REDIS_MGET) {
+        switch (r->type) {
+        case MSG_REQ_REDIS_MGET:
             status = msg_prepend_format(sub_msg, "*%d\r\n$4\r\nmget\r\n",
                                         sub_msg->narg + 1);
-        } else if (r->type == MSG_REQ_REDIS_DEL) {
+            break;
+
+        case MSG_REQ_REDIS_DEL:
             status = msg_prepend_format(sub_msg, "*%d\r\n$3\r\ndel\r\n",
                                         sub_msg->narg + 1);
-        } else if (r->type == MSG_REQ_REDIS_MSET) {
+            break;
+
+        case MSG_REQ_REDIS_MSET:
             status = msg_prepend_format(sub_msg, "*%d\r\n$4\r\nmset\r\n",
                                         sub_msg->narg + 1);
-        } else {
+            break;
+
+        case MSG_REQ_REDIS_EXISTS:
+            status = msg_prepend_format(sub_msg, "*%d\r\n$6\r\nexists\r\n",
+                                        sub_msg->narg + 1);
+            break;
+
+        case MSG_REQ_REDIS_TOUCH:
+            status = msg_prepend_format(sub_msg, "*%d\r\n$5\r\ntouch\r\n",
+                                        sub_msg->narg + 1);
+            break;
+
+        case MSG_REQ_REDIS_UNLINK:
+            status = msg_prepend_format(sub_msg, "*%d\r\n$6\r\nunlink\r\n",
+                                        sub_msg->narg + 1);
+            break;
+
+        case MSG_REQ_REDIS_SUNION:
+            status = msg_prepend_format(sub_msg, "*%d\r\n$6\r\nsunion\r\n",
+                                        sub_msg->narg + 1);
+            break;
+
+        case MSG_REQ_REDIS_SINTER:
+            status = msg_prepend_format(sub_msg, "*%d\r\n$6\r\nsinter\r\n",
+                                        sub_msg->narg + 1);
+            break;
+
+        case MSG_REQ_REDIS_SDIFF:
+            /*
+             * sdiff k1 k2 .. kn is k1 minus the union of k2 .. kn. The
+             * fragment that holds the first key computes the difference
+             * against the keys on its own server, while every other
+             * fragment returns the union of its keys, which is subtracted
+             * in redis_post_coalesce_set
+             */
+            if (sub_msg == r->frag->seq[0]) {
+                status = msg_prepend_format(sub_msg, "*%d\r\n$5\r\nsdiff\r\n",
+                                            sub_msg->narg + 1);
+            } else {
+                status = msg_prepend_format(sub_msg, "*%d\r\n$6\r\nsunion\r\n",
+                                            sub_msg->narg + 1);
+            }
+            break;
+
+        default:
             NOT_REACHED();
+            status = NC_ERROR;
+            break;
         }
         if (status != NC_OK) {
             nc_free(sub_msgs);
@@ -2702,7 +2843,7 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
         sub_msg->frag_owner = r->frag_owner;
 
         TAILQ_INSERT_TAIL(frag_msgq, sub_msg, m_tqe);
-        r->nfrag++;
+        r->frag->nfrag++;
     }
 
     nc_free(sub_msgs);
@@ -2712,13 +2853,19 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
 rstatus_t
 redis_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq)
 {
-    if (1 == array_n(r->keys)){
+    if (1 == array_n(&r->keys)){
         return NC_OK;
     }
 
     switch (r->type) {
     case MSG_REQ_REDIS_MGET:
     case MSG_REQ_REDIS_DEL:
+    case MSG_REQ_REDIS_EXISTS:
+    case MSG_REQ_REDIS_TOUCH:
+    case MSG_REQ_REDIS_UNLINK:
+    case MSG_REQ_REDIS_SUNION:
+    case MSG_REQ_REDIS_SINTER:
+    case MSG_REQ_REDIS_SDIFF:
         return redis_fragment_argx(r, ncontinuum, frag_msgq, 1);
 
     case MSG_REQ_REDIS_MSET:
@@ -2740,17 +2887,62 @@ redis_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq)
 rstatus_t
 redis_reply(struct msg *r)
 {
-    struct conn *c_conn;
     struct msg *response = r->peer;
+    struct mbuf *mbuf;
+    rstatus_t status;
 
     ASSERT(response != NULL && response->owner != NULL);
 
+    status = redis_reply_msg(r, response);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    /* type the reply by its first byte, as the parser would */
+    mbuf = STAILQ_FIRST(&response->mhdr);
+    if (mbuf == NULL || mbuf->pos == mbuf->last) {
+        return NC_OK;
+    }
+
+    switch (*mbuf->pos) {
+    case '+':
+        response->type = MSG_RSP_REDIS_STATUS;
+        break;
+
+    case '-':
+        response->type = MSG_RSP_REDIS_ERROR;
+        break;
+
+    case '*':
+        response->type = MSG_RSP_REDIS_MULTIBULK;
+        break;
+
+    case '%':
+        response->type = MSG_RSP_REDIS_MAP;
+        break;
+
+    default:
+        break;
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+redis_reply_msg(struct msg *r, struct msg *response)
+{
+    struct conn *c_conn;
+
     c_conn = response->owner;
     if (r->type == MSG_REQ_REDIS_AUTH) { //ͻ˷͵AUTH   
         //ͻ˺twemproxyAUTH֤
         return redis_handle_auth_req(r, response);
     }
 
+    if (r->type == MSG_REQ_REDIS_HELLO) {
+        return redis_handle_hello_req(r, response);
+    }
+
     if (!conn_authenticated(c_conn)) {  //twemproxyΪҪ֤ǿͻ˵һAUTH xxxʾͻҪ֤
         return msg_append(response, rsp_auth_required.data, rsp_auth_required.len);
     }
@@ -2809,8 +3001,8 @@ redis_post_coalesce_mget(struct msg *request)
         return;
     }
 
-    for (i = 0; i < array_n(request->keys); i++) {      /* for each key */
-        sub_msg = request->frag_seq[i]->peer;           /* get it's peer response */
+    for (i = 0; i < array_n(&request->keys); i++) {      /* for each key */
+        sub_msg = request->frag->seq[i]->peer;          /* get it's peer response */
         if (sub_msg == NULL) {
             response->owner->err = 1;
             return;
@@ -2823,6 +3015,254 @@ redis_post_coalesce_mget(struct msg *request)
     }
 }
 
+struct redis_member {
+    uint8_t  *data;      /* member data */
+    uint32_t len;        /* member length */
+    unsigned first:1;    /* from the fragment of the first key? */
+};
+
+static int
+redis_member_cmp(const void *t1, const void *t2)
+{
+    const struct redis_member *m1 = t1, *m2 = t2;
+    int ret;
+
+    ret = memcmp(m1->data, m2->data, MIN(m1->len, m2->len));
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (m1->len == m2->len) {
+        return 0;
+    }
+
+    return m1->len < m2->len ? -1 : 1;
+}
+
+/*
+ * Copy the multi-bulk (or resp3 set) reply of a fragment into a contiguous
+ * buffer, collect its members and drain the reply, so that nothing of it is
+ * sent to the client. The returned buffer is referenced by the members and
+ * must be freed by the caller
+ */
+static uint8_t *
+redis_collect_members(struct msg *r, struct array *members, bool first,
+                      uint8_t *agg)
+{
+    struct mbuf *mbuf;
+    struct redis_member *member;
+    uint8_t *buf, *p, *end;
+    uint32_t n, len;
+
+    buf = nc_alloc(r->mlen + 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    for (p = buf, mbuf = STAILQ_FIRST(&r->mhdr); mbuf != NULL;
+         mbuf = STAILQ_FIRST(&r->mhdr)) {
+        nc_memcpy(p, mbuf->pos, mbuf_length(mbuf));
+        p += mbuf_length(mbuf);
+
+        mbuf_remove(&r->mhdr, mbuf);
+        mbuf_put(mbuf);
+    }
+    ASSERT(p == buf + r->mlen);
+    r->mlen = 0;
+    end = p;
+
+    p = buf;
+    if (p == end || (*p != '*' && *p != '~')) {
+        goto error;
+    }
+    *agg = *p++;
+
+    for (n = 0; p < end && isdigit(*p); p++) {
+        n = n * 10 + (uint32_t)(*p - '0');
+    }
+    p += CRLF_LEN;
+
+    for (; n > 0; n--) {
+        if (p >= end || *p != '$') {
+            goto error;
+        }
+
+        for (p++, len = 0; p < end && isdigit(*p); p++) {
+            len = len * 10 + (uint32_t)(*p - '0');
+        }
+        p += CRLF_LEN;
+
+        if (p + len + CRLF_LEN > end) {
+            goto error;
+        }
+
+        member = array_push(members);
+        if (member == NULL) {
+            goto error;
+        }
+        member->data = p;
+        member->len = len;
+        member->first = first ? 1 : 0;
+
+        p += len + CRLF_LEN;
+    }
+
+    return buf;
+
+error:
+    nc_free(buf);
+    return NULL;
+}
+
+static rstatus_t
+redis_append_member(struct msg *r, struct redis_member *member)
+{
+    rstatus_t status;
+    uint8_t *p;
+    uint32_t len, n;
+    char lenbuf[16];
+    int digits;
+
+    digits = nc_snprintf(lenbuf, sizeof(lenbuf), "$%"PRIu32"\r\n", member->len);
+    status = msg_append(r, (uint8_t *)lenbuf, (size_t)digits);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    /* a member can be larger than a mbuf */
+    for (p = member->data, len = member->len; len > 0; p += n, len -= n) {
+        n = MIN(len, (uint32_t)mbuf_data_size());
+        status = msg_append(r, p, n);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return msg_append(r, (uint8_t *)CRLF, CRLF_LEN);
+}
+
+/*
+ * Merge the replies of a fragmented 'sunion', 'sinter' or 'sdiff'. Every
+ * fragment has already reduced the keys on its own server (see
+ * redis_fragment_argx); the members of all fragments are sorted and each
+ * run of equal members is kept or dropped depending on the set operation
+ */
+static void
+redis_post_coalesce_set(struct msg *request)
+{
+    struct msg *response = request->peer;
+    struct msg *cmsg;
+    struct array *members;
+    struct redis_member *member, *next;
+    uint8_t **bufs;
+    uint32_t i, j, nbuf, nmember, count, nfirst;
+    uint8_t agg = '*';
+    bool keep;
+    rstatus_t status;
+
+    members = array_create(64, sizeof(struct redis_member));
+    if (members == NULL) {
+        response->owner->err = 1;
+        return;
+    }
+
+    bufs = nc_zalloc(request->frag->nfrag * sizeof(*bufs));
+    if (bufs == NULL) {
+        array_destroy(members);
+        response->owner->err = 1;
+        return;
+    }
+
+    nbuf = 0;
+    for (cmsg = TAILQ_NEXT(request, c_tqe);
+         cmsg != NULL && cmsg->frag_id == request->frag_id;
+         cmsg = TAILQ_NEXT(cmsg, c_tqe)) {
+
+        if (cmsg->peer == NULL || nbuf == request->frag->nfrag) {
+            response->owner->err = 1;
+            goto done;
+        }
+
+        bufs[nbuf] = redis_collect_members(cmsg->peer, members,
+                                           cmsg == request->frag->seq[0],
+                                           &agg);
+        if (bufs[nbuf] == NULL) {
+            response->owner->err = 1;
+            goto done;
+        }
+        nbuf++;
+    }
+
+    if (array_n(members) > 1) {
+        array_sort(members, redis_member_cmp);
+    }
+
+    /* keep the selected members at the front of the array */
+    nmember = 0;
+    for (i = 0; i < array_n(members); i = j) {
+        member = array_get(members, i);
+        count = 0;
+        nfirst = 0;
+
+        for (j = i; j < array_n(members); j++) {
+            next = array_get(members, j);
+            if (redis_member_cmp(member, next) != 0) {
+                break;
+            }
+            count++;
+            nfirst += next->first;
+        }
+
+        switch (request->type) {
+        case MSG_REQ_REDIS_SUNION:
+            keep = true;
+            break;
+
+        case MSG_REQ_REDIS_SINTER:
+            keep = (count == request->frag->nfrag) ? true : false;
+            break;
+
+        case MSG_REQ_REDIS_SDIFF:
+            keep = (nfirst == count) ? true : false;
+            break;
+
+        default:
+            NOT_REACHED();
+            keep = false;
+        }
+
+        if (keep) {
+            *(struct redis_member *)array_get(members, nmember++) = *member;
+        }
+    }
+
+    status = msg_prepend_format(response, "%c%"PRIu32"\r\n", agg, nmember);
+    if (status != NC_OK) {
+        response->owner->err = 1;
+        goto done;
+    }
+    response->type = (agg == '~') ? MSG_RSP_REDIS_SET : MSG_RSP_REDIS_MULTIBULK;
+
+    for (i = 0; i < nmember; i++) {
+        status = redis_append_member(response, array_get(members, i));
+        if (status != NC_OK) {
+            response->owner->err = 1;
+            goto done;
+        }
+    }
+
+done:
+    while (array_n(members) != 0) {
+        array_pop(members);
+    }
+    array_destroy(members);
+
+    for (i = 0; i < nbuf; i++) {
+        nc_free(bufs[i]);
+    }
+    nc_free(bufs);
+}
+
 /*
  * Post-coalesce handler is invoked when the message is a response to
  * the fragmented multi vector request - 'mget' or 'del' and all the
@@ -2841,14 +3281,26 @@ redis_post_coalesce(struct msg *r)
         return;
     }
 
+    /* the coalesced response is built, not parsed, so it is typed here */
     switch (r->type) {
     case MSG_REQ_REDIS_MGET:
+        pr->type = MSG_RSP_REDIS_MULTIBULK;
         return redis_post_coalesce_mget(r);
 
     case MSG_REQ_REDIS_DEL:
+    case MSG_REQ_REDIS_EXISTS:
+    case MSG_REQ_REDIS_TOUCH:
+    case MSG_REQ_REDIS_UNLINK:
+        pr->type = MSG_RSP_REDIS_INTEGER;
         return redis_post_coalesce_del(r);
 
+    case MSG_REQ_REDIS_SUNION:
+    case MSG_REQ_REDIS_SINTER:
+    case MSG_REQ_REDIS_SDIFF:
+        return redis_post_coalesce_set(r);
+
     case MSG_REQ_REDIS_MSET:
+        pr->type = MSG_RSP_REDIS_STATUS;
         return redis_post_coalesce_mset(r);
 
     default:
@@ -2888,7 +3340,7 @@ redis_handle_auth_req(struct msg *req, struct msg *rsp)
     }
 
     //twemproxyredis_auth֤Ƚauth xxxеxxxredis_authַǷȣȷtrue
-    kpos = array_get(req->keys, 0);
+    kpos = array_get(&req->keys, 0);
     key = kpos->start;
     keylen = (uint32_t)(kpos->end - kpos->start);
     valid = (keylen == pool->redis_auth.len) &&
@@ -2943,6 +3395,127 @@ redis_add_auth(struct context *ctx, struct conn *c_conn, struct conn *s_conn)
     return NC_OK;
 }
 
+/*
+ * Reply to 'hello [protover [AUTH username password] [SETNAME clientname]]'
+ *
+ * The protocol version negotiated by the client is remembered on the client
+ * connection. Server connections are shared by all clients, so they are
+ * switched to the protocol of the client on demand, just before one of its
+ * requests is forwarded (see redis_add_hello). Clients of both protocols
+ * on a pool thus cost a HELLO on a server connection each time it goes
+ * from the requests of one to those of the other; RESP3 clients are best
+ * given a pool of their own when they share servers with RESP2 ones.
+ */
+static rstatus_t
+redis_handle_hello_req(struct msg *req, struct msg *rsp)
+{
+    struct conn *conn = (struct conn *)rsp->owner;
+    struct server_pool *pool;
+    struct keypos *kpos;
+    uint8_t *arg;
+    uint32_t i, nkeys, arglen;
+    unsigned resp3;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    pool = (struct server_pool *)conn->owner;
+    resp3 = conn->resp3;
+    nkeys = array_n(&req->keys);
+
+    if (nkeys > 0) {
+        kpos = array_get(&req->keys, 0);
+        arg = kpos->start;
+        arglen = (uint32_t)(kpos->end - kpos->start);
+        if (arglen != 1 || (arg[0] != '2' && arg[0] != '3')) {
+            return msg_append(rsp, rsp_no_proto.data, rsp_no_proto.len);
+        }
+        resp3 = (arg[0] == '3') ? 1 : 0;
+    }
+
+    for (i = 1; i < nkeys; i++) {
+        kpos = array_get(&req->keys, i);
+        arg = kpos->start;
+        arglen = (uint32_t)(kpos->end - kpos->start);
+
+        if (arglen == 4 && str4icmp(arg, 'a', 'u', 't', 'h') && i + 2 < nkeys) {
+            /* AUTH username password; the username is ignored */
+            kpos = array_get(&req->keys, i + 2);
+            arglen = (uint32_t)(kpos->end - kpos->start);
+            i += 2;
+
+            if (!pool->require_auth) {
+                continue;
+            }
+
+            if (arglen != pool->redis_auth.len ||
+                memcmp(pool->redis_auth.data, kpos->start, arglen) != 0) {
+                conn->authenticated = 0;
+                return msg_append(rsp, rsp_invalid_password.data,
+                                  rsp_invalid_password.len);
+            }
+            conn->authenticated = 1;
+        } else if (arglen == 7 && str7icmp(arg, 's', 'e', 't', 'n', 'a', 'm', 'e') &&
+                   i + 1 < nkeys) {
+            /* client names are not tracked by the proxy */
+            i += 1;
+        } else {
+            return msg_append(rsp, rsp_hello_syntax.data, rsp_hello_syntax.len);
+        }
+    }
+
+    if (!conn_authenticated(conn)) {
+        return msg_append(rsp, rsp_auth_required.data, rsp_auth_required.len);
+    }
+
+    conn->resp3 = resp3;
+
+    return msg_prepend_format(rsp, "%s\r\n"
+                              "$6\r\nserver\r\n$10\r\nnutcracker\r\n"
+                              "$7\r\nversion\r\n$%d\r\n%s\r\n"
+                              "$5\r\nproto\r\n:%d\r\n"
+                              "$4\r\nmode\r\n$10\r\nstandalone\r\n"
+                              "$4\r\nrole\r\n$6\r\nmaster\r\n"
+                              "$7\r\nmodules\r\n*0\r\n",
+                              resp3 ? "%6" : "*12",
+                              (int)strlen(NC_VERSION_STRING), NC_VERSION_STRING,
+                              resp3 ? 3 : 2);
+}
+
+rstatus_t
+redis_add_hello(struct context *ctx, struct conn *c_conn, struct conn *s_conn)
+{
+    rstatus_t status;
+    struct msg *msg;
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+    ASSERT(s_conn->resp3_next != c_conn->resp3);
+
+    /* a server that failed HELLO stays on the protocol it speaks */
+    if (s_conn->hello_err) {
+        return NC_OK;
+    }
+
+    msg = msg_get(c_conn, true, c_conn->redis);
+    if (msg == NULL) {
+        c_conn->err = errno;
+        return NC_ENOMEM;
+    }
+
+    status = msg_prepend_format(msg, "*2\r\n$5\r\nHELLO\r\n$1\r\n%d\r\n",
+                                c_conn->resp3 ? 3 : 2);
+    if (status != NC_OK) {
+        msg_put(msg);
+        return status;
+    }
+
+    msg->type = MSG_REQ_REDIS_HELLO;
+    msg->swallow = 1;
+    s_conn->enqueue_inq(ctx, s_conn, msg);
+    s_conn->resp3_next = c_conn->resp3;
+
+    return NC_OK;
+}
+
 //ѡredis db
 void
 redis_post_connect(struct context *ctx, struct conn *conn, struct server *server)
@@ -3021,4 +3594,26 @@ redis_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg)
                  conn_pool->redis_db, conn_pool->name.data,
                  conn_server->name.data, message);
     }
+
+    if (pmsg != NULL && pmsg->type == MSG_REQ_REDIS_HELLO && msg != NULL) {
+        struct server *conn_server = conn->owner;
+
+        if (!redis_error(msg)) {
+            /* HELLO 3 is answered with a map, HELLO 2 with an array */
+            conn->resp3 = (msg->type == MSG_RSP_REDIS_MAP) ? 1 : 0;
+            return;
+        }
+
+        /*
+         * Servers older than redis 6 don't know HELLO and keep replying in
+         * RESP2, which RESP3 clients still understand. No more HELLOs are
+         * sent on the connection
+         */
+        conn->hello_err = 1;
+        conn->resp3_next = conn->resp3;
+
+        log_warn("HELLO failed on %s | %s, server replies stay in RESP%d",
+                 conn_server->owner->name.data, conn_server->name.data,
+                 conn->resp3 ? 3 : 2);
+    }
 }
@@ -0,0 +1,762 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <nc_bench.h>
+
+/*
+ * nc_bench starts mock backends and a nutcracker in front of them, then
+ * runs each workload for a fixed duration from a multi-connection,
+ * pipelined load generator and reports throughput and latency. Mocks,
+ * proxy and load all run on this host, so a change can be measured
+ * before and after on the same machine with the same command line.
+ */
+
+#ifndef BENCH_NUTCRACKER
+#define BENCH_NUTCRACKER    "../../src/nutcracker"
+#endif
+
+#define BENCH_BACKENDS      4
+#define BENCH_LATENCY       0
+#define BENCH_VLEN          100
+#define BENCH_CONNS         50
+#define BENCH_DEPTH         16
+#define BENCH_THREADS       2
+#define BENCH_DURATION      5
+#define BENCH_KEYS          100000
+#define BENCH_MULTI         100
+#define BENCH_MBUF          16384
+#define BENCH_START_WAIT    5000    /* max msec for nutcracker to listen */
+
+struct bench_opts {
+    bool              redis;            /* redis or memcache protocol? */
+    uint32_t          nbackend;         /* # mock backends */
+    uint32_t          latency;          /* mock latency in usec */
+    uint32_t          vlen;             /* value length */
+    uint32_t          nconn;            /* # client connections */
+    uint32_t          depth;            /* # requests in flight per connection */
+    uint32_t          nthread;          /* # load generator threads */
+    uint32_t          duration;         /* sec per workload */
+    uint32_t          nkey;             /* # distinct keys */
+    uint32_t          nmulti;           /* # keys in an mget or mset */
+    uint32_t          mbuf;             /* nutcracker mbuf size */
+    bool              workload[BENCH_NWORKLOAD]; /* workloads to run */
+    bool              direct;           /* bench a mock without the proxy? */
+    char              *nutcracker;      /* nutcracker binary */
+    char              *target;          /* bench a running proxy at host:port */
+};
+
+static const char *workload_name[] = { "get", "set", "mget", "mset" };
+
+static struct option long_options[] = {
+    { "help",           no_argument,        NULL,   'h' },
+    { "memcache",       no_argument,        NULL,   'M' },
+    { "backends",       required_argument,  NULL,   'b' },
+    { "latency",        required_argument,  NULL,   'l' },
+    { "value-size",     required_argument,  NULL,   'z' },
+    { "conns",          required_argument,  NULL,   'c' },
+    { "pipeline",       required_argument,  NULL,   'p' },
+    { "threads",        required_argument,  NULL,   'T' },
+    { "duration",       required_argument,  NULL,   'd' },
+    { "keys",           required_argument,  NULL,   'k' },
+    { "multi",          required_argument,  NULL,   'n' },
+    { "mbuf-size",      required_argument,  NULL,   'm' },
+    { "workload",       required_argument,  NULL,   'w' },
+    { "direct",         no_argument,        NULL,   'x' },
+    { "nutcracker",     required_argument,  NULL,   'N' },
+    { "target",         required_argument,  NULL,   't' },
+    { NULL,             0,                  NULL,    0  }
+};
+
+static char short_options[] = "hMb:l:z:c:p:T:d:k:n:m:w:xN:t:";
+
+int64_t
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int
+bench_buf_reserve(struct bench_buf *buf, size_t n)
+{
+    size_t size;
+    char *data;
+
+    if (buf->size - buf->len >= n) {
+        return 0;
+    }
+
+    size = buf->size == 0 ? BENCH_BUF_SIZE : buf->size;
+    while (size - buf->len < n) {
+        size *= 2;
+    }
+
+    data = realloc(buf->data, size);
+    if (data == NULL) {
+        return -1;
+    }
+    buf->data = data;
+    buf->size = size;
+
+    return 0;
+}
+
+void
+bench_buf_compact(struct bench_buf *buf)
+{
+    if (buf->pos == 0) {
+        return;
+    }
+
+    memmove(buf->data, buf->data + buf->pos, buf->len - buf->pos);
+    buf->len -= buf->pos;
+    buf->pos = 0;
+}
+
+static uint32_t
+hist_index(uint64_t v)
+{
+    uint32_t shift;
+
+    if (v < 2 * HIST_SUB) {
+        return (uint32_t)v;
+    }
+
+    shift = (uint32_t)(63 - __builtin_clzll(v)) - HIST_SUB_BITS;
+
+    return shift * HIST_SUB + (uint32_t)(v >> shift);
+}
+
+static uint64_t
+hist_value(uint32_t idx)
+{
+    uint32_t shift;
+
+    if (idx < 2 * HIST_SUB) {
+        return idx;
+    }
+
+    shift = idx / HIST_SUB - 1;
+
+    /* middle of the bucket */
+    return ((uint64_t)(idx - shift * HIST_SUB) << shift) +
+           ((1ULL << shift) >> 1);
+}
+
+void
+hist_add(struct bench_hist *hist, uint64_t nsec)
+{
+    hist->bucket[hist_index(nsec)]++;
+    hist->count++;
+    hist->sum += nsec;
+    if (nsec > hist->max) {
+        hist->max = nsec;
+    }
+}
+
+void
+hist_merge(struct bench_hist *dst, struct bench_hist *src)
+{
+    uint32_t i;
+
+    for (i = 0; i < HIST_NBUCKET; i++) {
+        dst->bucket[i] += src->bucket[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+uint64_t
+hist_percentile(struct bench_hist *hist, double pct)
+{
+    uint64_t rank, seen;
+    uint32_t i;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    rank = (uint64_t)(pct / 100.0 * (double)hist->count);
+    if (rank >= hist->count) {
+        rank = hist->count - 1;
+    }
+
+    for (i = 0, seen = 0; i < HIST_NBUCKET; i++) {
+        seen += hist->bucket[i];
+        if (seen > rank) {
+            return hist_value(i) < hist->max ? hist_value(i) : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+static void
+bench_show_usage(void)
+{
+    fprintf(stderr,
+        "Usage: nc_bench [-hMx] [-b backends] [-l latency] [-z value size]\n"
+        "                [-c conns] [-p pipeline] [-T threads] [-d duration]\n"
+        "                [-k keys] [-n multi] [-m mbuf size] [-w workloads]\n"
+        "                [-N nutcracker] [-t host:port]\n"
+        "\n"
+        "Options:\n"
+        "  -h, --help             : this help\n"
+        "  -M, --memcache         : use memcache instead of redis protocol\n"
+        "  -b, --backends=N       : set # mock backends (default: %d)\n"
+        "  -l, --latency=N        : set mock reply latency in usec (default: %d)\n"
+        "  -z, --value-size=N     : set value size in bytes (default: %d)\n"
+        "  -c, --conns=N          : set # client connections (default: %d)\n"
+        "  -p, --pipeline=N       : set # requests in flight per connection (default: %d)\n"
+        "  -T, --threads=N        : set # load generator threads (default: %d)\n"
+        "  -d, --duration=N       : set seconds per workload (default: %d)\n"
+        "  -k, --keys=N           : set # distinct keys (default: %d)\n"
+        "  -n, --multi=N          : set # keys in mget and mset (default: %d)\n"
+        "  -m, --mbuf-size=N      : set nutcracker mbuf size (default: %d)\n"
+        "  -w, --workload=S       : set workloads, of get,set,mget,mset (default: all)\n"
+        "  -x, --direct           : bench a mock backend without the proxy\n"
+        "  -N, --nutcracker=S     : set nutcracker binary (default: %s)\n"
+        "  -t, --target=S         : bench a running proxy at host:port instead\n"
+        "",
+        BENCH_BACKENDS, BENCH_LATENCY, BENCH_VLEN, BENCH_CONNS, BENCH_DEPTH,
+        BENCH_THREADS, BENCH_DURATION, BENCH_KEYS, BENCH_MULTI, BENCH_MBUF,
+        BENCH_NUTCRACKER);
+}
+
+static int
+bench_number(const char *arg, char opt, uint32_t min, uint32_t *value)
+{
+    char *end;
+    unsigned long v;
+
+    errno = 0;
+    v = strtoul(arg, &end, 10);
+    if (errno != 0 || *end != '\0' || v < min || v > UINT32_MAX) {
+        fprintf(stderr, "nc_bench: option -%c requires a number >= %"PRIu32"\n",
+                opt, min);
+        return -1;
+    }
+    *value = (uint32_t)v;
+
+    return 0;
+}
+
+static int
+bench_workloads(char *arg, struct bench_opts *opts)
+{
+    char *name, *save;
+    int i;
+
+    memset(opts->workload, 0, sizeof(opts->workload));
+
+    for (name = strtok_r(arg, ",", &save); name != NULL;
+         name = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < BENCH_NWORKLOAD; i++) {
+            if (strcmp(name, workload_name[i]) == 0) {
+                opts->workload[i] = true;
+                break;
+            }
+        }
+        if (i == BENCH_NWORKLOAD) {
+            fprintf(stderr, "nc_bench: unknown workload '%s'\n", name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+bench_get_options(int argc, char **argv, struct bench_opts *opts)
+{
+    uint32_t *num;
+    uint32_t min;
+    int c, i;
+
+    opts->redis = true;
+    opts->nbackend = BENCH_BACKENDS;
+    opts->latency = BENCH_LATENCY;
+    opts->vlen = BENCH_VLEN;
+    opts->nconn = BENCH_CONNS;
+    opts->depth = BENCH_DEPTH;
+    opts->nthread = BENCH_THREADS;
+    opts->duration = BENCH_DURATION;
+    opts->nkey = BENCH_KEYS;
+    opts->nmulti = BENCH_MULTI;
+    opts->mbuf = BENCH_MBUF;
+    for (i = 0; i < BENCH_NWORKLOAD; i++) {
+        opts->workload[i] = true;
+    }
+    opts->direct = false;
+    opts->nutcracker = BENCH_NUTCRACKER;
+    opts->target = NULL;
+
+    for (;;) {
+        c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1) {
+            break;
+        }
+
+        num = NULL;
+        min = 1;
+
+        switch (c) {
+        case 'h':
+            bench_show_usage();
+            exit(0);
+
+        case 'M':
+            opts->redis = false;
+            break;
+
+        case 'b':
+            num = &opts->nbackend;
+            break;
+
+        case 'l':
+            num = &opts->latency;
+            min = 0;
+            break;
+
+        case 'z':
+            num = &opts->vlen;
+            break;
+
+        case 'c':
+            num = &opts->nconn;
+            break;
+
+        case 'p':
+            num = &opts->depth;
+            break;
+
+        case 'T':
+            num = &opts->nthread;
+            break;
+
+        case 'd':
+            num = &opts->duration;
+            break;
+
+        case 'k':
+            num = &opts->nkey;
+            break;
+
+        case 'n':
+            num = &opts->nmulti;
+            break;
+
+        case 'm':
+            num = &opts->mbuf;
+            break;
+
+        case 'w':
+            if (bench_workloads(optarg, opts) < 0) {
+                return -1;
+            }
+            break;
+
+        case 'x':
+            opts->direct = true;
+            break;
+
+        case 'N':
+            opts->nutcracker = optarg;
+            break;
+
+        case 't':
+            opts->target = optarg;
+            break;
+
+        default:
+            bench_show_usage();
+            return -1;
+        }
+
+        if (num != NULL && bench_number(optarg, (char)c, min, num) < 0) {
+            return -1;
+        }
+    }
+
+    if (opts->nbackend > BENCH_MAX_BACKEND ||
+        opts->nthread > BENCH_MAX_THREAD) {
+        fprintf(stderr, "nc_bench: at most %d backends and %d threads\n",
+                BENCH_MAX_BACKEND, BENCH_MAX_THREAD);
+        return -1;
+    }
+    if (opts->nthread > opts->nconn) {
+        opts->nthread = opts->nconn;
+    }
+
+    return 0;
+}
+
+static uint16_t
+bench_free_port(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen;
+    int sd;
+
+    sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sd < 0) {
+        return 0;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, BENCH_ADDR, &addr.sin_addr);
+
+    addrlen = sizeof(addr);
+    if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(sd, (struct sockaddr *)&addr, &addrlen) < 0) {
+        close(sd);
+        return 0;
+    }
+    close(sd);
+
+    return ntohs(addr.sin_port);
+}
+
+static bool
+bench_listening(uint16_t port)
+{
+    struct sockaddr_in addr;
+    int sd, status;
+
+    sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sd < 0) {
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, BENCH_ADDR, &addr.sin_addr);
+
+    status = connect(sd, (struct sockaddr *)&addr, sizeof(addr));
+    close(sd);
+
+    return status == 0;
+}
+
+/*
+ * Write a configuration with a single pool over the mock backends, start
+ * nutcracker on it and wait for it to listen. Returns its pid, or -1.
+ */
+static pid_t
+bench_start_proxy(struct bench_opts *opts, struct bench_mock *mock,
+                  char *conf, uint16_t *port)
+{
+    char mbuf[16], stats[16];
+    FILE *fp;
+    pid_t pid;
+    uint32_t i;
+    int fd, waited;
+
+    *port = bench_free_port();
+    snprintf(stats, sizeof(stats), "%u", bench_free_port());
+    snprintf(mbuf, sizeof(mbuf), "%"PRIu32"", opts->mbuf);
+    if (*port == 0) {
+        return -1;
+    }
+
+    fd = mkstemp(conf);
+    if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+        return -1;
+    }
+
+    fprintf(fp, "bench:\n"
+                "  listen: %s:%u\n"
+                "  redis: %s\n"
+                "  hash: fnv1a_64\n"
+                "  distribution: ketama\n"
+                "  auto_eject_hosts: false\n"
+                "  preconnect: true\n"
+                "  servers:\n",
+            BENCH_ADDR, *port, opts->redis ? "true" : "false");
+    for (i = 0; i < opts->nbackend; i++) {
+        fprintf(fp, "   - %s:%u:1 mock%"PRIu32"\n", BENCH_ADDR, mock[i].port, i);
+    }
+    fclose(fp);
+
+    pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+        execl(opts->nutcracker, opts->nutcracker, "-c", conf, "-s", stats,
+              "-m", mbuf, "-o", "/dev/null", (char *)NULL);
+        fprintf(stderr, "nc_bench: exec '%s' failed: %s\n", opts->nutcracker,
+                strerror(errno));
+        _exit(1);
+    }
+
+    for (waited = 0; waited < BENCH_START_WAIT; waited += 10) {
+        if (bench_listening(*port)) {
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return -1;
+        }
+        usleep(10000);
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+}
+
+/*
+ * Returns the cpu time used by pid so far in clock ticks, or -1
+ */
+static long
+bench_cpu(pid_t pid)
+{
+    char path[64], buf[1024], *p;
+    unsigned long utime, stime;
+    FILE *fp;
+    size_t n;
+
+    if (pid <= 0) {
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+
+    /* fields 14 and 15 follow the parenthesized command name */
+    p = strrchr(buf, ')');
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u "
+                            "%*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+
+    return (long)(utime + stime);
+}
+
+static int
+bench_run(struct bench_opts *opts, bench_workload_t workload,
+          const char *host, uint16_t port, pid_t proxy)
+{
+    static struct bench_load load[BENCH_MAX_THREAD];
+    struct bench_hist hist;
+    uint64_t nreq, nerror;
+    int64_t start, elapsed;
+    long cpu_start, cpu_end;
+    uint32_t i, nconn;
+    char cpu[16];
+    double sec;
+    int err;
+
+    memset(&hist, 0, sizeof(hist));
+
+    start = bench_now();
+    cpu_start = bench_cpu(proxy);
+
+    for (i = 0; i < opts->nthread; i++) {
+        nconn = opts->nconn / opts->nthread +
+                (i < opts->nconn % opts->nthread ? 1 : 0);
+
+        load[i].host = host;
+        load[i].port = port;
+        load[i].redis = opts->redis;
+        load[i].workload = workload;
+        load[i].nconn = nconn;
+        load[i].depth = opts->depth;
+        load[i].nkey = opts->nkey;
+        load[i].nmulti = opts->nmulti;
+        load[i].vlen = opts->vlen;
+        load[i].deadline = start + (int64_t)opts->duration * 1000000000LL;
+        load[i].seed = 2463534242U + i * 7919;
+
+        if (load_start(&load[i]) < 0) {
+            fprintf(stderr, "nc_bench: start load thread failed: %s\n",
+                    strerror(errno));
+            opts->nthread = i;
+            break;
+        }
+    }
+
+    nreq = nerror = 0;
+    err = 0;
+    for (i = 0; i < opts->nthread; i++) {
+        load_wait(&load[i]);
+        hist_merge(&hist, &load[i].hist);
+        nreq += load[i].nreq;
+        nerror += load[i].nerror;
+        if (load[i].err != 0) {
+            err = load[i].err;
+        }
+    }
+
+    elapsed = bench_now() - start;
+    cpu_end = bench_cpu(proxy);
+    sec = (double)elapsed / 1e9;
+
+    if (cpu_start >= 0 && cpu_end >= 0) {
+        snprintf(cpu, sizeof(cpu), "%.0f%%", (double)(cpu_end - cpu_start) * 100.0 /
+                 (double)sysconf(_SC_CLK_TCK) / sec);
+    } else {
+        snprintf(cpu, sizeof(cpu), "-");
+    }
+
+    printf("%-6s %12"PRIu64" %12.0f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %8"PRIu64" %6s\n",
+           workload_name[workload], nreq, (double)nreq / sec,
+           (double)hist.sum / (double)(hist.count ? hist.count : 1) / 1e3,
+           (double)hist_percentile(&hist, 50.0) / 1e3,
+           (double)hist_percentile(&hist, 90.0) / 1e3,
+           (double)hist_percentile(&hist, 99.0) / 1e3,
+           (double)hist_percentile(&hist, 99.9) / 1e3,
+           (double)hist.max / 1e3, nerror, cpu);
+    fflush(stdout);
+
+    if (err != 0) {
+        fprintf(stderr, "nc_bench: %s load failed: %s\n",
+                workload_name[workload], strerror(err));
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    static struct bench_mock mock[BENCH_MAX_BACKEND];
+    struct bench_opts opts;
+    char conf[] = "/tmp/nc_bench.XXXXXX";
+    char host[64], *colon;
+    uint16_t port;
+    pid_t proxy;
+    uint32_t i, nmock;
+    int w, status;
+
+    if (bench_get_options(argc, argv, &opts) < 0) {
+        exit(1);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    nmock = 0;
+    proxy = -1;
+    status = 0;
+
+    if (opts.target != NULL) {
+        colon = strrchr(opts.target, ':');
+        if (colon == NULL || (size_t)(colon - opts.target) >= sizeof(host)) {
+            fprintf(stderr, "nc_bench: target '%s' is not host:port\n",
+                    opts.target);
+            exit(1);
+        }
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - opts.target),
+                 opts.target);
+        port = (uint16_t)atoi(colon + 1);
+    } else {
+        for (nmock = 0; nmock < opts.nbackend; nmock++) {
+            mock[nmock].redis = opts.redis;
+            mock[nmock].latency = opts.latency;
+            mock[nmock].vlen = opts.vlen;
+            if (mock_start(&mock[nmock]) < 0) {
+                fprintf(stderr, "nc_bench: start mock backend failed: %s\n",
+                        strerror(errno));
+                status = -1;
+                goto done;
+            }
+        }
+
+        snprintf(host, sizeof(host), "%s", BENCH_ADDR);
+        if (opts.direct) {
+            port = mock[0].port;
+        } else {
+            proxy = bench_start_proxy(&opts, mock, conf, &port);
+            if (proxy < 0) {
+                fprintf(stderr, "nc_bench: start '%s' failed\n",
+                        opts.nutcracker);
+                status = -1;
+                goto done;
+            }
+        }
+    }
+
+    printf("# %s, %s, %"PRIu32" backends, latency %"PRIu32" usec, value %"PRIu32
+           " bytes, %"PRIu32" conns x %"PRIu32" pipeline, %"PRIu32" threads, "
+           "%"PRIu32" sec\n",
+           opts.redis ? "redis" : "memcache",
+           opts.target != NULL ? opts.target :
+           (opts.direct ? "direct" : "nutcracker"),
+           opts.nbackend, opts.latency, opts.vlen, opts.nconn, opts.depth,
+           opts.nthread, opts.duration);
+    printf("%-6s %12s %12s %9s %9s %9s %9s %9s %9s %8s %6s\n", "test",
+           "requests", "req/sec", "avg(us)", "p50", "p90", "p99", "p99.9",
+           "max", "errors", "cpu");
+
+    for (w = 0; w < BENCH_NWORKLOAD && status == 0; w++) {
+        if (!opts.workload[w]) {
+            continue;
+        }
+        if (w == BENCH_MSET && !opts.redis) {
+            /* memcache has no multi-key store */
+            continue;
+        }
+        status = bench_run(&opts, (bench_workload_t)w, host, port, proxy);
+    }
+
+done:
+    if (proxy > 0) {
+        kill(proxy, SIGTERM);
+        waitpid(proxy, NULL, 0);
+        unlink(conf);
+    }
+    for (i = 0; i < nmock; i++) {
+        mock_stop(&mock[i]);
+    }
+
+    exit(status == 0 ? 0 : 1);
+}
@@ -0,0 +1,103 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_BENCH_H_
+#define _NC_BENCH_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define BENCH_ADDR          "127.0.0.1"
+#define BENCH_MAX_BACKEND   64      /* max # mock backends */
+#define BENCH_MAX_THREAD    64      /* max # load generator threads */
+#define BENCH_BUF_SIZE      65536   /* initial size of a read or write buffer */
+
+#define HIST_SUB_BITS       5                       /* 1/32 of a power of two */
+#define HIST_SUB            (1 << HIST_SUB_BITS)
+#define HIST_NBUCKET        (2 * HIST_SUB + 58 * HIST_SUB)
+
+typedef enum bench_workload {
+    BENCH_GET,
+    BENCH_SET,
+    BENCH_MGET,
+    BENCH_MSET,
+    BENCH_NWORKLOAD
+} bench_workload_t;
+
+struct bench_buf {
+    char              *data;            /* buffer */
+    size_t            size;             /* size of data */
+    size_t            pos;              /* # bytes consumed */
+    size_t            len;              /* # bytes filled */
+};
+
+/* latency histogram in nsec, log-linear with HIST_SUB buckets per octave */
+struct bench_hist {
+    uint64_t          bucket[HIST_NBUCKET];
+    uint64_t          count;            /* # samples */
+    uint64_t          sum;              /* sum of samples */
+    uint64_t          max;              /* max sample */
+};
+
+struct bench_mock {
+    pthread_t         tid;              /* backend thread */
+    int               sd;               /* listening socket */
+    uint16_t          port;             /* listening port */
+    bool              redis;            /* redis or memcache protocol? */
+    uint32_t          latency;          /* usec to hold each reply */
+    uint32_t          vlen;             /* value length */
+    char              *value;           /* value returned for every key */
+    volatile int      stop;             /* backend thread to exit? */
+};
+
+struct bench_load {
+    pthread_t         tid;              /* load generator thread */
+    const char        *host;            /* target address */
+    uint16_t          port;             /* target port */
+    bool              redis;            /* redis or memcache protocol? */
+    bench_workload_t  workload;         /* requests to send */
+    uint32_t          nconn;            /* # connections of this thread */
+    uint32_t          depth;            /* # requests in flight per connection */
+    uint32_t          nkey;             /* # distinct keys */
+    uint32_t          nmulti;           /* # keys in an mget or mset */
+    uint32_t          vlen;             /* value length of a set */
+    int64_t           deadline;         /* stop sending at, in nsec */
+    uint32_t          seed;             /* key generator state */
+    uint64_t          nreq;             /* # responses received */
+    uint64_t          nerror;           /* # error responses */
+    struct bench_hist hist;             /* response latency */
+    int               err;              /* errno on failure */
+};
+
+int64_t bench_now(void);
+int bench_buf_reserve(struct bench_buf *buf, size_t n);
+void bench_buf_compact(struct bench_buf *buf);
+
+void hist_add(struct bench_hist *hist, uint64_t nsec);
+void hist_merge(struct bench_hist *dst, struct bench_hist *src);
+uint64_t hist_percentile(struct bench_hist *hist, double pct);
+
+int mock_start(struct bench_mock *mock);
+void mock_stop(struct bench_mock *mock);
+
+int load_start(struct bench_load *load);
+void load_wait(struct bench_load *load);
+
+#endif
@@ -0,0 +1,545 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <nc_bench.h>
+
+/*
+ * A load generator thread keeps depth requests in flight on each of its
+ * connections until the deadline, then waits for the replies still
+ * outstanding. The latency of a request is measured from just before it
+ * is written to when its reply has been parsed.
+ */
+
+#define LOAD_MAX_DEPTH      4096    /* max # requests in flight per connection */
+#define LOAD_DRAIN          5000    /* max msec to wait for replies after deadline */
+
+struct load_conn {
+    int               sd;               /* socket */
+    struct bench_buf  rbuf;             /* replies read */
+    struct bench_buf  wbuf;             /* requests to write */
+    int64_t           sent[LOAD_MAX_DEPTH]; /* send time of requests in flight */
+    uint32_t          shead;            /* oldest request in flight */
+    uint32_t          nflight;          /* # requests in flight */
+};
+
+static uint32_t
+load_rand(struct bench_load *load)
+{
+    uint32_t x = load->seed;
+
+    /* xorshift32 */
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    load->seed = x;
+
+    return x;
+}
+
+static int
+load_append(struct bench_buf *buf, const char *data, size_t n)
+{
+    if (bench_buf_reserve(buf, n) < 0) {
+        return -1;
+    }
+    memcpy(buf->data + buf->len, data, n);
+    buf->len += n;
+
+    return 0;
+}
+
+static int
+load_bulk(struct bench_buf *buf, const char *data, size_t n)
+{
+    char hdr[32];
+    int len;
+
+    len = snprintf(hdr, sizeof(hdr), "$%zu\r\n", n);
+    if (load_append(buf, hdr, (size_t)len) < 0 ||
+        load_append(buf, data, n) < 0 ||
+        load_append(buf, "\r\n", 2) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static size_t
+load_key(struct bench_load *load, char *key, size_t size)
+{
+    return (size_t)snprintf(key, size, "key:%010"PRIu32"",
+                            load_rand(load) % load->nkey);
+}
+
+static int
+load_request_redis(struct bench_load *load, struct bench_buf *buf,
+                   const char *value)
+{
+    char key[32], hdr[32];
+    size_t klen;
+    uint32_t i, nkey;
+    int len;
+
+    switch (load->workload) {
+    case BENCH_GET:
+    case BENCH_SET:
+        klen = load_key(load, key, sizeof(key));
+        if (load->workload == BENCH_GET) {
+            return (load_append(buf, "*2\r\n", 4) < 0 ||
+                    load_bulk(buf, "GET", 3) < 0 ||
+                    load_bulk(buf, key, klen) < 0) ? -1 : 0;
+        }
+        return (load_append(buf, "*3\r\n", 4) < 0 ||
+                load_bulk(buf, "SET", 3) < 0 ||
+                load_bulk(buf, key, klen) < 0 ||
+                load_bulk(buf, value, load->vlen) < 0) ? -1 : 0;
+
+    case BENCH_MGET:
+    case BENCH_MSET:
+        nkey = load->nmulti;
+        if (load->workload == BENCH_MGET) {
+            len = snprintf(hdr, sizeof(hdr), "*%"PRIu32"\r\n", nkey + 1);
+        } else {
+            len = snprintf(hdr, sizeof(hdr), "*%"PRIu32"\r\n", 2 * nkey + 1);
+        }
+        if (load_append(buf, hdr, (size_t)len) < 0 ||
+            load_bulk(buf, load->workload == BENCH_MGET ? "MGET" : "MSET",
+                      4) < 0) {
+            return -1;
+        }
+        for (i = 0; i < nkey; i++) {
+            klen = load_key(load, key, sizeof(key));
+            if (load_bulk(buf, key, klen) < 0) {
+                return -1;
+            }
+            if (load->workload == BENCH_MSET &&
+                load_bulk(buf, value, load->vlen) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+static int
+load_request_memcache(struct bench_load *load, struct bench_buf *buf,
+                      const char *value)
+{
+    char key[32], hdr[64];
+    size_t klen;
+    uint32_t i;
+    int len;
+
+    switch (load->workload) {
+    case BENCH_GET:
+    case BENCH_MGET:
+        if (load_append(buf, "get", 3) < 0) {
+            return -1;
+        }
+        for (i = 0; i < (load->workload == BENCH_GET ? 1 : load->nmulti); i++) {
+            klen = load_key(load, key, sizeof(key));
+            if (load_append(buf, " ", 1) < 0 ||
+                load_append(buf, key, klen) < 0) {
+                return -1;
+            }
+        }
+        return load_append(buf, "\r\n", 2);
+
+    case BENCH_SET:
+        klen = load_key(load, key, sizeof(key));
+        len = snprintf(hdr, sizeof(hdr), "set %.*s 0 0 %"PRIu32"\r\n",
+                       (int)klen, key, load->vlen);
+        return (load_append(buf, hdr, (size_t)len) < 0 ||
+                load_append(buf, value, load->vlen) < 0 ||
+                load_append(buf, "\r\n", 2) < 0) ? -1 : 0;
+
+    default:
+        /* memcache has no multi-key store */
+        return -1;
+    }
+}
+
+/*
+ * Parse one reply. Returns the # bytes it takes, 0 if it is incomplete,
+ * or -1 if it is malformed.
+ */
+static ssize_t
+load_parse_redis(char *p, char *end, bool *error)
+{
+    char *start, *nl;
+    long n, i;
+    ssize_t m;
+
+    start = p;
+
+    if (p >= end) {
+        return 0;
+    }
+    nl = memchr(p, '\n', (size_t)(end - p));
+    if (nl == NULL) {
+        return 0;
+    }
+
+    switch (*p) {
+    case '-':
+        *error = true;
+        /* fall through */
+    case '+':
+    case ':':
+        return nl + 1 - start;
+
+    case '$':
+        n = strtol(p + 1, NULL, 10);
+        p = nl + 1;
+        if (n < 0) {
+            return p - start;
+        }
+        if (end - p < n + 2) {
+            return 0;
+        }
+        return p + n + 2 - start;
+
+    case '*':
+        n = strtol(p + 1, NULL, 10);
+        p = nl + 1;
+        for (i = 0; i < n; i++) {
+            m = load_parse_redis(p, end, error);
+            if (m <= 0) {
+                return m;
+            }
+            p += m;
+        }
+        return p - start;
+
+    default:
+        return -1;
+    }
+}
+
+static ssize_t
+load_parse_memcache(char *p, char *end, bool *error)
+{
+    char *start, *nl;
+    unsigned long vlen;
+
+    start = p;
+
+    for (;;) {
+        if (p >= end) {
+            return 0;
+        }
+        nl = memchr(p, '\n', (size_t)(end - p));
+        if (nl == NULL) {
+            return 0;
+        }
+
+        if (strncmp(p, "VALUE ", 6) == 0) {
+            if (sscanf(p, "VALUE %*s %*s %lu", &vlen) != 1) {
+                return -1;
+            }
+            p = nl + 1;
+            if ((unsigned long)(end - p) < vlen + 2) {
+                return 0;
+            }
+            p += vlen + 2;
+            continue;
+        }
+
+        if (strncmp(p, "ERROR", 5) == 0 || strncmp(p, "CLIENT_ERROR", 12) == 0 ||
+            strncmp(p, "SERVER_ERROR", 12) == 0) {
+            *error = true;
+        }
+
+        return nl + 1 - start;
+    }
+}
+
+static int
+load_connect(struct bench_load *load, struct load_conn *c)
+{
+    struct sockaddr_in addr;
+    int one;
+
+    c->sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->sd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(load->port);
+    if (inet_pton(AF_INET, load->host, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (connect(c->sd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        return -1;
+    }
+
+    one = 1;
+    setsockopt(c->sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return fcntl(c->sd, F_SETFL, fcntl(c->sd, F_GETFL) | O_NONBLOCK);
+}
+
+static int
+load_fill(struct bench_load *load, struct load_conn *c, const char *value,
+          int64_t now)
+{
+    int status;
+
+    while (c->nflight < load->depth) {
+        if (load->redis) {
+            status = load_request_redis(load, &c->wbuf, value);
+        } else {
+            status = load_request_memcache(load, &c->wbuf, value);
+        }
+        if (status < 0) {
+            return -1;
+        }
+        c->sent[(c->shead + c->nflight) % LOAD_MAX_DEPTH] = now;
+        c->nflight++;
+    }
+
+    return 0;
+}
+
+static int
+load_write(struct load_conn *c)
+{
+    ssize_t n;
+
+    while (c->wbuf.pos < c->wbuf.len) {
+        n = write(c->sd, c->wbuf.data + c->wbuf.pos, c->wbuf.len - c->wbuf.pos);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        c->wbuf.pos += (size_t)n;
+    }
+
+    c->wbuf.pos = c->wbuf.len = 0;
+
+    return 0;
+}
+
+static int
+load_read(struct bench_load *load, struct load_conn *c, int64_t now)
+{
+    struct bench_buf *rbuf = &c->rbuf;
+    bool error;
+    ssize_t n;
+
+    for (;;) {
+        if (bench_buf_reserve(rbuf, BENCH_BUF_SIZE / 4) < 0) {
+            return -1;
+        }
+        n = read(c->sd, rbuf->data + rbuf->len, rbuf->size - rbuf->len);
+        if (n > 0) {
+            rbuf->len += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        break;
+    }
+
+    for (;;) {
+        error = false;
+        if (load->redis) {
+            n = load_parse_redis(rbuf->data + rbuf->pos, rbuf->data + rbuf->len,
+                                 &error);
+        } else {
+            n = load_parse_memcache(rbuf->data + rbuf->pos,
+                                    rbuf->data + rbuf->len, &error);
+        }
+        if (n < 0 || (n > 0 && c->nflight == 0)) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        rbuf->pos += (size_t)n;
+
+        hist_add(&load->hist, (uint64_t)(now - c->sent[c->shead]));
+        c->shead = (c->shead + 1) % LOAD_MAX_DEPTH;
+        c->nflight--;
+        load->nreq++;
+        if (error) {
+            load->nerror++;
+        }
+    }
+
+    bench_buf_compact(rbuf);
+
+    return 0;
+}
+
+static void *
+load_loop(void *arg)
+{
+    struct bench_load *load = arg;
+    struct load_conn *conn;
+    struct pollfd *pfd;
+    char *value;
+    uint32_t i, nflight;
+    int64_t now, stop;
+
+    conn = calloc(load->nconn, sizeof(*conn));
+    pfd = calloc(load->nconn, sizeof(*pfd));
+    value = malloc(load->vlen + 1);
+    if (conn == NULL || pfd == NULL || value == NULL) {
+        load->err = ENOMEM;
+        goto done;
+    }
+    memset(value, 'x', load->vlen);
+
+    for (i = 0; i < load->nconn; i++) {
+        conn[i].sd = -1;
+    }
+    for (i = 0; i < load->nconn; i++) {
+        if (load_connect(load, &conn[i]) < 0) {
+            load->err = errno;
+            goto done;
+        }
+    }
+
+    stop = load->deadline + (int64_t)LOAD_DRAIN * 1000000;
+
+    for (;;) {
+        now = bench_now();
+        if (now >= stop) {
+            break;
+        }
+
+        nflight = 0;
+        for (i = 0; i < load->nconn; i++) {
+            struct load_conn *c = &conn[i];
+
+            if (now < load->deadline && load_fill(load, c, value, now) < 0) {
+                load->err = EINVAL;
+                goto done;
+            }
+            if (load_write(c) < 0) {
+                load->err = errno;
+                goto done;
+            }
+            nflight += c->nflight;
+
+            pfd[i].fd = c->sd;
+            pfd[i].events = POLLIN;
+            if (c->wbuf.pos < c->wbuf.len) {
+                pfd[i].events |= POLLOUT;
+            }
+            pfd[i].revents = 0;
+        }
+
+        if (now >= load->deadline && nflight == 0) {
+            break;
+        }
+
+        if (poll(pfd, load->nconn, 100) < 0 && errno != EINTR) {
+            load->err = errno;
+            goto done;
+        }
+
+        now = bench_now();
+        for (i = 0; i < load->nconn; i++) {
+            if ((pfd[i].revents & (POLLIN | POLLERR | POLLHUP)) &&
+                load_read(load, &conn[i], now) < 0) {
+                load->err = errno;
+                goto done;
+            }
+        }
+    }
+
+done:
+    if (conn != NULL) {
+        for (i = 0; i < load->nconn; i++) {
+            if (conn[i].sd >= 0) {
+                close(conn[i].sd);
+            }
+            free(conn[i].rbuf.data);
+            free(conn[i].wbuf.data);
+        }
+    }
+    free(conn);
+    free(pfd);
+    free(value);
+
+    return NULL;
+}
+
+int
+load_start(struct bench_load *load)
+{
+    int status;
+
+    if (load->depth == 0 || load->depth > LOAD_MAX_DEPTH) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    load->nreq = 0;
+    load->nerror = 0;
+    load->err = 0;
+    memset(&load->hist, 0, sizeof(load->hist));
+
+    status = pthread_create(&load->tid, NULL, load_loop, load);
+    if (status != 0) {
+        errno = status;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+load_wait(struct bench_load *load)
+{
+    pthread_join(load->tid, NULL);
+}
@@ -0,0 +1,547 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <nc_bench.h>
+
+/*
+ * A mock backend answers every request on its own thread, without storing
+ * anything: gets always hit and return the configured value, and stores
+ * always succeed. With a latency set, each reply is held back for that
+ * long after its request was read, so the mock behaves like a server with
+ * a fixed service time that still pipelines.
+ */
+
+#define MOCK_MAX_CONN       1024    /* max # connections to a backend */
+#define MOCK_MAX_HOLD       4096    /* max # replies held back per connection */
+#define MOCK_MAX_LINE       16384   /* max length of a memcache command line */
+
+struct mock_hold {
+    int64_t           due;              /* release reply at, in nsec */
+    size_t            end;              /* end of reply in wbuf */
+};
+
+struct mock_conn {
+    int               sd;               /* socket */
+    struct bench_buf  rbuf;             /* requests read */
+    struct bench_buf  wbuf;             /* replies to write */
+    size_t            ready;            /* end of replies released in wbuf */
+    struct mock_hold  hold[MOCK_MAX_HOLD]; /* replies held back */
+    uint32_t          hhead;            /* first held reply */
+    uint32_t          nhold;            /* # held replies */
+};
+
+static int
+mock_append(struct bench_buf *buf, const char *data, size_t n)
+{
+    if (bench_buf_reserve(buf, n) < 0) {
+        return -1;
+    }
+    memcpy(buf->data + buf->len, data, n);
+    buf->len += n;
+
+    return 0;
+}
+
+static int
+mock_appendf(struct bench_buf *buf, const char *fmt, size_t n)
+{
+    char tmp[64];
+    int len;
+
+    len = snprintf(tmp, sizeof(tmp), fmt, n);
+
+    return mock_append(buf, tmp, (size_t)len);
+}
+
+static int
+mock_value(struct bench_mock *mock, struct bench_buf *buf)
+{
+    if (mock_appendf(buf, "$%zu\r\n", mock->vlen) < 0 ||
+        mock_append(buf, mock->value, mock->vlen) < 0 ||
+        mock_append(buf, "\r\n", 2) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Parse one multibulk request at the read position. Returns the # bytes
+ * it takes, 0 if it is incomplete, or -1 if it is malformed. The command
+ * name and # arguments are returned through cmd, cmdlen and narg.
+ */
+static ssize_t
+mock_parse_redis(char *p, size_t len, char **cmd, size_t *cmdlen,
+                 long *narg)
+{
+    char *start, *end, *nl;
+    long n, i, alen;
+
+    start = p;
+    end = p + len;
+
+    if (len == 0) {
+        return 0;
+    }
+    if (*p != '*') {
+        return -1;
+    }
+
+    nl = memchr(p, '\n', (size_t)(end - p));
+    if (nl == NULL) {
+        return 0;
+    }
+    n = strtol(p + 1, NULL, 10);
+    if (n <= 0) {
+        return -1;
+    }
+    p = nl + 1;
+
+    for (i = 0; i < n; i++) {
+        if (p >= end) {
+            return 0;
+        }
+        if (*p != '$') {
+            return -1;
+        }
+        nl = memchr(p, '\n', (size_t)(end - p));
+        if (nl == NULL) {
+            return 0;
+        }
+        alen = strtol(p + 1, NULL, 10);
+        if (alen < 0) {
+            return -1;
+        }
+        p = nl + 1;
+        if (end - p < alen + 2) {
+            return 0;
+        }
+        if (i == 0) {
+            *cmd = p;
+            *cmdlen = (size_t)alen;
+        }
+        p += alen + 2;
+    }
+
+    *narg = n;
+
+    return p - start;
+}
+
+static int
+mock_reply_redis(struct bench_mock *mock, struct bench_buf *buf, char *cmd,
+                 size_t cmdlen, long narg)
+{
+    long i;
+
+#define MOCK_IS(_name) \
+    (cmdlen == sizeof(_name) - 1 && strncasecmp(cmd, _name, cmdlen) == 0)
+
+    if (MOCK_IS("get")) {
+        return mock_value(mock, buf);
+    }
+
+    if (MOCK_IS("mget")) {
+        if (mock_appendf(buf, "*%zu\r\n", (size_t)(narg - 1)) < 0) {
+            return -1;
+        }
+        for (i = 1; i < narg; i++) {
+            if (mock_value(mock, buf) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if (MOCK_IS("del") || MOCK_IS("exists")) {
+        return mock_appendf(buf, ":%zu\r\n", (size_t)(narg - 1));
+    }
+
+    if (MOCK_IS("ping")) {
+        return mock_append(buf, "+PONG\r\n", 7);
+    }
+
+#undef MOCK_IS
+
+    return mock_append(buf, "+OK\r\n", 5);
+}
+
+/*
+ * Parse one memcache request at the read position and append its reply.
+ * Returns the # bytes it takes, 0 if it is incomplete, or -1 on error.
+ */
+static ssize_t
+mock_memcache(struct bench_mock *mock, struct mock_conn *c, char *p,
+              size_t len)
+{
+    char line[MOCK_MAX_LINE], *nl, *key, *save;
+    size_t llen, dlen;
+    bool noreply;
+
+    nl = memchr(p, '\n', len);
+    if (nl == NULL) {
+        return len < MOCK_MAX_LINE ? 0 : -1;
+    }
+    llen = (size_t)(nl - p) + 1;
+    if (llen > MOCK_MAX_LINE) {
+        return -1;
+    }
+
+    /* the line stays intact in the buffer until the request is complete */
+    memcpy(line, p, llen - 1);
+    line[llen - 1] = '\0';
+    if (llen > 1 && line[llen - 2] == '\r') {
+        line[llen - 2] = '\0';
+    }
+    p = line;
+
+    if (strncmp(p, "get ", 4) == 0 || strncmp(p, "gets ", 5) == 0) {
+        for (key = strtok_r(strchr(p, ' '), " ", &save); key != NULL;
+             key = strtok_r(NULL, " ", &save)) {
+            if (mock_append(&c->wbuf, "VALUE ", 6) < 0 ||
+                mock_append(&c->wbuf, key, strlen(key)) < 0 ||
+                mock_appendf(&c->wbuf, " 0 %zu\r\n", mock->vlen) < 0 ||
+                mock_append(&c->wbuf, mock->value, mock->vlen) < 0 ||
+                mock_append(&c->wbuf, "\r\n", 2) < 0) {
+                return -1;
+            }
+        }
+        return mock_append(&c->wbuf, "END\r\n", 5) < 0 ? -1 : (ssize_t)llen;
+    }
+
+    if (strncmp(p, "set ", 4) == 0 || strncmp(p, "add ", 4) == 0 ||
+        strncmp(p, "replace ", 8) == 0) {
+        /* <cmd> <key> <flags> <exptime> <bytes> [noreply] */
+        if (sscanf(p, "%*s %*s %*s %*s %zu", &dlen) != 1) {
+            return -1;
+        }
+        if (len < llen + dlen + 2) {
+            return 0;
+        }
+        noreply = (strstr(p, " noreply") != NULL);
+        if (!noreply && mock_append(&c->wbuf, "STORED\r\n", 8) < 0) {
+            return -1;
+        }
+        return (ssize_t)(llen + dlen + 2);
+    }
+
+    if (strncmp(p, "delete ", 7) == 0) {
+        return mock_append(&c->wbuf, "DELETED\r\n", 9) < 0 ? -1 : (ssize_t)llen;
+    }
+
+    if (strcmp(p, "version") == 0) {
+        return mock_append(&c->wbuf, "VERSION mock\r\n", 14) < 0 ?
+               -1 : (ssize_t)llen;
+    }
+
+    return mock_append(&c->wbuf, "ERROR\r\n", 7) < 0 ? -1 : (ssize_t)llen;
+}
+
+/*
+ * Answer all complete requests in the read buffer. Returns -1 to close
+ * the connection.
+ */
+static int
+mock_process(struct bench_mock *mock, struct mock_conn *c, int64_t now)
+{
+    struct bench_buf *rbuf = &c->rbuf;
+    struct mock_hold *h;
+    char *cmd = NULL;
+    size_t cmdlen = 0;
+    long narg = 0;
+    ssize_t n;
+
+    for (;;) {
+        if (mock->latency != 0 && c->nhold == MOCK_MAX_HOLD) {
+            break;
+        }
+
+        if (mock->redis) {
+            n = mock_parse_redis(rbuf->data + rbuf->pos, rbuf->len - rbuf->pos,
+                                 &cmd, &cmdlen, &narg);
+            if (n > 0 && mock_reply_redis(mock, &c->wbuf, cmd, cmdlen,
+                                          narg) < 0) {
+                return -1;
+            }
+        } else {
+            n = mock_memcache(mock, c, rbuf->data + rbuf->pos,
+                              rbuf->len - rbuf->pos);
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        rbuf->pos += (size_t)n;
+
+        if (mock->latency == 0) {
+            c->ready = c->wbuf.len;
+        } else {
+            h = &c->hold[(c->hhead + c->nhold) % MOCK_MAX_HOLD];
+            h->due = now + (int64_t)mock->latency * 1000;
+            h->end = c->wbuf.len;
+            c->nhold++;
+        }
+    }
+
+    bench_buf_compact(rbuf);
+
+    return 0;
+}
+
+/*
+ * Release replies whose latency has passed and write out what is ready.
+ * Returns -1 to close the connection.
+ */
+static int
+mock_flush(struct mock_conn *c, int64_t now)
+{
+    struct mock_hold *h;
+    ssize_t n;
+
+    while (c->nhold > 0) {
+        h = &c->hold[c->hhead];
+        if (h->due > now) {
+            break;
+        }
+        c->ready = h->end;
+        c->hhead = (c->hhead + 1) % MOCK_MAX_HOLD;
+        c->nhold--;
+    }
+
+    while (c->wbuf.pos < c->ready) {
+        n = write(c->sd, c->wbuf.data + c->wbuf.pos, c->ready - c->wbuf.pos);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        c->wbuf.pos += (size_t)n;
+    }
+
+    if (c->wbuf.pos == c->wbuf.len) {
+        c->wbuf.pos = c->wbuf.len = c->ready = 0;
+        for (; c->nhold > 0; c->nhold--) {
+            /* all held replies are empty (noreply) */
+            c->hhead = (c->hhead + 1) % MOCK_MAX_HOLD;
+        }
+    } else if (c->wbuf.pos > 0 && c->wbuf.pos == c->ready) {
+        size_t i, shift = c->wbuf.pos;
+
+        memmove(c->wbuf.data, c->wbuf.data + shift, c->wbuf.len - shift);
+        c->wbuf.len -= shift;
+        c->wbuf.pos = 0;
+        c->ready -= shift;
+        for (i = 0; i < c->nhold; i++) {
+            c->hold[(c->hhead + i) % MOCK_MAX_HOLD].end -= shift;
+        }
+    }
+
+    return 0;
+}
+
+static void
+mock_close(struct mock_conn *c)
+{
+    close(c->sd);
+    free(c->rbuf.data);
+    free(c->wbuf.data);
+    free(c);
+}
+
+static void *
+mock_loop(void *arg)
+{
+    struct bench_mock *mock = arg;
+    struct mock_conn *conn[MOCK_MAX_CONN];
+    struct pollfd pfd[MOCK_MAX_CONN + 1];
+    uint32_t i, j, nconn;
+    int64_t now, wait, next;
+    int timeout, sd, one;
+    ssize_t n;
+
+    nconn = 0;
+
+    while (!mock->stop) {
+        pfd[0].fd = mock->sd;
+        pfd[0].events = POLLIN;
+        next = 0;
+        for (i = 0; i < nconn; i++) {
+            pfd[i + 1].fd = conn[i]->sd;
+            pfd[i + 1].events = POLLIN;
+            if (conn[i]->wbuf.pos < conn[i]->ready) {
+                pfd[i + 1].events |= POLLOUT;
+            }
+            if (conn[i]->nhold > 0) {
+                wait = conn[i]->hold[conn[i]->hhead].due - bench_now();
+                if (next == 0 || wait < next) {
+                    next = wait > 0 ? wait : 1;
+                }
+            }
+        }
+
+        timeout = 100;
+        if (next > 0) {
+            timeout = (int)((next + 999999) / 1000000);
+        }
+
+        if (poll(pfd, nconn + 1, timeout) < 0 && errno != EINTR) {
+            break;
+        }
+
+        now = bench_now();
+
+        if ((pfd[0].revents & POLLIN) && nconn < MOCK_MAX_CONN) {
+            sd = accept(mock->sd, NULL, NULL);
+            if (sd >= 0) {
+                struct mock_conn *c = calloc(1, sizeof(*c));
+
+                one = 1;
+                setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+                if (c == NULL) {
+                    close(sd);
+                } else {
+                    c->sd = sd;
+                    conn[nconn++] = c;
+                    pfd[nconn].revents = 0;
+                }
+            }
+        }
+
+        for (i = 0, j = 0; i < nconn; i++) {
+            struct mock_conn *c = conn[i];
+            bool closed = false;
+
+            if (pfd[i + 1].revents & (POLLIN | POLLERR | POLLHUP)) {
+                for (;;) {
+                    if (bench_buf_reserve(&c->rbuf, BENCH_BUF_SIZE / 4) < 0) {
+                        closed = true;
+                        break;
+                    }
+                    n = read(c->sd, c->rbuf.data + c->rbuf.len,
+                             c->rbuf.size - c->rbuf.len);
+                    if (n > 0) {
+                        c->rbuf.len += (size_t)n;
+                        continue;
+                    }
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                        closed = true;
+                    }
+                    break;
+                }
+            }
+
+            if (!closed && mock_process(mock, c, now) < 0) {
+                closed = true;
+            }
+            if (!closed && mock_flush(c, now) < 0) {
+                closed = true;
+            }
+
+            if (closed) {
+                mock_close(c);
+            } else {
+                conn[j++] = c;
+            }
+        }
+        nconn = j;
+    }
+
+    for (i = 0; i < nconn; i++) {
+        mock_close(conn[i]);
+    }
+
+    return NULL;
+}
+
+int
+mock_start(struct bench_mock *mock)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen;
+    int one, status;
+
+    mock->value = malloc(mock->vlen + 1);
+    if (mock->value == NULL) {
+        return -1;
+    }
+    memset(mock->value, 'v', mock->vlen);
+    mock->value[mock->vlen] = '\0';
+
+    mock->sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (mock->sd < 0) {
+        return -1;
+    }
+
+    one = 1;
+    setsockopt(mock->sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    inet_pton(AF_INET, BENCH_ADDR, &addr.sin_addr);
+
+    if (bind(mock->sd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(mock->sd, 512) < 0) {
+        close(mock->sd);
+        return -1;
+    }
+
+    addrlen = sizeof(addr);
+    getsockname(mock->sd, (struct sockaddr *)&addr, &addrlen);
+    mock->port = ntohs(addr.sin_port);
+
+    mock->stop = 0;
+    status = pthread_create(&mock->tid, NULL, mock_loop, mock);
+    if (status != 0) {
+        close(mock->sd);
+        errno = status;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+mock_stop(struct bench_mock *mock)
+{
+    mock->stop = 1;
+    pthread_join(mock->tid, NULL);
+    close(mock->sd);
+    free(mock->value);
+}
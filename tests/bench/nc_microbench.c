@@ -0,0 +1,742 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MB_HAVE_TSC 1
+#endif
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_hashkit.h>
+
+/*
+ * nc_microbench times the hot paths of nutcracker in isolation, linked
+ * against the same objects as the proxy: the request and response parsers
+ * over canned corpora, every key hash and every distribution. Each case
+ * runs for a fixed time and reports ns/op and bytes per cycle, where a
+ * cycle is a tick of the time stamp counter.
+ */
+
+#define MB_DURATION         200     /* default msec per case */
+#define MB_NKEY             4096    /* # keys hashed or dispatched per pass */
+#define MB_PIPELINE         1000    /* # requests in a pipeline corpus */
+#define MB_SMALL_MBUF       512     /* mbuf size for the split corpora */
+#define MB_VLEN_SMALL       100
+#define MB_VLEN_LARGE       16384
+#define MB_NMULTI           100
+
+struct mb_corpus {
+    char              *data;            /* corpus */
+    size_t            len;              /* # bytes of data */
+    size_t            size;             /* allocated size of data */
+};
+
+struct mb_result {
+    uint64_t          nop;              /* # ops */
+    uint64_t          nbyte;            /* # bytes processed */
+    int64_t           nsec;             /* elapsed time */
+    uint64_t          ncycle;           /* elapsed tsc cycles, 0 if unknown */
+};
+
+typedef uint32_t (*mb_hash_t)(const char *, size_t);
+
+struct mb_hash {
+    const char        *name;
+    mb_hash_t         hash;
+};
+
+#define DEFINE_ACTION(_hash, _name) { #_name, hash_##_name },
+static struct mb_hash mb_hashes[] = {
+    HASH_CODEC( DEFINE_ACTION )
+    { NULL, NULL }
+};
+#undef DEFINE_ACTION
+
+static int64_t mb_duration = MB_DURATION * 1000000LL;
+static const char *mb_filter;
+static struct server_pool mb_pool;
+static struct conn mb_conn;
+static volatile uint32_t mb_sink;
+
+static struct option long_options[] = {
+    { "help",           no_argument,        NULL,   'h' },
+    { "duration",       required_argument,  NULL,   'd' },
+    { NULL,             0,                  NULL,    0  }
+};
+
+static char short_options[] = "hd:";
+
+static int64_t
+mb_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t
+mb_cycles(void)
+{
+#ifdef MB_HAVE_TSC
+    return (uint64_t)__rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static bool
+mb_selected(const char *name)
+{
+    return mb_filter == NULL || strstr(name, mb_filter) != NULL;
+}
+
+static void
+mb_report(const char *name, struct mb_result *res)
+{
+    char bytes[32], rate[32], cycle[32];
+    double nop;
+
+    nop = res->nop > 0 ? (double)res->nop : 1.0;
+
+    /* dispatch cases process no bytes */
+    snprintf(bytes, sizeof(bytes), "-");
+    snprintf(rate, sizeof(rate), "-");
+    snprintf(cycle, sizeof(cycle), "-");
+    if (res->nbyte > 0) {
+        snprintf(bytes, sizeof(bytes), "%.1f", (double)res->nbyte / nop);
+        snprintf(rate, sizeof(rate), "%.1f", (double)res->nbyte * 1e3 /
+                 (double)(res->nsec > 0 ? res->nsec : 1));
+        if (res->ncycle > 0) {
+            snprintf(cycle, sizeof(cycle), "%.3f",
+                     (double)res->nbyte / (double)res->ncycle);
+        }
+    }
+
+    printf("%-32s %12"PRIu64" %10.1f %10s %10s %10s\n", name, res->nop,
+           (double)res->nsec / nop, bytes, rate, cycle);
+    fflush(stdout);
+}
+
+static void
+mb_reserve(struct mb_corpus *c, size_t n)
+{
+    while (c->size - c->len <= n) {
+        c->size = c->size == 0 ? 65536 : c->size * 2;
+        c->data = realloc(c->data, c->size);
+        if (c->data == NULL) {
+            fprintf(stderr, "nc_microbench: out of memory\n");
+            exit(1);
+        }
+    }
+}
+
+static void
+mb_append(struct mb_corpus *c, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    mb_reserve(c, 256);
+
+    va_start(args, fmt);
+    n = vsnprintf(c->data + c->len, c->size - c->len, fmt, args);
+    va_end(args);
+
+    ASSERT(n >= 0 && (size_t)n < c->size - c->len);
+    c->len += (size_t)n;
+}
+
+static void
+mb_append_value(struct mb_corpus *c, size_t vlen)
+{
+    mb_reserve(c, vlen);
+    memset(c->data + c->len, 'x', vlen);
+    c->len += vlen;
+}
+
+static void
+mb_redis_set(struct mb_corpus *c, uint32_t key, size_t vlen)
+{
+    mb_append(c, "*3\r\n$3\r\nset\r\n$14\r\nkey:%010"PRIu32"\r\n$%zu\r\n",
+              key, vlen);
+    mb_append_value(c, vlen);
+    mb_append(c, "\r\n");
+}
+
+static void
+mb_redis_multi(struct mb_corpus *c, const char *cmd, uint32_t key,
+               uint32_t nkey, size_t vlen)
+{
+    uint32_t i;
+    bool value;
+
+    value = strcmp(cmd, "mset") == 0;
+
+    mb_append(c, "*%"PRIu32"\r\n$%zu\r\n%s\r\n", nkey * (value ? 2 : 1) + 1,
+              strlen(cmd), cmd);
+    for (i = 0; i < nkey; i++) {
+        mb_append(c, "$14\r\nkey:%010"PRIu32"\r\n", key + i);
+        if (value) {
+            mb_append(c, "$%zu\r\n", vlen);
+            mb_append_value(c, vlen);
+            mb_append(c, "\r\n");
+        }
+    }
+}
+
+static void
+mb_memcache_set(struct mb_corpus *c, uint32_t key, size_t vlen)
+{
+    mb_append(c, "set key:%010"PRIu32" 0 0 %zu\r\n", key, vlen);
+    mb_append_value(c, vlen);
+    mb_append(c, "\r\n");
+}
+
+static void
+mb_memcache_value(struct mb_corpus *c, uint32_t key, size_t vlen)
+{
+    mb_append(c, "VALUE key:%010"PRIu32" 0 %zu\r\n", key, vlen);
+    mb_append_value(c, vlen);
+    mb_append(c, "\r\n");
+}
+
+/*
+ * Build the corpus of a parser case. Small keys and large values are
+ * pipelines of a single command; the deep pipeline mixes commands the
+ * way a busy client does.
+ */
+static void
+mb_corpus_build(struct mb_corpus *c, bool redis, bool request,
+                const char *shape)
+{
+    uint32_t i, j;
+
+    c->len = 0;
+
+    for (i = 0; i < MB_PIPELINE; i++) {
+        if (strcmp(shape, "small") == 0) {
+            if (redis && request) {
+                mb_append(c, "*2\r\n$3\r\nget\r\n$14\r\nkey:%010"PRIu32"\r\n",
+                          i);
+            } else if (redis) {
+                mb_append(c, "$%d\r\n", MB_VLEN_SMALL);
+                mb_append_value(c, MB_VLEN_SMALL);
+                mb_append(c, "\r\n");
+            } else if (request) {
+                mb_append(c, "get key:%010"PRIu32"\r\n", i);
+            } else {
+                mb_memcache_value(c, i, MB_VLEN_SMALL);
+                mb_append(c, "END\r\n");
+            }
+        } else if (strcmp(shape, "large") == 0) {
+            if (i >= MB_PIPELINE / 10) {
+                break;
+            }
+            if (redis && request) {
+                mb_redis_set(c, i, MB_VLEN_LARGE);
+            } else if (redis) {
+                mb_append(c, "$%d\r\n", MB_VLEN_LARGE);
+                mb_append_value(c, MB_VLEN_LARGE);
+                mb_append(c, "\r\n");
+            } else if (request) {
+                mb_memcache_set(c, i, MB_VLEN_LARGE);
+            } else {
+                mb_memcache_value(c, i, MB_VLEN_LARGE);
+                mb_append(c, "END\r\n");
+            }
+        } else if (strcmp(shape, "multi") == 0) {
+            if (i >= MB_PIPELINE / 10) {
+                break;
+            }
+            if (redis && request) {
+                mb_redis_multi(c, "mget", i * MB_NMULTI, MB_NMULTI, 0);
+            } else if (redis) {
+                mb_append(c, "*%d\r\n", MB_NMULTI);
+                for (j = 0; j < MB_NMULTI; j++) {
+                    mb_append(c, "$%d\r\n", MB_VLEN_SMALL);
+                    mb_append_value(c, MB_VLEN_SMALL);
+                    mb_append(c, "\r\n");
+                }
+            } else if (request) {
+                mb_append(c, "get");
+                for (j = 0; j < MB_NMULTI; j++) {
+                    mb_append(c, " key:%010"PRIu32"", i * MB_NMULTI + j);
+                }
+                mb_append(c, "\r\n");
+            } else {
+                for (j = 0; j < MB_NMULTI; j++) {
+                    mb_memcache_value(c, i * MB_NMULTI + j, MB_VLEN_SMALL);
+                }
+                mb_append(c, "END\r\n");
+            }
+        } else {
+            /* mixed */
+            switch (i % 5) {
+            case 0:
+            case 1:
+                if (redis && request) {
+                    mb_append(c, "*2\r\n$3\r\nget\r\n$14\r\nkey:%010"PRIu32
+                              "\r\n", i);
+                } else if (redis) {
+                    mb_append(c, "$-1\r\n");
+                } else if (request) {
+                    mb_append(c, "get key:%010"PRIu32"\r\n", i);
+                } else {
+                    mb_append(c, "END\r\n");
+                }
+                break;
+
+            case 2:
+                if (redis && request) {
+                    mb_redis_set(c, i, MB_VLEN_SMALL);
+                } else if (redis) {
+                    mb_append(c, "+OK\r\n");
+                } else if (request) {
+                    mb_memcache_set(c, i, MB_VLEN_SMALL);
+                } else {
+                    mb_append(c, "STORED\r\n");
+                }
+                break;
+
+            case 3:
+                if (redis && request) {
+                    mb_append(c, "*2\r\n$4\r\nincr\r\n$14\r\nkey:%010"PRIu32
+                              "\r\n", i);
+                } else if (redis) {
+                    mb_append(c, ":%"PRIu32"\r\n", i);
+                } else if (request) {
+                    mb_append(c, "incr key:%010"PRIu32" 1\r\n", i);
+                } else {
+                    mb_append(c, "%"PRIu32"\r\n", i);
+                }
+                break;
+
+            default:
+                if (redis && request) {
+                    mb_redis_multi(c, "mget", i, 10, 0);
+                } else if (redis) {
+                    mb_append(c, "*10\r\n");
+                    for (j = 0; j < 10; j++) {
+                        mb_append(c, "$%d\r\n", MB_VLEN_SMALL);
+                        mb_append_value(c, MB_VLEN_SMALL);
+                        mb_append(c, "\r\n");
+                    }
+                } else if (request) {
+                    mb_append(c, "delete key:%010"PRIu32"\r\n", i);
+                } else {
+                    mb_append(c, "DELETED\r\n");
+                }
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Feed the corpus through the parser the way msg_recv_chain does: fill
+ * an mbuf, parse messages until the parser wants more, split the
+ * unparsed tail into a new message or mbuf, and repeat. Returns the
+ * number of messages parsed, or 0 on a parse error.
+ */
+static uint64_t
+mb_parse(struct mb_corpus *c, bool redis, bool request)
+{
+    struct msg *msg;
+    struct mbuf *mbuf, *nbuf;
+    char *p, *end;
+    uint64_t nmsg;
+    size_t n;
+
+    msg = msg_get(&mb_conn, request, redis);
+    if (msg == NULL) {
+        return 0;
+    }
+
+    p = c->data;
+    end = c->data + c->len;
+    nmsg = 0;
+
+    while (p < end) {
+        mbuf = STAILQ_LAST(&msg->mhdr, mbuf, next);
+        if (mbuf == NULL || mbuf_full(mbuf)) {
+            mbuf = mbuf_get();
+            if (mbuf == NULL) {
+                break;
+            }
+            mbuf_insert(&msg->mhdr, mbuf);
+            msg->pos = mbuf->pos;
+        }
+
+        n = MIN(mbuf_size(mbuf), (size_t)(end - p));
+        nc_memcpy(mbuf->last, p, n);
+        mbuf->last += n;
+        msg->mlen += (uint32_t)n;
+        p += n;
+
+        for (;;) {
+            msg->parser(msg);
+
+            if (msg->result == MSG_PARSE_OK) {
+                nmsg++;
+
+                mbuf = STAILQ_LAST(&msg->mhdr, mbuf, next);
+                if (msg->pos == mbuf->last) {
+                    msg_put(msg);
+                    msg = msg_get(&mb_conn, request, redis);
+                    break;
+                }
+
+                nbuf = mbuf_split(&msg->mhdr, msg->pos, NULL, NULL);
+                msg_put(msg);
+                msg = msg_get(&mb_conn, request, redis);
+                if (nbuf == NULL || msg == NULL) {
+                    return 0;
+                }
+                mbuf_insert(&msg->mhdr, nbuf);
+                msg->pos = nbuf->pos;
+                msg->mlen = mbuf_length(nbuf);
+                continue;
+            }
+
+            if (msg->result == MSG_PARSE_REPAIR) {
+                nbuf = mbuf_split(&msg->mhdr, msg->pos, NULL, NULL);
+                if (nbuf == NULL) {
+                    msg_put(msg);
+                    return 0;
+                }
+                mbuf_insert(&msg->mhdr, nbuf);
+                msg->pos = nbuf->pos;
+                break;
+            }
+
+            if (msg->result == MSG_PARSE_AGAIN) {
+                break;
+            }
+
+            msg_put(msg);
+            return 0;
+        }
+
+        if (msg == NULL) {
+            return 0;
+        }
+    }
+
+    if (msg == NULL) {
+        return 0;
+    }
+    if (!msg_empty(msg)) {
+        /* corpus ended inside a message */
+        nmsg = 0;
+    }
+    msg_put(msg);
+
+    return nmsg;
+}
+
+static void
+mb_mbuf_size(size_t size)
+{
+    struct instance nci;
+
+    mbuf_deinit();
+
+    nci.mbuf_chunk_size = size;
+    nci.mbuf_arena_size = 0;
+    mbuf_init(&nci);
+}
+
+static int
+mb_bench_parser(bool redis, bool request, const char *shape, bool split)
+{
+    struct mb_corpus corpus;
+    struct mb_result res;
+    char name[64];
+    int64_t start;
+    uint64_t cstart, nmsg;
+
+    snprintf(name, sizeof(name), "%s_parse_%s/%s%s",
+             redis ? "redis" : "memcache", request ? "req" : "rsp", shape,
+             split ? "_split" : "");
+    if (!mb_selected(name)) {
+        return 0;
+    }
+
+    memset(&corpus, 0, sizeof(corpus));
+    mb_corpus_build(&corpus, redis, request, shape);
+    mb_mbuf_size(split ? MB_SMALL_MBUF : MBUF_SIZE);
+
+    /* warm up the free lists */
+    nmsg = mb_parse(&corpus, redis, request);
+    if (nmsg == 0) {
+        fprintf(stderr, "nc_microbench: %s: corpus does not parse\n", name);
+        free(corpus.data);
+        return -1;
+    }
+
+    memset(&res, 0, sizeof(res));
+    start = mb_now();
+    cstart = mb_cycles();
+    do {
+        res.nop += mb_parse(&corpus, redis, request);
+        res.nbyte += corpus.len;
+        res.nsec = mb_now() - start;
+    } while (res.nsec < mb_duration);
+    res.ncycle = mb_cycles() - cstart;
+
+    mb_report(name, &res);
+    free(corpus.data);
+
+    return 0;
+}
+
+static void
+mb_bench_hash(struct mb_hash *h, size_t klen)
+{
+    struct mb_result res;
+    char *keys, name[64];
+    int64_t start;
+    uint64_t cstart;
+    uint32_t i, sum;
+
+    snprintf(name, sizeof(name), "hash_%s/%zu", h->name, klen);
+    if (!mb_selected(name)) {
+        return;
+    }
+
+    keys = malloc(MB_NKEY * klen);
+    if (keys == NULL) {
+        return;
+    }
+    for (i = 0; i < MB_NKEY * klen; i++) {
+        keys[i] = (char)('a' + (i * 7 + i / klen) % 26);
+    }
+
+    memset(&res, 0, sizeof(res));
+    sum = 0;
+    start = mb_now();
+    cstart = mb_cycles();
+    do {
+        for (i = 0; i < MB_NKEY; i++) {
+            sum += h->hash(keys + i * klen, klen);
+        }
+        res.nop += MB_NKEY;
+        res.nbyte += MB_NKEY * klen;
+        res.nsec = mb_now() - start;
+    } while (res.nsec < mb_duration);
+    res.ncycle = mb_cycles() - cstart;
+    mb_sink = sum;
+
+    mb_report(name, &res);
+    free(keys);
+}
+
+static void
+mb_bench_dispatch(const char *dist, uint32_t nserver)
+{
+    struct server_pool pool;
+    struct server *server;
+    struct mb_result res;
+    char name[64], *names;
+    uint32_t *hashes, i, sum;
+    int64_t start;
+    rstatus_t status;
+
+    snprintf(name, sizeof(name), "%s_dispatch/%"PRIu32"", dist, nserver);
+    if (!mb_selected(name)) {
+        return;
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    string_set_text(&pool.name, "microbench");
+    if (array_init(&pool.server, nserver, sizeof(struct server)) != NC_OK) {
+        return;
+    }
+
+    names = malloc((size_t)nserver * 32);
+    hashes = malloc(MB_NKEY * sizeof(*hashes));
+    if (names == NULL || hashes == NULL) {
+        goto done;
+    }
+
+    for (i = 0; i < nserver; i++) {
+        server = array_push(&pool.server);
+        memset(server, 0, sizeof(*server));
+        server->idx = i;
+        server->owner = &pool;
+        server->weight = 1;
+        snprintf(names + i * 32, 32, "10.0.%"PRIu32".%"PRIu32":6379",
+                 i / 256, i % 256);
+        string_set_raw(&server->name, names + i * 32);
+    }
+
+    if (strcmp(dist, "ketama") == 0) {
+        status = ketama_update(&pool);
+    } else if (strcmp(dist, "modula") == 0) {
+        status = modula_update(&pool);
+    } else {
+        status = random_update(&pool);
+    }
+    if (status != NC_OK) {
+        goto done;
+    }
+
+    for (i = 0; i < MB_NKEY; i++) {
+        char key[32];
+
+        snprintf(key, sizeof(key), "key:%010"PRIu32"", i);
+        hashes[i] = hash_fnv1a_64(key, strlen(key));
+    }
+
+    memset(&res, 0, sizeof(res));
+    sum = 0;
+    start = mb_now();
+    do {
+        for (i = 0; i < MB_NKEY; i++) {
+            if (dist[0] == 'k') {
+                sum += ketama_dispatch(pool.continuum, pool.ncontinuum,
+                                       hashes[i]);
+            } else if (dist[0] == 'm') {
+                sum += modula_dispatch(pool.continuum, pool.ncontinuum,
+                                       hashes[i]);
+            } else {
+                sum += random_dispatch(pool.continuum, pool.ncontinuum,
+                                       hashes[i]);
+            }
+        }
+        res.nop += MB_NKEY;
+        res.nsec = mb_now() - start;
+    } while (res.nsec < mb_duration);
+    mb_sink = sum;
+
+    mb_report(name, &res);
+
+done:
+    nc_free(pool.continuum);
+    pool.server.nelem = 0;
+    array_deinit(&pool.server);
+    free(names);
+    free(hashes);
+}
+
+static void
+mb_show_usage(void)
+{
+    fprintf(stderr,
+        "Usage: nc_microbench [-h] [-d msec] [filter]\n"
+        "\n"
+        "Options:\n"
+        "  -h, --help             : this help\n"
+        "  -d, --duration=N       : set msec per case (default: %d)\n"
+        "\n"
+        "Only cases whose name contains filter are run, e.g. 'redis_parse',\n"
+        "'hash_' or 'ketama'.\n"
+        "", MB_DURATION);
+}
+
+int
+main(int argc, char **argv)
+{
+    static const char *shapes[] = { "small", "large", "multi", "mixed" };
+    static const char *dists[] = { "ketama", "modula", "random" };
+    static const uint32_t nservers[] = { 10, 100, 1000 };
+    static const size_t klens[] = { 16, 256 };
+    struct mb_hash *h;
+    uint32_t i, j, k;
+    int c, status;
+    long value;
+
+    for (;;) {
+        c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'h':
+            mb_show_usage();
+            exit(0);
+
+        case 'd':
+            value = nc_atoi(optarg, strlen(optarg));
+            if (value <= 0) {
+                fprintf(stderr, "nc_microbench: option -d requires a "
+                        "positive number\n");
+                exit(1);
+            }
+            mb_duration = value * 1000000LL;
+            break;
+
+        default:
+            mb_show_usage();
+            exit(1);
+        }
+    }
+    if (optind < argc) {
+        mb_filter = argv[optind];
+    }
+
+    log_init(LOG_NOTICE, NULL);
+    msg_init();
+
+    /* messages are parsed on a client connection of a pool without slow log */
+    mb_conn.client = 1;
+    mb_conn.owner = &mb_pool;
+    mb_mbuf_size(MBUF_SIZE);
+
+    printf("%-32s %12s %10s %10s %10s %10s\n", "bench", "ops", "ns/op",
+           "bytes/op", "MB/s", "B/cycle");
+
+    status = 0;
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++) {
+            for (k = 0; k < NELEMS(shapes); k++) {
+                if (mb_bench_parser(i == 0, j == 0, shapes[k], false) < 0 ||
+                    mb_bench_parser(i == 0, j == 0, shapes[k], true) < 0) {
+                    status = -1;
+                }
+            }
+        }
+    }
+
+    for (h = mb_hashes; h->name != NULL; h++) {
+        for (k = 0; k < NELEMS(klens); k++) {
+            mb_bench_hash(h, klens[k]);
+        }
+    }
+
+    for (i = 0; i < NELEMS(dists); i++) {
+        for (k = 0; k < NELEMS(nservers); k++) {
+            mb_bench_dispatch(dists[i], nservers[k]);
+        }
+    }
+
+    mbuf_deinit();
+    msg_deinit();
+    log_deinit();
+
+    exit(status == 0 ? 0 : 1);
+}
@@ -214,10 +214,13 @@ class Memcached(Base):
 
 class NutCracker(Base):
     def __init__(self, host, port, path, cluster_name, masters, mbuf=512,
-            verbose=5, is_redis=True, redis_auth=None):
+            verbose=5, is_redis=True, redis_auth=None, pool_conf=None,
+            extra_conf=None):
         Base.__init__(self, 'nutcracker', host, port, path)
 
         self.masters = masters
+        self.pool_conf = pool_conf
+        self.extra_conf = extra_conf
 
         self.args['mbuf']        = mbuf
         self.args['verbose']     = verbose
@@ -226,9 +229,11 @@ class NutCracker(Base):
         self.args['pidfile']     = TT('$path/log/nutcracker.pid', self.args)
         self.args['logfile']     = TT('$path/log/nutcracker.log', self.args)
         self.args['status_port'] = self.args['port'] + 1000
+        self.args['admin_port']  = self.args['port'] + 2000
 
         self.args['startcmd'] = TTCMD('bin/nutcracker -d -c $conf -o $logfile \
                                        -p $pidfile -s $status_port            \
+                                       -A $admin_port                         \
                                        -v $verbose -m $mbuf -i 1', self.args)
         self.args['runcmd']   = TTCMD('bin/nutcracker -d -c $conf -o $logfile \
                                        -p $pidfile -s $status_port', self.args)
@@ -265,7 +270,12 @@ $cluster_name:
             content = content.replace('redis: $is_redis',
                     'redis: $is_redis\r\n  redis_auth: $redis_auth')
         content = TT(content, self.args)
-        return content + self._gen_conf_section()
+        if self.pool_conf:
+            content = content.replace('  servers:\n', self.pool_conf + '  servers:\n')
+        content += self._gen_conf_section()
+        if self.extra_conf:
+            content += '\n' + self.extra_conf
+        return content
 
     def _pre_deploy(self):
         self.args['BINS'] = conf.BINARYS['NUTCRACKER_BINS']
@@ -275,6 +285,10 @@ $cluster_name:
         fout.write(self._gen_conf())
         fout.close()
 
+    def check_conf(self):
+        '''run the conf through `nutcracker -t` and return its output'''
+        return self._run(TT('$path/bin/nutcracker -t -c $conf 2>&1', self.args))
+
     def version(self):
         #This is nutcracker-0.4.0
         s = self._run(TT('$BINS --version', self.args))
@@ -0,0 +1,87 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import socket
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,  '../')
+sys.path.append(os.path.join(WORKDIR, 'lib/'))
+sys.path.append(os.path.join(WORKDIR, 'conf/'))
+import conf
+
+from server_modules import *
+from utils import *
+
+CLUSTER_NAME = 'ntest'
+all_mc= [
+        Memcached('127.0.0.1', 2200, '/tmp/r/memcached-2200/', CLUSTER_NAME, 'mc-2200'),
+        Memcached('127.0.0.1', 2201, '/tmp/r/memcached-2201/', CLUSTER_NAME, 'mc-2201'),
+    ]
+
+nc_verbose = int(getenv('T_VERBOSE', 4))
+mbuf = int(getenv('T_MBUF', 512))
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_mc, mbuf=mbuf, verbose=nc_verbose, is_redis=False)
+
+def setup():
+    for r in all_mc:
+        r.deploy()
+        r.stop()
+        r.start()
+
+    nc.deploy()
+    nc.stop()
+    nc.start()
+
+def teardown():
+    for r in all_mc:
+        r.stop()
+    assert(nc._alive())
+    nc.stop()
+
+def getconn():
+    s = socket.create_connection((nc.host(), nc.port()))
+    return s
+
+def send_and_recv(s, req, expect):
+    '''send raw request bytes and read until the expected reply is complete'''
+    s.sendall(req)
+    data = ''
+    while len(data) < len(expect):
+        buf = s.recv(65536)
+        if not buf:
+            break
+        data += buf
+    return data
+
+def test_meta_basic():
+    s = getconn()
+
+    assert_equal('HD\r\n', send_and_recv(s, 'ms mk-1 3\r\nabc\r\n', 'HD\r\n'))
+    assert_equal('VA 3\r\nabc\r\n', send_and_recv(s, 'mg mk-1 v\r\n', 'VA 3\r\nabc\r\n'))
+    assert_equal('EN\r\n', send_and_recv(s, 'mg mk-none v\r\n', 'EN\r\n'))
+    assert_equal('HD\r\n', send_and_recv(s, 'md mk-1\r\n', 'HD\r\n'))
+    assert_equal('NF\r\n', send_and_recv(s, 'md mk-1\r\n', 'NF\r\n'))
+    assert_equal('MN\r\n', send_and_recv(s, 'mn\r\n', 'MN\r\n'))
+
+def test_meta_quiet_pipeline():
+    s = getconn()
+
+    req = ''
+    for i in range(100):
+        req += 'ms mq-%d %d q\r\nv-%d\r\n' % (i, len(str(i)) + 2, i)
+    req += 'mn\r\n'
+    assert_equal('MN\r\n', send_and_recv(s, req, 'MN\r\n'))
+
+    req = ''
+    expect = ''
+    for i in range(200):
+        req += 'mg mq-%d v q\r\n' % i
+        if i < 100:
+            expect += 'VA %d\r\nv-%d\r\n' % (len(str(i)) + 2, i)
+    req += 'mn\r\n'
+    expect += 'MN\r\n'
+    assert_equal(expect, send_and_recv(s, req, expect))
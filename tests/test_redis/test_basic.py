@@ -112,6 +112,52 @@ def test_nc_stats():
     assert(get_stat('requests') == 22)
     assert(get_stat('responses') == 22)
 
+def test_nc_stats_arena():
+    stat = nc._info_dict()
+    assert_equal(0, stat['mbuf_arena_reserved'])
+    assert_equal(0, stat['mbuf_arena_used'])
+
+    # with -H, mbufs are carved from slabs of huge pages
+    nc_arena = NutCracker('127.0.0.1', 4110, '/tmp/r/nutcracker-4110',
+                          CLUSTER_NAME, all_redis, mbuf=mbuf, verbose=nc_verbose)
+    nc_arena.args['startcmd'] += ' -H 3'
+    nc_arena.deploy()
+    nc_arena.stop()
+    nc_arena.start()
+
+    r = redis.Redis(nc_arena.host(), nc_arena.port())
+    for i in range(10):
+        r.set('kkk-%s' % i, 'vvv-%s' % i)
+        assert_equal('vvv-%s' % i, r.get('kkk-%s' % i))
+
+    time.sleep(.1)
+    stat = nc_arena._info_dict()
+    nc_arena.stop()
+
+    # 3 MB is rounded up to slabs of 4 MB
+    assert_equal(4 * 1024 * 1024, stat['mbuf_arena_reserved'])
+    assert(stat['mbuf_arena_used'] > 0)
+    assert(stat['mbuf_arena_used'] % mbuf == 0)
+
+def test_nc_stats_hot_keys():
+    r = getconn()
+    for i in range(2000):
+        r.get('hot-key')
+
+    # the hot keys in the stats are refreshed once a second
+    time.sleep(2)
+    stat = nc._info_dict()
+
+    # hot keys are kept apart from the pool and server stats
+    assert('hot_keys' not in stat[CLUSTER_NAME])
+    for k, v in stat[CLUSTER_NAME].items():
+        assert(type(v) in (int, long, dict))
+
+    hot = stat['hot_keys'][CLUSTER_NAME]
+    assert_equal('hot-key', hot[0]['key'])
+    assert(hot[0]['server'] in [s.args['server_name'] for s in all_redis])
+    assert(hot[0]['requests'] > 0)
+
 def test_issue_323():
     # do on redis
     r = all_redis[0]
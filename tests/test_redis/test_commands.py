@@ -93,3 +93,32 @@ def test_sscan():
     assert(str(cursor) == '0')
     assert(set(members) == set(['1']))
 
+
+def test_set_ops_multi_server():
+    r = getconn()
+
+    keys = ['set-%s' % i for i in range(10)]
+    for i, k in enumerate(keys):
+        r.sadd(k, *range(i, i + 5))
+
+    expect = [set(range(i, i + 5)) for i in range(10)]
+    union = set.union(*expect)
+    inter = set.intersection(*expect[:3])
+    diff = expect[0].difference(*expect[1:])
+
+    assert(set(r.sunion(keys)) == set(str(m) for m in union))
+    assert(set(r.sinter(keys[:3])) == set(str(m) for m in inter))
+    assert(set(r.sdiff(keys)) == set(str(m) for m in diff))
+    assert(r.sinter(keys) == set())
+
+def test_exists_touch_unlink():
+    r = getconn()
+
+    keys = ['etu-%s' % i for i in range(10)]
+    for k in keys[:4]:
+        r.set(k, 'v')
+
+    assert(4 == r.exists(*keys))
+    assert(4 == r.execute_command('TOUCH', *keys))
+    assert(2 == r.execute_command('UNLINK', *keys[:2]))
+    assert(2 == r.exists(*keys))
@@ -0,0 +1,127 @@
+#!/usr/bin/env python
+from common import *
+from nose import with_setup
+
+def get_conn():
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((nc.host(), nc.port()))
+    s.settimeout(.3)
+    return s
+
+def _cmd(*args):
+    req = '*%d\r\n' % len(args)
+    for a in args:
+        req += '$%d\r\n%s\r\n' % (len(a), a)
+    return req
+
+def _send_and_recv(s, req, expect):
+    s.sendall(req)
+    data = ''
+    while len(data) < len(expect):
+        buf = s.recv(10000)
+        if not buf:
+            break
+        data += buf
+    return data
+
+def test_hello():
+    s = get_conn()
+
+    data = _send_and_recv(s, _cmd('HELLO', '3'), '%6\r\n')
+    assert(data.startswith('%6\r\n'))
+    assert('$5\r\nproto\r\n:3\r\n' in data)
+
+    data = _send_and_recv(s, _cmd('HELLO'), '%6\r\n')
+    assert(data.startswith('%6\r\n'))
+
+    data = _send_and_recv(s, _cmd('HELLO', '2'), '*12\r\n')
+    assert(data.startswith('*12\r\n'))
+    assert('$5\r\nproto\r\n:2\r\n' in data)
+
+    expect = '-NOPROTO unsupported protocol version\r\n'
+    assert_equal(expect, _send_and_recv(s, _cmd('HELLO', '4'), expect))
+
+def test_resp3_mget():
+    r = getconn()
+    r.set('resp3-a', 'va')
+    r.set('resp3-b', 'vb')
+
+    s3 = get_conn()
+    s2 = get_conn()
+    _send_and_recv(s3, _cmd('HELLO', '3'), '%6\r\n')
+
+    keys = ['resp3-a', 'resp3-none-1', 'resp3-b', 'resp3-none-2']
+
+    # both clients share the same server connections
+    for i in range(3):
+        expect = '*4\r\n$2\r\nva\r\n_\r\n$2\r\nvb\r\n_\r\n'
+        assert_equal(expect, _send_and_recv(s3, _cmd('MGET', *keys), expect))
+
+        expect = '*4\r\n$2\r\nva\r\n$-1\r\n$2\r\nvb\r\n$-1\r\n'
+        assert_equal(expect, _send_and_recv(s2, _cmd('MGET', *keys), expect))
+
+def test_resp3_pipelined_mix():
+    r = getconn()
+    r.hset('resp3-h', 'f', 'v')
+
+    s3 = get_conn()
+    s2 = get_conn()
+    _send_and_recv(s3, _cmd('HELLO', '3'), '%6\r\n')
+
+    # the requests of both clients are in flight on the server connection
+    # together, along with the HELLOs switching it back and forth
+    n = 20
+    for i in range(n):
+        s3.sendall(_cmd('HGETALL', 'resp3-h'))
+        s2.sendall(_cmd('HGETALL', 'resp3-h'))
+
+    expect = '%1\r\n$1\r\nf\r\n$1\r\nv\r\n' * n
+    assert_equal(expect, _send_and_recv(s3, '', expect))
+    expect = '*2\r\n$1\r\nf\r\n$1\r\nv\r\n' * n
+    assert_equal(expect, _send_and_recv(s2, '', expect))
+
+def test_resp3_map():
+    r = getconn()
+    r.hset('resp3-h', 'f', 'v')
+
+    s = get_conn()
+    _send_and_recv(s, _cmd('HELLO', '3'), '%6\r\n')
+
+    expect = '%1\r\n$1\r\nf\r\n$1\r\nv\r\n'
+    assert_equal(expect, _send_and_recv(s, _cmd('HGETALL', 'resp3-h'), expect))
+
+nc_bulk = NutCracker('127.0.0.1', 4110, '/tmp/r/nutcracker-4110', CLUSTER_NAME,
+                     all_redis[:1], mbuf=mbuf, verbose=nc_verbose,
+                     pool_conf='  server_window: 1\n'
+                               '  bulk_commands:\n'
+                               '   - hgetall\n')
+
+def _bulk_setup():
+    nc_bulk.deploy()
+    nc_bulk.stop()
+    nc_bulk.start()
+
+def _bulk_teardown():
+    assert(nc_bulk._alive())
+    nc_bulk.stop()
+
+@with_setup(_bulk_setup, _bulk_teardown)
+def test_resp3_hello_behind_bulk():
+    r = getconn()
+    r.hset('resp3-h', 'f', 'v')
+    r.set('resp3-a', 'va')
+
+    s2 = socket.create_connection((nc_bulk.host(), nc_bulk.port()))
+    s3 = socket.create_connection((nc_bulk.host(), nc_bulk.port()))
+    _send_and_recv(s3, _cmd('HELLO', '3'), '%6\r\n')
+
+    # the point reads of the RESP3 client may not switch the shared server
+    # connection to RESP3 ahead of the queued bulk requests of s2
+    n = 100
+    s2.sendall(_cmd('HGETALL', 'resp3-h') * n)
+    for i in range(10):
+        expect = '$2\r\nva\r\n'
+        assert_equal(expect, _send_and_recv(s3, _cmd('GET', 'resp3-a'), expect))
+
+    expect = '*2\r\n$1\r\nf\r\n$1\r\nv\r\n' * n
+    assert_equal(expect, _send_and_recv(s2, '', expect))
@@ -0,0 +1,176 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+        RedisServer('127.0.0.1', 2101, '/tmp/r/redis-2101/', CLUSTER_NAME, 'redis-2101'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose)
+
+def _setup():
+    for r in all_redis + [nc]:
+        r.deploy()
+        r.stop()
+        r.start()
+
+def _teardown():
+    for r in all_redis + [nc]:
+        assert(r._alive())
+        r.stop()
+
+def admin(s, line):
+    '''send an admin command and read its reply up to OK, ERR or END'''
+    s.sendall(line + '\r\n')
+    data = ''
+    while not (data.endswith('OK\r\n') or data.endswith('END\r\n') or
+               (data.startswith('ERR') and data.endswith('\r\n'))):
+        buf = s.recv(10000)
+        if not buf:
+            break
+        data += buf
+    return data
+
+def dbsize(server):
+    return redis.Redis(server.host(), server.port()).dbsize()
+
+def servers(s):
+    lines = admin(s, 'servers ' + CLUSTER_NAME).split('\r\n')
+    return dict((l.split()[0], l.split()[2]) for l in lines if l.count(' ') > 2)
+
+@with_setup(_setup, _teardown)
+def test_admin_remove_add():
+    s = socket.create_connection((nc.host(), nc.args['admin_port']))
+    assert_equal({'redis-2100': 'live', 'redis-2101': 'live'}, servers(s))
+
+    r = redis.Redis(nc.host(), nc.port())
+    r.set('k', 'v')
+
+    assert_equal('OK\r\n', admin(s, 'remove %s redis-2101' % CLUSTER_NAME))
+    assert_equal(['redis-2100'], servers(s).keys())
+    assert_equal('ERR cannot remove the last server\r\n',
+                 admin(s, 'remove %s redis-2100' % CLUSTER_NAME))
+
+    # every key now lives on redis-2100
+    for i in range(10):
+        r.set('k-%d' % i, 'v')
+    assert(dbsize(all_redis[0]) >= 10)
+
+    assert_equal('OK\r\n', admin(s, 'add %s 127.0.0.1:2101:1 redis-2101' % CLUSTER_NAME))
+    assert_equal('ERR duplicate server name\r\n',
+                 admin(s, 'add %s 127.0.0.1:2101:1 redis-2101' % CLUSTER_NAME))
+    assert_equal(2, len(servers(s)))
+
+    assert(r.set('k', 'v2'))
+    assert_equal('v2', r.get('k'))
+
+    # servers are reflected in stats right away
+    stats = nc._info_dict()
+    assert('redis-2101' in stats[CLUSTER_NAME])
+
+@with_setup(_setup, _teardown)
+def test_admin_eject():
+    s = socket.create_connection((nc.host(), nc.args['admin_port']))
+    for server in all_redis:
+        redis.Redis(server.host(), server.port()).flushall()
+
+    assert_equal('OK\r\n', admin(s, 'eject %s redis-2100' % CLUSTER_NAME))
+    assert_equal('ejected', servers(s)['redis-2100'])
+    assert_equal('ERR cannot eject the last server\r\n',
+                 admin(s, 'eject %s redis-2101' % CLUSTER_NAME))
+
+    r = redis.Redis(nc.host(), nc.port())
+    for i in range(10):
+        r.set('k-%d' % i, 'v')
+    assert_equal(0, dbsize(all_redis[0]))
+
+    assert_equal('OK\r\n', admin(s, 'uneject %s redis-2100' % CLUSTER_NAME))
+    assert_equal('live', servers(s)['redis-2100'])
+
+    assert_equal('OK\r\n', admin(s, 'drain %s redis-2100' % CLUSTER_NAME))
+    assert_equal('draining', servers(s)['redis-2100'])
+    assert_equal('OK\r\n', admin(s, 'weight %s redis-2101 3' % CLUSTER_NAME))
+    assert_equal('ERR no such server\r\n',
+                 admin(s, 'weight %s redis-2102 3' % CLUSTER_NAME))
+
+@with_setup(_setup, _teardown)
+def test_admin_add_mid_request():
+    s = socket.create_connection((nc.host(), nc.args['admin_port']))
+    for server in all_redis:
+        redis.Redis(server.host(), server.port()).flushall()
+    assert_equal('OK\r\n', admin(s, 'remove %s redis-2101' % CLUSTER_NAME))
+
+    # requests whose keys were parsed before the add go to the right server
+    conns = []
+    for i in range(10):
+        c = socket.create_connection((nc.host(), nc.port()))
+        req = '*3\r\n$3\r\nSET\r\n$5\r\nkmid%d\r\n$1\r\nv\r\n' % i
+        c.sendall(req[:-1])
+        conns.append(c)
+    time.sleep(.1)
+
+    assert_equal('OK\r\n', admin(s, 'add %s 127.0.0.1:2101:1 redis-2101' % CLUSTER_NAME))
+    for c in conns:
+        c.sendall('\n')
+        assert_equal('+OK\r\n', c.recv(100))
+
+    r = redis.Redis(nc.host(), nc.port())
+    for i in range(10):
+        assert_equal('v', r.get('kmid%d' % i))
+
+@with_setup(_setup, _teardown)
+def test_admin_other_pools_kept():
+    other = '''other:
+  listen: 127.0.0.1:4111
+  hash: fnv1a_64
+  distribution: modula
+  redis: true
+  slowlog_slower_than: 1
+  hotkey_sample: 1
+  servers:
+    - 127.0.0.1:2100:1 redis-2100
+'''
+    nc_two = NutCracker('127.0.0.1', 4110, '/tmp/r/nutcracker-4110',
+                        CLUSTER_NAME, all_redis, mbuf=mbuf, verbose=nc_verbose,
+                        extra_conf=other)
+    nc_two.deploy()
+    nc_two.stop()
+    nc_two.start()
+
+    r = redis.Redis(nc_two.host(), 4111)
+    for i in range(20):
+        r.get('hot')
+
+    s = socket.create_connection((nc_two.host(), nc_two.args['admin_port']))
+    assert_equal(20, admin(s, 'slowlog other 100').count('REQ_REDIS_GET'))
+    assert(admin(s, 'hotkeys other').startswith('hot '))
+
+    # a change to one pool leaves the slow log and hot keys of the others
+    assert_equal('OK\r\n', admin(s, 'remove %s redis-2101' % CLUSTER_NAME))
+    assert_equal('OK\r\n', admin(s, 'add %s 127.0.0.1:2101:1 redis-2101' % CLUSTER_NAME))
+    assert_equal('OK\r\n', admin(s, 'weight %s redis-2100 3' % CLUSTER_NAME))
+
+    assert_equal(20, admin(s, 'slowlog other 100').count('REQ_REDIS_GET'))
+    assert(admin(s, 'hotkeys other').startswith('hot '))
+
+    nc_two.stop()
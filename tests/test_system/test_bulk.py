@@ -0,0 +1,145 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+    ]
+
+BULK_CONF = '''  bulk_commands:
+   - hgetall
+   - REQ_REDIS_LRANGE
+'''
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose,
+                pool_conf=BULK_CONF + '  bulk_connections: 1\n')
+
+nc_shared = NutCracker('127.0.0.1', 4110, '/tmp/r/nutcracker-4110', CLUSTER_NAME,
+                       all_redis, mbuf=mbuf, verbose=nc_verbose,
+                       pool_conf=BULK_CONF + '  server_window: 1\n')
+
+def _setup():
+    for r in all_redis + [nc, nc_shared]:
+        r.deploy()
+        r.stop()
+        r.start()
+    redis.Redis(all_redis[0].host(), all_redis[0].port()).flushall()
+
+def _teardown():
+    for r in all_redis + [nc, nc_shared]:
+        assert(r._alive())
+        r.stop()
+
+def _cmd(*args):
+    req = '*%d\r\n' % len(args)
+    for a in args:
+        req += '$%d\r\n%s\r\n' % (len(a), a)
+    return req
+
+def _send_and_recv(s, req, expect):
+    s.sendall(req)
+    data = ''
+    while len(data) < len(expect):
+        buf = s.recv(10000)
+        if not buf:
+            break
+        data += buf
+    return data
+
+def nclients(server):
+    return len(redis.Redis(server.host(), server.port()).client_list())
+
+@with_setup(_setup, _teardown)
+def test_bulk_connections():
+    r = redis.Redis(nc.host(), nc.port())
+    r.hset('h', 'f', 'v')
+    n = nclients(all_redis[0])
+
+    # the first bulk request opens the bulk connection to the server
+    assert_equal({'f': 'v'}, r.hgetall('h'))
+    assert_equal(n + 1, nclients(all_redis[0]))
+
+    for i in range(10):
+        assert_equal({'f': 'v'}, r.hgetall('h'))
+        assert_equal('v', r.hget('h', 'f'))
+    assert_equal(n + 1, nclients(all_redis[0]))
+
+    time.sleep(.1)
+    assert_equal(11, nc._info_dict()[CLUSTER_NAME]['bulk_requests'])
+
+@with_setup(_setup, _teardown)
+def test_bulk_order():
+    # requests of a client keep their order across the two groups
+    for proxy in [nc, nc_shared]:
+        s = socket.create_connection((proxy.host(), proxy.port()))
+        req = ''
+        expect = ''
+        for i in range(50):
+            req += _cmd('HSET', 'h-order', 'f', str(i))
+            req += _cmd('HGETALL', 'h-order')
+            req += _cmd('HGET', 'h-order', 'f')
+            expect += ':%d\r\n' % (i == 0)
+            expect += '*2\r\n$1\r\nf\r\n$%d\r\n%d\r\n' % (len(str(i)), i)
+            expect += '$%d\r\n%d\r\n' % (len(str(i)), i)
+        assert_equal(expect, _send_and_recv(s, req, expect))
+
+@with_setup(_setup, _teardown)
+def test_bulk_shared_queue():
+    r = redis.Redis(nc_shared.host(), nc_shared.port())
+    r.hmset('h-big', dict(('f-%d' % i, 'v' * 100) for i in range(1000)))
+    r.set('k', 'v')
+
+    # point reads of another client go ahead of the queued bulk requests
+    # and both clients get their own replies
+    n = 50
+    s1 = socket.create_connection((nc_shared.host(), nc_shared.port()))
+    s2 = socket.create_connection((nc_shared.host(), nc_shared.port()))
+    s1.sendall(_cmd('HLEN', 'h-big') + _cmd('HGETALL', 'h-big') * n +
+               _cmd('HLEN', 'h-big'))
+    for i in range(10):
+        assert_equal('$1\r\nv\r\n', _send_and_recv(s2, _cmd('GET', 'k'), '$1\r\nv\r\n'))
+
+    data = ''
+    while data.count(':1000\r\n') < 2:
+        buf = s1.recv(100000)
+        if not buf:
+            break
+        data += buf
+    assert(data.startswith(':1000\r\n*2000\r\n'))
+    assert(data.endswith(':1000\r\n'))
+    assert_equal(n, data.count('*2000\r\n'))
+
+def test_bulk_conf():
+    nc_conf = NutCracker('127.0.0.1', 4120, '/tmp/r/nutcracker-4120', CLUSTER_NAME,
+                         all_redis, mbuf=mbuf, verbose=nc_verbose)
+
+    for pool_conf, ok in [
+            (BULK_CONF, True),
+            (BULK_CONF + '  bulk_connections: 2\n', True),
+            ('  bulk_commands:\n   - nosuchcommand\n', False),
+            ('  bulk_commands:\n   - REQ_REDIS_NOSUCH\n', False),
+            ('  bulk_connections: 1\n', False),
+            ]:
+        nc_conf.pool_conf = pool_conf
+        nc_conf.deploy()
+        out = nc_conf.check_conf()
+        assert(strstr(out, 'syntax is ok') == ok), out
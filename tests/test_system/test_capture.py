@@ -0,0 +1,136 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+import subprocess
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+REPLAY = os.path.join(WORKDIR, '../scripts/nc-replay.py')
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose)
+CAPTURE = os.path.join(nc.args['path'], 'capture.bin')
+nc.args['startcmd'] += ' -C %s -S 1' % CAPTURE
+
+def _setup():
+    for r in all_redis + [nc]:
+        r.deploy()
+        r.stop()
+    if os.path.exists(CAPTURE):
+        os.remove(CAPTURE)
+    for r in all_redis + [nc]:
+        r.start()
+
+def _teardown():
+    for r in all_redis + [nc]:
+        assert(r._alive())
+        r.stop()
+
+def _cmd(*args):
+    req = '*%d\r\n' % len(args)
+    for a in args:
+        req += '$%d\r\n%s\r\n' % (len(a), a)
+    return req
+
+def replay(*args):
+    return subprocess.check_output([sys.executable, REPLAY] + list(args))
+
+def dump():
+    '''the records of the capture as (type, rsp_type, hash, nkey, req_len,
+    rsp_len) in order of receive time'''
+    lines = replay('--dump', CAPTURE).splitlines()
+    assert(lines[0].startswith('# '))
+    recs = []
+    for l in lines[2:]:
+        usec, pool, typ, rsp_typ, h, nkey, req_len, rsp_len, lat = l.split()
+        assert_equal('0', pool)
+        recs.append((typ, rsp_typ, h, int(nkey), int(req_len), int(rsp_len)))
+    return recs
+
+def traffic():
+    r = redis.Redis(nc.host(), nc.port())
+    for i in range(10):
+        assert_equal(True, r.set('key-%d' % i, 'v' * 100))
+    for i in range(10):
+        assert_equal('v' * 100, r.get('key-%d' % i))
+    assert_equal(['v' * 100] * 3, r.mget('key-0', 'key-1', 'key-2'))
+    assert_equal(1, r.delete('key-0'))
+    assert_equal(True, r.ping())
+
+@with_setup(_setup, _teardown)
+def test_capture_dump():
+    traffic()
+
+    # with -S 1 every request is recorded, proxy replies included
+    recs = dump()
+    assert_equal(23, len(recs))
+
+    for i in range(10):
+        req = _cmd('SET', 'key-%d' % i, 'v' * 100)
+        assert_equal(('REQ_REDIS_SET', 'RSP_REDIS_STATUS', 1, len(req), 5),
+                     recs[i][:2] + recs[i][3:])
+        req = _cmd('GET', 'key-%d' % i)
+        assert_equal(('REQ_REDIS_GET', 'RSP_REDIS_BULK', 1, len(req), 106),
+                     recs[10 + i][:2] + recs[10 + i][3:])
+
+        # the key itself is not recorded, only its hash
+        assert_equal(recs[i][2], recs[10 + i][2])
+    assert('key-' not in open(CAPTURE).read())
+
+    assert_equal(('REQ_REDIS_MGET', 'RSP_REDIS_MULTIBULK', recs[0][2], 3),
+                 recs[20][:4])
+    assert_equal(('REQ_REDIS_DEL', 'RSP_REDIS_INTEGER', recs[0][2], 1),
+                 recs[21][:4])
+    assert_equal(('REQ_REDIS_PING', 'RSP_REDIS_STATUS', 0, len('+PONG\r\n')),
+                 recs[22][:2] + recs[22][3:4] + recs[22][5:])
+
+@with_setup(_setup, _teardown)
+def test_capture_replay():
+    traffic()
+    redis.Redis(all_redis[0].host(), all_redis[0].port()).flushall()
+
+    # the replay rebuilds each request from its shape: keys from their
+    # hashes, and values sized to the recorded request
+    out = replay('-s', '0', '-p', '0=%s:%d' % (nc.host(), nc.port()), CAPTURE)
+    assert('replayed 23 requests' in out)
+    assert('skipped 0, substituted 1, errors 0' in out)
+
+    # the ten keys set, less the one deleted, with values that keep the
+    # size of the recorded requests
+    r = redis.Redis(all_redis[0].host(), all_redis[0].port())
+    keys = r.keys('nc:*')
+    assert_equal(9, len(keys))
+    assert_equal(9, r.dbsize())
+    size = len(_cmd('SET', 'key-0', 'v' * 100))
+    for k in keys:
+        assert(abs(len(_cmd('SET', k, r.get(k))) - size) <= 1)
+
+    # the replayed requests are captured in turn, with the same types; the
+    # PING, which has no key, is replayed as a GET
+    recs = dump()
+    assert_equal(46, len(recs))
+    orig = sorted((t, rt, n) for t, rt, h, n, l, rl in recs[:23]
+                  if t != 'REQ_REDIS_PING')
+    again = sorted((t, rt, n) for t, rt, h, n, l, rl in recs[23:])
+    again.remove(('REQ_REDIS_GET', 'RSP_REDIS_BULK', 1))
+    assert_equal(orig, again)
@@ -0,0 +1,107 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+        RedisServer('127.0.0.1', 2101, '/tmp/r/redis-2101/', CLUSTER_NAME, 'redis-2101'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose,
+                pool_conf='  client_rate: 100\n')
+
+# client_limits and servers, both sequences, in the same pool
+nc_net = NutCracker('127.0.0.1', 4110, '/tmp/r/nutcracker-4110', CLUSTER_NAME,
+                    all_redis, mbuf=mbuf, verbose=nc_verbose,
+                    pool_conf='  client_limits:\n'
+                              '   - 10.0.0.0/8 5 2\n'
+                              '   - 127.0.0.0/8 100\n')
+
+def _setup():
+    for r in all_redis + [nc, nc_net]:
+        r.deploy()
+        r.stop()
+        r.start()
+
+def _teardown():
+    for r in all_redis + [nc, nc_net]:
+        assert(r._alive())
+        r.stop()
+
+def _throttled(proxy):
+    r = redis.Redis(proxy.host(), proxy.port())
+
+    # 200 requests at 100 per second, the first 100 of them in the bucket
+    t = time.time()
+    for i in range(200):
+        r.set('k-%d' % i, 'v')
+    assert(time.time() - t > .5)
+
+    time.sleep(.1)
+    assert(proxy._info_dict()[CLUSTER_NAME]['client_throttled'] > 0)
+
+    for i in range(0, 200, 20):
+        assert_equal('v', r.get('k-%d' % i))
+
+@with_setup(_setup, _teardown)
+def test_client_rate():
+    _throttled(nc)
+
+@with_setup(_setup, _teardown)
+def test_client_limits():
+    _throttled(nc_net)
+
+def test_client_limits_conf():
+    nc_conf = NutCracker('127.0.0.1', 4120, '/tmp/r/nutcracker-4120', CLUSTER_NAME,
+                         all_redis, mbuf=mbuf, verbose=nc_verbose)
+
+    for limit, ok in [
+            ('10.0.0.0/8 5 2', True),
+            ('10.0.0.0/8 0', True),
+            ('10.0.0.1 5', True),
+            ('::1/128 5 1000', True),
+            ('10.0.0.0/33 5', False),
+            ('10.0.0.300/8 5', False),
+            ('10.0.0.0/8', False),
+            ('10.0.0.0/8 -1', False),
+            ('10.0.0.0/8 5 0', False),
+            ('10.0.0.0/8 5 1001', False),
+            ('10.0.0.0/8 5 2 3', False),
+            ]:
+        nc_conf.pool_conf = '  client_limits:\n   - %s\n' % limit
+        nc_conf.deploy()
+        out = nc_conf.check_conf()
+        assert(strstr(out, 'syntax is ok') == ok), limit
+
+    # a sequence nested in a sequence is rejected
+    for pool_conf in ['  client_limits:\n   - - 10.0.0.0/8 5\n',
+                      '  client_limits:\n   -\n     - 10.0.0.0/8 5\n']:
+        nc_conf.pool_conf = pool_conf
+        nc_conf.deploy()
+        assert(strstr(nc_conf.check_conf(), 'syntax is invalid'))
+
+    nc_conf.pool_conf = None
+    nc_conf.masters = []
+    nc_conf.deploy()
+    content = file(nc_conf.args['conf']).read()
+    file(nc_conf.args['conf'], 'w').write(content + '    - - 127.0.0.1:2100:1 redis-2100\n')
+    assert(strstr(nc_conf.check_conf(), 'syntax is invalid'))
@@ -0,0 +1,172 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+    ]
+
+all_mc = [
+        Memcached('127.0.0.1', 2200, '/tmp/r/memcached-2200/', CLUSTER_NAME, 'mc-2200'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose)
+nc.args['startcmd'] += ' -M 1'
+
+nc_mc = NutCracker('127.0.0.1', 4101, '/tmp/r/nutcracker-4101', CLUSTER_NAME,
+                   all_mc, mbuf=mbuf, verbose=nc_verbose, is_redis=False)
+nc_mc.args['startcmd'] += ' -M 1'
+
+# 20 responses of 300K hold about 6M, far over the limit of 1M
+VALUE = 'v' * 300000
+NREQ = 20
+
+def _setup():
+    for r in all_redis + all_mc + [nc, nc_mc]:
+        r.deploy()
+        r.stop()
+        r.start()
+
+def _teardown():
+    for r in all_redis + all_mc + [nc, nc_mc]:
+        assert(r._alive())
+        r.stop()
+
+def get_conn(proxy):
+    s = socket.create_connection((proxy.host(), proxy.port()))
+    s.settimeout(5)
+    return s
+
+def recv_all(s, size):
+    data = []
+    while size > 0:
+        d = s.recv(size)
+        assert(d)
+        data.append(d)
+        size -= len(d)
+    return ''.join(data)
+
+@with_setup(_setup, _teardown)
+def test_redis_pause_and_oom():
+    redis.Redis(nc.host(), nc.port()).set('big', VALUE)
+
+    # responses the client does not read are held by nutcracker
+    get_big = '*2\r\n$3\r\nGET\r\n$3\r\nbig\r\n'
+    rsp_big = '$%d\r\n%s\r\n' % (len(VALUE), VALUE)
+    s = get_conn(nc)
+    s.sendall(get_big * NREQ)
+    time.sleep(1.5)
+
+    info = nc._info_dict()
+    assert_equal(1024 * 1024, info['memory_limit'])
+    assert(info['memory_used'] > info['memory_limit'])
+
+    # over the soft limit, reads of the client holding the memory pause
+    s.sendall('*2\r\n$3\r\nGET\r\n$1\r\nk\r\n')
+    time.sleep(1.5)
+    assert(nc._info_dict()[CLUSTER_NAME]['client_paused'] >= 1)
+
+    # over the hard limit, requests of other clients are rejected
+    s2 = get_conn(nc)
+    s2.sendall('*2\r\n$3\r\nGET\r\n$1\r\nk\r\n')
+    assert_equal('-OOM out of memory\r\n', s2.recv(100))
+    assert(nc._info_dict()[CLUSTER_NAME]['oom_rejected'] >= 1)
+
+    # once the client catches up, the paused request is served and
+    # the memory is given back
+    assert_equal(rsp_big * NREQ, recv_all(s, len(rsp_big) * NREQ))
+    assert_equal('$-1\r\n', recv_all(s, 5))
+    time.sleep(1.5)
+    assert(nc._info_dict()['memory_used'] < 1024 * 1024)
+
+    s2.sendall('*2\r\n$3\r\nGET\r\n$1\r\nk\r\n')
+    assert_equal('$-1\r\n', s2.recv(100))
+
+@with_setup(_setup, _teardown)
+def test_memcache_oom():
+    s = get_conn(nc_mc)
+    s.sendall('set big 0 0 %d\r\n%s\r\n' % (len(VALUE), VALUE))
+    assert_equal('STORED\r\n', s.recv(100))
+
+    rsp_big = 'VALUE big 0 %d\r\n%s\r\nEND\r\n' % (len(VALUE), VALUE)
+    s.sendall('get big\r\n' * NREQ)
+    time.sleep(1.5)
+
+    s2 = get_conn(nc_mc)
+    s2.sendall('get k\r\n')
+    assert_equal('SERVER_ERROR out of memory\r\n', s2.recv(100))
+    assert(nc_mc._info_dict()[CLUSTER_NAME]['oom_rejected'] >= 1)
+
+    assert_equal(rsp_big * NREQ, recv_all(s, len(rsp_big) * NREQ))
+    time.sleep(1.5)
+
+    s2.sendall('get k\r\n')
+    assert_equal('END\r\n', s2.recv(100))
+
+@with_setup(_setup, _teardown)
+def test_redis_pause_partial():
+    redis.Redis(nc.host(), nc.port()).set('big', VALUE)
+
+    get_big = '*2\r\n$3\r\nGET\r\n$3\r\nbig\r\n'
+    rsp_big = '$%d\r\n%s\r\n' % (len(VALUE), VALUE)
+    s = get_conn(nc)
+    s.sendall(get_big * NREQ)
+    time.sleep(1.5)
+
+    # a client in the middle of a request is paused too, while the memory
+    # held by others keeps nutcracker over the limit
+    value = 'v' * 100000
+    set_hdr = '*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$%d\r\n' % len(value)
+    s2 = get_conn(nc)
+    s2.sendall(set_hdr + value[:50000])
+    time.sleep(1.5)
+    assert(nc._info_dict()[CLUSTER_NAME]['client_paused'] >= 1)
+
+    s2.sendall(value[50000:] + '\r\n')
+    time.sleep(.5)
+    s2.setblocking(0)
+    assert_fail('', s2.recv, 100)
+    s2.setblocking(1)
+
+    # and resumed once that memory is given back
+    assert_equal(rsp_big * NREQ, recv_all(s, len(rsp_big) * NREQ))
+    assert_equal('+OK\r\n', recv_all(s2, 5))
+
+@with_setup(_setup, _teardown)
+def test_redis_partial_over_limit():
+    # a request that alone takes nutcracker over the limit could never be
+    # forwarded, so its client is closed while it is still being read
+    value = 'v' * 1500000
+    s = get_conn(nc)
+    try:
+        s.sendall('*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$%d\r\n%s\r\n' % (len(value), value))
+        assert_equal('', s.recv(100))
+    except socket.error:
+        pass
+
+    time.sleep(1.5)
+    assert(nc._info_dict()[CLUSTER_NAME]['oom_rejected'] >= 1)
+    assert(nc._info_dict()['memory_used'] < 1024 * 1024)
+
+    s = get_conn(nc)
+    s.sendall('*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$1\r\nv\r\n')
+    assert_equal('+OK\r\n', s.recv(100))
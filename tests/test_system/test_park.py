@@ -0,0 +1,98 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+        RedisServer('127.0.0.1', 2101, '/tmp/r/redis-2101/', CLUSTER_NAME, 'redis-2101'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose,
+                pool_conf='  client_park_timeout: 200\n'
+                          '  client_idle_timeout: 2000\n')
+
+def _setup():
+    for r in all_redis + [nc]:
+        r.deploy()
+        r.stop()
+        r.start()
+
+def _teardown():
+    for r in all_redis + [nc]:
+        assert(r._alive())
+        r.stop()
+
+def get_conn():
+    s = socket.create_connection((nc.host(), nc.port()))
+    s.settimeout(1)
+    return s
+
+def stats(name):
+    return nc._info_dict()[CLUSTER_NAME][name]
+
+@with_setup(_setup, _teardown)
+def test_park_wake():
+    redis.Redis(nc.host(), nc.port()).set('k', 'v')
+
+    conns = [get_conn() for i in range(10)]
+    for s in conns:
+        s.sendall('*2\r\n$3\r\nGET\r\n$1\r\nk\r\n')
+        assert_equal('$1\r\nv\r\n', s.recv(100))
+
+    time.sleep(.5)
+    assert(stats('client_parked') >= 10)
+
+    # a read wakes a parked connection up
+    for s in conns:
+        s.sendall('*2\r\n$3\r\nGET\r\n$1\r\nk\r\n')
+        assert_equal('$1\r\nv\r\n', s.recv(100))
+    time.sleep(.1)
+    assert(stats('client_parked') < 10)
+
+@with_setup(_setup, _teardown)
+def test_park_split_request():
+    redis.Redis(nc.host(), nc.port()).set('k', 'v')
+
+    # a connection with part of a request is not parked
+    s = get_conn()
+    s.sendall('*2\r\n$3\r\nGET\r\n')
+    time.sleep(.5)
+    s.sendall('$1\r\nk\r\n')
+    assert_equal('$1\r\nv\r\n', s.recv(100))
+
+    # neither is a request split across the park timeout of an idle one
+    s = get_conn()
+    time.sleep(.5)
+    s.sendall('*2\r\n$3\r\nGET\r\n')
+    time.sleep(.5)
+    s.sendall('$1\r\nk\r\n')
+    assert_equal('$1\r\nv\r\n', s.recv(100))
+
+@with_setup(_setup, _teardown)
+def test_idle_close():
+    s = get_conn()
+    s.sendall('*2\r\n$3\r\nGET\r\n$1\r\nk\r\n')
+    s.recv(100)
+
+    time.sleep(3)
+    assert(stats('client_idle_closed') >= 1)
+    assert_equal('', s.recv(100))
@@ -0,0 +1,141 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose)
+
+def _setup():
+    for r in all_redis + [nc]:
+        r.deploy()
+        r.stop()
+        r.start()
+
+def _teardown():
+    for r in all_redis + [nc]:
+        assert(r._alive())
+        r.stop()
+
+def server_stats():
+    time.sleep(.5)
+    return nc._info_dict()[CLUSTER_NAME]['redis-2100']
+
+def _cmd(*args):
+    req = '*%d\r\n' % len(args)
+    for a in args:
+        req += '$%d\r\n%s\r\n' % (len(a), a)
+    return req
+
+def _bulk(v):
+    return '$%d\r\n%s\r\n' % (len(v), v)
+
+def recv_all(s, size, chunk=1000000, delay=0):
+    data = []
+    while size > 0:
+        d = s.recv(min(size, chunk))
+        assert(d)
+        data.append(d)
+        size -= len(d)
+        time.sleep(delay)
+    return ''.join(data)
+
+def _burst(n, seed):
+    # pipelined SETs and GETs whose keys and values fall at every offset of
+    # the mbufs the read window fills
+    rnd = random.Random(seed)
+    req = []
+    expect = []
+    for i in range(n):
+        key = 'key-%d-%s' % (i, 'k' * rnd.randint(0, 100))
+        val = ''.join(chr(ord('a') + rnd.randint(0, 25))
+                      for j in range(rnd.choice([1, 10, 300, 511, 512, 513, 5000])))
+        req.append(_cmd('SET', key, val) + _cmd('GET', key))
+        expect.append('+OK\r\n' + _bulk(val))
+    return ''.join(req), ''.join(expect)
+
+@with_setup(_setup, _teardown)
+def test_readv_burst():
+    s = socket.create_connection((nc.host(), nc.port()))
+    s.settimeout(5)
+
+    # a burst fills the whole window and makes it grow
+    req, expect = _burst(2000, 1)
+    s.sendall(req)
+    assert_equal(expect, recv_all(s, len(expect)))
+
+    # a small request after the burst makes it shrink again
+    s.sendall(_cmd('GET', 'nosuchkey'))
+    assert_equal('$-1\r\n', recv_all(s, 5))
+
+    req, expect = _burst(2000, 2)
+    s.sendall(req)
+    assert_equal(expect, recv_all(s, len(expect)))
+
+@with_setup(_setup, _teardown)
+def test_readv_short_reads():
+    s = socket.create_connection((nc.host(), nc.port()))
+    s.settimeout(5)
+    s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+    # reads that come up short in the middle of a request
+    req, expect = _burst(200, 3)
+    rnd = random.Random(4)
+    i = 0
+    while i < len(req):
+        n = rnd.choice([1, 7, 511, 513, 4096, 65536])
+        s.sendall(req[i:i + n])
+        i += n
+        if rnd.randint(0, 10) == 0:
+            time.sleep(.001)
+    assert_equal(expect, recv_all(s, len(expect)))
+
+@with_setup(_setup, _teardown)
+def test_readv_fragmented():
+    r = redis.Redis(nc.host(), nc.port())
+
+    # multi-key requests are split across the mbufs of the window
+    kv = dict(('mkey-%d' % i, 'v' * (i % 700)) for i in range(3000))
+    keys = sorted(kv.keys())
+    assert_equal(True, r.mset(kv))
+    assert_equal([kv[k] for k in keys], r.mget(keys))
+
+    p = r.pipeline(transaction=False)
+    for i in range(0, len(keys), 100):
+        p.mget(keys[i:i + 100])
+    res = p.execute()
+    assert_equal([kv[k] for k in keys], sum(res, []))
+
+@with_setup(_setup, _teardown)
+def test_readv_clients():
+    # many clients sending bursts at once each get their own replies
+    socks = [socket.create_connection((nc.host(), nc.port()))
+             for i in range(20)]
+    bursts = [_burst(200, 10 + i) for i in range(len(socks))]
+    for s, (req, expect) in zip(socks, bursts):
+        s.settimeout(5)
+        s.sendall(req)
+    for s, (req, expect) in zip(socks, bursts):
+        assert_equal(expect, recv_all(s, len(expect)))
@@ -188,6 +188,33 @@ reload_test:
 
     fds = system('ls -l /proc/%s/fd/' % pid)
     sockets = [s for s in fds.split('\n') if strstr(s, 'socket:') ]
-    # pool + stat + 2 backend + 1 client
-    assert(len(sockets) == 5)
+    # pool + stat + admin + 2 backend + 1 client
+    assert(len(sockets) == 6)
 
+
+@with_setup(_setup, _teardown)
+def test_reload_servers_on_sighup():
+    pid = nc.pid()
+
+    conn = get_tcp_conn(nc.host(), nc.port())
+    send_cmd(conn, '*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$1\r\nv\r\n', '+OK\r\n')
+
+    # drop the last server and reload in place
+    path = TT('$path/conf/nutcracker.conf', nc.args)
+    content = open(path).read().rstrip('\n')
+    fout = open(path, 'w+')
+    fout.write(content[:content.rfind('\n')])
+    fout.close()
+
+    nc.signal('HUP')
+    time.sleep(1)
+
+    assert(pid == nc.pid())
+
+    servers = nc._info_dict()[CLUSTER_NAME]
+    assert('redis-2100' in servers)
+    assert('redis-2101' not in servers)
+
+    # the client connection survives the reload
+    send_cmd(conn, '*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$1\r\nv\r\n', '+OK\r\n')
+    send_cmd(conn, '*2\r\n$3\r\nGET\r\n$1\r\nk\r\n', '$1\r\nv\r\n')
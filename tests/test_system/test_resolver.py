@@ -0,0 +1,98 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+RESOLVER_TTL = 30
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+    ]
+
+# the same redis by name, and a name that never resolves
+pools = '''named:
+  listen: 127.0.0.1:4101
+  hash: fnv1a_64
+  distribution: modula
+  redis: true
+  servers:
+    - localhost:2100:1 redis-2100
+invalid:
+  listen: 127.0.0.1:4102
+  hash: fnv1a_64
+  distribution: modula
+  redis: true
+  servers:
+    - nosuchhost.invalid:2100:1 redis-2100
+'''
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose, extra_conf=pools)
+
+def _setup():
+    for r in all_redis + [nc]:
+        r.deploy()
+        r.stop()
+        r.start()
+
+def _teardown():
+    for r in all_redis + [nc]:
+        assert(r._alive())
+        r.stop()
+
+def resolves(pool):
+    time.sleep(.5)
+    return nc._info_dict()[pool]['redis-2100']['server_resolves']
+
+@with_setup(_setup, _teardown)
+def test_resolve_refresh():
+    r = redis.Redis(nc.host(), 4101)
+    assert_equal(True, r.set('k', 'v'))
+    assert_equal('v', r.get('k'))
+
+    # resolved with the configuration, not in the background yet
+    assert_equal(0, resolves('named'))
+
+    # once stale, the name is resolved again while requests keep flowing
+    deadline = time.time() + RESOLVER_TTL + 5
+    while resolves('named') == 0 and time.time() < deadline:
+        assert_equal('v', r.get('k'))
+    assert(resolves('named') >= 1)
+
+    # numeric addresses are never looked up
+    assert_equal(0, resolves(CLUSTER_NAME))
+
+    assert_equal('v', r.get('k'))
+    assert_equal('v', redis.Redis(nc.host(), 4101).get('k'))
+
+@with_setup(_setup, _teardown)
+def test_resolve_failure():
+    r = redis.Redis(nc.host(), 4102)
+
+    # a server whose name does not resolve fails its requests fast
+    for i in range(3):
+        t = time.time()
+        assert_fail('Host is down', r.get, 'k')
+        assert(time.time() - t < 1)
+    assert_equal(0, resolves('invalid'))
+
+    # and leaves the other pools alone
+    assert_equal(True, redis.Redis(nc.host(), 4101).set('k', 'v'))
+    assert_equal('v', redis.Redis(nc.host(), nc.port()).get('k'))
@@ -0,0 +1,143 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+SLOWER_THAN = 50000
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose,
+                pool_conf='  slowlog_slower_than: %d\n  slowlog_max_len: 3\n' %
+                          SLOWER_THAN)
+
+ENTRY = re.compile(r'^(\d+) (\d+\.\d{6}) (REQ_REDIS_\w+) (\S+) keys (\d+) '
+                   r'server (\S+) client (\S+) usec (\d+) recv (\d+) '
+                   r'route (\d+) queue (\d+) backend (\d+) reply (\d+)$')
+
+def _setup():
+    for r in all_redis + [nc]:
+        r.deploy()
+        r.stop()
+        r.start()
+
+def _teardown():
+    for r in all_redis + [nc]:
+        assert(r._alive())
+        r.stop()
+
+def admin(s, line):
+    '''send an admin command and read its reply, a single line or a list
+    up to END'''
+    s.sendall(line + '\r\n')
+    data = ''
+    while not data.endswith('END\r\n'):
+        buf = s.recv(10000)
+        if not buf:
+            break
+        data += buf
+        if (data.endswith('\r\n') and
+            not ENTRY.match(data.split('\r\n')[0])):
+            break
+    return data
+
+def slowlog(s, arg=''):
+    lines = admin(s, ('slowlog %s %s' % (CLUSTER_NAME, arg)).strip())
+    lines = lines.split('\r\n')
+    assert_equal(['END', ''], lines[-2:])
+    return [ENTRY.match(l).groups() for l in lines[:-2]]
+
+def slow(s, req):
+    '''send req while redis is blocked, so that it takes over SLOWER_THAN'''
+    t = threading.Thread(target=all_redis[0].rediscmd, args=('DEBUG SLEEP .2',))
+    t.start()
+    time.sleep(.05)
+    s.sendall(req)
+    data = s.recv(10000)
+    t.join()
+    return data
+
+@with_setup(_setup, _teardown)
+def test_slowlog_entries():
+    c = socket.create_connection((nc.host(), nc.port()))
+    client = '%s:%d' % c.getsockname()
+    a = socket.create_connection((nc.host(), nc.args['admin_port']))
+
+    # fast requests are not logged
+    c.sendall('*2\r\n$3\r\nGET\r\n$4\r\nfast\r\n')
+    assert_equal('$-1\r\n', c.recv(100))
+    assert_equal('0\r\n', admin(a, 'slowlog %s len' % CLUSTER_NAME))
+    assert_equal([], slowlog(a))
+
+    for key in ['k1', 'k2', 'k3', 'k4']:
+        req = '*2\r\n$3\r\nGET\r\n$2\r\n%s\r\n' % key
+        assert_equal('$-1\r\n', slow(c, req))
+    assert_equal(':0\r\n', slow(c, '*3\r\n$3\r\nDEL\r\n$2\r\nk5\r\n$2\r\nk6\r\n'))
+
+    # only the last slowlog_max_len are kept, most recent first
+    entries = slowlog(a)
+    assert_equal(3, len(entries))
+    assert_equal(['k5', 'k4', 'k3'], [e[3] for e in entries])
+    assert_equal(['REQ_REDIS_DEL', 'REQ_REDIS_GET', 'REQ_REDIS_GET'],
+                 [e[2] for e in entries])
+    assert_equal(['2', '1', '1'], [e[4] for e in entries])
+    ids = [int(e[0]) for e in entries]
+    assert_equal([ids[0], ids[0] - 1, ids[0] - 2], ids)
+    assert(float(entries[0][1]) >= float(entries[1][1]))
+    assert(abs(float(entries[0][1]) - time.time()) < 10)
+
+    for e in entries:
+        assert_equal('redis-2100', e[5])
+        assert_equal(client, e[6])
+
+        # the phases add up to the total
+        usec = int(e[7])
+        phases = [int(p) for p in e[8:]]
+        assert(usec >= SLOWER_THAN)
+        assert_equal(usec, sum(phases))
+
+    # most of the time of a single key request is spent waiting for redis
+    assert(int(entries[1][11]) >= int(entries[1][7]) / 2)
+
+    assert_equal(5, nc._info_dict()[CLUSTER_NAME]['slow_requests'])
+
+@with_setup(_setup, _teardown)
+def test_slowlog_commands():
+    c = socket.create_connection((nc.host(), nc.port()))
+    a = socket.create_connection((nc.host(), nc.args['admin_port']))
+
+    for key in ['k1', 'k2']:
+        req = '*2\r\n$3\r\nGET\r\n$2\r\n%s\r\n' % key
+        assert_equal('$-1\r\n', slow(c, req))
+
+    assert_equal(['k2'], [e[3] for e in slowlog(a, '1')])
+    assert_equal(['k2', 'k1'], [e[3] for e in slowlog(a, '100')])
+    assert_equal('2\r\n', admin(a, 'slowlog %s len' % CLUSTER_NAME))
+
+    assert_equal('OK\r\n', admin(a, 'slowlog %s reset' % CLUSTER_NAME))
+    assert_equal('0\r\n', admin(a, 'slowlog %s len' % CLUSTER_NAME))
+    assert_equal([], slowlog(a))
+
+    assert_equal('ERR no such pool\r\n', admin(a, 'slowlog nosuchpool'))
+    assert_equal('ERR count must be a positive number\r\n',
+                 admin(a, 'slowlog %s 0' % CLUSTER_NAME))
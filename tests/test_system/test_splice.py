@@ -0,0 +1,121 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+THRESHOLD = 65536
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose,
+                pool_conf='  splice_threshold: %d\n' % THRESHOLD)
+
+BIG = ''.join(chr(ord('a') + i % 26) for i in range(1024 * 1024))
+SMALL = 'v' * (THRESHOLD / 2)
+
+def _setup():
+    for r in all_redis + [nc]:
+        r.deploy()
+        r.stop()
+        r.start()
+    r = redis.Redis(all_redis[0].host(), all_redis[0].port())
+    r.set('big', BIG)
+    r.set('small', SMALL)
+
+def _teardown():
+    for r in all_redis + [nc]:
+        assert(r._alive())
+        r.stop()
+
+def server_stats():
+    time.sleep(.5)
+    return nc._info_dict()[CLUSTER_NAME]['redis-2100']
+
+def _cmd(*args):
+    req = '*%d\r\n' % len(args)
+    for a in args:
+        req += '$%d\r\n%s\r\n' % (len(a), a)
+    return req
+
+def _bulk(v):
+    return '$%d\r\n%s\r\n' % (len(v), v)
+
+def recv_all(s, size, chunk=1000000, delay=0):
+    data = []
+    while size > 0:
+        d = s.recv(min(size, chunk))
+        assert(d)
+        data.append(d)
+        size -= len(d)
+        time.sleep(delay)
+    return ''.join(data)
+
+@with_setup(_setup, _teardown)
+def test_splice_get():
+    r = redis.Redis(nc.host(), nc.port())
+
+    # values over the threshold are spliced, smaller ones are not
+    for i in range(3):
+        assert_equal(BIG, r.get('big'))
+        assert_equal(SMALL, r.get('small'))
+
+    st = server_stats()
+    assert_equal(3, st['spliced_responses'])
+    assert(st['spliced_bytes'] > 0 and st['spliced_bytes'] <= 3 * len(BIG))
+
+@with_setup(_setup, _teardown)
+def test_splice_pipeline():
+    s = socket.create_connection((nc.host(), nc.port()))
+    s.settimeout(5)
+
+    # spliced responses keep their place among the others; the multi-key
+    # request is fragmented, so its value goes through mbufs, and a value
+    # whose response is queued behind unsent ones is not spliced either
+    req = (_cmd('GET', 'big') + _cmd('GET', 'small') + _cmd('GET', 'big') +
+           _cmd('MGET', 'big', 'small') + _cmd('GET', 'nosuchkey'))
+    expect = (_bulk(BIG) + _bulk(SMALL) + _bulk(BIG) +
+              '*2\r\n' + _bulk(BIG) + _bulk(SMALL) + '$-1\r\n')
+    s.sendall(req * 3)
+    assert_equal(expect * 3, recv_all(s, len(expect) * 3))
+
+    n = server_stats()['spliced_responses']
+    assert(n >= 1 and n <= 6)
+
+@with_setup(_setup, _teardown)
+def test_splice_slow_client():
+    s = socket.create_connection((nc.host(), nc.port()))
+    s.settimeout(5)
+
+    # a client that drains the pipe slowly still gets the whole value, and
+    # the requests of other clients on the same server connection wait for
+    # it without getting any of it
+    expect = _bulk(BIG) + _bulk(SMALL)
+    s.sendall(_cmd('GET', 'big') + _cmd('GET', 'small'))
+    data = recv_all(s, 100000, chunk=10000, delay=.01)
+
+    s2 = socket.create_connection((nc.host(), nc.port()))
+    s2.settimeout(5)
+    s2.sendall(_cmd('GET', 'small'))
+
+    data += recv_all(s, len(expect) - len(data), chunk=100000, delay=.01)
+    assert_equal(expect, data)
+    assert_equal(_bulk(SMALL), recv_all(s2, len(_bulk(SMALL))))
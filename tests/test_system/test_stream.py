@@ -0,0 +1,121 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose)
+
+BIG = ''.join(chr(ord('a') + i % 26) for i in range(1024 * 1024))
+ITEMS = ['item-%d' % i for i in range(20000)]
+
+def _setup():
+    for r in all_redis + [nc]:
+        r.deploy()
+        r.stop()
+        r.start()
+    r = redis.Redis(all_redis[0].host(), all_redis[0].port())
+    r.set('big', BIG)
+    r.set('small', 'v')
+    p = r.pipeline(transaction=False)
+    for i in range(0, len(ITEMS), 1000):
+        p.rpush('list', *ITEMS[i:i + 1000])
+    p.execute()
+
+def _teardown():
+    for r in all_redis + [nc]:
+        assert(r._alive())
+        r.stop()
+
+def server_stats():
+    time.sleep(.5)
+    return nc._info_dict()[CLUSTER_NAME]['redis-2100']
+
+def _cmd(*args):
+    req = '*%d\r\n' % len(args)
+    for a in args:
+        req += '$%d\r\n%s\r\n' % (len(a), a)
+    return req
+
+def _bulk(v):
+    return '$%d\r\n%s\r\n' % (len(v), v)
+
+def recv_all(s, size, chunk=1000000, delay=0):
+    data = []
+    while size > 0:
+        d = s.recv(min(size, chunk))
+        assert(d)
+        data.append(d)
+        size -= len(d)
+        time.sleep(delay)
+    return ''.join(data)
+
+def _array(items):
+    return '*%d\r\n' % len(items) + ''.join(_bulk(i) for i in items)
+
+@with_setup(_setup, _teardown)
+def test_stream_get():
+    r = redis.Redis(nc.host(), nc.port())
+
+    # a value spanning many mbufs is forwarded before it is complete; one
+    # that fits in a single mbuf is not
+    for i in range(3):
+        assert_equal(BIG, r.get('big'))
+        assert_equal('v', r.get('small'))
+
+    assert_equal(3, server_stats()['streamed_responses'])
+
+@with_setup(_setup, _teardown)
+def test_stream_lrange():
+    r = redis.Redis(nc.host(), nc.port())
+
+    assert_equal(ITEMS, r.lrange('list', 0, -1))
+    assert_equal(ITEMS[:10], r.lrange('list', 0, 9))
+    assert_equal(1, server_stats()['streamed_responses'])
+
+@with_setup(_setup, _teardown)
+def test_stream_pipeline():
+    s = socket.create_connection((nc.host(), nc.port()))
+    s.settimeout(5)
+
+    # streamed responses keep their place among the others; only those at
+    # the head of the client queue are streamed
+    req = (_cmd('GET', 'big') + _cmd('GET', 'small') +
+           _cmd('LRANGE', 'list', '0', '-1') + _cmd('GET', 'nosuchkey') +
+           _cmd('GET', 'big'))
+    expect = (_bulk(BIG) + _bulk('v') + _array(ITEMS) + '$-1\r\n' +
+              _bulk(BIG))
+    s.sendall(req * 3)
+    assert_equal(expect * 3, recv_all(s, len(expect) * 3))
+
+    n = server_stats()['streamed_responses']
+    assert(n >= 1 and n <= 9)
+
+@with_setup(_setup, _teardown)
+def test_stream_fragmented():
+    r = redis.Redis(nc.host(), nc.port())
+
+    # the fragments of a multi-key request are buffered whole
+    assert_equal([BIG, 'v', BIG], r.mget('big', 'small', 'big'))
+    assert_equal(0, server_stats()['streamed_responses'])
@@ -0,0 +1,95 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+
+T_UPGRADE_DELAY = 2
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+        RedisServer('127.0.0.1', 2101, '/tmp/r/redis-2101/', CLUSTER_NAME, 'redis-2101'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose)
+
+# started with conf, log and pid file paths relative to $path, which the
+# daemon leaves for /
+nc.args['startcmd'] = TTCMD('bin/nutcracker -d -c conf/nutcracker.conf     \
+                             -o log/nutcracker.log -p log/nutcracker.pid \
+                             -s $status_port -A $admin_port              \
+                             -v $verbose -m $mbuf -i 1', nc.args)
+nc.args['runcmd']   = TTCMD('bin/nutcracker -d -c conf/nutcracker.conf     \
+                             -o log/nutcracker.log -p log/nutcracker.pid \
+                             -s $status_port', nc.args)
+
+def _setup():
+    for r in all_redis + [nc]:
+        r.deploy()
+        r.stop()
+        r.start()
+
+def _teardown():
+    for r in all_redis + [nc]:
+        assert(r._alive())
+        r.stop()
+
+@with_setup(_setup, _teardown)
+def test_upgrade_relative_paths():
+    pid = nc.pid()
+    r = redis.Redis(nc.host(), nc.port())
+    r.set('k', 'v')
+    r.connection_pool.disconnect()
+
+    nc.signal('USR2')
+    time.sleep(T_UPGRADE_DELAY)
+
+    # the new process found its conf, and took over the log and pid file
+    newpid = nc.pid()
+    assert(newpid and newpid != pid)
+    assert_equal(newpid, file(nc.args['pidfile']).read().strip())
+    assert(strstr(file(nc.logfile()).read(), 'upgrade took over'))
+
+    r = redis.Redis(nc.host(), nc.port())
+    assert_equal('v', r.get('k'))
+
+@with_setup(_setup, _teardown)
+def test_upgrade_idle_clients():
+    conns = []
+    for i in range(5):
+        s = socket.create_connection((nc.host(), nc.port()))
+        s.settimeout(5)
+        s.sendall('*2\r\n$3\r\nGET\r\n$1\r\nk\r\n')
+        s.recv(100)
+        conns.append(s)
+
+    nc.signal('USR2')
+    time.sleep(1)
+
+    # idle keep-alive clients are closed at handoff, so the old process
+    # does not wait for them until the drain times out
+    for s in conns:
+        assert_equal('', s.recv(100))
+    time.sleep(1)
+    assert(strstr(file(nc.logfile()).read(),
+                  'upgrade drained all client connections'))
+
+    r = redis.Redis(nc.host(), nc.port())
+    assert(r.set('k', 'v'))
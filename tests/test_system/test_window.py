@@ -0,0 +1,104 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import os
+import sys
+import redis
+import threading
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+WINDOW = 64
+
+all_redis = [
+        RedisServer('127.0.0.1', 2100, '/tmp/r/redis-2100/', CLUSTER_NAME, 'redis-2100'),
+    ]
+
+nc = NutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100', CLUSTER_NAME,
+                all_redis, mbuf=mbuf, verbose=nc_verbose,
+                pool_conf='  server_window: %d\n' % WINDOW)
+
+def _setup():
+    for r in all_redis + [nc]:
+        r.deploy()
+        r.stop()
+        r.start()
+
+def _teardown():
+    for r in all_redis + [nc]:
+        assert(r._alive())
+        r.stop()
+
+def window():
+    time.sleep(1.5)
+    return nc._info_dict()[CLUSTER_NAME]['redis-2100']['server_window']
+
+def burst(n):
+    s = socket.create_connection((nc.host(), nc.port()))
+    s.settimeout(5)
+    s.sendall('*2\r\n$3\r\nGET\r\n$1\r\nk\r\n' * n)
+    data = ''
+    while data.count('$-1\r\n') < n:
+        buf = s.recv(100000)
+        assert(buf)
+        data += buf
+    s.close()
+
+@with_setup(_setup, _teardown)
+def test_window_grows():
+    r = redis.Redis(nc.host(), nc.port())
+
+    # a new connection starts with a window of one, which doubles once
+    # the reply comes back
+    assert_equal(None, r.get('k'))
+    assert_equal(2, window())
+
+    # replies that keep coming back fast open the window up to the limit
+    burst(3000)
+    w = window()
+    assert(w > 2 and w <= WINDOW), w
+
+@with_setup(_setup, _teardown)
+def test_window_timeout():
+    r = redis.Redis(nc.host(), nc.port())
+    burst(3000)
+    assert(window() > 2)
+
+    # a timeout closes the server connection along with its window, and
+    # the next connection starts over with a window of one
+    t = threading.Thread(target=all_redis[0].rediscmd, args=('DEBUG SLEEP 1',))
+    t.start()
+    time.sleep(.1)
+    assert_fail('timed out', r.get, 'k')
+    t.join()
+    assert_equal(0, window())
+
+    assert_equal(None, r.get('k'))
+    assert_equal(2, window())
+
+@with_setup(_setup, _teardown)
+def test_window_error():
+    r = redis.Redis(nc.host(), nc.port())
+    burst(3000)
+    assert(window() > 2)
+
+    # so does an error on the server connection
+    all_redis[0].stop()
+    assert_fail('', r.get, 'k')
+    assert_equal(0, window())
+
+    all_redis[0].start()
+    assert_equal(None, r.get('k'))
+    assert_equal(2, window())